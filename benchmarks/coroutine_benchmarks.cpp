@@ -0,0 +1,83 @@
+// Purpose: Compare the cost of co_await chains built with async_operation and
+// with task.
+
+#include <chrono>
+#include <cstdio>
+
+#include <coroutine.h>
+#include <task.h>
+
+namespace
+{
+  async_operation<int> async_operation_leaf()
+  {
+    co_return 1;
+  }
+
+  async_operation<int> async_operation_chain(int depth)
+  {
+    if (depth == 0)
+      co_return co_await async_operation_leaf();
+
+    auto result = co_await async_operation_chain(depth - 1);
+    co_return result.value() + 1;
+  }
+
+  pine::task<int> task_leaf()
+  {
+    co_return 1;
+  }
+
+  pine::task<int> task_chain(int depth)
+  {
+    if (depth == 0)
+      co_return co_await task_leaf();
+
+    co_return co_await task_chain(depth - 1) + 1;
+  }
+
+  /// @brief Run a benchmark and print the average cost of one co_await.
+  /// @param name The name of the benchmark.
+  /// @param depth The number of nested co_await per iteration.
+  /// @param iterations The number of iterations.
+  /// @param run The function running one iteration.
+  template <typename function_t>
+  void run_benchmark(const char* name,
+                     int depth,
+                     int iterations,
+                     function_t&& run)
+  {
+    long long checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+      checksum += run(depth);
+    auto end = std::chrono::steady_clock::now();
+
+    double total_ns = static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    double awaits = static_cast<double>(iterations) * (depth + 1);
+
+    std::printf("%-16s depth %4d: %8.1f ns/co_await (checksum %lld)\n",
+                name, depth, total_ns / awaits, checksum);
+  }
+}
+
+int main()
+{
+  constexpr int iterations = 20000;
+
+  for (int depth : { 1, 10, 100 })
+  {
+    run_benchmark("async_operation", depth, iterations, [](int depth)
+                  {
+                    auto operation = async_operation_chain(depth);
+                    return operation.get_future().get().value();
+                  });
+
+    run_benchmark("task", depth, iterations, [](int depth)
+                  {
+                    return pine::sync_wait(task_chain(depth));
+                  });
+  }
+}
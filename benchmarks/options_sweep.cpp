@@ -0,0 +1,149 @@
+// Purpose: Measure the effect of each server option on the throughput of a
+// small GET request. Every configuration changes a single option from the
+// defaults and runs against its own server on its own port.
+
+#include <WinSock2.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <loguru.hpp>
+#include <server.h>
+#include <server_options.h>
+#include <wsa.h>
+
+namespace
+{
+  constexpr int client_threads = 8;
+  constexpr auto run_duration = std::chrono::seconds(5);
+
+  struct configuration
+  {
+    const char* name;
+    std::function<void(pine::server_options&)> apply;
+  };
+
+  /// @brief Send one request on a new connection and read the response until
+  /// the server closes the connection.
+  /// @return True if a response was received.
+  bool send_request(const char* port)
+  {
+    auto address = pine::get_address_info("127.0.0.1", port);
+    if (!address)
+      return false;
+
+    auto socket = pine::create_socket(address.value());
+    if (!socket)
+      return false;
+
+    bool received = false;
+    if (pine::connect_socket(socket.value(), address.value()))
+    {
+      static constexpr char request[] =
+        "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+      send(socket.value(), request, sizeof(request) - 1, 0);
+
+      char buffer[4096];
+      while (recv(socket.value(), buffer, sizeof(buffer), 0) > 0)
+        received = true;
+    }
+
+    pine::close_socket(socket.value());
+    return received;
+  }
+
+  /// @brief Run a configuration and print its throughput.
+  /// @param baseline The throughput of the defaults, 0 while running them.
+  /// @return The throughput in requests per second, 0 if the server did not
+  /// start.
+  double run(const configuration& config, int port_number, double baseline)
+  {
+    pine::server_options options;
+    config.apply(options);
+
+    // Servers do not join their worker threads yet, so they cannot be
+    // destroyed: each configuration leaks its server.
+    std::string port = std::to_string(port_number);
+    auto& server = *new pine::server(port.c_str(), options);
+    server.add_route("/", [](const pine::http_request&, pine::http_response& response)
+                     {
+                       response.set_body("Hello, world!");
+                     });
+
+    if (!server.start())
+    {
+      std::printf("%-28s failed to start\n", config.name);
+      return 0;
+    }
+
+    std::atomic<size_t> completed = 0;
+    std::atomic<size_t> failed = 0;
+    std::atomic<bool> running = true;
+
+    std::vector<std::jthread> clients;
+    for (int i = 0; i < client_threads; i++)
+    {
+      clients.emplace_back([&]
+                           {
+                             while (running)
+                             {
+                               if (send_request(port.c_str()))
+                                 completed++;
+                               else
+                                 failed++;
+                             }
+                           });
+    }
+
+    std::this_thread::sleep_for(run_duration);
+    running = false;
+    clients.clear();
+
+    server.stop();
+
+    double seconds = std::chrono::duration<double>(run_duration).count();
+    double throughput = static_cast<double>(completed) / seconds;
+    std::printf("%-28s %10.0f requests/s", config.name, throughput);
+    if (baseline > 0)
+      std::printf(" %+6.1f%%", (throughput / baseline - 1) * 100);
+    std::printf(" (%zu failed)\n", failed.load());
+    return throughput;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+  loguru::init(argc, argv);
+
+  const std::vector<configuration> configurations
+  {
+    { "defaults", [](auto&) {} },
+    { "worker_threads = 1", [](auto& o) { o.worker_threads = 1; } },
+    { "worker_threads = 4", [](auto& o) { o.worker_threads = 4; } },
+    { "mode = thread_per_core", [](auto& o) { o.mode = pine::server_mode::thread_per_core; } },
+    { "accept_depth = 1", [](auto& o) { o.accept_depth = 1; } },
+    { "accept_depth = 64", [](auto& o) { o.accept_depth = 64; } },
+    { "backlog = 16", [](auto& o) { o.backlog = 16; } },
+    { "buffers = 0", [](auto& o) { o.receive_buffer_size = 0; o.send_buffer_size = 0; } },
+    { "buffers = 256 KiB", [](auto& o) { o.receive_buffer_size = 256 * 1024; o.send_buffer_size = 256 * 1024; } },
+    { "no_delay = false", [](auto& o) { o.no_delay = false; } },
+    { "max_body_size = 1 MiB", [](auto& o) { o.max_body_size = 1024 * 1024; } },
+    { "access_log", [](auto& o) { o.access_log = pine::access_log_options{ "options_sweep_access_log" }; } },
+  };
+
+  // The servers keep running once stopped, so each one gets its own port.
+  // The first configuration is the defaults, the others are compared to it.
+  int port = 18080;
+  double baseline = 0;
+  for (const auto& config : configurations)
+  {
+    double throughput = run(config, port++, baseline);
+    if (baseline == 0)
+      baseline = throughput;
+  }
+}
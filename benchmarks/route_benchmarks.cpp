@@ -0,0 +1,197 @@
+// Purpose: Measure the cost of route lookups in a tree of thousands of
+// routes, with static segments, path parameters and wildcards, and compare
+// the tree with a route table built at compile time and with its route cache
+// on a skewed workload.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <path_params.h>
+#include <route_node.h>
+#include <route_table.h>
+#include <route_tree.h>
+
+namespace
+{
+  /// @brief Build a tree of routes. Routes are built at runtime, so the
+  /// nodes are added directly instead of through compile time route paths.
+  /// For each resource:
+  /// /resource<i>, /resource<i>/:id, /resource<i>/:id/items
+  /// and /resource<i>/files/*path.
+  /// @param tree The tree to add the routes to.
+  /// @param resources The number of resources.
+  void build_tree(pine::route_tree& tree, int resources)
+  {
+    auto& root = tree.root();
+    for (int i = 0; i < resources; i++)
+    {
+      auto& resource = root.add_child("resource" + std::to_string(i));
+      auto& id = resource.add_child(":id");
+      id.add_child("items");
+      resource.add_child("files").add_child("*path");
+    }
+  }
+
+  void handler(const pine::http_request&, pine::http_response&) {}
+
+  using api_table = pine::route_table<
+    pine::table_route<"/", pine::http_method::get, &handler>,
+    pine::table_route<"/login", pine::http_method::post, &handler>,
+    pine::table_route<"/logout", pine::http_method::post, &handler>,
+    pine::table_route<"/users", pine::http_method::get, &handler>,
+    pine::table_route<"/users/:id", pine::http_method::get, &handler>,
+    pine::table_route<"/orders", pine::http_method::get, &handler>,
+    pine::table_route<"/orders/:id", pine::http_method::get, &handler>,
+    pine::table_route<"/health", pine::http_method::get, &handler>,
+    pine::table_route<"/metrics", pine::http_method::get, &handler>,
+    pine::table_route<"/static/*path", pine::http_method::get, &handler>>;
+
+  /// @brief Run a benchmark and print the average cost of one lookup.
+  /// @param name The name of the benchmark.
+  /// @param paths The paths to look up.
+  /// @param iterations The number of times each path is looked up.
+  /// @param lookup The function looking up one path.
+  template <typename function_t>
+  void run_benchmark(const char* name,
+                     const std::vector<std::string>& paths,
+                     int iterations,
+                     function_t&& lookup)
+  {
+    size_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+      for (const auto& path : paths)
+        checksum += lookup(path);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double total_ns = static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    double lookups = static_cast<double>(iterations) * paths.size();
+
+    std::printf("%-24s: %8.1f ns/lookup (checksum %zu)\n",
+                name, total_ns / lookups, checksum);
+  }
+}
+
+int main()
+{
+  constexpr int iterations = 200;
+
+  {
+    pine::route_tree tree;
+    for (auto path : { "login", "logout", "users", "orders", "health", "metrics" })
+      tree.root().add_child(path);
+    tree.root().find_child("users").add_child(":id");
+    tree.root().find_child("orders").add_child(":id");
+    tree.root().add_child("static").add_child("*path");
+
+    std::vector<std::string> static_paths{ "/login", "/users", "/health", "/metrics" };
+    std::vector<std::string> param_paths{ "/users/42", "/orders/7" };
+
+    std::printf("10 routes\n");
+
+    run_benchmark("tree static", static_paths, iterations * 1000,
+                  [&](const std::string& path)
+                  {
+                    return tree.find_route(path).path().size();
+                  });
+
+    run_benchmark("table static", static_paths, iterations * 1000,
+                  [&](const std::string& path)
+                  {
+                    return size_t{ api_table::find(path, pine::http_method::get) != nullptr };
+                  });
+
+    run_benchmark("tree path parameters", param_paths, iterations * 1000,
+                  [&](const std::string& path)
+                  {
+                    const auto& [node, found, params] =
+                      tree.find_route_with_params(path);
+                    return params.size();
+                  });
+
+    run_benchmark("table path parameters", param_paths, iterations * 1000,
+                  [&](const std::string& path)
+                  {
+                    pine::path_params params;
+                    api_table::find(path, params);
+                    return params.size();
+                  });
+  }
+
+  for (int resources : { 10, 1000, 5000 })
+  {
+    pine::route_tree tree;
+    build_tree(tree, resources);
+
+    std::vector<std::string> static_paths;
+    std::vector<std::string> param_paths;
+    std::vector<std::string> wildcard_paths;
+    for (int i = 0; i < 1000; i++)
+    {
+      auto resource = "/resource" + std::to_string(i * 7919 % resources);
+      static_paths.push_back(resource);
+      param_paths.push_back(resource + "/" + std::to_string(i) + "/items");
+      wildcard_paths.push_back(resource + "/files/images/" + std::to_string(i));
+    }
+
+    std::printf("%d routes\n", resources * 4);
+
+    run_benchmark("static", static_paths, iterations,
+                  [&](const std::string& path)
+                  {
+                    return tree.find_route(path).path().size();
+                  });
+
+    run_benchmark("path parameters", param_paths, iterations,
+                  [&](const std::string& path)
+                  {
+                    const auto& [node, found, params] =
+                      tree.find_route_with_params(path);
+                    return params.size();
+                  });
+
+    run_benchmark("wildcard", wildcard_paths, iterations,
+                  [&](const std::string& path)
+                  {
+                    const auto& [node, found, params] =
+                      tree.find_route_with_params(path);
+                    return params[0].second.size();
+                  });
+  }
+
+  {
+    pine::route_tree tree;
+    build_tree(tree, 5000);
+
+    // Nine lookups out of ten hit one of twenty hot paths.
+    std::vector<std::string> skewed_paths;
+    for (int i = 0; i < 1000; i++)
+    {
+      int resource = i % 10 != 0 ? i % 20 : i * 7919 % 5000;
+      skewed_paths.push_back("/resource" + std::to_string(resource)
+                             + "/" + std::to_string(resource) + "/items");
+    }
+
+    std::printf("20000 routes, skewed\n");
+
+    auto lookup = [&](const std::string& path)
+      {
+        const auto& [node, found, params] = tree.find_route_with_params(path);
+        return params[0].second.size();
+      };
+
+    run_benchmark("uncached", skewed_paths, iterations, lookup);
+
+    tree.enable_cache(true);
+    run_benchmark("cached", skewed_paths, iterations, lookup);
+
+    auto stats = tree.cache_stats();
+    std::printf("cache hit rate: %.1f%%\n", stats.hit_rate() * 100);
+  }
+}
@@ -5,6 +5,8 @@
 
 #include <loguru.hpp>
 #include <server.h>
+#include <task.h>
+#include <thread_pool.h>
 
 int main(int argc, char** argv)
 {
@@ -61,6 +63,21 @@ int main(int argc, char** argv)
                    },
                    { pine::http_method::post });
 
+  // Add a route with an asynchronous handler. The handler moves its slow work
+  // to the thread pool, so the I/O threads keep serving other clients while it
+  // is suspended.
+  server.add_route("/slow",
+                   [](const pine::http_request&) -> pine::task<pine::http_response>
+                   {
+                     co_await pine::thread_pool::get_instance().schedule();
+                     std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+                     pine::http_response response;
+                     response.set_status(pine::http_status::ok);
+                     response.set_body("Done waiting.");
+                     co_return response;
+                   });
+
   // Add a route that responds to GET requests to /public_directory/*.
   // This route will serve files from the public directory.
   server.add_static_route("/public_directory", std::filesystem::current_path() / "public");
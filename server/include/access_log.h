@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <error.h>
+#include <expected.h>
+#include <filesystem>
+#include <http.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace pine
+{
+  /// @brief An entry of the access log: one request and its response.
+  /// @details Records have a fixed size so that logging is a copy. Numbers
+  /// are stored in the byte order of the machine writing them. A record
+  /// whose time is zero was never written.
+  struct access_record
+  {
+    /// @brief Room for the path, longer paths are truncated.
+    static constexpr size_t path_capacity = 84;
+
+    /// @brief When the request was received, in nanoseconds since the Unix
+    /// epoch.
+    uint64_t time = 0;
+
+    /// @brief Time from receiving the request to sending its response, in
+    /// nanoseconds.
+    uint64_t latency = 0;
+
+    uint64_t bytes_received = 0;
+    uint64_t bytes_sent = 0;
+
+    /// @brief IPv4 address of the client, in network byte order.
+    std::array<uint8_t, 4> peer_address{};
+
+    uint16_t peer_port = 0;
+    uint16_t status = 0;
+
+    /// @brief The method of the request, 0 if it was not parsed.
+    uint8_t method = 0;
+
+    /// @brief Whether the path was truncated to path_capacity.
+    uint8_t path_truncated = 0;
+
+    uint16_t path_size = 0;
+    std::array<char, path_capacity> path{};
+
+    /// @brief Set the path, truncated to path_capacity.
+    void set_path(std::string_view value) noexcept
+    {
+      path_truncated = value.size() > path_capacity;
+      path_size = static_cast<uint16_t>(
+        path_truncated ? path_capacity : value.size());
+      std::memcpy(path.data(), value.data(), path_size);
+    }
+
+    /// @brief Get the path, possibly truncated.
+    std::string_view get_path() const noexcept
+    {
+      return { path.data(), std::min<size_t>(path_size, path_capacity) };
+    }
+  };
+
+  static_assert(sizeof(access_record) == 128);
+
+  /// @brief The header at the start of each segment of the access log.
+  struct access_log_header
+  {
+    static constexpr std::array<char, 8> expected_magic{
+      'P', 'I', 'N', 'E', 'A', 'L', 'O', 'G' };
+    static constexpr uint32_t current_version = 1;
+
+    std::array<char, 8> magic = expected_magic;
+    uint32_t version = current_version;
+    uint32_t record_size = sizeof(access_record);
+
+    /// @brief When the segment was created, in nanoseconds since the Unix
+    /// epoch.
+    uint64_t created = 0;
+
+    /// @brief The writer of the segment, one per thread.
+    uint32_t writer = 0;
+
+    /// @brief The number of the segment among those of its writer.
+    uint32_t sequence = 0;
+
+    std::array<uint8_t, 32> reserved{};
+  };
+
+  static_assert(sizeof(access_log_header) == 64);
+
+  /// @brief Settings of an access_log.
+  struct access_log_options
+  {
+    /// @brief The directory of the segments, created if needed.
+    std::filesystem::path directory = "access_log";
+
+    /// @brief Size of each segment file. A writer moves to a new segment
+    /// once its current one is full.
+    size_t segment_size = 64 * 1024 * 1024;
+
+    /// @brief Number of full segments kept per writer, the oldest being
+    /// deleted. 0 keeps them all.
+    size_t max_segments = 0;
+  };
+
+  /// @brief A binary access log, written by each thread into its own
+  /// memory-mapped segment files.
+  /// @details Each thread logging gets a writer of its own the first time it
+  /// logs, so logging takes no lock and threads share nothing. A record is
+  /// copied into the mapped segment, and the system writes the pages back to
+  /// the file. A background thread creates the segments ahead, maps their
+  /// pages before they are written and closes the full ones.
+  ///
+  /// Segments are named access-<run>-<writer>-<sequence>.plog, where run is
+  /// the time the log was created in milliseconds since the Unix epoch, so
+  /// that runs do not overwrite each other. Decode them with
+  /// read_access_log and format_access_record, or with the access_log_decode
+  /// tool.
+  ///
+  /// The log must outlive the threads logging to it.
+  class access_log
+  {
+  public:
+    explicit access_log(const access_log_options& options);
+
+    access_log(const access_log&) = delete;
+    access_log& operator=(const access_log&) = delete;
+
+    /// @brief Close the segments, cut to the records written.
+    ~access_log();
+
+    /// @brief Log a request from the current thread. Records that cannot be
+    /// written, because a segment could not be created, are counted as
+    /// dropped.
+    /// @param record The record. Its time must not be zero.
+    void write(const access_record& record) noexcept;
+
+    /// @brief Convert a time of the steady clock to the time of a record,
+    /// without reading the system clock.
+    uint64_t to_record_time(std::chrono::steady_clock::time_point time)
+      const noexcept
+    {
+      return static_cast<uint64_t>(
+        (epoch_offset_ + time.time_since_epoch()).count());
+    }
+
+    /// @brief Get the number of records that could not be written.
+    uint64_t dropped() const noexcept
+    {
+      return dropped_.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Get the options of the log.
+    const access_log_options& options() const noexcept
+    {
+      return options_;
+    }
+
+  private:
+    struct segment;
+    class writer;
+
+    /// @brief Time between two rounds of the preparing thread.
+    static constexpr std::chrono::milliseconds prepare_interval{ 10 };
+
+    /// @brief Get the writer of the current thread, creating it if needed.
+    writer* get_writer() noexcept;
+
+    /// @brief Body of the preparing thread.
+    void prepare(std::stop_token stop);
+
+    access_log_options options_;
+
+    /// @brief Identifies the log in the thread caches of the writers, even
+    /// if another log takes its address.
+    uint64_t id_;
+
+    /// @brief Difference between the system clock and the steady clock.
+    std::chrono::nanoseconds epoch_offset_;
+
+    /// @brief Names the segments of this log apart from those of other runs.
+    uint64_t run_;
+
+    std::atomic<uint64_t> dropped_ = 0;
+
+    /// @brief Guards the list of writers, changed once per thread.
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<writer>> writers_;
+
+    /// @brief Wakes the preparing thread to stop it.
+    std::condition_variable_any wake_;
+
+    /// @brief Prepares the next segments of the writers, maps their pages
+    /// ahead of the records and closes the full segments, so that the
+    /// threads logging make no system call. Declared last, so that it stops
+    /// before the writers are destroyed.
+    std::jthread preparer_;
+  };
+
+  /// @brief The text formats of the access log.
+  enum class access_log_format
+  {
+    /// @brief One line per request: time, client, method, path, status,
+    /// bytes received and sent, and latency.
+    text,
+
+    /// @brief Comma separated values, after the access_log_csv_header line.
+    csv,
+  };
+
+  /// @brief The first line of the CSV format.
+  inline constexpr std::string_view access_log_csv_header =
+    "time,peer,method,path,path_truncated,status,bytes_received,bytes_sent,"
+    "latency_ns";
+
+  /// @brief Read the records of a segment of the access log. Reading stops
+  /// at the first record never written, so segments still being written can
+  /// be read.
+  /// @param path The path of the segment.
+  /// @return The records, or an error if the file is not a segment.
+  std::expected<std::vector<access_record>, pine::error>
+    read_access_log(const std::filesystem::path& path);
+
+  /// @brief Format a record of the access log, without line break.
+  /// @param record The record.
+  /// @param format The format.
+  /// @return The text of the record.
+  std::string format_access_record(const access_record& record,
+                                   access_log_format format);
+}
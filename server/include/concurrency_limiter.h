@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace pine
+{
+  /// @brief Settings of a concurrency_limiter.
+  struct concurrency_limiter_options
+  {
+    /// @brief Number of requests allowed in flight before any measurement.
+    size_t initial_limit = 64;
+
+    /// @brief The limit never drops below this value.
+    size_t min_limit = 4;
+
+    /// @brief The limit never grows above this value.
+    size_t max_limit = 4096;
+
+    /// @brief Requests slower than this are taken as a sign of overload.
+    std::chrono::milliseconds latency_target{ 100 };
+
+    /// @brief Factor applied to the limit on overload.
+    double backoff_ratio = 0.9;
+
+    /// @brief Value of the Retry-After header of shed requests.
+    std::chrono::seconds retry_after{ 1 };
+  };
+
+  /// @brief Adaptive limit on the number of requests handled at the same time.
+  /// @details The limit follows an AIMD scheme, like TCP congestion control:
+  /// every request completed within the latency target while the limiter is
+  /// busy raises the limit by 1 / limit, so by about one per round of
+  /// requests, and a request slower than the target cuts it by the backoff
+  /// ratio. Cuts happen at most once per latency target, so a burst of slow
+  /// requests caused by one overload is only counted once.
+  ///
+  /// Acquiring and releasing are lock-free, so the limiter can be shared by
+  /// every worker thread.
+  class concurrency_limiter
+  {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    explicit concurrency_limiter(const concurrency_limiter_options& options = {});
+
+    /// @brief Admit a request if the limit allows it.
+    /// @return True if the request may be handled, false if it should be shed.
+    bool try_acquire() noexcept;
+
+    /// @brief Report the completion of an admitted request.
+    /// @param latency The time taken to handle the request.
+    /// @param now The current time.
+    void release(clock::duration latency, clock::time_point now = clock::now()) noexcept;
+
+    /// @brief Report an admitted request that was dropped, for instance
+    /// because it timed out. Counts as overload.
+    /// @param now The current time.
+    void release_dropped(clock::time_point now = clock::now()) noexcept;
+
+    /// @brief Get the current limit.
+    size_t limit() const noexcept;
+
+    /// @brief Get the number of requests in flight.
+    size_t in_flight() const noexcept;
+
+    /// @brief Get the settings of the limiter.
+    const concurrency_limiter_options& options() const noexcept { return options_; }
+
+  private:
+    /// @brief Raise the limit after a fast request.
+    void increase() noexcept;
+
+    /// @brief Cut the limit after a slow or dropped request.
+    void decrease(clock::time_point now) noexcept;
+
+    concurrency_limiter_options options_;
+
+    /// @brief The limit, fractional so it can grow by less than one.
+    std::atomic<double> limit_;
+    std::atomic<size_t> in_flight_ = 0;
+
+    /// @brief Time before which the limit is not cut again.
+    std::atomic<int64_t> next_decrease_ = 0;
+  };
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <http.h>
+#include <request_trace.h>
+#include <string>
+#include <string_view>
+
+namespace pine
+{
+  class route_tree;
+
+  /// @brief A histogram of latencies with buckets of bounded relative
+  /// error, in the manner of HdrHistogram.
+  /// @details Latencies are counted in nanoseconds. Below 2^sub_bucket_bits
+  /// each value has its own bucket; above, every power of two is split into
+  /// 2^sub_bucket_bits buckets, so a bucket is at most 1/16 wider than the
+  /// values it holds. Latencies above max_latency go to the last bucket.
+  ///
+  /// Recording is wait-free: it adds to three counters, without any lock or
+  /// retry, from any number of threads. Reading while recording gives counts
+  /// that may be a few records apart from each other.
+  ///
+  /// Each thread records in one of several shards, so that threads recording
+  /// the same route do not contend on its cache lines; the shards are summed
+  /// when read. A shard takes about 4.2 KiB, so only the first is part of
+  /// the histogram and the others are allocated by the first thread
+  /// recording in them. A route served by one thread stays at one shard, a
+  /// route served by every thread grows to shard_count shards.
+  class latency_histogram
+  {
+  public:
+    /// @brief Number of bits of the sub-buckets of each power of two.
+    static constexpr size_t sub_bucket_bits = 4;
+
+    /// @brief Number of sub-buckets of each power of two.
+    static constexpr size_t sub_bucket_count = size_t{ 1 } << sub_bucket_bits;
+
+    /// @brief Number of powers of two covered, so that latencies up to about
+    /// a minute keep their precision.
+    static constexpr size_t magnitude_count = 36 - sub_bucket_bits;
+
+    /// @brief Number of buckets.
+    static constexpr size_t bucket_count =
+      sub_bucket_count * (magnitude_count + 1);
+
+    /// @brief Highest latency with a bucket of its own.
+    static constexpr std::chrono::nanoseconds max_latency{
+      (uint64_t{ 1 } << (magnitude_count + sub_bucket_bits)) - 1 };
+
+    /// @brief Number of shards, shared by the threads.
+    static constexpr size_t shard_count = 8;
+
+    latency_histogram() = default;
+
+    latency_histogram(const latency_histogram&) = delete;
+    latency_histogram& operator=(const latency_histogram&) = delete;
+
+    ~latency_histogram();
+
+    /// @brief Record a latency.
+    /// @param latency The latency. Negative latencies count as 0.
+    void record(std::chrono::nanoseconds latency) noexcept
+    {
+      uint64_t value = latency.count() > 0
+        ? static_cast<uint64_t>(latency.count())
+        : 0;
+
+      shard& shard = local_shard();
+      shard.buckets[bucket_index(value)]
+        .fetch_add(1, std::memory_order_relaxed);
+      shard.count.fetch_add(1, std::memory_order_relaxed);
+      shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /// @brief Get the number of latencies recorded.
+    uint64_t count() const noexcept;
+
+    /// @brief Get the sum of the latencies recorded.
+    std::chrono::nanoseconds sum() const noexcept;
+
+    /// @brief Get the number of latencies recorded in a bucket.
+    /// @param index The index of the bucket, less than bucket_count.
+    uint64_t bucket(size_t index) const noexcept;
+
+    /// @brief Get a percentile of the latencies recorded.
+    /// @param percentile The percentile, between 0 and 100.
+    /// @return The highest latency of the bucket holding the percentile, 0
+    /// if nothing was recorded.
+    std::chrono::nanoseconds percentile(double percentile) const noexcept;
+
+    /// @brief Get the bucket of a latency.
+    /// @param value The latency in nanoseconds.
+    /// @return The index of the bucket.
+    static constexpr size_t bucket_index(uint64_t value) noexcept
+    {
+      if (value < sub_bucket_count)
+        return static_cast<size_t>(value);
+
+      size_t magnitude = std::bit_width(value) - 1 - sub_bucket_bits;
+      if (magnitude >= magnitude_count)
+        return bucket_count - 1;
+
+      size_t sub_bucket = (value >> magnitude) - sub_bucket_count;
+      return sub_bucket_count * (magnitude + 1) + sub_bucket;
+    }
+
+    /// @brief Get the highest latency counted in a bucket.
+    /// @param index The index of the bucket, less than bucket_count.
+    /// @return The latency in nanoseconds.
+    static constexpr uint64_t bucket_upper_bound(size_t index) noexcept
+    {
+      if (index < sub_bucket_count)
+        return index;
+
+      size_t magnitude = index / sub_bucket_count - 1;
+      uint64_t sub_bucket = index % sub_bucket_count + sub_bucket_count;
+      return ((sub_bucket + 1) << magnitude) - 1;
+    }
+
+  private:
+    struct alignas(64) shard
+    {
+      std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+      std::atomic<uint64_t> count = 0;
+      std::atomic<uint64_t> sum = 0;
+    };
+
+    /// @brief Get the shard the thread records in, allocating it on first
+    /// use. Falls back to the first shard if no memory is available.
+    shard& local_shard() noexcept;
+
+    /// @brief Call a function with each shard allocated.
+    template <typename function>
+    void for_each_shard(function&& f) const noexcept
+    {
+      f(first_shard_);
+      for (const auto& other : other_shards_)
+      {
+        if (const shard* allocated = other.load(std::memory_order_acquire))
+          f(*allocated);
+      }
+    }
+
+    shard first_shard_;
+
+    /// @brief The shards after the first, null until a thread records in
+    /// them.
+    std::array<std::atomic<shard*>, shard_count - 1> other_shards_{};
+  };
+
+  /// @brief The counters of a server.
+  enum class server_counter
+  {
+    /// @brief Requests received, including the shed and the invalid ones.
+    requests,
+    /// @brief Bytes of the requests received.
+    bytes_received,
+    /// @brief Bytes of the responses sent.
+    bytes_sent,
+    /// @brief Connections accepted.
+    accepts,
+    /// @brief Connections removed from the server.
+    disconnects,
+    /// @brief Requests that could not be parsed.
+    parse_errors,
+  };
+
+  constexpr size_t server_counter_count = 6;
+
+  /// @brief The counters of a server summed over the threads.
+  struct server_metrics_snapshot
+  {
+    /// @brief The first status counted, statuses below are not.
+    static constexpr size_t first_status = 100;
+
+    /// @brief Number of statuses counted, from first_status.
+    static constexpr size_t status_count = 500;
+
+    /// @brief The counters, indexed by pine::server_counter.
+    std::array<uint64_t, server_counter_count> counters{};
+
+    /// @brief The responses sent, indexed by their status minus
+    /// first_status.
+    std::array<uint64_t, status_count> statuses{};
+
+    /// @brief Get a counter.
+    uint64_t get(server_counter counter) const noexcept
+    {
+      return counters[static_cast<size_t>(counter)];
+    }
+
+    /// @brief Get the number of responses sent with a status.
+    uint64_t get(http_status status) const noexcept;
+
+    /// @brief Get the number of connections open: accepted and not removed
+    /// yet.
+    uint64_t active_connections() const noexcept
+    {
+      return get(server_counter::accepts) - get(server_counter::disconnects);
+    }
+  };
+
+  /// @brief The counters of a server, such as the requests received and the
+  /// responses sent by status.
+  /// @details Each thread counts in one of several sets of counters, on
+  /// their own cache lines, so that threads do not contend. Counting is
+  /// wait-free; the sets are summed when the counters are read.
+  class server_metrics
+  {
+  public:
+    /// @brief Number of sets of counters, shared by the threads.
+    static constexpr size_t shard_count = 16;
+
+    /// @brief Add to a counter.
+    /// @param counter The counter.
+    /// @param value The value to add.
+    void add(server_counter counter, uint64_t value = 1) noexcept;
+
+    /// @brief Count a response sent.
+    /// @param status The status of the response. Statuses out of the range
+    /// of server_metrics_snapshot are not counted.
+    void count_response(http_status status) noexcept;
+
+    /// @brief Sum the counters of the threads.
+    server_metrics_snapshot snapshot() const noexcept;
+
+  private:
+    struct alignas(64) shard
+    {
+      std::array<std::atomic<uint64_t>, server_counter_count> counters{};
+      std::array<std::atomic<uint64_t>,
+                 server_metrics_snapshot::status_count> statuses{};
+    };
+
+    std::array<shard, shard_count> shards_{};
+  };
+
+  /// @brief The time requests spend in each phase of their life, gathered
+  /// from their traces when built with PINE_TRACING.
+  class phase_histograms
+  {
+  public:
+    /// @brief Record the phases of a request. The time of a phase is
+    /// counted from the previous phase reached.
+    /// @param trace The trace of the request.
+    void record(const basic_request_trace<true>& trace) noexcept
+    {
+      for (size_t i = 1; i < trace_phase_count; ++i)
+      {
+        auto phase = static_cast<trace_phase>(i);
+        if (trace.reached(phase))
+          histograms_[i].record(trace.phase_duration(phase));
+      }
+    }
+
+    /// @brief Get the times spent reaching a phase.
+    const latency_histogram& operator[](trace_phase phase) const noexcept
+    {
+      return histograms_[static_cast<size_t>(phase)];
+    }
+
+  private:
+    std::array<latency_histogram, trace_phase_count> histograms_{};
+  };
+
+  /// @brief Write metrics in the Prometheus text format.
+  namespace prometheus
+  {
+    /// @brief Write the counters of a server.
+    /// @param output The text to append to.
+    /// @param metrics The counters.
+    void write(std::string& output, const server_metrics_snapshot& metrics);
+
+    /// @brief Write the latency histograms of the routes of a tree as the
+    /// pine_request_duration_seconds histogram, labelled by route. Routes
+    /// without requests are skipped.
+    /// @param output The text to append to.
+    /// @param routes The routes.
+    void write(std::string& output, const route_tree& routes);
+
+    /// @brief Write the latency histogram of a route as samples of the
+    /// pine_request_duration_seconds histogram, without its header. Used for
+    /// the routes of a pine::route_table, after the routes of the tree.
+    /// @param output The text to append to.
+    /// @param route The path of the route.
+    /// @param latency The latencies of the route.
+    void write(std::string& output,
+               std::string_view route,
+               const latency_histogram& latency);
+
+    /// @brief Write the times spent in the phases of the requests as the
+    /// pine_request_phase_seconds histogram, labelled by phase.
+    /// @param output The text to append to.
+    /// @param phases The times of the phases.
+    void write(std::string& output, const phase_histograms& phases);
+  }
+}
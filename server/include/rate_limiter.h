@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace pine
+{
+  /// @brief What a rate_limiter counts the requests by.
+  enum class rate_limit_key
+  {
+    /// @brief The address of the client.
+    remote_address,
+
+    /// @brief The value of a header of the request, for instance an API key.
+    header
+  };
+
+  /// @brief Settings of a rate_limiter.
+  struct rate_limit_options
+  {
+    /// @brief Requests allowed per second and per key, on average. Must be
+    /// positive and finite.
+    double requests_per_second = 10;
+
+    /// @brief Requests allowed in a burst, that is the size of the buckets.
+    double burst = 20;
+
+    /// @brief What the requests are counted by.
+    rate_limit_key key = rate_limit_key::remote_address;
+
+    /// @brief The header identifying the client when key is header. Requests
+    /// without the header share a single bucket.
+    std::string header;
+
+    /// @brief Time after which the bucket of an idle key is dropped. Never
+    /// shorter than the time a bucket takes to refill, so dropping a bucket
+    /// grants no extra request.
+    std::chrono::seconds idle_expiry{ 60 };
+
+    /// @brief Most keys with a bucket at the same time. Once it is reached,
+    /// the bucket of a key not used recently is evicted for each new key, so
+    /// that clients sending new keys cannot grow the limiter without bound.
+    /// An evicted key starts again with a full bucket.
+    size_t max_keys = 64 * 1024;
+  };
+
+  /// @brief Token bucket rate limiter.
+  /// @details Each key owns a bucket of burst tokens, refilled at
+  /// requests_per_second. A request takes a token and is rejected when the
+  /// bucket is empty.
+  ///
+  /// Buckets are spread over shards, each with its own lock, so threads
+  /// rarely contend and a request costs a hash lookup under an uncontended
+  /// lock. Each shard holds a fixed number of buckets, swept by a clock hand:
+  /// every request moves the hand over a few buckets, dropping those idle
+  /// since idle_expiry, and a new key in a full shard takes the first bucket
+  /// the hand finds not used since its last pass.
+  class rate_limiter
+  {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /// @brief Construct a rate limiter.
+    /// @param options The options. Throws pine::error with
+    /// error_code::invalid_parameter if requests_per_second is not positive
+    /// and finite.
+    explicit rate_limiter(const rate_limit_options& options = {});
+
+    /// @brief Take a token from the bucket of a key.
+    /// @param key The key, given by one of the key_of functions.
+    /// @param now The current time.
+    /// @return True if the request may be handled, false if it is rejected.
+    bool try_acquire(uint64_t key, clock::time_point now = clock::now());
+
+    /// @brief Get the key of an IPv4 address.
+    static constexpr uint64_t key_of(uint32_t address) noexcept
+    {
+      return address;
+    }
+
+    /// @brief Get the key of a header value.
+    static uint64_t key_of(std::string_view value) noexcept
+    {
+      return std::hash<std::string_view>{}(value);
+    }
+
+    /// @brief Get the number of keys with a bucket.
+    size_t size() const;
+
+    /// @brief Get the 429 Too Many Requests response sent to rejected
+    /// requests, rendered once.
+    std::string_view rejection() const noexcept { return rejection_; }
+
+    /// @brief Get the settings of the limiter.
+    const rate_limit_options& options() const noexcept { return options_; }
+
+  private:
+    static constexpr size_t shard_count = 64;
+
+    /// @brief Buckets the clock hand passes over on each request.
+    static constexpr size_t sweep_step = 4;
+
+    struct bucket
+    {
+      uint64_t key;
+      double tokens;
+      clock::rep last_refill;
+
+      /// @brief Whether the bucket is used by a key.
+      bool used;
+
+      /// @brief Whether the bucket was used since the hand last passed it.
+      bool referenced;
+    };
+
+    /// @brief Aligned on a cache line so that threads using neighbouring
+    /// shards do not share one.
+    struct alignas(64) shard
+    {
+      mutable std::mutex mutex;
+
+      /// @brief The index of the bucket of each key.
+      std::unordered_map<uint64_t, uint32_t> keys;
+
+      /// @brief The buckets, at most the capacity of a shard.
+      std::vector<bucket> buckets;
+
+      /// @brief The buckets not used by a key.
+      std::vector<uint32_t> free;
+
+      /// @brief The bucket the clock hand is on.
+      uint32_t hand = 0;
+    };
+
+    /// @brief Get the shard holding the bucket of a key.
+    shard& shard_of(uint64_t key) noexcept;
+
+    /// @brief Move the clock hand over sweep_step buckets, dropping those
+    /// idle since idle_expiry. The shard must be locked.
+    void sweep(shard& shard, clock::rep now);
+
+    /// @brief Get a bucket for a new key, evicting one if the shard is full.
+    /// The shard must be locked.
+    /// @return The index of the bucket.
+    uint32_t allocate(shard& shard, clock::rep now);
+
+    /// @brief Drop the key of a bucket. The shard must be locked.
+    void release(shard& shard, uint32_t index);
+
+    rate_limit_options options_;
+
+    /// @brief Tokens added per tick of the clock.
+    double tokens_per_tick_;
+
+    /// @brief The idle expiry, in ticks of the clock.
+    clock::rep idle_expiry_;
+
+    /// @brief Most buckets of a shard.
+    size_t shard_capacity_;
+
+    std::array<shard, shard_count> shards_;
+
+    std::string rejection_;
+  };
+}
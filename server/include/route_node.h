@@ -8,9 +8,13 @@
 #include <http.h>
 #include <http_request.h>
 #include <http_response.h>
+#include <inline_function.h>
 #include <memory>
+#include <metrics.h>
+#include <rate_limiter.h>
 #include <string>
 #include <string_view>
+#include <task.h>
 #include <vector>
 #include <filesystem>
 
@@ -22,9 +26,15 @@ namespace pine
   {
   public:
 
-    /// @brief The type of the handler function.
+    /// @brief The type of the handler function. Handlers are stored in the
+    /// node, so calling one costs a single indirect call.
     using handler_type =
-      std::function<void(const http_request&, http_response&)>;
+      inline_function<void(const http_request&, http_response&)>;
+
+    /// @brief The type of the asynchronous handler function. The handler may
+    /// suspend, the response is sent once the returned task completes.
+    using async_handler_type =
+      inline_function<task<void>(const http_request&, http_response&)>;
 
     /// @brief Construct a new base route node. The path of the node
     /// corresponds to one part of a route (e.g. a segment of the URI).
@@ -36,6 +46,11 @@ namespace pine
     /// with the pine::http_request::get_path_param<T>(std::string_view name)
     /// function.
     /// 
+    /// If the path starts with a star followed by a name (e.g. "/files/*path"),
+    /// the node will be a wildcard node. A wildcard node matches the rest of
+    /// the URI, slashes included, and stores it as the path parameter named
+    /// after the star. It must be the last part of a route.
+    /// 
     /// If the path contains a /, the node will contain children. The children
     /// are used to represent the rest of the route.
     /// 
@@ -46,7 +61,39 @@ namespace pine
     void handle(const http_request& request,
                 http_response& response) const noexcept
     {
-      handlers_[static_cast<size_t>(request.get_method())]->operator()(request, response);
+      handlers_[http_method_index(request.get_method())](request, response);
+    }
+
+    /// @brief Call the asynchronous handler registered for the method of the
+    /// request.
+    /// @return The task running the handler.
+    task<void> handle_async(const http_request& request,
+                            http_response& response) const
+    {
+      return async_handlers_[http_method_index(request.get_method())](request, response);
+    }
+
+    /// @brief Check whether the node has a handler for a method.
+    /// @param method The HTTP method.
+    /// @return True if a synchronous or asynchronous handler is registered.
+    constexpr bool has_handler(http_method method) const noexcept
+    {
+      return http_method_mask_ & (1 << http_method_index(method));
+    }
+
+    /// @brief Check whether the node has a handler for any method.
+    /// @return False if the node only prefixes other routes.
+    constexpr bool has_handlers() const noexcept
+    {
+      return http_method_mask_ != 0;
+    }
+
+    /// @brief Check whether the handler of a method is asynchronous.
+    /// @param method The HTTP method.
+    /// @return True if the handler registered for the method is asynchronous.
+    bool is_async(http_method method) const noexcept
+    {
+      return static_cast<bool>(async_handlers_[http_method_index(method)]);
     }
 
     /// @brief Get the path of the node. The path of the node corresponds to one
@@ -57,7 +104,7 @@ namespace pine
     /// @brief Get the handlers of the node, indexed by pine::http_method.
     /// @return The handlers of the node.
     constexpr
-      const std::array<std::unique_ptr<handler_type>, http_method_count>&
+      const std::array<handler_type, http_method_count>&
       handlers() const noexcept { return handlers_; }
 
     /// @brief Add a child to the node. The child will be a part of the route
@@ -73,10 +120,16 @@ namespace pine
     /// Calling this function will overwrite any existing handler for the method.
     /// @param method The HTTP method to handle.
     /// @param handler The handler to call.
-    void add_handler(http_method method,
-                     std::unique_ptr<handler_type> handler) noexcept;
+    void add_handler(http_method method, handler_type handler);
+
+    /// @brief Add an asynchronous handler to the node. Calling this function
+    /// will overwrite any existing handler for the method.
+    /// @param method The HTTP method to handle.
+    /// @param handler The handler to call.
+    void add_handler(http_method method, async_handler_type handler);
 
-    /// @brief Find a child of the node by path.
+    /// @brief Find a child of the node by path. Static children are tried
+    /// first, then the path parameter child, then the wildcard child.
     /// @param path The path of the child to find. The path can be a segment of
     /// the URI or the rest of the URI.
     /// @return If the child was found, a reference to the child. If the child
@@ -84,6 +137,25 @@ namespace pine
     route_node&
       find_child(std::string_view path) const noexcept;
 
+    /// @brief Find the static child whose path is exactly a segment.
+    /// @param segment The segment, without slashes.
+    /// @return The child, or nullptr if there is none.
+    route_node* find_static_child(std::string_view segment) const noexcept;
+
+    /// @brief Get the path parameter child of the node.
+    /// @return The child, or nullptr if there is none.
+    constexpr route_node* path_parameter_child() const noexcept
+    {
+      return path_parameter_child_;
+    }
+
+    /// @brief Get the wildcard child of the node.
+    /// @return The child, or nullptr if there is none.
+    constexpr route_node* wildcard_child() const noexcept
+    {
+      return wildcard_child_;
+    }
+
     /// @brief Check if the node is a path parameter node.
     /// @return True if the node is a path parameter node, otherwise false.
     constexpr bool is_path_parameter() const noexcept
@@ -91,6 +163,13 @@ namespace pine
       return is_path_parameter_;
     }
 
+    /// @brief Check if the node is a wildcard node.
+    /// @return True if the node is a wildcard node, otherwise false.
+    constexpr bool is_wildcard() const noexcept
+    {
+      return is_wildcard_;
+    }
+
     /// @brief Check if the node has children that are path parameter nodes.
     /// @return True if the node has children that are path parameter nodes,
     constexpr bool has_path_parameter_children() const noexcept
@@ -105,22 +184,79 @@ namespace pine
       return children_;
     }
 
+    /// @brief Serve files on GET requests. If the location is a file, the
+    /// route serves it. If it is a directory, the route serves its
+    /// index.html, and a wildcard child named "*file" serves the files below
+    /// it, for instance "/public/css/app.css".
+    /// @param location The file or the directory to serve.
+    /// @return A reference to the node.
     route_node& serve_files(std::filesystem::path&& location);
 
+    /// @brief Limit the rate of the requests to the route. Requests over the
+    /// limit are answered with 429 Too Many Requests before reaching the
+    /// handler. Calling this function again replaces the limit.
+    /// @param options The settings of the limit.
+    /// @return A reference to the node.
+    route_node& limit_rate(const rate_limit_options& options);
+
+    /// @brief Get the rate limiter of the route.
+    /// @return The rate limiter, or nullptr if the route is not limited.
+    pine::rate_limiter* rate_limiter() const noexcept
+    {
+      return rate_limiter_.get();
+    }
+
+    /// @brief Get the latencies of the requests handled by the route, from
+    /// receiving the request to sending its response.
+    /// @return The histogram, or nullptr if the node has no handler.
+    latency_histogram* latency() const noexcept
+    {
+      return latency_.get();
+    }
+
   private:
-    // Optimization: Store the start of path alongside the children for faster
-    // comparison.
-    // Optimization: Maybe make a small cache for the children?
-    // Optimization: Store whether the node is an endpoint or not.
+    /// @brief Number of static children from which they are dispatched by
+    /// their first byte, and searched by bisection rather than scanned.
+    static constexpr size_t first_byte_dispatch_threshold = 8;
+
+    /// @brief A static child and its path, stored side by side so that
+    /// looking up a child only touches contiguous memory.
+    struct child_entry
+    {
+      std::string_view path;
+      route_node* node;
+    };
 
-    std::array<std::unique_ptr<handler_type>, http_method_count> handlers_{};
+    /// @brief Add a static child to the sorted entries and rebuild the first
+    /// byte dispatch table.
+    void index_static_child(route_node& child);
+
+    std::array<handler_type, http_method_count> handlers_{};
+    std::array<async_handler_type, http_method_count> async_handlers_{};
     uint16_t http_method_mask_ = 0;
 
+    std::unique_ptr<pine::rate_limiter> rate_limiter_;
+
+    /// @brief Allocated with the first handler, so that nodes which only
+    /// prefix other routes do not carry one.
+    std::unique_ptr<latency_histogram> latency_;
+
     std::vector<std::unique_ptr<route_node>> children_;
     std::string path_;
 
+    /// @brief The static children, sorted by path.
+    std::vector<child_entry> static_children_;
+
+    /// @brief For each byte, the first entry of static_children_ whose path
+    /// starts with a greater or equal byte. The entries starting with byte b
+    /// are [first_byte_index_[b], first_byte_index_[b + 1]). Empty while the
+    /// node has few static children, which are then scanned.
+    std::vector<uint16_t> first_byte_index_;
+
     bool is_path_parameter_ = false;
+    bool is_wildcard_ = false;
     bool has_path_parameter_children_ = false;
     route_node* path_parameter_child_ = nullptr;
+    route_node* wildcard_child_ = nullptr;
   };
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <format>
+#include <path_params.h>
 #include <string_view>
 #include <vector>
 
@@ -19,6 +21,16 @@ namespace pine
       {
         throw std::format_error("Invalid path");
       }
+
+      if (param_count() > path_params::max_params)
+      {
+        throw std::format_error("Too many path parameters");
+      }
+
+      if (!validate_wildcard(path_))
+      {
+        throw std::format_error("Wildcard before the end of the path");
+      }
     }
 
     /// @brief Get the parts of the path as a range of string views.
@@ -44,6 +56,43 @@ namespace pine
       return parts;
     }
 
+    /// @brief Get the number of path parameters of the path, wildcard
+    /// included.
+    constexpr size_t param_count() const noexcept
+    {
+      size_t count = 0;
+      for (size_t i = 1; i < path_.size(); i++)
+      {
+        if ((path_[i] == ':' || path_[i] == '*') && path_[i - 1] == '/')
+          count++;
+      }
+      return count;
+    }
+
+    /// @brief Get the position of a path parameter in the path, to read it
+    /// with http_request::get_path_param<T, index>() without searching it by
+    /// name. For instance, with
+    /// constexpr route_path route = "/users/:id";
+    /// route.param_index("id") is 0.
+    /// @param name The name of the parameter, without the colon.
+    /// @return The position of the parameter, or path_params::max_params if
+    /// the path has no parameter with this name.
+    constexpr size_t param_index(std::string_view name) const noexcept
+    {
+      size_t index = 0;
+      for (const auto& part : parts())
+      {
+        if (!part.starts_with(':') && !part.starts_with('*'))
+          continue;
+
+        if (part.substr(1) == name)
+          return index;
+
+        index++;
+      }
+      return path_params::max_params;
+    }
+
     /// @brief Validates a path. A path must start with a forward slash and may
     /// contain only the following characters:
     /// 
@@ -55,6 +104,9 @@ namespace pine
     /// 
     /// - Following special characters: - _ . ~ ! $ & ' ( ) * + , ; = : @ /
     /// 
+    /// Parts may not be empty: "//" is invalid, since request paths are
+    /// normalized without them and such a part could never match.
+    /// 
     /// @param path The path to validate.
     /// @return True if the path is valid; false otherwise.
     static constexpr bool validate_path(std::string_view path)
@@ -89,11 +141,27 @@ namespace pine
             path[i] != '@' &&
             path[i] != '/')
           return false;
+
+        if (path[i] == '/' && path[i - 1] == '/')
+          return false;
       }
 
       return true;
     }
 
+    /// @brief Checks that a wildcard, a part starting with a star, is the
+    /// last part of a path.
+    /// @param path The path to check.
+    /// @return True if the path has no wildcard or ends with it.
+    static constexpr bool validate_wildcard(std::string_view path)
+    {
+      size_t wildcard = path.find("/*");
+      if (wildcard == std::string_view::npos)
+        return true;
+
+      return path.find('/', wildcard + 1) == std::string_view::npos;
+    }
+
     /// @brief Get the path as a string view.
     constexpr auto get() const noexcept
     {
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <route_tree.h>
+#include <utility>
+#include <vector>
+
+namespace pine
+{
+  /// @brief Publishes route trees to the requests being served, so that
+  /// routes can be replaced while the server runs.
+  /// @details A published tree is never changed: new routes are built in a
+  /// new tree, which replaces the current one atomically. Requests pin the
+  /// tree they route with, and a replaced tree is destroyed once every
+  /// request that may have pinned it is done.
+  ///
+  /// Reclamation is epoch based. A request pins the global epoch by counting
+  /// itself in one of two reader counts, chosen by the parity of the epoch,
+  /// then reads the current tree. The counts are spread over shards on their
+  /// own cache lines, so pinning takes no lock and threads do not contend.
+  /// The epoch only advances once the readers of the previous epoch are
+  /// gone, so readers are always in the current epoch or the previous one.
+  /// A tree replaced in epoch E is destroyed in epoch E + 2.
+  class route_publisher
+  {
+  public:
+    /// @brief A pinned route tree. The tree, its nodes and the path
+    /// parameters found in it stay valid as long as the guard lives. Guards
+    /// may be released on another thread than the one that took them.
+    class guard
+    {
+    public:
+      guard(guard&& other) noexcept
+        : publisher_(std::exchange(other.publisher_, nullptr)),
+        shard_(other.shard_),
+        parity_(other.parity_),
+        routes_(other.routes_)
+      {}
+
+      guard& operator=(guard&&) = delete;
+
+      ~guard()
+      {
+        if (publisher_)
+          publisher_->unpin(shard_, parity_);
+      }
+
+      /// @brief Get the pinned routes.
+      const route_tree& routes() const noexcept { return *routes_; }
+
+      const route_tree* operator->() const noexcept { return routes_; }
+
+    private:
+      friend class route_publisher;
+
+      guard(const route_publisher* publisher,
+            size_t shard,
+            size_t parity,
+            const route_tree* routes) noexcept
+        : publisher_(publisher),
+        shard_(shard),
+        parity_(parity),
+        routes_(routes)
+      {}
+
+      const route_publisher* publisher_;
+      size_t shard_;
+      size_t parity_;
+      const route_tree* routes_;
+    };
+
+    /// @brief Construct a publisher.
+    /// @param routes The first routes to publish.
+    explicit route_publisher(std::unique_ptr<route_tree> routes
+                             = std::make_unique<route_tree>());
+
+    route_publisher(const route_publisher&) = delete;
+    route_publisher& operator=(const route_publisher&) = delete;
+
+    /// @brief Destroy the published and the replaced trees. No guard may be
+    /// left.
+    ~route_publisher();
+
+    /// @brief Pin the current routes. Takes no lock.
+    /// @return The guard keeping the routes alive.
+    guard pin() const noexcept;
+
+    /// @brief Replace the current routes. Requests pinning the routes from
+    /// now on use the new ones, requests in flight keep the old ones. Never
+    /// waits for the requests in flight, so it may be called from a handler.
+    /// @param routes The new routes. They must not be changed once
+    /// published.
+    void publish(std::unique_ptr<route_tree> routes);
+
+    /// @brief Destroy the replaced trees that no request uses anymore.
+    /// Publishing does it too.
+    void reclaim();
+
+    /// @brief Get the number of replaced trees not destroyed yet.
+    size_t retired_count() const;
+
+    /// @brief Get the current routes, to be changed only while no request
+    /// is served, for instance before the server starts.
+    route_tree& current() noexcept
+    {
+      return *current_.load(std::memory_order_acquire);
+    }
+
+    const route_tree& current() const noexcept
+    {
+      return *current_.load(std::memory_order_acquire);
+    }
+
+  private:
+    /// @brief Number of shards of the reader counts.
+    static constexpr size_t shard_count = 16;
+
+    /// @brief Reader counts of the two live epochs, by parity.
+    struct alignas(64) reader_shard
+    {
+      std::array<std::atomic<uint64_t>, 2> readers{};
+    };
+
+    /// @brief A replaced tree and the epoch it was replaced in.
+    struct retired_routes
+    {
+      std::unique_ptr<route_tree> routes;
+      uint64_t epoch;
+    };
+
+    /// @brief Release a pin taken by pin().
+    void unpin(size_t shard, size_t parity) const noexcept
+    {
+      shards_[shard].readers[parity].fetch_sub(1, std::memory_order_release);
+    }
+
+    /// @brief Advance the epoch if the readers of the previous one are gone.
+    /// The mutex must be held.
+    /// @return True if the epoch advanced.
+    bool try_advance() noexcept;
+
+    /// @brief Destroy the replaced trees whose readers are gone. The mutex
+    /// must be held.
+    void reclaim_locked();
+
+    mutable std::array<reader_shard, shard_count> shards_{};
+    std::atomic<uint64_t> epoch_ = 0;
+    std::atomic<route_tree*> current_;
+
+    /// @brief Serializes the writers: publish and reclaim.
+    mutable std::mutex mutex_;
+    std::vector<retired_routes> retired_;
+  };
+}
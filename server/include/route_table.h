@@ -0,0 +1,403 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <http.h>
+#include <http_request.h>
+#include <http_response.h>
+#include <metrics.h>
+#include <path_params.h>
+#include <route_path.h>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace pine
+{
+  /// @brief A route path usable as a template argument. It is validated like
+  /// a pine::route_path.
+  template <size_t size>
+  struct route_literal
+  {
+    consteval route_literal(const char(&path)[size])
+    {
+      std::copy_n(path, size, value);
+
+      [[maybe_unused]] route_path checked{ std::string_view{ path, size - 1 } };
+    }
+
+    /// @brief Get the path as a string view.
+    constexpr std::string_view get() const noexcept
+    {
+      return { value, size - 1 };
+    }
+
+    char value[size]{};
+  };
+
+  /// @brief A route of a pine::route_table: a path, a method and a
+  /// synchronous handler, all known at compile time.
+  /// @tparam route The path of the route. It may contain path parameters and
+  /// end with a wildcard, like the routes of pine::route_tree.
+  /// @tparam route_method The HTTP method of the route.
+  /// @tparam handler A function, or a lambda without captures, called with
+  /// the request and the response.
+  template <route_literal route, http_method route_method, auto handler>
+    requires std::is_invocable_v<decltype(handler),
+                                 const http_request&,
+                                 http_response&>
+  struct table_route
+  {
+    static constexpr std::string_view path = route.get();
+    static constexpr http_method method = route_method;
+
+    static void handle(const http_request& request, http_response& response)
+    {
+      std::invoke(handler, request, response);
+    }
+  };
+
+  /// @brief The result of routing a request through a pine::route_table.
+  struct route_table_match
+  {
+    /// @brief ok if the route has a handler for the method, not_found if no
+    /// route matches the path, method_not_allowed if the route has no
+    /// handler for the method.
+    http_status status = http_status::not_found;
+
+    /// @brief The handler, if the status is ok.
+    void (*handler)(const http_request&, http_response&) = nullptr;
+
+    /// @brief The latencies of the route, unless the status is not_found.
+    latency_histogram* latency = nullptr;
+  };
+
+  /// @brief A set of routes declared at compile time.
+  /// @details The routes are sorted into a table when the program is
+  /// compiled. Routes without path parameters are found through a perfect
+  /// hash of their path: the path is hashed once, and the hash selects a
+  /// displacement that sends every path of the table to its own slot. Routes
+  /// with path parameters are matched afterwards, segment by segment, in the
+  /// order of declaration. Each handler is called through a single function
+  /// pointer.
+  ///
+  /// Asynchronous handlers are not supported: register them on the route
+  /// tree of the server, which is searched when the table has no route for
+  /// the path or no handler for the method. Each path of the table has its
+  /// own latency histogram, written with the histograms of the route tree.
+  ///
+  /// @code
+  /// using routes = pine::route_table<
+  ///   pine::table_route<"/", pine::http_method::get, &index>,
+  ///   pine::table_route<"/users/:id", pine::http_method::get, &get_user>>;
+  /// server.set_route_table<routes>();
+  /// @endcode
+  template <typename... routes_t>
+  class route_table
+  {
+  public:
+    using handler_type = void (*)(const http_request&, http_response&);
+
+    /// @brief The handlers of a path, indexed by method.
+    struct path_entry
+    {
+      std::string_view path;
+      bool has_params = false;
+      std::array<handler_type, http_method_count> handlers{};
+    };
+
+    static constexpr size_t route_count = sizeof...(routes_t);
+
+    /// @brief Find the handlers of a path.
+    /// @param path The path, starting with a slash.
+    /// @param params The path parameters to fill.
+    /// @return The handlers of the path, or nullptr if no route matches.
+    static constexpr const path_entry* find(std::string_view path,
+                                            path_params& params) noexcept
+    {
+      if (auto entry = find_static(path))
+        return entry;
+
+      return find_with_params(path, params);
+    }
+
+    /// @brief Find the handler of a path and a method.
+    /// @param path The path, starting with a slash.
+    /// @param method The method.
+    /// @return The handler, or nullptr if there is none.
+    static constexpr handler_type find(std::string_view path,
+                                       http_method method) noexcept
+    {
+      auto entry = find_static(path);
+      if (!entry)
+      {
+        path_params params;
+        entry = find_with_params(path, params);
+      }
+
+      return entry ? entry->handlers[http_method_index(method)] : nullptr;
+    }
+
+    /// @brief Route a request and call its handler.
+    /// @param request The request. Its path parameters are set before the
+    /// handler is called.
+    /// @param response The response.
+    /// @return ok if a handler was called, not_found if no route matches the
+    /// path, method_not_allowed if the route has no handler for the method.
+    static http_status dispatch(http_request& request, http_response& response)
+    {
+      auto match = route(request);
+      if (match.handler)
+        match.handler(request, response);
+
+      return match.status;
+    }
+
+    /// @brief Route a request without calling its handler.
+    /// @param request The request. Its path parameters are set if a handler
+    /// is found.
+    /// @return The handler and the latencies of the route.
+    static route_table_match route(http_request& request)
+    {
+      path_params params;
+      auto entry = find(request.get_path(), params);
+      if (!entry)
+        return {};
+
+      auto& latency = latencies_[static_cast<size_t>(entry - table_.paths.data())];
+      auto handler = entry->handlers[http_method_index(request.get_method())];
+      if (!handler)
+        return { http_status::method_not_allowed, nullptr, &latency };
+
+      request.set_path_params(params);
+      return { http_status::ok, handler, &latency };
+    }
+
+    /// @brief Write the latencies of the routes with requests as samples of
+    /// the pine_request_duration_seconds histogram, labelled by route.
+    /// @param output The text to append to, after the histograms of the
+    /// route tree.
+    static void write_metrics(std::string& output)
+    {
+      for (size_t i = 0; i < table_.path_count; i++)
+      {
+        if (latencies_[i].count() > 0)
+          prometheus::write(output, table_.paths[i].path, latencies_[i]);
+      }
+    }
+
+  private:
+    /// @brief Number of first level buckets of the perfect hash.
+    static constexpr size_t bucket_count = route_count > 0 ? route_count : 1;
+
+    /// @brief Number of slots of the perfect hash, a power of two.
+    static constexpr size_t slot_count = std::bit_ceil(2 * bucket_count);
+
+    struct table
+    {
+      std::array<path_entry, bucket_count> paths{};
+      size_t path_count = 0;
+
+      /// @brief Displacement of the slots of each bucket.
+      std::array<uint64_t, bucket_count> displacements{};
+
+      /// @brief Position of the path in paths plus one, or 0 if the slot is
+      /// empty.
+      std::array<uint16_t, slot_count> slots{};
+    };
+
+    /// @brief FNV-1a hash of a path.
+    static constexpr uint64_t hash_path(std::string_view path) noexcept
+    {
+      uint64_t hash = 14695981039346656037ull;
+      for (char c : path)
+      {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+      }
+      return hash;
+    }
+
+    static constexpr size_t bucket_of(uint64_t hash) noexcept
+    {
+      return (hash >> 32) % bucket_count;
+    }
+
+    static constexpr size_t slot_of(uint64_t hash, uint64_t displacement) noexcept
+    {
+      // Finalizer of MurmurHash3, so that each displacement scatters the
+      // paths of a bucket differently.
+      hash += displacement * 0x9e3779b97f4a7c15ull;
+      hash ^= hash >> 33;
+      hash *= 0xff51afd7ed558ccdull;
+      hash ^= hash >> 33;
+      hash *= 0xc4ceb93f53fe1a85ull;
+      hash ^= hash >> 33;
+      return hash & (slot_count - 1);
+    }
+
+    /// @brief Find the handlers of a path through the perfect hash.
+    /// @return The handlers, or nullptr if the path is not a static route.
+    static constexpr const path_entry* find_static(std::string_view path) noexcept
+    {
+      uint64_t hash = hash_path(path);
+      size_t slot = table_.slots[slot_of(hash, table_.displacements[bucket_of(hash)])];
+      if (slot != 0 && table_.paths[slot - 1].path == path)
+        return &table_.paths[slot - 1];
+
+      return nullptr;
+    }
+
+    /// @brief Find the handlers of a path among the routes with path
+    /// parameters, in the order they were declared.
+    /// @return The handlers, or nullptr if none of these routes matches.
+    static constexpr const path_entry* find_with_params(std::string_view path,
+                                                        path_params& params) noexcept
+    {
+      for (size_t i = 0; i < table_.path_count; i++)
+      {
+        const auto& entry = table_.paths[i];
+        if (entry.has_params && match(entry.path, path, params))
+          return &entry;
+
+        params.truncate(0);
+      }
+
+      return nullptr;
+    }
+
+    /// @brief Match a path against a route with path parameters.
+    static constexpr bool match(std::string_view route,
+                                std::string_view path,
+                                path_params& params) noexcept
+    {
+      if (path.empty())
+        return false;
+
+      route.remove_prefix(1);
+      path.remove_prefix(1);
+
+      while (!route.empty())
+      {
+        std::string_view part = route.substr(0, route.find('/'));
+        route.remove_prefix(std::min(part.size() + 1, route.size()));
+
+        if (part.starts_with('*'))
+        {
+          params.set(part.substr(1), path);
+          return true;
+        }
+
+        size_t end = path.find('/');
+        std::string_view segment = path.substr(0, end);
+        path.remove_prefix(end == std::string_view::npos ? path.size() : end + 1);
+
+        if (part.starts_with(':'))
+        {
+          if (segment.empty())
+            return false;
+
+          params.set(part.substr(1), segment);
+        }
+        else if (part != segment)
+          return false;
+      }
+
+      return path.empty();
+    }
+
+    /// @brief Sort the routes into the table and search the displacements
+    /// of the perfect hash.
+    static consteval table build()
+    {
+      table result;
+
+      constexpr std::array<std::string_view, route_count> paths{ routes_t::path... };
+      constexpr std::array<http_method, route_count> methods{ routes_t::method... };
+      constexpr std::array<handler_type, route_count> handlers{ &routes_t::handle... };
+
+      for (size_t i = 0; i < route_count; i++)
+      {
+        size_t index = 0;
+        while (index < result.path_count && result.paths[index].path != paths[i])
+          index++;
+
+        auto& entry = result.paths[index];
+        if (index == result.path_count)
+        {
+          entry.path = paths[i];
+          entry.has_params = paths[i].find("/:") != std::string_view::npos
+            || paths[i].find("/*") != std::string_view::npos;
+          result.path_count++;
+        }
+
+        auto& handler = entry.handlers[http_method_index(methods[i])];
+        if (handler)
+          throw std::format_error("Duplicate route");
+
+        handler = handlers[i];
+      }
+
+      // Place the largest buckets first, while most slots are free.
+      std::array<size_t, bucket_count> bucket_sizes{};
+      for (size_t i = 0; i < result.path_count; i++)
+      {
+        if (!result.paths[i].has_params)
+          bucket_sizes[bucket_of(hash_path(result.paths[i].path))]++;
+      }
+
+      for (size_t size = result.path_count; size > 0; size--)
+      {
+        for (size_t bucket = 0; bucket < bucket_count; bucket++)
+        {
+          if (bucket_sizes[bucket] == size)
+            place_bucket(result, bucket);
+        }
+      }
+
+      return result;
+    }
+
+    /// @brief Find a displacement sending every static path of a bucket to a
+    /// free slot.
+    static consteval void place_bucket(table& result, size_t bucket)
+    {
+      for (uint64_t displacement = 0; displacement < 1 << 20; displacement++)
+      {
+        auto slots = result.slots;
+        bool placed = true;
+
+        for (size_t i = 0; i < result.path_count && placed; i++)
+        {
+          const auto& entry = result.paths[i];
+          uint64_t hash = hash_path(entry.path);
+          if (entry.has_params || bucket_of(hash) != bucket)
+            continue;
+
+          auto& slot = slots[slot_of(hash, displacement)];
+          placed = slot == 0;
+          slot = static_cast<uint16_t>(i + 1);
+        }
+
+        if (placed)
+        {
+          result.slots = slots;
+          result.displacements[bucket] = displacement;
+          return;
+        }
+      }
+
+      throw std::format_error("No perfect hash for the routes");
+    }
+
+    static constexpr table table_ = build();
+
+    /// @brief The latencies of the requests of each path of the table.
+    static inline std::array<latency_histogram, bucket_count> latencies_{};
+  };
+}
@@ -1,25 +1,52 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <http.h>
 #include <http_request.h>
 #include <http_response.h>
 #include <memory>
+#include <path_params.h>
 #include <route_node.h>
 #include <route_path.h>
 #include <string_view>
-#include <unordered_map>
+#include <tuple>
 #include <utility>
 
 namespace pine
 {
+  /// @brief Hits and misses of the route cache of a tree.
+  struct route_cache_stats
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    /// @brief Get the share of the lookups answered by the cache.
+    double hit_rate() const noexcept;
+  };
+
   /// @brief A tree that represents routes.
   class route_tree
   {
   public:
+    /// @brief Number of entries of the route cache of each thread.
+    static constexpr size_t cache_size = 64;
+
+    /// @brief Longest path kept in the route cache.
+    static constexpr size_t cache_max_path = 64;
+
+    /// @brief Number of sets of counters of the route cache, shared by the
+    /// threads.
+    static constexpr size_t cache_counter_count = 16;
+
     /// @brief The type of the handler function.
-    using handler_type =
-      std::function<void(const http_request&, http_response&)>;
+    using handler_type = route_node::handler_type;
+
+    /// @brief The type of the asynchronous handler function.
+    using async_handler_type = route_node::async_handler_type;
 
     route_tree() = default;
 
@@ -46,22 +73,57 @@ namespace pine
 
     /// @brief Finds a route in the tree and gathers the path parameters.
     /// @param path The path to search for.
-    /// @param method The HTTP method to search for.
     /// @return A tuple with a reference to the route node if found, a boolean
-    /// indicating if the route was found, and a map with the path parameters.
-    /// reference to the node.
-    std::tuple<const route_node&,
-      bool, 
-      std::unordered_map<std::string, std::string_view>>
+    /// indicating if the route was found, and the path parameters. Their
+    /// names refer to the nodes of the tree and their values to the path.
+    std::tuple<const route_node&, bool, path_params>
       find_route_with_params(std::string_view path) const;
 
+    /// @brief Enable or disable the route cache. When enabled, each thread
+    /// remembers the routes it found for the paths it looks up most, with
+    /// the positions of their path parameters, so that the few paths making
+    /// most of the traffic skip the walk down the tree. Paths longer than cache_max_path
+    /// and unknown paths are not cached.
+    /// @param enabled Whether to cache the routes found.
+    void enable_cache(bool enabled) noexcept;
+
+    /// @brief Forget the routes cached by every thread. Adding a route does
+    /// it already; call it after changing the nodes of the tree directly,
+    /// for instance after adding handlers.
+    void invalidate_cache() noexcept;
+
+    /// @brief Get the hits and misses of the route cache, summed over the
+    /// threads.
+    route_cache_stats cache_stats() const noexcept;
+
     /// @brief Gets the root node of the tree.
     /// @return A reference to the root node.
     route_node& root() noexcept { return *root_; }
+    const route_node& root() const noexcept { return *root_; }
 
     static route_node unknown_route;
 
   private:
+    /// @brief Gets a new generation of the route cache.
+    static uint64_t new_generation() noexcept;
+
+    /// @brief Finds a route in the tree without the cache.
+    std::tuple<const route_node&, bool, path_params>
+      lookup(std::string_view path) const;
+
+    /// @brief Matches a path against the subtree of a node in a single pass.
+    /// At each segment, the static child takes precedence over the path
+    /// parameter child. When the path leads nowhere, or to a node without
+    /// handlers, the deepest wildcard passed on the way matches the rest of
+    /// the path: the longest prefix wins.
+    /// @param node The node to start from.
+    /// @param path The rest of the path, without its leading slash.
+    /// @param params The path parameters to fill, or nullptr.
+    /// @return The node of the route, or nullptr if no route matches.
+    static const route_node* match(const route_node& node,
+                                   std::string_view path,
+                                   path_params* params);
+
     /// @brief Gets the deepest node in the tree that matches the path.
     /// @param path The path to search for.
     /// @return A tuple with a boolean indicating if the node was found, a
@@ -72,5 +134,21 @@ namespace pine
       get_deepest_node(std::string_view path) const;
 
     std::unique_ptr<route_node> root_ = std::make_unique<route_node>("/");
+
+    /// @brief Hits and misses of the route cache, on their own cache lines
+    /// so that threads counting on different sets do not contend.
+    struct alignas(64) cache_counter
+    {
+      mutable std::atomic<uint64_t> hits = 0;
+      mutable std::atomic<uint64_t> misses = 0;
+    };
+
+    bool cache_enabled_ = false;
+
+    /// @brief Generation of the routes. Cached routes of other generations
+    /// are ignored.
+    std::atomic<uint64_t> generation_ = new_generation();
+
+    std::array<cache_counter, cache_counter_count> cache_counters_{};
   };
 }
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <WinSock2.h>
+#include <access_log.h>
+#include <atomic>
+#include <chrono>
+#include <concurrency_limiter.h>
+#include <connection_slab.h>
 #include <coroutine.h>
 #include <cstdint>
 #include <error.h>
@@ -13,12 +18,21 @@
 #include <initializer_list>
 #include <iocp.h>
 #include <memory>
+#include <metrics.h>
+#include <optional>
+#include <rate_limiter.h>
 #include <route_node.h>
 #include <route_path.h>
+#include <route_publisher.h>
+#include <route_table.h>
 #include <route_tree.h>
-#include <shared_mutex>
+#include <server_options.h>
+#include <string>
 #include <string_view>
+#include <task.h>
 #include <thread>
+#include <topology.h>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 #include <ws2def.h>
@@ -26,21 +40,25 @@
 namespace pine
 {
   class iocp_operation_data;
-  template <size_t buffer_size>
   class server_connection;
 
   /// @brief A server that accepts connections from clients.
   class server
   {
-    template <size_t buffer_size>
     friend class server_connection;
     friend class iocp_context;
 
   public:
     using callback_function = std::function<void(const http_request&, http_response&)>;
+    using async_callback_function = std::function<task<void>(const http_request&, http_response&)>;
 
-    /// @brief Construct a server with the given asio context and port.
-    explicit server(const char* port = "80");
+    /// @brief Construct a server with the given port and options.
+    /// @param port The port to listen on.
+    /// @param options The options of the server.
+    explicit server(const char* port = "80",
+                    const server_options& options = {});
+
+    ~server();
 
     /// @brief Start listening for connections.
     std::expected<void, pine::error> start();
@@ -48,24 +66,80 @@ namespace pine
     /// @brief Stop listening for connections.
     void stop();
 
-    /// @brief Disconnect a client.
+    /// @brief Disconnect a client. The client is removed from the server
+    /// once its pending operations have completed.
     /// @param client_id Id of the client to disconnect.
-    /// @return An asynchronous task completed when the client has been
-    /// disconnected.
-    async_operation<void> remove_client(uint64_t const& client_id);
+    /// @return An error if the client was not found.
+    std::expected<void, pine::error> remove_client(uint64_t client_id);
 
-    /// @brief Add a route to the server.
+    /// @brief Add a route to the server. The handler is copied into the
+    /// route for each method. Routes added this way change the current
+    /// routes in place, so they must be added before the server starts;
+    /// replace the routes with publish_routes afterwards.
     /// @param path The HTTP path to match in order to call the handler.
     /// @param methods The HTTP methods to match in order to call the handler.
     /// @param handler The function to call when the route is requested.
     /// The second parameter of the handler represents the response to send
     /// to the client.
     /// @return A reference to the created route.
+    template <typename handler_t>
+      requires std::is_invocable_v<handler_t&,
+                                   const http_request&, http_response&> &&
+               std::is_void_v<std::invoke_result_t<handler_t&,
+                                                   const http_request&,
+                                                   http_response&>>
+    route_node&
+      add_route(route_path path,
+                const handler_t& handler,
+                const std::initializer_list<pine::http_method>& methods
+                = { http_method::get })
+    {
+      auto& new_route = add_route_node(path, "route");
+      for (const auto& method : methods)
+        new_route.add_handler(method, route_node::handler_type{ handler });
+
+      routes_.current().invalidate_cache();
+      return new_route;
+    }
+
+    /// @brief Add a route with an asynchronous handler to the server. The
+    /// handler returns a task and may suspend, for instance while waiting for
+    /// a database or a downstream service, without holding an I/O thread.
+    /// 
+    /// The handler either fills the response passed as second parameter
+    /// (pine::task<void>), or takes only the request and returns the response
+    /// (pine::task<pine::http_response>).
+    /// @param path The HTTP path to match in order to call the handler.
+    /// @param handler The coroutine to call when the route is requested.
+    /// @param methods The HTTP methods to match in order to call the handler.
+    /// @return A reference to the created route.
+    template <typename handler_t>
+      requires std::is_invocable_r_v<task<void>, handler_t&,
+                                     const http_request&, http_response&> ||
+               std::is_invocable_r_v<task<http_response>, handler_t&,
+                                     const http_request&>
     route_node&
       add_route(route_path path,
-                const callback_function& handler,
+                handler_t&& handler,
                 const std::initializer_list<pine::http_method>& methods
-                = { http_method::get });
+                = { http_method::get })
+    {
+      if constexpr (std::is_invocable_r_v<task<void>, handler_t&,
+                                          const http_request&, http_response&>)
+        return add_async_route(path,
+                               std::forward<handler_t>(handler),
+                               methods);
+      else
+        return add_async_route(
+          path,
+          [handler = std::forward<handler_t>(handler)](
+            const http_request& request,
+            http_response& response) -> task<void>
+          {
+            response = co_await handler(request);
+          },
+          methods);
+    }
 
     /// @brief Add a static route to the server. The route will serve files from
     /// the specified directory, or the specified file.
@@ -75,21 +149,91 @@ namespace pine
     route_node& add_static_route(route_path path,
                                  std::filesystem::path&& location);
 
+    /// @brief Route requests through a table of routes declared at compile
+    /// time. The table is searched before the routes added at runtime, which
+    /// handle the paths it does not know and the methods it has no handler
+    /// for, such as asynchronous handlers. The latencies of the table routes
+    /// are part of the metrics.
+    /// @tparam table_t A pine::route_table.
+    template <typename table_t>
+    void set_route_table() noexcept
+    {
+      route_table_ = &table_t::route;
+      route_table_metrics_ = &table_t::write_metrics;
+    }
+
     /// @brief Add an error handler to the server. The handler will be called
     /// when the server encounters a certain error.
     /// @param status The status to match.
     /// @param handler The function to call.
     void add_error_handler(http_status status, callback_function&& handler);
 
+    /// @brief Set the timeouts applied to the connections accepted from now on.
+    /// @param timeouts The timeouts.
+    void set_timeouts(const connection_timeouts& timeouts)
+    {
+      options_.timeouts = timeouts;
+    }
+
+    /// @brief Get the timeouts applied to the connections.
+    const connection_timeouts& get_timeouts() const noexcept
+    {
+      return options_.timeouts;
+    }
+
+    /// @brief Get the options of the server.
+    const server_options& get_options() const noexcept
+    {
+      return options_;
+    }
+
+    /// @brief Replace the routes while the server runs, without stopping
+    /// it. Requests in flight finish with the routes they started with, which
+    /// are destroyed once they are done. Build the new routes with
+    /// route_tree::add_route and route_node::add_handler.
+    /// @param routes The new routes.
+    void publish_routes(std::unique_ptr<route_tree> routes);
+
     /// @brief Get a route by path and method.
     /// @return If the route was found, a shared pointer to the route.
-    /// If the route was not found, an error code.
+    /// If the route was not found, an error code. The route is valid until
+    /// the routes are replaced.
     const route_node&
       get_route(std::string_view path) const;
 
-  private:
-    static constexpr size_t buffer_size = 64 * 1024;
+    /// @brief Get the hits and misses of the route cache of the current
+    /// routes, enabled with pine::server_options::route_cache.
+    route_cache_stats get_route_cache_stats() const noexcept
+    {
+      return routes_.current().cache_stats();
+    }
+
+    /// @brief Get the counters of the server, summed over the threads.
+    server_metrics_snapshot get_metrics() const noexcept
+    {
+      return metrics_.snapshot();
+    }
+
+    /// @brief Render the counters of the server and the latencies of its
+    /// routes in the Prometheus text format.
+    /// @return The metrics.
+    std::string render_metrics() const;
+
+    /// @brief Add a route answering GET requests with the metrics of the
+    /// server, in the Prometheus text format, for a Prometheus server to
+    /// scrape.
+    /// @param path The path of the route.
+    /// @return A reference to the created route.
+    route_node& add_metrics_route(route_path path = "/metrics");
+
+    /// @brief Get the number of access log records that could not be
+    /// written, 0 if the access log is disabled.
+    uint64_t get_access_log_dropped() const noexcept
+    {
+      return access_log_ ? access_log_->dropped() : 0;
+    }
 
+  private:
     /// @brief Accept clients.
     /// This function waits for clients to connect and creates a server
     /// connection for each client.
@@ -97,14 +241,109 @@ namespace pine
     /// listening.
     std::expected<void, pine::error> accept_clients();
 
-    iocp_context iocp_;
+    /// @brief A completion port, its worker threads, and the connections
+    /// they serve. Timers and coroutine frames are per loop too: the timer
+    /// wheel belongs to the completion port and frames are recycled per
+    /// thread.
+    struct event_loop
+    {
+      /// @param options The options of the server.
+      /// @param first_id The first slot index of the connections of the loop,
+      /// so that ids are unique across loops.
+      /// @param node The NUMA node to allocate the connections on.
+      event_loop(const server_options& options, size_t first_id, uint32_t node);
+
+      iocp_context iocp;
+
+      /// @brief Memory of the connections, of their read buffers and of their
+      /// request arenas, on the node of the loop. Declared before the slab,
+      /// which gives its connections back to them.
+      node_pool connections;
+      node_pool read_buffers;
+      node_pool arenas;
+
+      /// @brief The connections, indexed by the id carried by their
+      /// operations.
+      connection_slab<server_connection> clients;
+    };
+
+    /// @brief Create the event loops and start their worker threads.
+    void start_event_loops();
+
+    /// @brief Create an event loop and register the completion handlers.
+    /// @param node The NUMA node of the loop.
+    /// @return The loop. Its worker threads are not started.
+    event_loop& add_event_loop(uint32_t node);
+
+    /// @brief Destroy a client once it is closed and its last reference has
+    /// been released.
+    /// @param loop The event loop of the client.
+    /// @param client_id Id of the client.
+    void release_client(event_loop& loop, uint64_t client_id);
+
+    /// @brief Register an asynchronous handler for the given methods.
+    template <typename handler_t>
+    route_node& add_async_route(route_path path,
+                                const handler_t& handler,
+                                const std::initializer_list<pine::http_method>& methods)
+    {
+      auto& new_route = add_route_node(path, "asynchronous route");
+      for (const auto& method : methods)
+        new_route.add_handler(method, route_node::async_handler_type{ handler });
+
+      routes_.current().invalidate_cache();
+      return new_route;
+    }
+
+    /// @brief Add the node of a route to the route tree.
+    /// @param path The path of the route.
+    /// @param kind The kind of the route, for the logs.
+    /// @return The node of the route.
+    route_node& add_route_node(route_path path, std::string_view kind);
 
-    std::shared_mutex clients_mutex_;
+    /// @brief The access log, when enabled in the options. Declared before
+    /// the event loops, so that it outlives their worker threads.
+    std::optional<pine::access_log> access_log_;
+
+    /// @brief The event loops. The first one accepts the connections.
+    std::vector<std::unique_ptr<event_loop>> loops_;
+
+    /// @brief Round robin counter choosing the loop of the next connection.
+    std::atomic<size_t> next_loop_ = 0;
 
-    std::unordered_map<uint64_t, std::shared_ptr<server_connection<buffer_size>>> clients;
     std::unordered_map<http_status, callback_function> error_handlers;
 
-    route_tree routes;
+    /// @brief The routes, replaced by publish_routes while requests are
+    /// served.
+    route_publisher routes_;
+
+    /// @brief Counters of the requests, connections and responses.
+    server_metrics metrics_;
+
+    /// @brief Times of the phases of the requests, only allocated when
+    /// built with PINE_TRACING.
+    std::unique_ptr<phase_histograms> phases_;
+
+    /// @brief Routing function of the route table, if one is set.
+    route_table_match (*route_table_)(http_request&) = nullptr;
+
+    /// @brief Writes the latencies of the route table, if one is set.
+    void (*route_table_metrics_)(std::string&) = nullptr;
+
+    server_options options_;
+
+    /// @brief Limit on the requests handled at the same time, when enabled
+    /// in the options.
+    std::optional<concurrency_limiter> limiter_;
+
+    /// @brief Limit on the rate of the requests of each client, when enabled
+    /// in the options.
+    std::optional<rate_limiter> rate_limiter_;
+
+    /// @brief The 503 response sent to shed requests, over the concurrency
+    /// limit or finding the thread pool full. Rendered once so that shedding
+    /// costs nothing but a write.
+    std::string shed_response_;
 
     const char* port;
   #ifdef _WIN32
@@ -122,9 +361,9 @@ namespace pine
     void on_accept(const iocp_operation_data*);
 
     /// @brief Handle a read operation.
-    void on_read(const iocp_operation_data*);
+    void on_read(event_loop& loop, const iocp_operation_data*);
 
     /// @brief Handle a write operation.
-    void on_write(const iocp_operation_data*);
+    void on_write(event_loop& loop, const iocp_operation_data*);
   };
 }
\ No newline at end of file
@@ -1,31 +1,90 @@
 #pragma once
 
+#include <access_log.h>
 #include <atomic>
+#include <cassert>
+#include <chrono>
+#include <concurrency_limiter.h>
 #include <connection.h>
+#include <cstddef>
+#include <cstring>
 #include <http_request.h>
 #include <http_response.h>
+#include <log_sink.h>
 #include <memory>
+#include <memory_resource>
+#include <metrics.h>
+#include <rate_limiter.h>
+#include <request_arena.h>
+#include <request_trace.h>
+#include <route_node.h>
+#include <server.h>
+#include <string_view>
+#include <task.h>
+#include <thread_pool.h>
+#include <timer_wheel.h>
+#include <topology.h>
 
 namespace pine
 {
-  class server;
-
   /// @brief A connection to a client.
-  template <size_t buffer_size>
+  /// @details Connections, their read buffers and their request arenas are
+  /// allocated from the node_pools of their event loop, so they live on the
+  /// NUMA node of the loop. The request, the response and its rendering are
+  /// allocated from the request arena.
   class server_connection
-    : public connection<buffer_size>,
-    public std::enable_shared_from_this<server_connection<buffer_size>>
+    : public connection,
+    public node_allocated
   {
     friend class server;
 
   public:
     /// @brief Construct a server connection with the given socket and server.
-    explicit server_connection(SOCKET socket, pine::server& server)
-      : connection<buffer_size>(socket, server.iocp_),
-      server(server)
+    /// @param socket The socket of the connection.
+    /// @param server The server that accepted the connection.
+    /// @param loop The event loop serving the connection. The socket must be
+    /// associated with its completion port.
+    explicit server_connection(SOCKET socket,
+                               pine::server& server,
+                               pine::server::event_loop& loop)
+      : connection(socket,
+                   loop.iocp,
+                   { static_cast<char*>(loop.read_buffers.allocate()),
+                     loop.read_buffers.block_size() },
+                   server.options_.get_message_limits()),
+      server(server),
+      loop_(loop),
+      arena_block_(static_cast<std::byte*>(loop.arenas.allocate()),
+                   node_pool::deleter{ &loop.arenas }),
+      arena_({ arena_block_.get(), loop.arenas.block_size() }),
+      request_(arena_.resource()),
+      response_(arena_.resource()),
+      raw_response_(arena_.resource())
     {}
 
-    /// @brief Close the connection and remove it from the server.
+    ~server_connection() override
+    {
+      loop_.read_buffers.deallocate(get_read_buffer().data());
+    }
+
+    /// @brief Start enforcing the timeouts of the server on the connection.
+    void start_timeouts()
+    {
+      // The timer is cancelled before the connection releases its own
+      // reference and when it is destroyed, so the callback never outlives
+      // the connection.
+      timeout_timer_.set_callback(
+        [this]
+        {
+          PINE_LOG(debug, "Connection %zu timed out", this->get_socket());
+          close();
+        });
+
+      arm_timeout(server.options_.timeouts.header_read);
+    }
+
+    /// @brief Close the connection. It is removed from the server once its
+    /// pending operations have completed.
     void close() override
     {
       if (pending_close.exchange(true))
@@ -33,13 +92,23 @@ namespace pine
         return;
       }
 
-      std::lock_guard write_lock{ this->write_mutex };
-      std::lock_guard read_lock{ this->read_mutex };
+      {
+        std::lock_guard write_lock{ this->write_mutex };
+        std::lock_guard read_lock{ this->read_mutex };
+
+        loop_.iocp.timers().cancel(timeout_timer_);
+
+        connection::close();
+      }
 
-      connection<buffer_size>::close();
+      // A request closed before its response, for instance by a timeout,
+      // counts as overload.
+      if (admitted_.exchange(false))
+        server.limiter_->release_dropped();
 
-      auto self = server_connection<buffer_size>::shared_from_this();
-      server.remove_client(connection<buffer_size>::get_socket());
+      // Release the reference held while the connection was open. This may
+      // destroy the connection.
+      this->release();
     }
 
     /// @brief Handle an error. This function will modify the response to
@@ -59,62 +128,204 @@ namespace pine
       handler(request, response);
     }
 
-    /// @brief Handle a request. This function will route the request to the
-    /// appropriate handler and send the response.
-    /// @param request The request to handle.
-    void handle_request(http_request& request)
+    /// @brief Handle the current request. This function will route the
+    /// request to the appropriate handler and send the response. Asynchronous
+    /// handlers are started here and send the response once they complete.
+    void handle_request()
     {
-      const std::string_view& path = request.get_uri();
+      // Keep alive is not supported yet.
+      response_.set_header("Connection", "close");
 
-      const auto& [route, found, params] =
-        server.routes.find_route_with_params(path);
+      // The latencies of the table route of the path, when the table has
+      // no handler for the method and the route tree may have one.
+      latency_histogram* table_latency = nullptr;
 
-      http_response response;
-      // Keep alive is not supported yet.
-      response.set_header("Connection", "close");
+      if (server.route_table_)
+      {
+        auto match = server.route_table_(request_);
+        if (match.handler)
+        {
+          latency_ = match.latency;
+          trace().mark(trace_phase::route_found);
+
+          arm_timeout(server.options_.timeouts.handler);
+
+          trace().mark(trace_phase::handler_started);
+          match.handler(request_, response_);
+          trace().mark(trace_phase::handler_ended);
+
+          send_response(response_);
+          return;
+        }
+
+        table_latency = match.latency;
+      }
+
+      const std::string_view& path = request_.get_path();
+
+      // The routes may be replaced meanwhile: keep these ones until the
+      // handler is done.
+      auto routes = server.routes_.pin();
+      const auto& [route, found, params] =
+        routes->find_route_with_params(path);
 
       if (!found)
-        handle_error(http_status::not_found, request, response);
-      else if (route.handlers()[static_cast<size_t>(request.get_method())] == nullptr)
-        handle_error(http_status::method_not_allowed, request, response);
+      {
+        // The table has the path, but no handler for the method.
+        handle_error(table_latency ? http_status::method_not_allowed
+                                   : http_status::not_found,
+                     request_, response_);
+      }
+      else if (!route.has_handler(request_.get_method()))
+        handle_error(http_status::method_not_allowed, request_, response_);
+      else if (auto limiter = route.rate_limiter();
+               limiter && !check_rate(*limiter))
+        return;
       else
       {
-        for (const auto& [name, value] : params)
-          request.add_path_param(name, value);
-        route.handle(request, response);
+        request_.set_path_params(params);
+
+        // The latencies of a path of the table are counted by the table,
+        // whichever handles the method.
+        latency_ = table_latency ? table_latency : route.latency();
+        trace().mark(trace_phase::route_found);
+
+        arm_timeout(server.options_.timeouts.handler);
+
+        trace().mark(trace_phase::handler_started);
+        if (route.is_async(request_.get_method()))
+        {
+          this->retain();
+          start_detached(handle_async_request(route, std::move(routes)));
+          return;
+        }
+
+        route.handle(request_, response_);
+        trace().mark(trace_phase::handler_ended);
       }
 
-      send_response(response);
+      send_response(response_);
+    }
+
+    /// @brief Run an asynchronous handler and send its response. The caller
+    /// takes a reference on the connection, which the task releases once the
+    /// response has been posted.
+    /// @param route The route of the request.
+    /// @param routes The routes the route was found in, kept until the
+    /// handler is done.
+    /// @return A task completed when the response has been posted.
+    task<void> handle_async_request(const route_node& route,
+                                    [[maybe_unused]] route_publisher::guard routes)
+    {
+      bool overloaded = false;
+      try
+      {
+        co_await route.handle_async(request_, response_);
+      }
+      catch (const thread_pool_full&)
+      {
+        overloaded = true;
+      }
+      catch (...)
+      {
+        response_ = http_response{ arena_.resource() };
+        handle_error(http_status::internal_server_error, request_, response_);
+      }
+
+      trace().mark(trace_phase::handler_ended);
+
+      if (overloaded)
+      {
+        PINE_LOG(debug, "Thread pool full, shedding request of connection %zu",
+                 this->get_socket());
+        send_raw(server.shed_response_, http_status::service_unavailable);
+      }
+      else
+        send_response(response_);
+      this->release();
     }
 
     /// @brief Handle a read operation.
     /// @param data The data to read.
     void on_read(std::string_view message) override
     {
-      auto self = server_connection<buffer_size>::shared_from_this();
-      auto request_result = http_request::parse(message);
+      received_at_ = std::chrono::steady_clock::now();
+      request_size_ = message.size();
+      server.metrics_.add(server_counter::requests);
+      server.metrics_.add(server_counter::bytes_received, message.size());
+
+      // Limits keyed on the address are checked before parsing, limits keyed
+      // on a header once the headers are parsed.
+      auto& rate_limit = server.rate_limiter_;
+      if (rate_limit
+          && rate_limit->options().key == rate_limit_key::remote_address
+          && !check_rate(*rate_limit))
+        return;
+
+      if (!admit())
+      {
+        PINE_LOG(debug, "Shedding request of connection %zu", this->get_socket());
+        send_raw(server.shed_response_, http_status::service_unavailable);
+        return;
+      }
+
+      auto request_result = http_request::parse(message, arena_.resource());
       if (!request_result)
       {
-        http_response response;
-        http_request request;
-        handle_error(http_status::bad_request, request, response);
-        send_response(response);
+        server.metrics_.add(server_counter::parse_errors);
+        handle_error(http_status::bad_request, request_, response_);
+        send_response(response_);
         return;
       }
-      auto&& request = std::move(request_result.value());
-      handle_request(request);
+      request_ = std::move(request_result.value());
+      trace().mark(trace_phase::headers_parsed);
+
+      if (rate_limit
+          && rate_limit->options().key == rate_limit_key::header
+          && !check_rate(*rate_limit))
+        return;
+
+      handle_request();
+    }
+
+    /// @brief Answer a request exceeding the size limits of the server. The
+    /// connection is closed once the response has been sent.
+    /// @param status The status describing the limit.
+    void on_read_error(http_status status) override
+    {
+      received_at_ = std::chrono::steady_clock::now();
+      request_size_ = 0;
+      handle_error(status, request_, response_);
+      send_response(response_);
+    }
+
+    /// @brief Handle a partial read operation: the request is not complete
+    /// yet. Switches from the header timeout to the body timeout once the
+    /// headers are received.
+    /// @param headers_received Whether all the headers have been received.
+    void on_partial_read(bool headers_received) override
+    {
+      if (headers_received && !receiving_body_)
+      {
+        receiving_body_ = true;
+        arm_timeout(server.options_.timeouts.body_read);
+      }
     }
 
     /// @brief Handle a write operation.
     /// @param data The data to write.
     void on_write() override
     {
-      auto self =
-        server_connection<buffer_size>::shared_from_this();
-
       // The response has been sent, so close the connection.
       if (!this->write_pending)
-      close();
+      {
+      #ifdef PINE_TRACING
+        finish_trace();
+      #endif // PINE_TRACING
+
+        reset_request();
+        close();
+      }
     }
 
     /// @brief Send an HTTP response.
@@ -122,18 +333,215 @@ namespace pine
     /// @return An asynchronous task completed when the response has been sent.
     void send_response(http_response const& response)
     {
-      auto self = server_connection<buffer_size>::shared_from_this();
-      std::string response_string = response.to_string();
+      raw_response_ = response.to_string(arena_.resource());
+      send_raw(raw_response_, response.get_status());
+    }
+
+    /// @brief Send a response already rendered, such as the rejections of
+    /// the limiters.
+    /// @param raw_response The response to send. It must stay alive until
+    /// the write completes.
+    /// @param status The status of the response, for the metrics.
+    void send_raw(std::string_view raw_response, http_status status)
+    {
+      // An empty write is never posted, the client would get no response.
+      assert(!raw_response.empty());
+
+      server.metrics_.count_response(status);
+      server.metrics_.add(server_counter::bytes_sent, raw_response.size());
+
+      auto now = std::chrono::steady_clock::now();
+      if (latency_)
+      {
+        latency_->record(now - received_at_);
+        latency_ = nullptr;
+      }
+      if (server.access_log_)
+        log_access(*server.access_log_, raw_response.size(), status, now);
+
+      if (admitted_.exchange(false))
+        server.limiter_->release(concurrency_limiter::clock::now() - admitted_at_);
+
+      arm_timeout(server.options_.timeouts.idle);
       struct linger lo = { 1, 0 };
       setsockopt(this->get_socket(), SOL_SOCKET, SO_LINGER, (char*)&lo, sizeof(lo));
-      connection<buffer_size>::post_write(response_string);
+      post_write(raw_response);
+    }
+
+  protected:
+    /// @brief Remove the connection from the server once it is closed and
+    /// none of its operations is pending.
+    void on_released() override
+    {
+      server.release_client(loop_, this->get_id());
     }
 
   private:
+    /// @brief Write the record of the current request to the access log.
+    /// @param log The access log of the server.
+    /// @param bytes_sent The size of the response.
+    /// @param status The status of the response.
+    /// @param now When the response is sent.
+    void log_access(access_log& log,
+                    size_t bytes_sent,
+                    http_status status,
+                    std::chrono::steady_clock::time_point now) noexcept
+    {
+      const auto& peer = get_peer_address();
+
+      access_record record;
+      record.time = log.to_record_time(received_at_);
+      record.latency = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now - received_at_).count());
+      record.bytes_received = request_size_;
+      record.bytes_sent = bytes_sent;
+      std::memcpy(record.peer_address.data(), &peer.sin_addr,
+                  record.peer_address.size());
+      record.peer_port = ntohs(peer.sin_port);
+      record.status = static_cast<uint16_t>(status);
+
+      // Requests answered before being parsed have no path.
+      auto path = request_.get_path();
+      if (!path.empty())
+        record.method = static_cast<uint8_t>(request_.get_method());
+      record.set_path(path);
+
+      log.write(record);
+    }
+
+    /// @brief Drop the request and the response once the response has been
+    /// sent, and reset the arena they were allocated from. They are destroyed
+    /// before the reset and rebuilt on the empty arena.
+    void reset_request() noexcept
+    {
+      std::destroy_at(&raw_response_);
+      std::destroy_at(&response_);
+      std::destroy_at(&request_);
+
+      arena_.reset();
+
+      std::construct_at(&request_, arena_.resource());
+      std::construct_at(&response_, arena_.resource());
+      std::construct_at(&raw_response_, arena_.resource());
+    }
+
+  #ifdef PINE_TRACING
+    /// @brief Add the phases of the request just answered to the metrics of
+    /// the server, log them if the request was slow, and start a new trace.
+    void finish_trace()
+    {
+      server.phases_->record(trace());
+
+      auto threshold = server.options_.slow_request_threshold;
+      if (threshold.count() > 0 && trace().total() >= threshold)
+        PINE_LOG(warning, "Slow request on connection %zu: %s",
+                 this->get_socket(), trace().to_string().c_str());
+
+      trace().reset();
+    }
+  #endif // PINE_TRACING
+
+    /// @brief Ask the concurrency limiter of the server to admit the request
+    /// just received.
+    /// @return True if the request may be handled, false if it must be shed.
+    bool admit()
+    {
+      if (!server.limiter_)
+        return true;
+
+      if (!server.limiter_->try_acquire())
+        return false;
+
+      admitted_at_ = concurrency_limiter::clock::now();
+      admitted_ = true;
+      return true;
+    }
+
+    /// @brief Take a token from a rate limiter for the current request, and
+    /// send its rejection if there is none left. Limiters keyed on a header
+    /// need the request to be parsed.
+    /// @param limiter The rate limiter.
+    /// @return True if the request may go on.
+    bool check_rate(rate_limiter& limiter)
+    {
+      const auto& options = limiter.options();
+      uint64_t key = options.key == rate_limit_key::remote_address
+        ? rate_limiter::key_of(
+          static_cast<uint32_t>(get_peer_address().sin_addr.s_addr))
+        : rate_limiter::key_of(request_.get_header(options.header));
+
+      if (limiter.try_acquire(key))
+        return true;
+
+      PINE_LOG(debug, "Rate limiting request of connection %zu", this->get_socket());
+      send_raw(limiter.rejection(), http_status::too_many_requests);
+      return false;
+    }
+
+    /// @brief Arm the timeout timer of the connection, replacing the previous
+    /// timeout.
+    /// @param timeout The timeout. Zero disables the timeout.
+    void arm_timeout(std::chrono::milliseconds timeout)
+    {
+      if (this->is_closed)
+        return;
+
+      if (timeout.count() > 0)
+        loop_.iocp.timers().arm(timeout_timer_, timeout);
+      else
+        loop_.iocp.timers().cancel(timeout_timer_);
+    }
+
     /// @brief The server that the connection is connected to.
     server& server;
 
+    /// @brief The event loop serving the connection.
+    pine::server::event_loop& loop_;
+
     /// @brief Whether the connection is pending close.
     std::atomic_bool pending_close = false;
+
+    /// @brief The block of the request arena. Declared before the objects
+    /// allocated from it, so it is given back to the loop after them.
+    std::unique_ptr<std::byte, node_pool::deleter> arena_block_;
+
+    /// @brief Memory of the current request, reset once its response has
+    /// been sent.
+    request_arena arena_;
+
+    /// @brief The request being handled. Path parameters and asynchronous
+    /// handlers refer to it, so it lives as long as the connection.
+    http_request request_;
+
+    /// @brief The response to the current request.
+    http_response response_;
+
+    /// @brief The rendering of the response, kept until it has been written.
+    std::pmr::string raw_response_;
+
+    /// @brief Whether the current request holds a slot of the concurrency
+    /// limiter, released once its response is sent.
+    std::atomic_bool admitted_ = false;
+
+    /// @brief When the current request was admitted.
+    concurrency_limiter::clock::time_point admitted_at_;
+
+    /// @brief When the current request was received.
+    std::chrono::steady_clock::time_point received_at_;
+
+    /// @brief The size of the current request, for the access log.
+    size_t request_size_ = 0;
+
+    /// @brief The latencies of the route of the current request, once its
+    /// handler is called. Its routes are pinned until the response is sent.
+    latency_histogram* latency_ = nullptr;
+
+    /// @brief Whether the headers of the current request have been received.
+    bool receiving_body_ = false;
+
+    /// @brief Timer closing the connection when the current phase of the
+    /// request takes too long.
+    timer timeout_timer_;
   };
 }
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <access_log.h>
+#include <chrono>
+#include <concurrency_limiter.h>
+#include <connection.h>
+#include <cstddef>
+#include <optional>
+#include <rate_limiter.h>
+#include <topology.h>
+#include <vector>
+
+namespace pine
+{
+  /// @brief Timeouts applied to every connection. A zero duration disables
+  /// the timeout.
+  struct connection_timeouts
+  {
+    /// @brief Time allowed between accepting the connection and receiving
+    /// the last header of the request. Protects against clients that never
+    /// send anything and against slowloris attacks.
+    std::chrono::milliseconds header_read{ 10'000 };
+
+    /// @brief Time allowed to receive the body once the headers are received.
+    std::chrono::milliseconds body_read{ 30'000 };
+
+    /// @brief Time a connection may stay idle once the response has been
+    /// handed to the socket, for instance because the client does not read it.
+    std::chrono::milliseconds idle{ 60'000 };
+
+    /// @brief Time allowed to the handler to produce the response.
+    std::chrono::milliseconds handler{ 30'000 };
+  };
+
+  /// @brief How the server spreads its connections over worker threads.
+  enum class server_mode
+  {
+    /// @brief Every worker thread waits on the same completion port and may
+    /// handle any connection.
+    shared,
+
+    /// @brief One event loop per processor, each with a single worker thread
+    /// pinned to its processor. A connection is handed to one loop when it is
+    /// accepted and stays there, so the loops share nothing on the request
+    /// path.
+    thread_per_core
+  };
+
+  /// @brief Options of a server. The defaults suit a small server; tune them
+  /// per deployment.
+  struct server_options
+  {
+    /// @brief How connections are spread over worker threads.
+    server_mode mode = server_mode::shared;
+
+    /// @brief In shared mode, the number of threads waiting on the completion
+    /// port, 0 for twice the number of processors. In thread per core mode,
+    /// the number of event loops, 0 for one per processor of the affinity.
+    size_t worker_threads = 0;
+
+    /// @brief The processors the worker threads run on.
+    /// @details Worker threads are pinned to the processors in turn, and the
+    /// connections of an event loop are allocated on the NUMA node of its
+    /// first processor. List the processors of one node together, for
+    /// instance with the order given by get_processors. When empty, threads
+    /// are not pinned in shared mode and event loops are pinned to every
+    /// processor in thread per core mode.
+    std::vector<processor> affinity;
+
+    /// @brief Number of accept operations kept pending on the listening
+    /// socket. More absorb bursts of new connections better.
+    size_t accept_depth = 10;
+
+    /// @brief Length of the queue of connections waiting to be accepted by
+    /// the system. 0 for the system maximum.
+    int backlog = 0;
+
+    /// @brief Size of the receive buffer of the sockets (SO_RCVBUF). Leave
+    /// empty to keep the system default, which grows automatically.
+    std::optional<int> receive_buffer_size;
+
+    /// @brief Size of the send buffer of the sockets (SO_SNDBUF). Leave empty
+    /// to keep the system default. 0 makes sends complete only once the data
+    /// has been acknowledged, which avoids a copy but adds latency.
+    std::optional<int> send_buffer_size;
+
+    /// @brief Whether to disable Nagle's algorithm (TCP_NODELAY), so
+    /// responses are sent immediately instead of being coalesced.
+    bool no_delay = true;
+
+    /// @brief Maximum size of the request line and headers. Larger requests
+    /// are answered with 431 Request Header Fields Too Large.
+    size_t max_header_size = 16 * 1024;
+
+    /// @brief Maximum size of a request body. Larger requests are answered
+    /// with 413 Payload Too Large. Each connection reserves
+    /// max_header_size + max_body_size bytes to read requests.
+    size_t max_body_size = 48 * 1024;
+
+    /// @brief Size of the block each connection reserves for the memory of
+    /// its requests: headers, path parameters and the response. Requests
+    /// needing more fall back to the global heap.
+    size_t request_arena_size = 8 * 1024;
+
+    /// @brief Maximum number of connections per event loop.
+    size_t max_connections = 16 * 1024;
+
+    /// @brief Timeouts applied to every connection.
+    connection_timeouts timeouts;
+
+    /// @brief Adaptive limit on the requests handled at the same time.
+    /// Requests over the limit are answered with 503 Service Unavailable
+    /// before being parsed. Leave empty to admit every request.
+    std::optional<concurrency_limiter_options> concurrency_limit;
+
+    /// @brief Limit on the rate of the requests of each client, applied to
+    /// every route. Requests over the limit are answered with 429 Too Many
+    /// Requests. Limits per route are set with route_node::limit_rate. Leave
+    /// empty to not limit the rate.
+    std::optional<rate_limit_options> rate_limit;
+
+    /// @brief Whether each thread caches the routes found for the paths it
+    /// looks up most. Helps when a few paths make most of the traffic.
+    /// Hits and misses are given by server::get_route_cache_stats.
+    bool route_cache = false;
+
+    /// @brief Requests taking longer from their accept to the end of their
+    /// write have the times of their phases logged. Zero logs none. Only
+    /// used when built with PINE_TRACING, which also adds the times of the
+    /// phases to the metrics.
+    std::chrono::milliseconds slow_request_threshold{ 0 };
+
+    /// @brief Write a binary record of every request to memory-mapped
+    /// segment files: method, path, status, bytes, latency and client.
+    /// Decode them with the access_log_decode tool. Leave empty to not log
+    /// the requests.
+    std::optional<access_log_options> access_log;
+
+    /// @brief Get the limits on the size of the requests.
+    message_limits get_message_limits() const noexcept
+    {
+      return { max_header_size, max_body_size };
+    }
+  };
+}
@@ -0,0 +1,718 @@
+#include <access_log.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <error.h>
+#include <expected.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <http.h>
+#include <log_sink.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  /// @brief A file mapped in memory for writing.
+  class mapped_file
+  {
+  public:
+    mapped_file() = default;
+
+    mapped_file(mapped_file&& other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      file_(std::exchange(other.file_, invalid_file))
+    #ifdef _WIN32
+      , mapping_(std::exchange(other.mapping_, nullptr))
+    #endif
+    {}
+
+    mapped_file& operator=(mapped_file&& other) noexcept
+    {
+      close(size_);
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+      file_ = std::exchange(other.file_, invalid_file);
+    #ifdef _WIN32
+      mapping_ = std::exchange(other.mapping_, nullptr);
+    #endif
+      return *this;
+    }
+
+    ~mapped_file()
+    {
+      close(size_);
+    }
+
+    /// @brief Create a file, replacing any file of the same name, filled
+    /// with zeros, and map it.
+    /// @param path The path of the file.
+    /// @param size The size of the file.
+    static std::expected<mapped_file, pine::error>
+      create(const std::filesystem::path& path, size_t size)
+    {
+      mapped_file result;
+      result.size_ = size;
+
+    #ifdef _WIN32
+      result.file_ = CreateFileW(path.c_str(),
+                                 GENERIC_READ | GENERIC_WRITE,
+                                 FILE_SHARE_READ,
+                                 nullptr,
+                                 CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 nullptr);
+      if (result.file_ == invalid_file)
+        return std::make_unexpected(
+          pine::error(pine::error_code::file_error,
+                      "Failed to create " + path.string()));
+
+      // Mapping beyond the end of the file extends it with zeros.
+      LARGE_INTEGER large_size{};
+      large_size.QuadPart = static_cast<LONGLONG>(size);
+      result.mapping_ = CreateFileMappingW(result.file_,
+                                           nullptr,
+                                           PAGE_READWRITE,
+                                           static_cast<DWORD>(large_size.HighPart),
+                                           large_size.LowPart,
+                                           nullptr);
+      if (!result.mapping_)
+        return std::make_unexpected(
+          pine::error(pine::error_code::file_error,
+                      "Failed to map " + path.string()));
+
+      result.data_ = static_cast<std::byte*>(
+        MapViewOfFile(result.mapping_, FILE_MAP_WRITE, 0, 0, size));
+    #else
+      result.file_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (result.file_ == invalid_file)
+        return std::make_unexpected(
+          pine::error(pine::error_code::file_error,
+                      "Failed to create " + path.string()));
+
+      if (::ftruncate(result.file_, static_cast<off_t>(size)) != 0)
+        return std::make_unexpected(
+          pine::error(pine::error_code::file_error,
+                      "Failed to extend " + path.string()));
+
+      void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          result.file_, 0);
+      result.data_ = data == MAP_FAILED ? nullptr
+                                        : static_cast<std::byte*>(data);
+    #endif
+
+      if (!result.data_)
+        return std::make_unexpected(
+          pine::error(pine::error_code::file_error,
+                      "Failed to map " + path.string()));
+
+      return result;
+    }
+
+    /// @brief Unmap and close the file, cut to the bytes used.
+    /// @param used The number of bytes to keep.
+    void close(size_t used) noexcept
+    {
+    #ifdef _WIN32
+      if (data_)
+        UnmapViewOfFile(data_);
+      if (mapping_)
+        CloseHandle(mapping_);
+      if (file_ != invalid_file)
+      {
+        LARGE_INTEGER position{};
+        position.QuadPart = static_cast<LONGLONG>(used);
+        if (SetFilePointerEx(file_, position, nullptr, FILE_BEGIN))
+          SetEndOfFile(file_);
+        CloseHandle(file_);
+      }
+      mapping_ = nullptr;
+    #else
+      if (data_)
+        ::munmap(data_, size_);
+      if (file_ != invalid_file)
+      {
+        std::ignore = ::ftruncate(file_, static_cast<off_t>(used));
+        ::close(file_);
+      }
+    #endif
+
+      data_ = nullptr;
+      size_ = 0;
+      file_ = invalid_file;
+    }
+
+    /// @brief Map the pages of a range writable ahead of their first
+    /// write, so that the thread writing them takes no page fault. The bytes
+    /// of the range are left unchanged, even if another thread writes them
+    /// meanwhile.
+    /// @param offset The offset of the range.
+    /// @param size The size of the range, clamped to the end of the file.
+    void prefault(size_t offset, size_t size) const noexcept
+    {
+      if (offset >= size_)
+        return;
+      size = (std::min)(size, size_ - offset);
+
+      static const size_t page_size = get_page_size();
+      size_t aligned = offset / page_size * page_size;
+
+    #ifdef MADV_POPULATE_WRITE
+      // One system call rather than a page fault per page.
+      if (::madvise(data_ + aligned, size + offset - aligned,
+                    MADV_POPULATE_WRITE) == 0)
+        return;
+    #endif
+
+      // Windows has no equivalent: PrefetchVirtualMemory reads the pages
+      // without mapping them. Each page is written instead, adding zero to
+      // its first word atomically so that a record being copied there is
+      // not overwritten.
+      for (size_t page = aligned; page < offset + size; page += page_size)
+      {
+        std::atomic_ref<uint64_t>{ *reinterpret_cast<uint64_t*>(data_ + page) }
+          .fetch_add(0, std::memory_order_relaxed);
+      }
+    }
+
+    std::byte* data() const noexcept { return data_; }
+
+    size_t size() const noexcept { return size_; }
+
+  private:
+    static size_t get_page_size() noexcept
+    {
+    #ifdef _WIN32
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return info.dwPageSize;
+    #else
+      return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    #endif
+    }
+
+  #ifdef _WIN32
+    using file_handle = HANDLE;
+    static inline const file_handle invalid_file = INVALID_HANDLE_VALUE;
+  #else
+    using file_handle = int;
+    static constexpr file_handle invalid_file = -1;
+  #endif
+
+    std::byte* data_ = nullptr;
+    size_t size_ = 0;
+    file_handle file_ = invalid_file;
+  #ifdef _WIN32
+    HANDLE mapping_ = nullptr;
+  #endif
+  };
+
+  /// @brief Format a time of the access log as an ISO 8601 UTC time.
+  std::string format_time(uint64_t time)
+  {
+    using namespace std::chrono;
+
+    sys_time<nanoseconds> point{ nanoseconds{ time } };
+    auto day = floor<days>(point);
+    year_month_day date{ day };
+    hh_mm_ss<nanoseconds> clock{ point - day };
+
+    return std::format("{:04}-{:02}-{:02}T{:02}:{:02}:{:02}.{:09}Z",
+                       static_cast<int>(date.year()),
+                       static_cast<unsigned>(date.month()),
+                       static_cast<unsigned>(date.day()),
+                       clock.hours().count(),
+                       clock.minutes().count(),
+                       clock.seconds().count(),
+                       clock.subseconds().count());
+  }
+
+  /// @brief Escape the bytes of a path that could forge lines or fields:
+  /// control bytes, bytes outside ASCII and backslashes, and spaces in the
+  /// text format. Paths are decoded before routing, so a client can send
+  /// any of them.
+  /// @param separator Whether spaces separate the fields.
+  std::string escape_path(std::string_view path, bool separator)
+  {
+    std::string result;
+    result.reserve(path.size());
+    for (char c : path)
+    {
+      auto byte = static_cast<unsigned char>(c);
+      if (byte < 0x20 || byte >= 0x7f || (separator && byte == ' '))
+        result += std::format("\\x{:02x}", static_cast<unsigned>(byte));
+      else if (c == '\\')
+        result += "\\\\";
+      else
+        result += c;
+    }
+    return result;
+  }
+
+  /// @brief Get the name of the method of a record, "-" if unknown.
+  std::string_view method_name(uint8_t method)
+  {
+    auto it = pine::http_method_strings.find(
+      static_cast<pine::http_method>(method));
+    return it == pine::http_method_strings.end() ? "-" : it->second;
+  }
+}
+
+namespace pine
+{
+  /// @brief A segment file of a writer.
+  struct access_log::segment
+  {
+    mapped_file file;
+    std::filesystem::path path;
+
+    /// @brief Bytes written, set once the writer moves to another segment.
+    size_t used = 0;
+
+    /// @brief Bytes mapped ahead, by the preparing thread.
+    size_t prefaulted = 0;
+
+    /// @brief Next segment of the list of retired segments.
+    segment* next_retired = nullptr;
+  };
+
+  /// @brief The segments written by one thread.
+  /// @details The writer takes its segments ready made from the preparing
+  /// thread of the log, which also maps their pages ahead of the records and
+  /// closes the full segments, so that writing a record is a copy.
+  class access_log::writer
+  {
+  public:
+    writer(access_log& log, uint32_t index)
+      : log_(log),
+      index_(index),
+      thread_(std::this_thread::get_id())
+    {}
+
+    ~writer()
+    {
+      close_retired();
+
+      // The current segment is not full, so it is kept whatever the limit.
+      if (auto current = current_.load(std::memory_order_relaxed))
+      {
+        current->file.close(static_cast<size_t>(next_ - begin_));
+        delete current;
+      }
+
+      // Prepared segments never written are removed.
+      if (auto ready = ready_.load(std::memory_order_relaxed))
+      {
+        auto path = ready->path;
+        delete ready;
+        std::error_code error;
+        std::filesystem::remove(path, error);
+      }
+    }
+
+    /// @brief Copy a record to the current segment, moving to the next
+    /// segment if it is full.
+    /// @return False if no segment could be created.
+    bool write(const access_record& record) noexcept
+    {
+      if (next_ == end_ && !rotate())
+        return false;
+
+      // The time is written last, so that readers of a segment being
+      // written stop before a record only partly copied.
+      constexpr size_t time_size = sizeof(record.time);
+      std::memcpy(next_ + time_size,
+                  reinterpret_cast<const std::byte*>(&record) + time_size,
+                  sizeof(access_record) - time_size);
+      std::atomic_ref<uint64_t>{ *reinterpret_cast<uint64_t*>(next_) }
+        .store(record.time, std::memory_order_release);
+
+      next_ += sizeof(access_record);
+      position_.store(next_ - begin_, std::memory_order_relaxed);
+      return true;
+    }
+
+    /// @brief Get the thread the writer belongs to.
+    std::thread::id thread() const noexcept
+    {
+      return thread_;
+    }
+
+    /// @brief Prepare the next segment, map the pages ahead of the current
+    /// record and close the full segments. Called by the preparing thread.
+    void prepare() noexcept
+    {
+      if (!ready_.load(std::memory_order_acquire))
+      {
+        if (auto ready = create_segment())
+        {
+          ready->file.prefault(0, prefault_window);
+          ready->prefaulted = prefault_window;
+          ready_.store(ready, std::memory_order_release);
+        }
+      }
+
+      // The current segment is only unmapped below, by this thread, so it
+      // stays mapped even if the writer moves on meanwhile.
+      if (auto current = current_.load(std::memory_order_acquire))
+      {
+        size_t target = static_cast<size_t>(
+          position_.load(std::memory_order_relaxed)) + prefault_window;
+        if (target > current->prefaulted + prefault_window / 2)
+        {
+          current->file.prefault(current->prefaulted,
+                                 target - current->prefaulted);
+          current->prefaulted = target;
+        }
+      }
+
+      close_retired();
+    }
+
+  private:
+    /// @brief Size of the pages mapped ahead of the records. Taking a page
+    /// fault for each page costs more than the copy of its records.
+    static constexpr size_t prefault_window = 4 * 1024 * 1024;
+
+    /// @brief Move to the segment prepared by the preparing thread, or
+    /// create one if none is ready. Once creating a segment failed, the
+    /// writer drops its records.
+    /// @return True if a segment is ready.
+    bool rotate() noexcept
+    {
+      if (failed_)
+        return false;
+
+      if (auto current = current_.load(std::memory_order_relaxed))
+      {
+        current->used = static_cast<size_t>(next_ - current->file.data());
+        current->next_retired = retired_.load(std::memory_order_relaxed);
+        while (!retired_.compare_exchange_weak(current->next_retired, current,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed))
+        {}
+      }
+
+      auto next = ready_.exchange(nullptr, std::memory_order_acquire);
+      if (!next)
+        next = create_segment();
+
+      current_.store(next, std::memory_order_release);
+      if (!next)
+      {
+        failed_ = true;
+        next_ = end_ = nullptr;
+        return false;
+      }
+
+      begin_ = next->file.data();
+      next_ = begin_ + sizeof(access_log_header);
+      end_ = begin_ + next->file.size();
+      position_.store(sizeof(access_log_header), std::memory_order_relaxed);
+      return true;
+    }
+
+    /// @brief Create the next segment of the writer.
+    /// @return The segment, or nullptr if it could not be created.
+    segment* create_segment() noexcept
+    {
+      try
+      {
+        const auto& options = log_.options_;
+        uint32_t sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+
+        auto result = std::make_unique<segment>();
+        result->path = options.directory / std::format(
+          "access-{}-{}-{:06}.plog", log_.run_, index_, sequence);
+
+        // The segment holds the header and a whole number of records.
+        size_t record_count =
+          ((std::max)(options.segment_size, 2 * sizeof(access_record))
+           - sizeof(access_log_header)) / sizeof(access_record);
+        auto file = mapped_file::create(
+          result->path,
+          sizeof(access_log_header) + record_count * sizeof(access_record));
+        if (!file)
+        {
+          PINE_LOG(error, "Access log segment not created: %s",
+                   file.error().message());
+          return nullptr;
+        }
+        result->file = std::move(file.value());
+
+        access_log_header header;
+        header.created = log_.to_record_time(std::chrono::steady_clock::now());
+        header.writer = index_;
+        header.sequence = sequence;
+        std::memcpy(result->file.data(), &header, sizeof(header));
+
+        return result.release();
+      }
+      catch (...)
+      {
+        return nullptr;
+      }
+    }
+
+    /// @brief Close a full segment, and delete the oldest full segments
+    /// beyond the limit.
+    void close(segment* full) noexcept
+    {
+      try
+      {
+        full->file.close(full->used);
+        full_segments_.push_back(std::move(full->path));
+        delete full;
+
+        std::error_code error;
+        size_t max_segments = log_.options_.max_segments;
+        while (max_segments > 0 && full_segments_.size() > max_segments)
+        {
+          std::filesystem::remove(full_segments_.front(), error);
+          full_segments_.pop_front();
+        }
+      }
+      catch (...)
+      {}
+    }
+
+    /// @brief Close the segments the writer moved away from.
+    void close_retired() noexcept
+    {
+      auto retired = retired_.exchange(nullptr, std::memory_order_acquire);
+
+      // The list is newest first, close them oldest first.
+      std::vector<segment*> segments;
+      for (; retired; retired = retired->next_retired)
+        segments.push_back(retired);
+      for (auto it = segments.rbegin(); it != segments.rend(); ++it)
+        close(*it);
+    }
+
+    access_log& log_;
+    uint32_t index_;
+    std::thread::id thread_;
+
+    /// @brief The segment being written and where the next record goes in
+    /// it. Only the writer changes them.
+    std::atomic<segment*> current_ = nullptr;
+    std::byte* begin_ = nullptr;
+    std::byte* next_ = nullptr;
+    std::byte* end_ = nullptr;
+
+    /// @brief Bytes written in the current segment, for the preparing
+    /// thread.
+    std::atomic<size_t> position_ = 0;
+
+    /// @brief The next segment, prepared by the preparing thread.
+    std::atomic<segment*> ready_ = nullptr;
+
+    /// @brief The full segments not closed yet, newest first.
+    std::atomic<segment*> retired_ = nullptr;
+
+    std::atomic<uint32_t> sequence_ = 0;
+
+    /// @brief The closed segments kept, oldest first. Only used by the
+    /// preparing thread, then by the destructor.
+    std::deque<std::filesystem::path> full_segments_;
+
+    bool failed_ = false;
+  };
+
+  access_log::access_log(const access_log_options& options)
+    : options_(options)
+  {
+    using namespace std::chrono;
+
+    static std::atomic<uint64_t> next_id = 1;
+    id_ = next_id.fetch_add(1, std::memory_order_relaxed);
+
+    auto system_now = system_clock::now();
+    auto steady_now = steady_clock::now();
+    epoch_offset_ = duration_cast<nanoseconds>(system_now.time_since_epoch())
+      - duration_cast<nanoseconds>(steady_now.time_since_epoch());
+    run_ = static_cast<uint64_t>(
+      duration_cast<milliseconds>(system_now.time_since_epoch()).count());
+
+    std::error_code error;
+    std::filesystem::create_directories(options_.directory, error);
+
+    preparer_ = std::jthread([this](std::stop_token stop) { prepare(stop); });
+  }
+
+  access_log::~access_log()
+  {
+    // The writers close their segments once the preparing thread is done
+    // with them.
+    preparer_.request_stop();
+    preparer_.join();
+  }
+
+  void access_log::write(const access_record& record) noexcept
+  {
+    auto writer = get_writer();
+    if (!writer || !writer->write(record))
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  access_log::writer* access_log::get_writer() noexcept
+  {
+    struct cached_writer
+    {
+      uint64_t log = 0;
+      writer* current = nullptr;
+    };
+    thread_local cached_writer cache;
+
+    if (cache.log == id_)
+      return cache.current;
+
+    std::scoped_lock lock{ mutex_ };
+
+    // The thread may have switched between logs.
+    auto thread = std::this_thread::get_id();
+    for (const auto& existing : writers_)
+    {
+      if (existing->thread() == thread)
+      {
+        cache = { id_, existing.get() };
+        return cache.current;
+      }
+    }
+
+    try
+    {
+      auto index = static_cast<uint32_t>(writers_.size());
+      writers_.push_back(std::make_unique<writer>(*this, index));
+    }
+    catch (...)
+    {
+      return nullptr;
+    }
+
+    cache = { id_, writers_.back().get() };
+    return cache.current;
+  }
+
+  void access_log::prepare(std::stop_token stop)
+  {
+    std::vector<writer*> writers;
+    while (!stop.stop_requested())
+    {
+      {
+        std::unique_lock lock{ mutex_ };
+        writers.clear();
+        for (const auto& writer : writers_)
+          writers.push_back(writer.get());
+      }
+
+      // Writers are only destroyed with the log, after this thread.
+      for (auto writer : writers)
+        writer->prepare();
+
+      std::unique_lock lock{ mutex_ };
+      wake_.wait_for(lock, stop, prepare_interval, [] { return false; });
+    }
+  }
+
+  std::expected<std::vector<access_record>, pine::error>
+    read_access_log(const std::filesystem::path& path)
+  {
+    std::ifstream file{ path, std::ios::binary };
+    if (!file)
+      return std::make_unexpected(
+        error(error_code::file_error, "Failed to open " + path.string()));
+
+    access_log_header header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || header.magic != access_log_header::expected_magic)
+      return std::make_unexpected(
+        error(error_code::file_error,
+              path.string() + " is not an access log segment"));
+
+    if (header.version != access_log_header::current_version
+        || header.record_size != sizeof(access_record))
+      return std::make_unexpected(
+        error(error_code::file_error,
+              path.string() + " has an unsupported version"));
+
+    std::vector<access_record> records;
+    access_record record;
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record))
+           && record.time != 0)
+      records.push_back(record);
+
+    return records;
+  }
+
+  std::string format_access_record(const access_record& record,
+                                   access_log_format format)
+  {
+    const auto& address = record.peer_address;
+    std::string peer = std::format("{}.{}.{}.{}:{}",
+                                   static_cast<unsigned>(address[0]),
+                                   static_cast<unsigned>(address[1]),
+                                   static_cast<unsigned>(address[2]),
+                                   static_cast<unsigned>(address[3]),
+                                   record.peer_port);
+
+    if (format == access_log_format::csv)
+    {
+      // Paths are always quoted, their quotes doubled.
+      std::string path = "\"";
+      for (char c : escape_path(record.get_path(), false))
+      {
+        if (c == '"')
+          path += '"';
+        path += c;
+      }
+      path += '"';
+
+      return std::format("{},{},{},{},{},{},{},{},{}",
+                         format_time(record.time),
+                         peer,
+                         method_name(record.method),
+                         path,
+                         static_cast<unsigned>(record.path_truncated),
+                         record.status,
+                         record.bytes_received,
+                         record.bytes_sent,
+                         record.latency);
+    }
+
+    return std::format("{} {} {} {}{} {} {} {} {}us",
+                       format_time(record.time),
+                       peer,
+                       method_name(record.method),
+                       record.get_path().empty()
+                         ? "-"
+                         : escape_path(record.get_path(), true),
+                       record.path_truncated ? "..." : "",
+                       record.status,
+                       record.bytes_received,
+                       record.bytes_sent,
+                       record.latency / 1000);
+  }
+}
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concurrency_limiter.h>
+#include <cstddef>
+
+namespace pine
+{
+  concurrency_limiter::concurrency_limiter(const concurrency_limiter_options& options)
+    : options_(options),
+    limit_(static_cast<double>(std::clamp(options.initial_limit,
+                                          options.min_limit,
+                                          options.max_limit)))
+  {}
+
+  bool concurrency_limiter::try_acquire() noexcept
+  {
+    size_t limit = this->limit();
+    size_t current = in_flight_.load(std::memory_order_relaxed);
+
+    do
+    {
+      if (current >= limit)
+        return false;
+    } while (!in_flight_.compare_exchange_weak(current, current + 1,
+                                               std::memory_order_relaxed));
+
+    return true;
+  }
+
+  void concurrency_limiter::release(clock::duration latency,
+                                    clock::time_point now) noexcept
+  {
+    size_t in_flight = in_flight_.fetch_sub(1, std::memory_order_relaxed);
+
+    if (latency > options_.latency_target)
+      decrease(now);
+    // Only grow while the limit is actually used, otherwise a quiet period
+    // would let it grow without bound.
+    else if (in_flight * 2 >= limit())
+      increase();
+  }
+
+  void concurrency_limiter::release_dropped(clock::time_point now) noexcept
+  {
+    in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    decrease(now);
+  }
+
+  size_t concurrency_limiter::limit() const noexcept
+  {
+    return static_cast<size_t>(limit_.load(std::memory_order_relaxed));
+  }
+
+  size_t concurrency_limiter::in_flight() const noexcept
+  {
+    return in_flight_.load(std::memory_order_relaxed);
+  }
+
+  void concurrency_limiter::increase() noexcept
+  {
+    double limit = limit_.load(std::memory_order_relaxed);
+    double increased;
+
+    do
+    {
+      increased = std::min(limit + 1.0 / limit,
+                           static_cast<double>(options_.max_limit));
+    } while (!limit_.compare_exchange_weak(limit, increased,
+                                           std::memory_order_relaxed));
+  }
+
+  void concurrency_limiter::decrease(clock::time_point now) noexcept
+  {
+    int64_t now_count = now.time_since_epoch().count();
+    int64_t next = next_decrease_.load(std::memory_order_relaxed);
+
+    if (now_count < next)
+      return;
+
+    int64_t window = std::chrono::duration_cast<clock::duration>(
+      options_.latency_target).count();
+    if (!next_decrease_.compare_exchange_strong(next, now_count + window,
+                                                std::memory_order_relaxed))
+      return;
+
+    double limit = limit_.load(std::memory_order_relaxed);
+    double decreased;
+
+    do
+    {
+      decreased = std::max(limit * options_.backoff_ratio,
+                           static_cast<double>(options_.min_limit));
+    } while (!limit_.compare_exchange_weak(limit, decreased,
+                                           std::memory_order_relaxed));
+  }
+}
@@ -0,0 +1,361 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <http.h>
+#include <metrics.h>
+#include <new>
+#include <request_trace.h>
+#include <route_node.h>
+#include <route_tree.h>
+#include <string>
+#include <string_view>
+
+namespace
+{
+  /// @brief Get the number of the thread, from which the shards it updates
+  /// are chosen. Threads are numbered in the order they first update one.
+  size_t thread_number() noexcept
+  {
+    static std::atomic<size_t> next_number = 0;
+    thread_local size_t number =
+      next_number.fetch_add(1, std::memory_order_relaxed);
+    return number;
+  }
+
+  /// @brief Get the set of counters the thread updates.
+  size_t shard_index() noexcept
+  {
+    return thread_number() % pine::server_metrics::shard_count;
+  }
+
+  /// @brief Upper bounds of the buckets of the Prometheus histogram, in
+  /// seconds. The buckets of the latency histograms are much finer, so they
+  /// are merged into these.
+  constexpr std::array<double, 15> prometheus_buckets{
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+    0.25, 0.5, 1, 2.5, 5,
+  };
+
+  /// @brief Write the HELP and TYPE lines of a metric.
+  void write_header(std::string& output,
+                    std::string_view name,
+                    std::string_view type,
+                    std::string_view help)
+  {
+    output += std::format("# HELP {} {}\n# TYPE {} {}\n",
+                          name, help, name, type);
+  }
+
+  /// @brief Write a label value, escaped as the text format requires.
+  void write_label_value(std::string& output, std::string_view value)
+  {
+    for (char c : value)
+    {
+      if (c == '\\' || c == '"')
+        output += '\\';
+      if (c == '\n')
+      {
+        output += "\\n";
+        continue;
+      }
+      output += c;
+    }
+  }
+
+  /// @brief Write a histogram labelled by one label.
+  /// @param name The name of the metric.
+  /// @param label The name of the label.
+  /// @param value The value of the label.
+  void write_histogram(std::string& output,
+                       std::string_view name,
+                       std::string_view label,
+                       std::string_view value,
+                       const pine::latency_histogram& histogram)
+  {
+    using histogram_t = pine::latency_histogram;
+
+    auto write_sample = [&](std::string_view suffix, std::string_view le)
+      {
+        output += name;
+        output += suffix;
+        output += '{';
+        output += label;
+        output += "=\"";
+        write_label_value(output, value);
+        output += '"';
+        if (!le.empty())
+        {
+          output += ",le=\"";
+          output += le;
+          output += '"';
+        }
+        output += "} ";
+      };
+
+    // Counts are read once, so that the cumulative buckets only grow even
+    // while requests are recorded.
+    uint64_t cumulative = 0;
+    size_t index = 0;
+    for (double bound : prometheus_buckets)
+    {
+      auto bound_ns = static_cast<uint64_t>(std::llround(bound * 1e9));
+      for (; index < histogram_t::bucket_count
+           && histogram_t::bucket_upper_bound(index) <= bound_ns; ++index)
+        cumulative += histogram.bucket(index);
+
+      write_sample("_bucket", std::format("{}", bound));
+      output += std::to_string(cumulative) + '\n';
+    }
+
+    for (; index < histogram_t::bucket_count; ++index)
+      cumulative += histogram.bucket(index);
+
+    write_sample("_bucket", "+Inf");
+    output += std::to_string(cumulative) + '\n';
+
+    write_sample("_sum", {});
+    output += std::format(
+      "{}\n", std::chrono::duration<double>(histogram.sum()).count());
+
+    write_sample("_count", {});
+    output += std::to_string(cumulative) + '\n';
+  }
+
+  /// @brief Write the histograms of a node and of the nodes below it.
+  /// @param route The path of the route of the node.
+  void write_histograms(std::string& output,
+                        std::string& route,
+                        const pine::route_node& node)
+  {
+    if (auto histogram = node.latency(); histogram && histogram->count() > 0)
+      write_histogram(output, "pine_request_duration_seconds", "route",
+                      route.empty() ? "/" : route, *histogram);
+
+    for (const auto& child : node.children())
+    {
+      size_t size = route.size();
+      route += '/';
+      route += child->path();
+      write_histograms(output, route, *child);
+      route.resize(size);
+    }
+  }
+}
+
+namespace pine
+{
+  latency_histogram::~latency_histogram()
+  {
+    for (auto& other : other_shards_)
+      delete other.load(std::memory_order_relaxed);
+  }
+
+  uint64_t latency_histogram::count() const noexcept
+  {
+    uint64_t count = 0;
+    for_each_shard([&](const shard& shard)
+                   {
+                     count += shard.count.load(std::memory_order_relaxed);
+                   });
+    return count;
+  }
+
+  std::chrono::nanoseconds latency_histogram::sum() const noexcept
+  {
+    uint64_t sum = 0;
+    for_each_shard([&](const shard& shard)
+                   {
+                     sum += shard.sum.load(std::memory_order_relaxed);
+                   });
+    return std::chrono::nanoseconds{ sum };
+  }
+
+  uint64_t latency_histogram::bucket(size_t index) const noexcept
+  {
+    uint64_t count = 0;
+    for_each_shard([&](const shard& shard)
+                   {
+                     count += shard.buckets[index]
+                       .load(std::memory_order_relaxed);
+                   });
+    return count;
+  }
+
+  latency_histogram::shard& latency_histogram::local_shard() noexcept
+  {
+    size_t index = thread_number() % shard_count;
+    if (index == 0)
+      return first_shard_;
+
+    auto& slot = other_shards_[index - 1];
+    if (shard* existing = slot.load(std::memory_order_acquire))
+      return *existing;
+
+    auto created = new (std::nothrow) shard;
+    if (!created)
+      return first_shard_;
+
+    // Another thread of the same shard may have installed one first.
+    shard* expected = nullptr;
+    if (slot.compare_exchange_strong(expected, created,
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_acquire))
+      return *created;
+
+    delete created;
+    return *expected;
+  }
+
+  std::chrono::nanoseconds
+    latency_histogram::percentile(double percentile) const noexcept
+  {
+    uint64_t total = count();
+    if (total == 0)
+      return {};
+
+    auto rank = static_cast<uint64_t>(
+      std::ceil(percentile / 100 * static_cast<double>(total)));
+    if (rank == 0)
+      rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t index = 0; index < bucket_count; ++index)
+    {
+      seen += bucket(index);
+      if (seen >= rank)
+        return std::chrono::nanoseconds{ bucket_upper_bound(index) };
+    }
+
+    // Buckets recorded after the count was read.
+    return std::chrono::nanoseconds{ bucket_upper_bound(bucket_count - 1) };
+  }
+
+  uint64_t server_metrics_snapshot::get(http_status status) const noexcept
+  {
+    auto code = static_cast<size_t>(status);
+    if (code < first_status || code - first_status >= status_count)
+      return 0;
+
+    return statuses[code - first_status];
+  }
+
+  void server_metrics::add(server_counter counter, uint64_t value) noexcept
+  {
+    shards_[shard_index()].counters[static_cast<size_t>(counter)]
+      .fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void server_metrics::count_response(http_status status) noexcept
+  {
+    auto code = static_cast<size_t>(status);
+    if (code < server_metrics_snapshot::first_status
+        || code - server_metrics_snapshot::first_status
+           >= server_metrics_snapshot::status_count)
+      return;
+
+    shards_[shard_index()].statuses[code - server_metrics_snapshot::first_status]
+      .fetch_add(1, std::memory_order_relaxed);
+  }
+
+  server_metrics_snapshot server_metrics::snapshot() const noexcept
+  {
+    server_metrics_snapshot result;
+    for (const auto& shard : shards_)
+    {
+      for (size_t i = 0; i < server_counter_count; ++i)
+        result.counters[i] += shard.counters[i].load(std::memory_order_relaxed);
+
+      for (size_t i = 0; i < server_metrics_snapshot::status_count; ++i)
+        result.statuses[i] += shard.statuses[i].load(std::memory_order_relaxed);
+    }
+
+    return result;
+  }
+
+  namespace prometheus
+  {
+    void write(std::string& output, const server_metrics_snapshot& metrics)
+    {
+      struct counter_metric
+      {
+        server_counter counter;
+        std::string_view name;
+        std::string_view help;
+      };
+
+      constexpr std::array<counter_metric, 5> counters{ {
+        { server_counter::requests, "pine_requests_total",
+          "Requests received." },
+        { server_counter::bytes_received, "pine_received_bytes_total",
+          "Bytes of the requests received." },
+        { server_counter::bytes_sent, "pine_sent_bytes_total",
+          "Bytes of the responses sent." },
+        { server_counter::accepts, "pine_accepted_connections_total",
+          "Connections accepted." },
+        { server_counter::parse_errors, "pine_parse_errors_total",
+          "Requests that could not be parsed." },
+      } };
+
+      for (const auto& [counter, name, help] : counters)
+      {
+        write_header(output, name, "counter", help);
+        output += std::format("{} {}\n", name, metrics.get(counter));
+      }
+
+      write_header(output, "pine_active_connections", "gauge",
+                   "Connections open.");
+      output += std::format("pine_active_connections {}\n",
+                            metrics.active_connections());
+
+      write_header(output, "pine_responses_total", "counter",
+                   "Responses sent, by status.");
+      for (size_t i = 0; i < server_metrics_snapshot::status_count; ++i)
+      {
+        if (metrics.statuses[i] == 0)
+          continue;
+
+        output += "pine_responses_total{status=\"";
+        output += std::to_string(i + server_metrics_snapshot::first_status);
+        output += "\"} ";
+        output += std::to_string(metrics.statuses[i]) + '\n';
+      }
+    }
+
+    void write(std::string& output, const route_tree& routes)
+    {
+      write_header(output, "pine_request_duration_seconds", "histogram",
+                   "Time from receiving a request to sending its response, "
+                   "by route.");
+
+      std::string route;
+      write_histograms(output, route, routes.root());
+    }
+
+    void write(std::string& output,
+               std::string_view route,
+               const latency_histogram& latency)
+    {
+      write_histogram(output, "pine_request_duration_seconds", "route", route,
+                      latency);
+    }
+
+    void write(std::string& output, const phase_histograms& phases)
+    {
+      write_header(output, "pine_request_phase_seconds", "histogram",
+                   "Time spent reaching each phase of a request since the "
+                   "previous one, by phase.");
+
+      for (size_t i = 1; i < trace_phase_count; ++i)
+      {
+        const auto& histogram = phases[static_cast<trace_phase>(i)];
+        if (histogram.count() > 0)
+          write_histogram(output, "pine_request_phase_seconds", "phase",
+                          trace_phase_names[i], histogram);
+      }
+    }
+  }
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <error.h>
+#include <http.h>
+#include <http_response.h>
+#include <mutex>
+#include <rate_limiter.h>
+#include <string>
+
+namespace pine
+{
+  rate_limiter::rate_limiter(const rate_limit_options& options)
+    : options_(options),
+    tokens_per_tick_(options.requests_per_second
+                     * clock::period::num / clock::period::den)
+  {
+    // The refill time and the Retry-After header divide by the rate.
+    if (!std::isfinite(options_.requests_per_second)
+        || options_.requests_per_second <= 0)
+      throw error(error_code::invalid_parameter,
+                  "The rate of a rate limiter must be positive and finite.");
+
+    options_.burst = std::max(options_.burst, 1.0);
+
+    auto refill_time = std::chrono::duration<double>(
+      options_.burst / options_.requests_per_second);
+    idle_expiry_ = std::max(
+      std::chrono::duration_cast<clock::duration>(options_.idle_expiry),
+      std::chrono::ceil<clock::duration>(refill_time)).count();
+
+    shard_capacity_ = std::max<size_t>(1, options_.max_keys / shard_count);
+
+    // A client rejected with an empty bucket gets a token back after
+    // 1 / requests_per_second.
+    auto retry_after = std::max<int64_t>(
+      1, static_cast<int64_t>(std::ceil(1.0 / options_.requests_per_second)));
+
+    http_response response;
+    response.set_status(http_status::too_many_requests);
+    response.set_header("Connection", "close");
+    response.set_header("Retry-After", std::to_string(retry_after));
+    response.set_body(http_status_strings.at(http_status::too_many_requests));
+    rejection_ = response.to_string();
+  }
+
+  bool rate_limiter::try_acquire(uint64_t key, clock::time_point now)
+  {
+    clock::rep now_count = now.time_since_epoch().count();
+    shard& shard = shard_of(key);
+
+    std::lock_guard lock{ shard.mutex };
+
+    sweep(shard, now_count);
+
+    bucket* bucket;
+    if (auto it = shard.keys.find(key); it != shard.keys.end())
+    {
+      bucket = &shard.buckets[it->second];
+      double refill = (now_count - bucket->last_refill) * tokens_per_tick_;
+      bucket->tokens = std::min(bucket->tokens + refill, options_.burst);
+      bucket->last_refill = now_count;
+      bucket->referenced = true;
+    }
+    else
+    {
+      uint32_t index = allocate(shard, now_count);
+      shard.keys.emplace(key, index);
+      bucket = &shard.buckets[index];
+      // New keys are not referenced, so that a flood of keys used once
+      // evicts itself before the keys of returning clients.
+      *bucket = { key, options_.burst, now_count, true, false };
+    }
+
+    if (bucket->tokens < 1.0)
+      return false;
+
+    bucket->tokens -= 1.0;
+    return true;
+  }
+
+  size_t rate_limiter::size() const
+  {
+    size_t size = 0;
+    for (const auto& shard : shards_)
+    {
+      std::lock_guard lock{ shard.mutex };
+      size += shard.keys.size();
+    }
+    return size;
+  }
+
+  rate_limiter::shard& rate_limiter::shard_of(uint64_t key) noexcept
+  {
+    // Addresses differ mostly in their low bits and hashes are not always
+    // well mixed, so scramble the key before picking the shard.
+    return shards_[(key * 0x9E3779B97F4A7C15ull)
+                   >> (64 - std::bit_width(shard_count - 1))];
+  }
+
+  void rate_limiter::sweep(shard& shard, clock::rep now)
+  {
+    size_t size = shard.buckets.size();
+    for (size_t i = 0; i < std::min(sweep_step, size); ++i)
+    {
+      const bucket& bucket = shard.buckets[shard.hand];
+      if (bucket.used && now - bucket.last_refill >= idle_expiry_)
+        release(shard, shard.hand);
+      shard.hand = static_cast<uint32_t>((shard.hand + 1) % size);
+    }
+  }
+
+  uint32_t rate_limiter::allocate(shard& shard, clock::rep now)
+  {
+    if (!shard.free.empty())
+    {
+      uint32_t index = shard.free.back();
+      shard.free.pop_back();
+      return index;
+    }
+
+    if (shard.buckets.size() < shard_capacity_)
+    {
+      shard.buckets.push_back({});
+      return static_cast<uint32_t>(shard.buckets.size() - 1);
+    }
+
+    // Every bucket is used. The first pass of the hand clears the
+    // references, so the second pass at the latest finds a bucket to evict.
+    size_t size = shard.buckets.size();
+    while (true)
+    {
+      uint32_t index = shard.hand;
+      bucket& bucket = shard.buckets[index];
+      shard.hand = static_cast<uint32_t>((shard.hand + 1) % size);
+
+      if (bucket.referenced && now - bucket.last_refill < idle_expiry_)
+      {
+        bucket.referenced = false;
+        continue;
+      }
+
+      shard.keys.erase(bucket.key);
+      bucket.used = false;
+      return index;
+    }
+  }
+
+  void rate_limiter::release(shard& shard, uint32_t index)
+  {
+    bucket& bucket = shard.buckets[index];
+    shard.keys.erase(bucket.key);
+    bucket.used = false;
+    shard.free.push_back(index);
+  }
+}
@@ -1,9 +1,14 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <error.h>
 #include <expected.h>
 #include <fstream>
 #include <http.h>
 #include <iterator>
 #include <memory>
+#include <metrics.h>
+#include <rate_limiter.h>
 #include <route_node.h>
 #include <route_path.h>
 #include <route_tree.h>
@@ -23,50 +28,58 @@ static std::string read_file(const std::filesystem::path& location)
                      std::istreambuf_iterator<char>());
 }
 
-/// @brief Get the file path from the request URI
-/// @param request_path The path of the route
-/// @param requested_uri The requested URI
-/// @param location The location of the file/directory
-/// @return The file path
-static std::filesystem::path get_file_path(std::string_view request_path,
-                                           std::string_view requested_uri,
-                                           const std::filesystem::path& location)
+/// @brief Check whether a path requested below a directory stays in it.
+/// @param relative_path The path, relative to the directory.
+/// @return False if the path is absolute or a segment of the path is "..".
+static bool stays_below(std::string_view relative_path)
 {
-  std::string_view file_path = requested_uri.substr(request_path.size());
-  if (file_path.size() == 0)
-    return "index.html";
+  if (relative_path.starts_with('/')
+      || relative_path.starts_with('\\')
+      || relative_path.find(':') != std::string_view::npos)
+    return false;
 
-  if (file_path.starts_with('/'))
-    file_path = file_path.substr(1);
+  while (!relative_path.empty())
+  {
+    size_t end = relative_path.find_first_of("/\\");
+    if (relative_path.substr(0, end) == "..")
+      return false;
 
-  return location / file_path;
+    if (end == std::string_view::npos)
+      break;
+
+    relative_path.remove_prefix(end + 1);
+  }
+
+  return true;
 }
 
 namespace pine
 {
-  static void serve_files(std::string_view route_path,
-                          const http_request& request,
+  /// @brief Answer a request for a file.
+  /// @param relative_path The path requested below the location, empty for
+  /// the location itself.
+  /// @param response The response.
+  /// @param location The file or the directory served.
+  static void serve_files(std::string_view relative_path,
                           http_response& response,
                           const std::filesystem::path& location)
   {
-    if (!std::filesystem::exists(location))
+    std::filesystem::path file_location = location;
+    if (std::filesystem::is_directory(location))
     {
-      response.set_status(http_status::not_found);
-      response.set_body("404 Not found");
-      return;
-    }
+      if (relative_path.empty())
+        relative_path = "index.html";
 
-    if (!std::filesystem::is_directory(location))
-    {
-      response.set_status(http_status::ok);
-      response.set_body(read_file(location));
-      return;
+      if (stays_below(relative_path))
+        file_location /= relative_path;
+      else
+        file_location.clear();
     }
+    else if (!relative_path.empty())
+      file_location.clear();
 
-    std::filesystem::path file_location = get_file_path(route_path,
-                                                        request.get_uri(),
-                                                        location);
-    if (!std::filesystem::exists(file_location))
+    if (file_location.empty()
+        || !std::filesystem::is_regular_file(file_location))
     {
       response.set_status(http_status::not_found);
       response.set_body("404 Not found");
@@ -82,7 +95,8 @@ namespace pine
 {
   route_node::route_node(std::string_view path)
     : path_(path),
-    is_path_parameter_(path.starts_with(':'))
+    is_path_parameter_(path.starts_with(':')),
+    is_wildcard_(path.starts_with('*'))
   {
     if (path_ == "/")
     {
@@ -109,8 +123,6 @@ namespace pine
     auto child = std::make_unique<route_node>(path);
     auto child_ptr = child.get();
 
-    children_.push_back(std::move(child));
-
     if (child_ptr->is_path_parameter_)
     {
       if (has_path_parameter_children_)
@@ -119,78 +131,153 @@ namespace pine
       has_path_parameter_children_ = true;
       path_parameter_child_ = child_ptr;
     }
+    else if (child_ptr->is_wildcard_)
+    {
+      if (wildcard_child_)
+        throw error(error_code::path_parameter_conflict);
+
+      wildcard_child_ = child_ptr;
+    }
+    else
+      index_static_child(*child_ptr);
+
+    children_.push_back(std::move(child));
 
     return *child_ptr;
   }
 
+  void route_node::index_static_child(route_node& child)
+  {
+    child_entry entry{ child.path_, &child };
+    auto position = std::upper_bound(static_children_.begin(),
+                                     static_children_.end(),
+                                     entry,
+                                     [](const auto& a, const auto& b)
+                                     {
+                                       return a.path < b.path;
+                                     });
+    static_children_.insert(position, entry);
+
+    if (static_children_.size() < first_byte_dispatch_threshold)
+      return;
+
+    // The entries are sorted, so those starting with the same byte are
+    // contiguous.
+    first_byte_index_.assign(257, 0);
+    size_t entry_index = 0;
+    for (size_t byte = 0; byte < 257; byte++)
+    {
+      // Empty paths sort first and have no first byte; validate_path keeps
+      // them out of routes, and normalized request paths never look them up.
+      while (entry_index < static_children_.size()
+             && (static_children_[entry_index].path.empty()
+                 || static_cast<unsigned char>(static_children_[entry_index].path[0]) < byte))
+        entry_index++;
+
+      first_byte_index_[byte] = static_cast<uint16_t>(entry_index);
+    }
+  }
+
   void route_node::add_handler(http_method method,
-                               std::unique_ptr<handler_type> handler) noexcept
+                               handler_type handler)
   {
-    handlers_[static_cast<size_t>(method)] = std::move(handler);
-    http_method_mask_ |= 1 << static_cast<size_t>(method);
+    handlers_[http_method_index(method)] = std::move(handler);
+    async_handlers_[http_method_index(method)] = nullptr;
+    http_method_mask_ |= 1 << http_method_index(method);
+
+    if (!latency_)
+      latency_ = std::make_unique<latency_histogram>();
   }
 
-  static bool paths_match(std::string_view node_path, std::string_view path)
+  void route_node::add_handler(http_method method,
+                               async_handler_type handler)
   {
-    // node_path: api
-    // path:      api/users/
-    // should return true, because api is a prefix of api/users
-    size_t child_length = node_path.size();
-    size_t path_length = path.size();
-    size_t min_length = std::min(child_length, path_length);
-
-    size_t i;
-    for (i = 0; i < min_length; i++)
-    {
-      if (path[i] != '/' && path[i] != node_path[i])
-        return false;
+    async_handlers_[http_method_index(method)] = std::move(handler);
+    handlers_[http_method_index(method)] = nullptr;
+    http_method_mask_ |= 1 << http_method_index(method);
 
-      if (path[i] == '/')
-      {
-        if (i == child_length)
-          return true;
+    if (!latency_)
+      latency_ = std::make_unique<latency_histogram>();
+  }
 
-        return false;
-      }
+  route_node*
+    route_node::find_static_child(std::string_view segment) const noexcept
+  {
+    if (segment.empty())
+      return nullptr;
+
+    const child_entry* entry = static_children_.data();
+    const child_entry* end = entry + static_children_.size();
+
+    if (!first_byte_index_.empty())
+    {
+      auto byte = static_cast<unsigned char>(segment[0]);
+      end = static_children_.data() + first_byte_index_[byte + 1];
+      entry = static_children_.data() + first_byte_index_[byte];
     }
 
-    // check if the path is a prefix of the node path
-    if (child_length > path_length)
-      return false;
+    // Children sharing a prefix end up in the same range: search it by
+    // bisection once it is large.
+    if (static_cast<size_t>(end - entry) >= first_byte_dispatch_threshold)
+    {
+      entry = std::lower_bound(entry, end, segment,
+                               [](const child_entry& a, std::string_view b)
+                               {
+                                 return a.path < b;
+                               });
+      end = std::min(entry + 1, end);
+    }
 
-    if (child_length == path_length)
-      return true;
+    for (; entry != end; entry++)
+    {
+      if (entry->path.size() == segment.size()
+          && std::memcmp(entry->path.data(), segment.data(), segment.size()) == 0)
+        return entry->node;
+    }
 
-    return path[i] == '/';
+    return nullptr;
   }
 
   route_node&
     route_node::find_child(std::string_view path) const noexcept
   {
-    for (const auto& child : children_)
-    {
-      if (paths_match(child->path_, path))
-        return *child;
-    }
+    std::string_view segment = path.substr(0, path.find('/'));
+
+    if (auto child = find_static_child(segment))
+      return *child;
 
-    if (has_path_parameter_children_)
+    if (path_parameter_child_)
       return *path_parameter_child_;
 
+    if (wildcard_child_)
+      return *wildcard_child_;
+
     return route_tree::unknown_route;
   }
 
   route_node& route_node::serve_files(std::filesystem::path&& location)
   {
-    handlers_[static_cast<size_t>(http_method::get)] =
-      std::make_unique<handler_type>(
-        [this, location = std::move(location)](const http_request& request,
-                                               http_response& response)
-        {
-          pine::serve_files(path_, request, response, location);
-        });
+    add_child("*file").add_handler(
+      http_method::get,
+      [location](const http_request& request, http_response& response)
+      {
+        auto file = request.get_path_params().find("file");
+        pine::serve_files(file ? file->second : "", response, location);
+      });
+
+    add_handler(http_method::get,
+                [location = std::move(location)](const http_request&,
+                                                 http_response& response)
+                {
+                  pine::serve_files("", response, location);
+                });
 
-    http_method_mask_ |= 1 << static_cast<size_t>(http_method::get);
+    return *this;
+  }
 
+  route_node& route_node::limit_rate(const rate_limit_options& options)
+  {
+    rate_limiter_ = std::make_unique<pine::rate_limiter>(options);
     return *this;
   }
 }
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <route_publisher.h>
+#include <route_tree.h>
+#include <utility>
+
+namespace
+{
+  /// @brief Get the shard of the reader counts the thread updates.
+  size_t shard_index(size_t shard_count) noexcept
+  {
+    static std::atomic<size_t> next_index = 0;
+    thread_local size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed);
+    return index % shard_count;
+  }
+}
+
+namespace pine
+{
+  route_publisher::route_publisher(std::unique_ptr<route_tree> routes)
+    : current_(routes.release())
+  {}
+
+  route_publisher::~route_publisher()
+  {
+    delete current_.load();
+  }
+
+  route_publisher::guard route_publisher::pin() const noexcept
+  {
+    size_t shard = shard_index(shard_count);
+
+    for (;;)
+    {
+      uint64_t epoch = epoch_.load();
+      size_t parity = epoch & 1;
+      shards_[shard].readers[parity].fetch_add(1);
+
+      // The epoch may have advanced before the reader was counted, in which
+      // case the writer may not have seen it: count it in the new epoch.
+      if (epoch_.load() == epoch)
+        return guard{ this, shard, parity, current_.load() };
+
+      unpin(shard, parity);
+    }
+  }
+
+  void route_publisher::publish(std::unique_ptr<route_tree> routes)
+  {
+    std::lock_guard lock{ mutex_ };
+
+    std::unique_ptr<route_tree> previous{ current_.exchange(routes.release()) };
+    retired_.push_back({ std::move(previous), epoch_.load() });
+
+    reclaim_locked();
+  }
+
+  void route_publisher::reclaim()
+  {
+    std::lock_guard lock{ mutex_ };
+    reclaim_locked();
+  }
+
+  size_t route_publisher::retired_count() const
+  {
+    std::lock_guard lock{ mutex_ };
+    return retired_.size();
+  }
+
+  bool route_publisher::try_advance() noexcept
+  {
+    uint64_t epoch = epoch_.load();
+
+    // The previous epoch has the parity of the next one.
+    size_t previous_parity = (epoch + 1) & 1;
+    for (const auto& shard : shards_)
+    {
+      if (shard.readers[previous_parity].load() != 0)
+        return false;
+    }
+
+    epoch_.store(epoch + 1);
+    return true;
+  }
+
+  void route_publisher::reclaim_locked()
+  {
+    if (retired_.empty())
+      return;
+
+    // Two advances end the epoch of the last replaced tree.
+    if (try_advance())
+      try_advance();
+
+    uint64_t epoch = epoch_.load();
+    std::erase_if(retired_,
+                  [epoch](const retired_routes& retired)
+                  {
+                    return retired.epoch + 2 <= epoch;
+                  });
+  }
+}
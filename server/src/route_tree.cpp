@@ -1,23 +1,116 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <expected.h>
+#include <functional>
 #include <http.h>
 #include <memory>
+#include <path_params.h>
 #include <route_node.h>
 #include <route_path.h>
 #include <route_tree.h>
 #include <string_view>
-#include <unordered_map>
+#include <tuple>
 #include <utility>
 
+namespace
+{
+  /// @brief A route found for a path, with the positions of its path
+  /// parameters in the path.
+  struct cache_entry
+  {
+    /// @brief Generation of the tree when the entry was filled, 0 while the
+    /// entry is empty.
+    uint64_t generation = 0;
+    size_t hash = 0;
+    const pine::route_node* node = nullptr;
+    uint8_t path_size = 0;
+    uint8_t param_count = 0;
+
+    /// @brief Hits of the entry not yet offset by misses of other paths
+    /// mapped to it. The entry is only replaced once it drops to 0, so that
+    /// cold paths do not evict the hot ones.
+    uint8_t frequency = 0;
+    std::array<char, pine::route_tree::cache_max_path> path{};
+    std::array<std::string_view, pine::path_params::max_params> names{};
+    std::array<std::pair<uint8_t, uint8_t>, pine::path_params::max_params> values{};
+  };
+
+  /// @brief Number of entries of a set of the route cache.
+  constexpr size_t cache_ways = 2;
+
+  /// @brief Number of sets of the route cache.
+  constexpr size_t cache_sets = pine::route_tree::cache_size / cache_ways;
+
+  /// @brief Route cache of the thread, as sets of entries selected by the
+  /// hash of the path. Entries of every tree share it, told apart by their
+  /// generation.
+  thread_local std::array<cache_entry, pine::route_tree::cache_size> route_cache{};
+
+  /// @brief Highest frequency of a cache entry.
+  constexpr uint8_t max_frequency = 3;
+
+  /// @brief Source of the generations of every tree, so that two trees, or
+  /// two states of a tree, never share one.
+  std::atomic<uint64_t> next_generation = 1;
+
+  /// @brief Get the counters of the route cache the thread updates.
+  size_t counter_index() noexcept
+  {
+    static std::atomic<size_t> next_index = 0;
+    thread_local size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed)
+      % pine::route_tree::cache_counter_count;
+    return index;
+  }
+}
+
 namespace pine
 {
   route_node route_tree::unknown_route("");
 
+  double route_cache_stats::hit_rate() const noexcept
+  {
+    uint64_t lookups = hits + misses;
+    return lookups ? static_cast<double>(hits) / lookups : 0.0;
+  }
+
+  uint64_t route_tree::new_generation() noexcept
+  {
+    return next_generation.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void route_tree::enable_cache(bool enabled) noexcept
+  {
+    cache_enabled_ = enabled;
+    invalidate_cache();
+  }
+
+  void route_tree::invalidate_cache() noexcept
+  {
+    generation_.store(new_generation(), std::memory_order_release);
+  }
+
+  route_cache_stats route_tree::cache_stats() const noexcept
+  {
+    route_cache_stats stats;
+    for (const auto& counter : cache_counters_)
+    {
+      stats.hits += counter.hits.load(std::memory_order_relaxed);
+      stats.misses += counter.misses.load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
   route_node& route_tree::add_route(const route_path& path)
   {
     auto [match, depth, deepest_node] = get_deepest_node(path);
     if (match)
       return deepest_node;
 
+    invalidate_cache();
+
     auto node = &deepest_node;
     const auto& parts = path.parts();
 
@@ -32,63 +125,160 @@ namespace pine
   const route_node&
     route_tree::find_route(std::string_view path) const
   {
-    auto node = root_.get();
-
     if (path == "/")
-      return *node;
+      return *root_;
 
     path.remove_prefix(1);
 
-    for (size_t i = 0; i < path.size();)
+    if (auto node = match(*root_, path, nullptr))
+      return *node;
+
+    return unknown_route;
+  }
+
+  std::tuple<const route_node&, bool, path_params>
+    route_tree::find_route_with_params(std::string_view path) const
+  {
+    if (!cache_enabled_ || path.size() > cache_max_path)
+      return lookup(path);
+
+    uint64_t generation = generation_.load(std::memory_order_acquire);
+    size_t hash = std::hash<std::string_view>{}(path);
+    auto set = &route_cache[hash % cache_sets * cache_ways];
+    auto& counter = cache_counters_[counter_index()];
+
+    for (size_t way = 0; way < cache_ways; way++)
     {
-      auto child = &node->find_child(path.substr(i));
-      if (child == &unknown_route)
-        return unknown_route;
+      auto& entry = set[way];
+      if (entry.generation != generation
+          || entry.hash != hash
+          || std::string_view{ entry.path.data(), entry.path_size } != path)
+        continue;
 
-      node = child;
-      i += node->path().size() + 1;
+      counter.hits.fetch_add(1, std::memory_order_relaxed);
+      if (entry.frequency < max_frequency)
+        entry.frequency++;
+
+      path_params params;
+      for (size_t i = 0; i < entry.param_count; i++)
+      {
+        const auto& [offset, size] = entry.values[i];
+        params.set(entry.names[i], path.substr(offset, size));
+      }
+      return { *entry.node, true, params };
     }
 
-    return *node;
+    counter.misses.fetch_add(1, std::memory_order_relaxed);
+
+    auto result = lookup(path);
+    const auto& [node, found, params] = result;
+
+    // Unknown paths are not cached, so that scans do not evict the routes.
+    if (!found)
+      return result;
+
+    // Replace the least used entry of the set, once misses have worn its
+    // frequency down.
+    auto& entry = *std::min_element(set, set + cache_ways,
+                                    [generation](const auto& a, const auto& b)
+                                    {
+                                      return (a.generation == generation ? a.frequency + 1 : 0)
+                                        < (b.generation == generation ? b.frequency + 1 : 0);
+                                    });
+
+    if (entry.generation == generation && entry.frequency > 0)
+      entry.frequency--;
+    else
+    {
+      entry.frequency = 0;
+      entry.generation = generation;
+      entry.hash = hash;
+      entry.node = &node;
+      entry.path_size = static_cast<uint8_t>(path.size());
+      std::copy(path.begin(), path.end(), entry.path.begin());
+      entry.param_count = static_cast<uint8_t>(params.size());
+      for (size_t i = 0; i < params.size(); i++)
+      {
+        entry.names[i] = params[i].first;
+        entry.values[i] = {
+          static_cast<uint8_t>(params[i].second.data() - path.data()),
+          static_cast<uint8_t>(params[i].second.size())
+        };
+      }
+    }
+
+    return result;
   }
 
-  std::tuple<const route_node&,
-    bool,
-    std::unordered_map<std::string, std::string_view>>
-    route_tree::find_route_with_params(std::string_view path) const
+  std::tuple<const route_node&, bool, path_params>
+    route_tree::lookup(std::string_view path) const
   {
-    auto node = root_.get();
-    std::unordered_map<std::string, std::string_view> params;
+    path_params params;
 
     if (path == "/")
-      return { *node, true, params };
+      return { *root_, true, params };
 
     path.remove_prefix(1);
 
-    for (size_t i = 0; i < path.size();)
-    {
-      auto child = &node->find_child(path.substr(i));
-      if (child == &unknown_route)
-        return { *node, false, params };
+    if (auto node = match(*root_, path, &params))
+      return { *node, true, params };
+
+    return { unknown_route, false, params };
+  }
+
+  const route_node* route_tree::match(const route_node& root,
+                                      std::string_view path,
+                                      path_params* params)
+  {
+    const route_node* node = &root;
 
-      if (child->is_path_parameter())
+    // The deepest wildcard passed so far, and what it would capture.
+    const route_node* wildcard = nullptr;
+    std::string_view wildcard_value;
+    size_t wildcard_params = 0;
+
+    while (node && !path.empty())
+    {
+      if (auto child = node->wildcard_child())
       {
-        std::string_view param_name = child->path().substr(1);
-        size_t end = path.find_first_of("/", i);
-        if (end == std::string_view::npos)
-          end = path.size();
+        wildcard = child;
+        wildcard_value = path;
+        wildcard_params = params ? params->size() : 0;
+      }
 
-        params[std::string(param_name)] = path.substr(i, end - i);
+      size_t end = path.find('/');
+      std::string_view segment = path.substr(0, end);
+      path = end == std::string_view::npos
+        ? std::string_view{}
+        : path.substr(end + 1);
 
-        i = end + 1;
+      if (auto child = node->find_static_child(segment))
+        node = child;
+      else if (auto child = node->path_parameter_child())
+      {
+        if (params)
+          params->set(child->path().substr(1), segment);
+        node = child;
       }
       else
-        i += child->path().size() + 1;
+        node = nullptr;
+    }
 
-      node = child;
+    // A node without handlers only prefixes other routes, so the wildcard
+    // is a better match.
+    if (node && (node->has_handlers() || !wildcard))
+      return node;
+
+    if (!wildcard)
+      return nullptr;
+
+    if (params)
+    {
+      params->truncate(wildcard_params);
+      params->set(wildcard->path().substr(1), wildcard_value);
     }
 
-    return { *node, true, params };
+    return wildcard;
   }
 
   std::tuple<bool, size_t, route_node&>
@@ -104,12 +294,23 @@ namespace pine
 
     for (size_t i = 0; i < path.size();)
     {
-      auto child = &node->find_child(path.substr(i));
-      if (child == &unknown_route)
+      std::string_view segment = path.substr(i, path.find('/', i) - i);
+
+      // Parameters and wildcards only match a child of the same name, so
+      // that conflicting names are reported when the child is added.
+      route_node* child = node->find_static_child(segment);
+      if (!child && node->path_parameter_child()
+          && node->path_parameter_child()->path() == segment)
+        child = node->path_parameter_child();
+      if (!child && node->wildcard_child()
+          && node->wildcard_child()->path() == segment)
+        child = node->wildcard_child();
+
+      if (!child)
         return { false, depth, *node };
 
       node = child;
-      i += node->path().size() + 1;
+      i += segment.size() + 1;
       depth++;
     }
 
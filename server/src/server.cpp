@@ -1,3 +1,6 @@
+#include <connection_slab.h>
+#include <algorithm>
+#include <cassert>
 #include <coroutine.h>
 #include <cstdint>
 #include <error.h>
@@ -9,14 +12,19 @@
 #include <http_response.h>
 #include <initializer_list>
 #include <iocp.h>
-#include <loguru.hpp>
+#include <log_sink.h>
 #include <memory>
+#include <metrics.h>
+#include <request_trace.h>
 #include <route_node.h>
 #include <route_path.h>
 #include <route_tree.h>
 #include <server.h>
 #include <server_connection.h>
 #include <string>
+#include <task.h>
+#include <thread>
+#include <topology.h>
 #include <type_traits>
 #include <vector>
 #include <WinSock2.h>
@@ -28,8 +36,8 @@
 
 namespace pine
 {
-  server::server(const char* port)
-    : iocp_{},
+  server::server(const char* port, const server_options& options)
+    : options_{ options },
     port{ port }
   {
     for (const auto& [status_code, status_string] : http_status_strings)
@@ -41,8 +49,38 @@ namespace pine
           res.set_status(status_code);
         };
     }
+
+    routes_.current().enable_cache(options_.route_cache);
+
+    if constexpr (tracing_enabled)
+      phases_ = std::make_unique<phase_histograms>();
+
+    if (options_.rate_limit)
+      rate_limiter_.emplace(*options_.rate_limit);
+
+    if (options_.access_log)
+      access_log_.emplace(*options_.access_log);
+
+    // Rendered even without a concurrency limit: requests finding the queue
+    // of the thread pool full are shed too.
+    http_response shed_response;
+    shed_response.set_status(http_status::service_unavailable);
+    shed_response.set_header("Connection", "close");
+    if (options_.concurrency_limit)
+    {
+      limiter_.emplace(*options_.concurrency_limit);
+      shed_response.set_header(
+        "Retry-After",
+        std::to_string(options_.concurrency_limit->retry_after.count()));
+    }
+    shed_response.set_body(
+      http_status_strings.at(http_status::service_unavailable));
+    shed_response_ = shed_response.to_string();
+    assert(!shed_response_.empty());
   }
 
+  server::~server() = default;
+
   std::expected<void, error> server::start()
   {
     if (const auto& init_result = initialize_wsa();
@@ -64,39 +102,40 @@ namespace pine
     setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR,
                (char*)&opt, sizeof(opt));
 
-    // Increase the buffer size.
-    int socket_buffer_size = 0;
-    setsockopt(server_socket, SOL_SOCKET, SO_RCVBUF,
-               (char*)&socket_buffer_size, sizeof(socket_buffer_size));
-    setsockopt(server_socket, SOL_SOCKET, SO_SNDBUF,
-               (char*)&socket_buffer_size, sizeof(socket_buffer_size));
+    // Accepted sockets inherit the buffer sizes of the listening socket.
+    if (options_.receive_buffer_size)
+      setsockopt(server_socket, SOL_SOCKET, SO_RCVBUF,
+                 (char*)&*options_.receive_buffer_size,
+                 sizeof(*options_.receive_buffer_size));
+    if (options_.send_buffer_size)
+      setsockopt(server_socket, SOL_SOCKET, SO_SNDBUF,
+                 (char*)&*options_.send_buffer_size,
+                 sizeof(*options_.send_buffer_size));
 
     if (const auto& bind_result = bind_socket(server_socket,
                                               address_info);
         !bind_result)
       return std::make_unexpected(bind_result.error());
 
-    if (const auto& listen_result = listen_socket(server_socket, SOMAXCONN);
+    int backlog = options_.backlog > 0 ? options_.backlog : SOMAXCONN;
+    if (const auto& listen_result = listen_socket(server_socket, backlog);
         !listen_result)
       return std::make_unexpected(listen_result.error());
 
     is_listening = true;
 
-    LOG_F(INFO, "Server socket initialized. Will start receiving requests soon.");
+    PINE_LOG(info, "Server socket initialized. Will start receiving requests soon.");
 
-    iocp_.init(server_socket);
-    iocp_.set_on_accept([this](const pine::iocp_operation_data* data) { on_accept(data); });
-    iocp_.set_on_read([this](const pine::iocp_operation_data* data) { on_read(data); });
-    iocp_.set_on_write([this](const pine::iocp_operation_data* data) { on_write(data); });
-    iocp_.associate(server_socket);
+    start_event_loops();
+    loops_.front()->iocp.associate(server_socket);
 
-    LOG_F(INFO, "IOCP initialized.");
+    PINE_LOG(info, "IOCP initialized.");
 
     if (const auto& accept_result = accept_clients();
         !accept_result)
       return std::make_unexpected(accept_result.error());
 
-    LOG_F(INFO, "Accepting clients.");
+    PINE_LOG(info, "Accepting clients.");
 
     return {};
   }
@@ -105,32 +144,88 @@ namespace pine
   {
     is_listening = false;
 
-    LOG_F(INFO, "Stopping server.");
+    PINE_LOG(info, "Stopping server.");
 
     close_socket(server_socket);
 
     delete address_info;
 
-    for (const auto& [id, client] : clients)
+    for (const auto& loop : loops_)
     {
-      client->close();
+      loop->clients.for_each_acquired([](server_connection& client)
+                                      {
+                                        client.close();
+                                      });
     }
 
-    clients.clear();
+    PINE_LOG(info, "Server stopped.");
+    log_sink::instance().flush();
+  }
+
+  server::event_loop::event_loop(const server_options& options,
+                                 size_t first_id,
+                                 uint32_t node)
+    : connections(node_allocated::block_size_for<server_connection>, node),
+    read_buffers(options.get_message_limits().max_message_size(), node),
+    arenas(options.request_arena_size, node),
+    clients(options.max_connections, first_id)
+  {}
+
+  void server::start_event_loops()
+  {
+    const auto& affinity = options_.affinity;
+    const std::vector<processor> processors =
+      affinity.empty() ? get_processors() : affinity;
 
-    LOG_F(INFO, "Server stopped.");
+    if (options_.mode == server_mode::thread_per_core)
+    {
+      size_t loop_count = options_.worker_threads
+        ? options_.worker_threads
+        : processors.size();
+
+      for (size_t i = 0; i < loop_count; i++)
+      {
+        const processor& target = processors[i % processors.size()];
+        auto& loop = add_event_loop(target.node);
+        loop.iocp.init(server_socket, 1);
+        loop.iocp.pin_threads({ &target, 1 });
+      }
+    }
+    else
+    {
+      auto& loop = add_event_loop(processors.front().node);
+      loop.iocp.init(server_socket, options_.worker_threads);
+      if (!affinity.empty())
+        loop.iocp.pin_threads(affinity);
+    }
+
+    PINE_LOG(info, "Started %zu event loops.", loops_.size());
+  }
+
+  server::event_loop& server::add_event_loop(uint32_t node)
+  {
+    auto& loop = *loops_.emplace_back(
+      std::make_unique<event_loop>(options_,
+                                   loops_.size() * options_.max_connections,
+                                   node));
+
+    loop.iocp.set_on_accept([this](const pine::iocp_operation_data* data) { on_accept(data); });
+    loop.iocp.set_on_read([this, &loop](const pine::iocp_operation_data* data) { on_read(loop, data); });
+    loop.iocp.set_on_write([this, &loop](const pine::iocp_operation_data* data) { on_write(loop, data); });
+
+    return loop;
   }
 
   std::expected<void, error> server::accept_clients()
   {
-    // Post 10 accept operations so there is no delay starting a new thread
-    // when a client connects.
+    // Keep several accept operations pending so there is no delay starting
+    // a new thread when a client connects.
 
-    LOG_F(INFO, "Posting 10 accept operations.");
+    PINE_LOG(info, "Posting %zu accept operations.", options_.accept_depth);
 
-    for (size_t i = 0; i < 10; i++)
+    for (size_t i = 0; i < options_.accept_depth; i++)
     {
-      if (!iocp_.post(iocp_operation::accept, server_socket, {}, 0))
+      if (!loops_.front()->iocp.post(iocp_operation::accept, server_socket, {}, 0))
         return std::make_unexpected(error(error_code::iocp_error,
                                           "Failed to post accept operation: " + std::to_string(WSAGetLastError())));
     }
@@ -138,40 +233,47 @@ namespace pine
     return {};
   }
 
-  async_operation<void> server::remove_client(uint64_t const& client_id)
+  std::expected<void, error> server::remove_client(uint64_t client_id)
   {
-    std::unique_lock lock{ clients_mutex_ };
-
-    const auto& it = clients.find(client_id);
-    if (it == clients.end())
+    server_connection* client = nullptr;
+    for (const auto& loop : loops_)
     {
-      LOG_F(WARNING, "Attempting to remove non-existent client: % zu", client_id);
-      co_return error(error_code::client_not_found,
-                      "The client was not found.");
+      if (loop->clients.owns(client_id))
+        client = loop->clients.acquire(client_id);
     }
 
-    LOG_F(INFO, "Removing client: %zu. Remaining clients: %llu", client_id, clients.size() - 1);
+    if (!client)
+    {
+      PINE_LOG(warning, "Attempting to remove non-existent client: %zu", client_id);
+      return std::make_unexpected(error(error_code::client_not_found,
+                                        "The client was not found."));
+    }
 
-    auto&& client = std::move(it->second);
-    clients.erase(it);
+    client->close();
+    client->release();
 
-    co_return{};
+    return {};
   }
 
-  route_node&
-    server::add_route(route_path path,
-                      const std::function<void(const http_request&,
-                                               http_response&)>& handler,
-                      const std::initializer_list<http_method>& methods)
+  void server::release_client(event_loop& loop, uint64_t client_id)
   {
-    auto& new_route = routes.add_route(path);
-    for (const auto& method : methods)
+    if (!loop.clients.remove(client_id))
     {
-      new_route.add_handler(method,
-                            std::make_unique<route_tree::handler_type>(handler));
+      PINE_LOG(warning, "Attempting to release non-existent client: %zu", client_id);
+      return;
     }
 
-    LOG_F(INFO, "Added route: %s", path.get().data());
+    metrics_.add(server_counter::disconnects);
+
+    PINE_LOG(debug, "Removed client: %zu. Remaining clients on its loop: %zu",
+              client_id, loop.clients.size());
+  }
+
+  route_node& server::add_route_node(route_path path, std::string_view kind)
+  {
+    auto& new_route = routes_.current().add_route(path);
+
+    PINE_LOG(info, "Added %s: %s", kind, path.get());
 
     return new_route;
   }
@@ -180,15 +282,43 @@ namespace pine
                                        std::filesystem::path&&
                                        location)
   {
-    auto& new_route = routes.add_route(path);
+    auto& new_route = routes_.current().add_route(path);
 
     new_route.serve_files(std::move(location));
+    routes_.current().invalidate_cache();
 
-    LOG_F(INFO, "Added static route: %s", path.get().data());
+    PINE_LOG(info, "Added static route: %s", path.get());
 
     return new_route;
   }
 
+  std::string server::render_metrics() const
+  {
+    std::string output;
+    prometheus::write(output, metrics_.snapshot());
+
+    auto routes = routes_.pin();
+    prometheus::write(output, routes.routes());
+    if (route_table_metrics_)
+      route_table_metrics_(output);
+
+    if (phases_)
+      prometheus::write(output, *phases_);
+
+    return output;
+  }
+
+  route_node& server::add_metrics_route(route_path path)
+  {
+    return add_route(
+      path,
+      [this](const http_request&, http_response& response)
+      {
+        response.set_header("Content-Type", "text/plain; version=0.0.4");
+        response.set_body(render_metrics());
+      });
+  }
+
   void server::add_error_handler(http_status status, callback_function&& callback)
   {
     error_handlers[status] = std::move(callback);
@@ -197,55 +327,92 @@ namespace pine
   const route_node&
     server::get_route(std::string_view path) const
   {
-    return routes.find_route(path);
+    return routes_.current().find_route(path);
+  }
+
+  void server::publish_routes(std::unique_ptr<route_tree> routes)
+  {
+    routes->enable_cache(options_.route_cache);
+    routes_.publish(std::move(routes));
+
+    PINE_LOG(info, "Published new routes");
   }
 
   void server::on_accept(const iocp_operation_data* data)
   {
     const auto& client_socket = data->socket;
-    LOG_F(INFO, "New client connection accepted: %zu", client_socket);
+    PINE_LOG(debug, "New client connection accepted: %zu", client_socket);
+
+    // The connection is served by a single loop from now on. In thread per
+    // core mode the loops take the connections in turn.
+    auto& loop = *loops_[next_loop_.fetch_add(1, std::memory_order_relaxed)
+      % loops_.size()];
+
+    if (!loop.iocp.associate(client_socket))
+    {
+      closesocket(client_socket);
+      loops_.front()->iocp.post(iocp_operation::accept, server_socket, {}, 0);
+      return;
+    }
 
-    const auto& client = std::make_shared<server_connection<buffer_size>>(client_socket,
-                                                                          *this);
+    if (options_.no_delay)
     {
-      std::unique_lock lock{ clients_mutex_ };
-      clients[data->socket] = client;
-      LOG_F(INFO, "Client added to the list: %zu", client_socket);
+      BOOL no_delay = TRUE;
+      setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY,
+                 (char*)&no_delay, sizeof(no_delay));
     }
 
-    client->post_read();
+    std::unique_ptr<server_connection> new_client{
+      new (loop.connections) server_connection(client_socket, *this, loop) };
+    auto client = new_client.get();
 
-    iocp_.post(iocp_operation::accept, server_socket, {}, 0);
+    if (uint64_t id = loop.clients.insert(std::move(new_client));
+        id != loop.clients.invalid_id)
+    {
+      PINE_LOG(debug, "Client added to the list: %zu", client_socket);
+      metrics_.add(server_counter::accepts);
+
+      // Hold a reference while setting up the connection, so that it cannot
+      // be released until post_read returns.
+      client->set_id(id);
+      client->trace().mark(trace_phase::accepted);
+      client->set_peer_address(get_peer_address(*data));
+      client->retain();
+      client->start_timeouts();
+      client->post_read();
+      client->release();
+    }
+    else
+      PINE_LOG(warning, "Too many clients, rejecting connection: %zu", client_socket);
+
+    loops_.front()->iocp.post(iocp_operation::accept, server_socket, {}, 0);
   }
 
-  void server::on_read(const iocp_operation_data* data)
+  void server::on_read(event_loop& loop, const iocp_operation_data* data)
   {
-    std::shared_ptr<server_connection<buffer_size>> client;
+    // The operation holds a reference on the client, released once its
+    // completion has been handled.
+    auto client = loop.clients.get(data->user_data);
+    if (!client)
     {
-      std::shared_lock lock{ clients_mutex_ };
-
-      const auto& it = clients.find(data->socket);
-      if (it == clients.end())
-        return;
-      client = it->second;
+      PINE_LOG(warning, "Client not found: %zu", data->socket);
+      return;
     }
+
     client->on_read_raw(data);
+    client->release();
   }
 
-  void server::on_write(const iocp_operation_data* data)
+  void server::on_write(event_loop& loop, const iocp_operation_data* data)
   {
-    std::shared_ptr<server_connection<buffer_size>> client;
+    auto client = loop.clients.get(data->user_data);
+    if (!client)
     {
-      std::shared_lock lock{ clients_mutex_ };
-
-      const auto& it = clients.find(data->socket);
-      if (it == clients.end())
-      {
-        LOG_F(WARNING, "Client not found: %zu", data->socket);
-        return;
-      }
-      client = it->second;
+      PINE_LOG(warning, "Client not found: %zu", data->socket);
+      return;
     }
+
     client->on_write_raw(data);
+    client->release();
   }
 }
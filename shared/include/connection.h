@@ -1,13 +1,19 @@
 #pragma once
 
+#include <atomic>
 #include <coroutine.h>
 #include <cstdint>
 #include <error.h>
+#include <http.h>
 #include <iocp.h>
-#include <loguru.hpp>
+#include <log_sink.h>
 #include <memory>
 #include <mutex>
+#include <request_trace.h>
+#include <span>
+#include <string>
 #include <string_view>
+#include <task.h>
 #include <vector>
 
 #ifdef _WIN32
@@ -17,14 +23,41 @@
 
 namespace pine
 {
+  /// @brief Limits on the size of the messages received by a connection.
+  struct message_limits
+  {
+    /// @brief Maximum size of the request line and headers, including the
+    /// empty line ending them.
+    size_t max_header_size = 16 * 1024;
+
+    /// @brief Maximum size of the body.
+    size_t max_body_size = 48 * 1024;
+
+    /// @brief Get the size of the buffer needed to hold the largest message.
+    constexpr size_t max_message_size() const noexcept
+    {
+      return max_header_size + max_body_size;
+    }
+  };
+
   /// @brief A connection base class that is used by the server and the client.
-  template <size_t buffer_size>
   class connection
   {
   public:
-    explicit connection(SOCKET socket, iocp_context& context)
+    /// @brief Construct a connection.
+    /// @param socket The socket of the connection.
+    /// @param context The completion port the socket is associated with.
+    /// @param read_buffer The buffer receiving the messages. It must hold at
+    /// least limits.max_message_size() bytes and outlive the connection.
+    /// @param limits The limits on the size of the messages.
+    explicit connection(SOCKET socket,
+                        iocp_context& context,
+                        std::span<char> read_buffer,
+                        const message_limits& limits)
       : socket_(socket),
-      context_(context)
+      context_(context),
+      read_buffer_(read_buffer),
+      limits_(limits)
     {}
 
     /// @brief Destroy the connection.
@@ -33,11 +66,11 @@ namespace pine
       close();
     }
 
-    /// @brief Close the connection.
+    /// @brief Close the connection. Pending operations complete with an
+    /// error.
     virtual void close()
     {
-      if (bool expected = false;
-        is_closed.compare_exchange_strong(expected, true))
+      if (is_closed.exchange(true))
         return;
 
       if (socket_ == INVALID_SOCKET)
@@ -54,6 +87,122 @@ namespace pine
       return socket_;
     }
 
+    /// @brief Set the address of the peer of the connection.
+    void set_peer_address(const sockaddr_in& address) noexcept
+    {
+      peer_address_ = address;
+    }
+
+    /// @brief Get the address of the peer of the connection.
+    const sockaddr_in& get_peer_address() const noexcept
+    {
+      return peer_address_;
+    }
+
+    /// @brief Set the id of the connection. It is carried by every operation
+    /// posted by the connection and handed back with its completion.
+    void set_id(uint64_t id) noexcept
+    {
+      id_ = id;
+    }
+
+    /// @brief Get the id of the connection.
+    uint64_t get_id() const noexcept
+    {
+      return id_;
+    }
+
+    /// @brief Get the trace of the current request, empty unless built with
+    /// PINE_TRACING.
+    request_trace& trace() noexcept
+    {
+      return trace_;
+    }
+
+    /// @brief Take a reference on the connection.
+    /// @details A connection starts with one reference, released by its owner
+    /// when the connection is closed. Every pending operation holds another
+    /// one until its completion has been handled, so the connection outlives
+    /// the operations it posted.
+    void retain() noexcept
+    {
+      references_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// @brief Take a reference on the connection unless its last one has
+    /// already been released, for callers that do not hold one yet.
+    /// @return True if a reference was taken.
+    bool try_retain() noexcept
+    {
+      uint32_t references = references_.load(std::memory_order_relaxed);
+      while (references != 0)
+      {
+        if (references_.compare_exchange_weak(references, references + 1,
+                                              std::memory_order_relaxed))
+          return true;
+      }
+      return false;
+    }
+
+    /// @brief Release a reference on the connection. Releasing the last one
+    /// calls on_released, which may destroy the connection: the caller must
+    /// not touch it afterwards.
+    void release()
+    {
+      if (references_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        on_released();
+    }
+
+    /// @brief Receive data from the connection.
+    /// @details The awaiting coroutine is resumed on the worker thread that
+    /// dequeues the completion. Do not mix with post_read on the same
+    /// connection.
+    /// @param buffer The buffer to fill.
+    /// @return An awaitable resuming with the number of bytes received.
+    socket_read_awaitable read_some(std::span<char> buffer) noexcept
+    {
+      return context_.read(socket_, buffer);
+    }
+
+    /// @brief Send every byte of a list of buffers.
+    /// @details The buffers are advanced in place when the socket accepts
+    /// only part of them, they must stay alive until the task completes.
+    /// @param buffers The buffers to send.
+    /// @return A task resuming with the number of bytes sent.
+    task<std::expected<size_t, pine::error>> write_all(std::span<WSABUF> buffers)
+    {
+      size_t total = 0;
+
+      while (!buffers.empty())
+      {
+        auto result = co_await context_.write(socket_, buffers);
+        if (!result)
+          co_return std::make_unexpected(result.error());
+
+        size_t written = result.value();
+        if (written == 0)
+          co_return std::make_unexpected(
+            error(error_code::connection_closed,
+                  "The peer closed the connection."));
+
+        total += written;
+
+        while (!buffers.empty() && written >= buffers.front().len)
+        {
+          written -= buffers.front().len;
+          buffers = buffers.subspan(1);
+        }
+
+        if (!buffers.empty())
+        {
+          buffers.front().buf += written;
+          buffers.front().len -= static_cast<ULONG>(written);
+        }
+      }
+
+      co_return total;
+    }
+
     /// @brief This function is called when a message is received.
     /// @param message The message that was received.
     virtual void on_read(std::string_view message) = 0;
@@ -61,6 +210,20 @@ namespace pine
     /// @brief This function is called when a message is sent.
     virtual void on_write() = 0;
 
+    /// @brief This function is called when data was received but the message
+    /// is not complete yet.
+    /// @param headers_received Whether all the headers have been received.
+    virtual void on_partial_read(bool headers_received) {}
+
+    /// @brief This function is called when the message received exceeds the
+    /// limits of the connection. No more data is read. Closes the connection
+    /// by default.
+    /// @param status request_header_fields_too_large or payload_too_large.
+    virtual void on_read_error(http_status status)
+    {
+      close();
+    }
+
     /// @brief Handle a read operation.
     /// @param data The data of the operation.
     void on_read_raw(const iocp_operation_data* data)
@@ -81,23 +244,60 @@ namespace pine
       {
         std::lock_guard lock{ buffer_mutex };
 
+        if (message_size_ == 0)
+          trace_.mark(trace_phase::first_byte);
+
         message_size_ += bytes_transferred;
-        if (message_size_ >= buffer_size)
+
+        std::string_view message{ read_buffer_.data(), message_size_ };
+
+        // Keep reading until the headers and the body announced by
+        // Content-Length have been received.
+        size_t headers_end = message.find("\r\n\r\n");
+        if (headers_end == std::string_view::npos)
+        {
+          if (message_size_ >= limits_.max_header_size)
+          {
+            reject(http_status::request_header_fields_too_large);
+            return;
+          }
+
+          on_partial_read(false);
+          post_read();
+          return;
+        }
+
+        if (headers_end + 4 > limits_.max_header_size)
         {
-          LOG_F(WARNING,
-            "Connection %zu tried to send a message that was too large",
-            get_socket());
-          close();
+          reject(http_status::request_header_fields_too_large);
           return;
         }
 
-        if (data->flags & MSG_PARTIAL)
+        auto content_length =
+          http_utils::get_content_length(message.substr(0, headers_end + 2));
+        if (!content_length)
         {
+          // Framing the message as bodiless would let the bytes that follow
+          // be read as another request.
+          reject(http_status::bad_request);
+          return;
+        }
+
+        if (*content_length > limits_.max_body_size)
+        {
+          reject(http_status::payload_too_large);
+          return;
+        }
+
+        size_t message_end = headers_end + 4 + *content_length;
+        if (message_size_ < message_end)
+        {
+          on_partial_read(true);
           post_read();
           return;
         }
 
-        on_read(std::string_view{ read_buffer_.data(), message_size_ });
+        on_read(message.substr(0, message_end));
       }
 
       message_size_ = 0;
@@ -108,13 +308,14 @@ namespace pine
     void on_write_raw(const iocp_operation_data* data)
     {
       write_pending = false;
+      trace_.mark(trace_phase::write_completed);
 
       if (is_closed)
         return;
 
       if (data->bytes_transferred == 0)
       {
-        LOG_F(WARNING, "Connection %zu failed to write message", get_socket());
+        PINE_LOG(warning, "Connection %zu failed to write message", get_socket());
         close();
         return;
       }
@@ -125,50 +326,82 @@ namespace pine
     /// @brief Post a read operation to the thread pool.
     void post_read()
     {
-      std::lock_guard lock{ read_mutex };
+      {
+        std::lock_guard lock{ read_mutex };
 
-      if (is_closed || read_pending)
-        return;
+        if (is_closed || read_pending)
+          return;
 
-      WSABUF wsa_buffer{};
-      wsa_buffer.buf = read_buffer_.data();
-      wsa_buffer.len = buffer_size;
+        WSABUF wsa_buffer{};
+        wsa_buffer.buf = read_buffer_.data() + message_size_;
+        wsa_buffer.len = static_cast<ULONG>(read_buffer_.size() - message_size_);
 
-      if (!context_.post(iocp_operation::read, socket_, wsa_buffer, 0))
-      {
-        LOG_F(WARNING, "Failed to post read operation: %d", WSAGetLastError());
-        close();
+        retain();
+        read_pending = true;
+
+        if (context_.post(iocp_operation::read, socket_, wsa_buffer, 0, id_))
+          return;
+
+        read_pending = false;
       }
 
-      read_pending = true;
+      PINE_LOG(warning, "Failed to post read operation: %d", WSAGetLastError());
+      release();
+      close();
     }
 
     /// @brief Post a write operation to the thread pool.
-    /// @param raw_message The message to write.
+    /// @param raw_message The message to write. It is not copied and must
+    /// stay alive until the operation completes.
     void post_write(std::string_view raw_message)
     {
-      std::lock_guard lock{ write_mutex };
+      {
+        std::lock_guard lock{ write_mutex };
 
-      if (is_closed || write_pending || raw_message.size() == 0)
-        return;
+        if (is_closed || write_pending || raw_message.size() == 0)
+          return;
 
-      write_buffer_.fill(0);
-      std::ranges::copy(raw_message, write_buffer_.begin());
+        WSABUF wsa_buffer{};
+        wsa_buffer.buf = const_cast<char*>(raw_message.data());
+        wsa_buffer.len = static_cast<ULONG>(raw_message.size());
 
-      WSABUF wsa_buffer{};
-      wsa_buffer.buf = write_buffer_.data();
-      wsa_buffer.len = static_cast<ULONG>(raw_message.size());
+        retain();
+        write_pending = true;
+        trace_.mark(trace_phase::write_posted);
 
-      if (!context_.post(iocp_operation::write, socket_, wsa_buffer, 0))
-      {
-        LOG_F(WARNING, "Failed to post write operation: %d", WSAGetLastError());
-        close();
+        if (context_.post(iocp_operation::write, socket_, wsa_buffer, 0, id_))
+          return;
+
+        write_pending = false;
       }
 
-      write_pending = true;
+      PINE_LOG(warning, "Failed to post write operation: %d", WSAGetLastError());
+      release();
+      close();
     }
 
   protected:
+    /// @brief Called when the last reference on the connection is released.
+    virtual void on_released() {}
+
+    /// @brief Get the buffer receiving the messages.
+    std::span<char> get_read_buffer() const noexcept
+    {
+      return read_buffer_;
+    }
+
+    /// @brief Stop reading and report a message exceeding the limits or
+    /// that cannot be framed.
+    /// @param status The status describing the reason.
+    void reject(http_status status)
+    {
+      PINE_LOG(warning,
+               "Rejecting the message of connection %zu with status %d",
+               get_socket(), static_cast<int>(status));
+      message_size_ = 0;
+      on_read_error(status);
+    }
+
     std::atomic_bool write_pending = false;
     std::atomic_bool read_pending = false;
     std::atomic_bool is_closed = false;
@@ -184,8 +417,21 @@ namespace pine
 
     iocp_context& context_;
 
-    std::array<char, buffer_size> read_buffer_;
-    std::array<char, buffer_size> write_buffer_;
+    /// @brief The id of the connection, given to the operations it posts.
+    uint64_t id_ = 0;
+
+    /// @brief The address of the peer.
+    sockaddr_in peer_address_{};
+
+    /// @brief The number of references on the connection.
+    std::atomic<uint32_t> references_ = 1;
+
+    std::span<char> read_buffer_;
     size_t message_size_ = 0;
+
+    message_limits limits_;
+
+    /// @brief Takes no room unless built with PINE_TRACING.
+    PINE_NO_UNIQUE_ADDRESS request_trace trace_;
   };
 }
\ No newline at end of file
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pine
+{
+  /// @brief Fixed capacity table of connections indexed by slot.
+  /// @details Each connection is identified by a 64-bit id made of its slot
+  /// index (low 32 bits) and of the generation of the slot (high 32 bits).
+  /// The id travels with every I/O operation, so a completion finds its
+  /// connection with one array access and no lock. The generation changes
+  /// every time a slot is reused, which makes completions that outlive their
+  /// connection miss instead of reaching the next connection of the slot.
+  ///
+  /// Only inserting, removing and acquiring take a lock, to maintain the
+  /// list of free slots and to keep a connection alive while it is
+  /// retained. Looking up never does.
+  ///
+  /// Slabs used side by side can be given disjoint ranges of slot indices, so
+  /// that the ids of their connections never collide.
+  /// @tparam T The type of the connections.
+  template <typename T>
+  class connection_slab
+  {
+  public:
+    /// @brief Id that never matches a connection.
+    static constexpr uint64_t invalid_id = ~uint64_t{ 0 };
+
+    /// @brief Construct a slab.
+    /// @param capacity The maximum number of connections.
+    /// @param first_index The slot index used in the id of the first slot.
+    explicit connection_slab(size_t capacity, size_t first_index = 0)
+      : slots_(std::make_unique<slot[]>(capacity)),
+      capacity_(capacity),
+      first_index_(first_index)
+    {
+      free_slots_.reserve(capacity);
+      for (size_t i = capacity; i > 0; i--)
+        free_slots_.push_back(static_cast<uint32_t>(i - 1));
+    }
+
+    connection_slab(const connection_slab&) = delete;
+    connection_slab& operator=(const connection_slab&) = delete;
+
+    ~connection_slab()
+    {
+      for (size_t i = 0; i < capacity_; i++)
+        delete slots_[i].object.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Insert a connection.
+    /// @param object The connection. The slab takes ownership of it.
+    /// @return The id of the connection, or invalid_id if the slab is full,
+    /// in which case the connection is destroyed.
+    uint64_t insert(std::unique_ptr<T> object)
+    {
+      uint32_t index;
+      {
+        std::lock_guard lock{ mutex_ };
+        if (free_slots_.empty())
+          return invalid_id;
+
+        index = free_slots_.back();
+        free_slots_.pop_back();
+      }
+
+      slot& target = slots_[index];
+      uint32_t generation =
+        target.generation.load(std::memory_order_relaxed) + 1;
+
+      target.object.store(object.release(), std::memory_order_relaxed);
+      target.generation.store(generation, std::memory_order_release);
+      size_.fetch_add(1, std::memory_order_relaxed);
+
+      return make_id(index, generation);
+    }
+
+    /// @brief Check whether an id designates a slot of this slab, whether or
+    /// not the connection it designated still exists.
+    /// @param id The id of a connection.
+    bool owns(uint64_t id) const noexcept
+    {
+      return slot_of(id) < capacity_;
+    }
+
+    /// @brief Find a connection. The caller must already hold a reference
+    /// on it, such as the one of a pending operation; otherwise use acquire.
+    /// @param id The id of the connection.
+    /// @return The connection, or nullptr if the id is stale or invalid.
+    T* get(uint64_t id) const noexcept
+    {
+      size_t index = slot_of(id);
+      if (index >= capacity_)
+        return nullptr;
+
+      const slot& target = slots_[index];
+      auto generation = static_cast<uint32_t>(id >> 32);
+      if (target.generation.load(std::memory_order_acquire) != generation)
+        return nullptr;
+
+      T* object = target.object.load(std::memory_order_acquire);
+
+      // The slot may have been reused between the two loads.
+      if (target.generation.load(std::memory_order_acquire) != generation)
+        return nullptr;
+
+      return object;
+    }
+
+    /// @brief Find a connection and take a reference on it, so that it is
+    /// not destroyed while in use. T must provide try_retain, taking a
+    /// reference unless the last one is already gone, and release.
+    /// @param id The id of the connection.
+    /// @return The connection, which the caller must release, or nullptr if
+    /// the id is stale or invalid or the connection is being destroyed.
+    T* acquire(uint64_t id)
+    {
+      size_t index = slot_of(id);
+      if (index >= capacity_)
+        return nullptr;
+
+      // Removing takes the lock too, so the connection cannot be removed,
+      // and then destroyed, between the check and the reference.
+      std::lock_guard lock{ mutex_ };
+      slot& target = slots_[index];
+      if (target.generation.load(std::memory_order_acquire) !=
+          static_cast<uint32_t>(id >> 32))
+        return nullptr;
+
+      T* object = target.object.load(std::memory_order_acquire);
+      if (!object || !object->try_retain())
+        return nullptr;
+
+      return object;
+    }
+
+    /// @brief Remove a connection from the slab.
+    /// @param id The id of the connection.
+    /// @return The connection, or nullptr if the id is stale or invalid.
+    std::unique_ptr<T> remove(uint64_t id)
+    {
+      size_t index = slot_of(id);
+      if (index >= capacity_)
+        return nullptr;
+
+      slot& target = slots_[index];
+      uint32_t generation = static_cast<uint32_t>(id >> 32);
+
+      std::lock_guard lock{ mutex_ };
+      if (!target.generation.compare_exchange_strong(generation,
+                                                     generation + 1,
+                                                     std::memory_order_acq_rel))
+        return nullptr;
+
+      std::unique_ptr<T> object{
+        target.object.exchange(nullptr, std::memory_order_acq_rel) };
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      free_slots_.push_back(static_cast<uint32_t>(index));
+
+      return object;
+    }
+
+    /// @brief Call a function on every connection of the slab. Connections
+    /// inserted or removed concurrently may or may not be visited, and must
+    /// not be: use for_each_acquired when connections may be removed.
+    /// @param function The function to call with a reference to the
+    /// connection.
+    template <typename function_t>
+    void for_each(function_t&& function) const
+    {
+      for (size_t i = 0; i < capacity_; i++)
+      {
+        if (T* object = slots_[i].object.load(std::memory_order_acquire))
+          function(*object);
+      }
+    }
+
+    /// @brief Call a function on every connection of the slab, holding a
+    /// reference on it as acquire does. Connections inserted or removed
+    /// concurrently may or may not be visited.
+    /// @param function The function to call with a reference to the
+    /// connection.
+    template <typename function_t>
+    void for_each_acquired(function_t&& function)
+    {
+      std::vector<T*> objects;
+      {
+        std::lock_guard lock{ mutex_ };
+        for (size_t i = 0; i < capacity_; i++)
+        {
+          T* object = slots_[i].object.load(std::memory_order_acquire);
+          if (object && object->try_retain())
+            objects.push_back(object);
+        }
+      }
+
+      // Released without the lock: releasing the last reference removes the
+      // connection.
+      for (T* object : objects)
+      {
+        function(*object);
+        object->release();
+      }
+    }
+
+    /// @brief Get the number of connections in the slab.
+    size_t size() const noexcept
+    {
+      return size_.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Get the maximum number of connections.
+    size_t capacity() const noexcept
+    {
+      return capacity_;
+    }
+
+  private:
+    uint64_t make_id(uint32_t index, uint32_t generation) const noexcept
+    {
+      return (uint64_t{ generation } << 32) | (first_index_ + index);
+    }
+
+    /// @brief Get the slot designated by an id. Ids of other slabs give an
+    /// index past the capacity.
+    size_t slot_of(uint64_t id) const noexcept
+    {
+      return static_cast<uint32_t>(id) - first_index_;
+    }
+
+    struct slot
+    {
+      std::atomic<uint32_t> generation = 0;
+      std::atomic<T*> object = nullptr;
+    };
+
+    std::unique_ptr<slot[]> slots_;
+    size_t capacity_;
+    size_t first_index_;
+    std::atomic<size_t> size_ = 0;
+
+    /// @brief Guards the free slots, and removals against acquire.
+    std::mutex mutex_;
+    std::vector<uint32_t> free_slots_;
+  };
+}
@@ -9,6 +9,7 @@
 #include <type_traits>
 #include "error.h"
 #include "expected.h"
+#include "frame_allocator.h"
 #include "thread_pool.h"
 
 /// @brief An awaitable coroutine that returns a value.
@@ -20,8 +21,9 @@ struct async_operation
 {
   /// @brief The promise type of the coroutine.
   /// @details The promise type is responsible for managing the coroutine's
-  /// lifetime and returning the result.
-  struct promise_type
+  /// lifetime and returning the result. Its frame is recycled by
+  /// pine::frame_allocator.
+  struct promise_type : pine::frame_allocated
   {
     /// @brief The promise object that holds the result.
     std::shared_ptr<std::promise<std::expected<T, pine::error>>> promise =
@@ -171,7 +173,7 @@ template <>
 struct async_operation<void>
 {
   /// @brief The promise type of the coroutine.
-  struct promise_type
+  struct promise_type : pine::frame_allocated
   {
     std::shared_ptr<std::promise<std::expected<void, pine::error>>> promise =
       std::make_shared<std::promise<std::expected<void, pine::error>>>();
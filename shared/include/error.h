@@ -26,6 +26,7 @@ namespace pine
     invalid_parameter,
     parameter_not_found,
     iocp_error,
+    file_error,
   };
 
   class error
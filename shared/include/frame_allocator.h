@@ -0,0 +1,108 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <memory_resource>
+
+namespace pine
+{
+  /// @brief Allocator for coroutine frames.
+  /// @details Frames are rounded up to a power of two size class and
+  /// recycled through free lists owned by the calling thread, so a thread that
+  /// keeps starting coroutines of similar sizes stops hitting the global heap
+  /// once its pools are warm. Frames larger than the biggest size class go
+  /// straight to the global operator new.
+  class frame_allocator
+  {
+  public:
+    /// @brief Smallest size class, in bytes.
+    static constexpr std::size_t min_frame_size = 64;
+
+    /// @brief Biggest size class, in bytes.
+    static constexpr std::size_t max_frame_size = 4096;
+
+    /// @brief Maximum number of free frames kept per size class and thread.
+    static constexpr std::size_t max_cached_frames = 256;
+
+    /// @brief Allocate a coroutine frame.
+    /// @param size The size of the frame.
+    /// @return A pointer to the frame.
+    static void* allocate(std::size_t size);
+
+    /// @brief Give a coroutine frame back to the pool of the calling thread.
+    /// @param frame The frame to release.
+    /// @param size The size the frame was allocated with.
+    static void deallocate(void* frame, std::size_t size) noexcept;
+  };
+
+  /// @brief Base for promise types whose coroutine frames should come from
+  /// frame_allocator.
+  struct frame_allocated
+  {
+    static void* operator new(std::size_t size)
+    {
+      return frame_allocator::allocate(size);
+    }
+
+    static void operator delete(void* frame, std::size_t size) noexcept
+    {
+      frame_allocator::deallocate(frame, size);
+    }
+  };
+
+  /// @brief Arguments of a coroutine that carry the memory resource its
+  /// frame should be allocated from, such as pine::http_request.
+  template <typename T>
+  concept frame_resource_source = requires(const T& value)
+  {
+    { value.get_resource() } -> std::convertible_to<std::pmr::memory_resource*>;
+  };
+
+  /// @brief Base for promise types whose coroutine frames should come from
+  /// the memory resource of their arguments when they have one, and from
+  /// frame_allocator otherwise.
+  /// @details A handler taking a request thus allocates its frame, and the
+  /// frames of the tasks it awaits, from the arena of the request, reset with
+  /// it once the response is sent. The frames must not outlive the
+  /// resource. The resource is remembered in front of the frame, so that the
+  /// frame goes back where it came from.
+  struct resource_frame_allocated
+  {
+    template <typename... args_t>
+    static void* operator new(std::size_t size, const args_t&... args)
+    {
+      std::pmr::memory_resource* resource = nullptr;
+      ((resource = resource ? resource : resource_of(args)), ...);
+
+      auto block = static_cast<std::byte*>(
+        resource
+        ? resource->allocate(size + header_size, header_size)
+        : frame_allocator::allocate(size + header_size));
+      *reinterpret_cast<std::pmr::memory_resource**>(block) = resource;
+      return block + header_size;
+    }
+
+    static void operator delete(void* frame, std::size_t size) noexcept
+    {
+      auto block = static_cast<std::byte*>(frame) - header_size;
+      auto resource = *reinterpret_cast<std::pmr::memory_resource**>(block);
+      if (resource)
+        resource->deallocate(block, size + header_size, header_size);
+      else
+        frame_allocator::deallocate(block, size + header_size);
+    }
+
+    /// @brief Space reserved in front of the frame, keeping it aligned.
+    static constexpr std::size_t header_size = alignof(std::max_align_t);
+
+  private:
+    template <typename T>
+    static std::pmr::memory_resource* resource_of(const T& argument) noexcept
+    {
+      if constexpr (frame_resource_source<T>)
+        return argument.get_resource();
+      else
+        return nullptr;
+    }
+  };
+}
@@ -42,6 +42,15 @@ namespace pine
 
   constexpr auto http_method_count = 9;
 
+  /// @brief Get the position of a method in arrays indexed by method. Methods
+  /// start at 1, positions at 0.
+  /// @param method The method.
+  /// @return The position, less than http_method_count.
+  constexpr size_t http_method_index(http_method method) noexcept
+  {
+    return static_cast<size_t>(method) - 1;
+  }
+
   /// @brief Map of HTTP methods to their string representations.
   inline const std::unordered_map<http_method, std::string_view> http_method_strings
   {
@@ -63,7 +72,11 @@ namespace pine
     bad_request = 400, /// The Bad Request status code.
     not_found = 404, /// The Not Found status code.
     method_not_allowed = 405, /// The Method Not Allowed status code.
+    payload_too_large = 413, /// The Payload Too Large status code.
+    too_many_requests = 429, /// The Too Many Requests status code.
+    request_header_fields_too_large = 431, /// The Request Header Fields Too Large status code.
     internal_server_error = 500, /// The Internal Server Error status code.
+    service_unavailable = 503, /// The Service Unavailable status code.
   };
 
   /// @brief Map of HTTP status codes to their string representations.
@@ -73,7 +86,11 @@ namespace pine
     { http_status::bad_request, "Bad Request" },
     { http_status::not_found, "Not Found" },
     { http_status::method_not_allowed, "Method Not Allowed" },
+    { http_status::payload_too_large, "Payload Too Large" },
+    { http_status::too_many_requests, "Too Many Requests" },
+    { http_status::request_header_fields_too_large, "Request Header Fields Too Large" },
     { http_status::internal_server_error, "Internal Server Error" },
+    { http_status::service_unavailable, "Service Unavailable" },
   };
 
   /// @brief Represents an HTTP version.
@@ -111,7 +128,7 @@ namespace pine
     /// @param request The HTTP request.
     /// @param offset The offset in the request where the header starts.
     /// @return The extracted header as a pair of key and value.
-    std::expected<std::pair<std::string, std::string_view>, pine::error>
+    std::expected<std::pair<std::string_view, std::string_view>, pine::error>
       try_get_header(std::string_view request, size_t& offset);
 
     /// @brief Tries to extract the HTTP method from an HTTP request.
@@ -135,6 +152,38 @@ namespace pine
     std::expected<std::string_view, pine::error>
       try_get_uri(std::string_view request, size_t& offset);
 
+    /// @brief Gets the value of the Content-Length header of a message.
+    /// @details Framing is strict, so that the server and the proxies in
+    /// front of it never disagree on where a message ends: the value must
+    /// be digits only, repeated headers must agree, and Transfer-Encoding,
+    /// which is not supported, is refused.
+    /// @param head The start line and headers of the message.
+    /// @return The length of the body, 0 if the header is missing, or
+    /// parse_error_headers if the message cannot be framed.
+    std::expected<size_t, pine::error>
+      get_content_length(std::string_view head);
+
+    /// @brief Decodes a component of a query string: percent-encoded bytes
+    /// are decoded and '+' stands for a space. Invalid escapes are kept as
+    /// they are.
+    /// @param text The encoded text.
+    /// @param output Where the decoded text is written, at least text.size()
+    /// bytes long. Decoding never makes the text longer.
+    /// @return The size of the decoded text.
+    size_t percent_decode(std::string_view text, char* output);
+
+    /// @brief Normalizes the path of a URI in a single pass: percent-encoded
+    /// bytes are decoded, "." and ".." segments are resolved and duplicate
+    /// slashes are collapsed. ".." never goes above the root.
+    /// @param path The path, starting with '/'.
+    /// @param output Where the normalized path is written if the path is not
+    /// normal already, at least path.size() bytes long.
+    /// @return The path itself if it is normal, the normalized path in
+    /// output otherwise. An error if the path does not start with '/', has
+    /// an invalid escape, or an escape decoding to '/' or to NUL.
+    std::expected<std::string_view, pine::error>
+      normalize_path(std::string_view path, char* output);
+
     /// @brief Tries to extract the HTTP version from an HTTP request.
     /// @param request The HTTP request.
     /// @param offset The offset in the request where the version starts.
@@ -1,14 +1,20 @@
 #pragma once
 
+#include <array>
 #include <charconv>
 #include <error.h>
 #include <expected.h>
 #include <http.h>
+#include <memory_resource>
+#include <optional>
+#include <path_params.h>
+#include <request_arena.h>
 #include <string>
 #include <string_view>
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace pine
 {
@@ -19,6 +25,14 @@ namespace pine
     /// @brief Default constructor.
     explicit http_request() = default;
 
+    /// @brief Construct an empty request allocating from a memory resource.
+    /// @param resource The resource, usually the arena of a request_arena.
+    explicit http_request(std::pmr::memory_resource* resource)
+      : uri(resource), headers(resource), body(resource),
+      normalized_path(resource), query_params(resource),
+      query_decoded(resource)
+    {}
+
     /// @brief Constructor that initializes the HTTP request with the
     /// given parameters.
     /// @param method The HTTP method of the request.
@@ -26,30 +40,53 @@ namespace pine
     /// @param version The HTTP version of the request.
     /// @param headers The headers of the request.
     /// @param body The body of the request.
+    /// @param resource The resource to allocate from.
     explicit http_request(pine::http_method method,
                           std::string_view _viewuri,
                           pine::http_version version,
                           const std::unordered_map<std::string, std::string_view>& headers,
-                          std::string_view _viewbody);
+                          std::string_view _viewbody,
+                          std::pmr::memory_resource* resource
+                          = std::pmr::get_default_resource());
 
     /// @brief Parses an HTTP request from a string.
     /// @param request The string representation of the request.
+    /// @param resource The resource the request allocates from.
     /// @return An expected object containing the parsed HTTP request or an
     /// error code.
     static std::expected<http_request, pine::error>
-      parse(std::string_view request);
+      parse(std::string_view request,
+            std::pmr::memory_resource* resource
+            = std::pmr::get_default_resource());
 
-    /// @brief Adds a path parameter to the HTTP request.
-    /// @param name The name of the path parameter.
-    /// @param value The value of the path parameter.
+    /// @brief Adds a path parameter to the HTTP request. Ignored once the
+    /// request has path_params::max_params parameters.
+    /// @param name The name of the path parameter. It must outlive the
+    /// request.
+    /// @param value The value of the path parameter. It must outlive the
+    /// request.
     void add_path_param(std::string_view name, std::string_view value)
     {
-      this->path_params.insert_or_assign(std::string(name), value);
+      this->params.set(name, value);
+    }
+
+    /// @brief Sets all the path parameters of the HTTP request.
+    /// @param value The path parameters, as gathered by the router.
+    void set_path_params(const pine::path_params& value) noexcept
+    {
+      this->params = value;
+    }
+
+    /// @brief Gets the path parameters of the HTTP request.
+    /// @return The path parameters, in the order of the route.
+    const pine::path_params& get_path_params() const noexcept
+    {
+      return this->params;
     }
 
     /// @brief Gets the body of the HTTP request.
     /// @return The body of the request.
-    constexpr std::string_view get_body() const
+    std::string_view get_body() const
     {
       return this->body;
     }
@@ -57,15 +94,24 @@ namespace pine
     /// @brief Gets the value of the specified header from the HTTP request.
     /// @param name The name of the header.
     /// @return The value of the header.
-    std::string_view get_header(const std::string& name) const;
+    std::string_view get_header(std::string_view name) const;
 
     /// @brief Gets the headers of the HTTP request.
     /// @return The headers of the request.
-    constexpr const std::unordered_map<std::string, std::string_view>& get_headers() const
+    const string_map<std::pmr::string>& get_headers() const
     {
       return this->headers;
     }
 
+    /// @brief Gets the memory resource the request allocates from.
+    /// @details Coroutines taking the request, such as asynchronous
+    /// handlers, allocate their frames from it too.
+    /// @return The resource, usually the arena of the request.
+    std::pmr::memory_resource* get_resource() const noexcept
+    {
+      return this->uri.get_allocator().resource();
+    }
+
     /// @brief Gets the HTTP method of the request.
     /// @return The HTTP method.
     constexpr pine::http_method get_method() const
@@ -84,34 +130,96 @@ namespace pine
       std::is_same_v<T, std::string_view>
       std::expected<T, error> get_path_param(std::string_view name) const
     {
-      auto it = this->path_params.find(std::string(name));
-      if (it == this->path_params.end())
+      auto param = this->params.find(name);
+      if (!param)
         return std::make_unexpected(
           error(error_code::parameter_not_found,
                 "Parameter not found: " + std::string(name)));
 
-      if constexpr (std::is_same_v<T, std::string>)
-        return std::string(it->second);
-      else if constexpr (std::is_same_v<T, std::string_view>)
-        return it->second;
-      else
-      {
-        T value;
-        if (std::from_chars(it->second.data(),
-                            it->second.data() + it->second.size(),
-                            value).ec != std::errc{})
-          return std::make_unexpected(
-            error(error_code::invalid_parameter,
-                  "Invalid parameter: " + std::string(name)));
+      return convert_param<T>(*param);
+    }
 
-        return value;
-      }
+    /// @brief Gets the value of a path parameter from its position in the
+    /// route, skipping the search by name. The position of a parameter of a
+    /// known route is given by route_path::param_index.
+    /// @tparam T The type of the path parameter.
+    /// @tparam index The position of the path parameter in the route.
+    /// @return The value of the path parameter.
+    template <typename T, size_t index>
+      requires std::is_integral_v<T> ||
+    std::is_floating_point_v<T> ||
+      std::is_same_v<T, std::string> ||
+      std::is_same_v<T, std::string_view>
+      std::expected<T, error> get_path_param() const
+    {
+      static_assert(index < path_params::max_params,
+                    "Routes have at most path_params::max_params parameters");
+
+      if (index >= this->params.size())
+        return std::make_unexpected(
+          error(error_code::parameter_not_found,
+                "Parameter not found: " + std::to_string(index)));
+
+      return convert_param<T>(this->params[index]);
+    }
+
+    /// @brief Gets the value of the specified parameter from the query
+    /// string. The query string is split on the first call, and only the
+    /// parameters containing escapes are decoded.
+    /// @tparam T The type of the query parameter.
+    /// @param name The decoded name of the query parameter.
+    /// @return The decoded value of the first query parameter with that
+    /// name. A view stays valid as long as the request and its URI.
+    template <typename T>
+      requires std::is_integral_v<T> ||
+    std::is_floating_point_v<T> ||
+      std::is_same_v<T, std::string> ||
+      std::is_same_v<T, std::string_view>
+      std::expected<T, error> get_query_param(std::string_view name) const
+    {
+      auto value = find_query_param(name);
+      if (!value)
+        return std::make_unexpected(
+          error(error_code::parameter_not_found,
+                "Parameter not found: " + std::string(name)));
+
+      return convert_param<T>({ name, *value });
+    }
+
+    /// @brief Checks whether the query string has the specified parameter.
+    /// @param name The decoded name of the query parameter.
+    /// @return True if the parameter is present, even without a value.
+    bool has_query_param(std::string_view name) const
+    {
+      return find_query_param(name).has_value();
+    }
+
+    /// @brief Gets the path of the request: the URI without its query
+    /// string, normalized by http_utils::normalize_path. Requests are routed
+    /// and files are served on it.
+    /// @return The path.
+    std::string_view get_path() const
+    {
+      if (!this->normalized_path.empty())
+        return this->normalized_path;
+
+      return std::string_view{ this->uri }.substr(0, this->path_size);
+    }
+
+    /// @brief Gets the query string of the request, still encoded.
+    /// @return The query string without its '?', empty if there is none.
+    std::string_view get_query() const
+    {
+      if (this->path_size == this->uri.size())
+        return {};
+
+      return std::string_view{ this->uri }.substr(this->path_size + 1);
     }
 
 
     /// @brief Gets the URI of the request.
-    /// @return The URI.
-    constexpr std::string_view get_uri() const
+    /// @return The URI, including the query string.
+    std::string_view get_uri() const
     {
       return this->uri;
     }
@@ -138,7 +246,12 @@ namespace pine
       }
       else
       {
-        this->headers.insert_or_assign("Content-Length", std::to_string(value.size()));
+        std::array<char, 20> length;
+        auto end = std::to_chars(length.data(),
+                                 length.data() + length.size(),
+                                 value.size()).ptr;
+        this->set_header("Content-Length",
+                         std::string_view(length.data(), end));
       }
     }
 
@@ -147,7 +260,8 @@ namespace pine
     /// @param value The value of the header.
     void set_header(std::string_view name, std::string_view value)
     {
-      this->headers.insert_or_assign(std::string(name), value);
+      this->headers.insert_or_assign(
+        std::pmr::string(name, this->headers.get_allocator()), value);
     }
 
     /// @brief Sets the HTTP method of the request.
@@ -158,10 +272,13 @@ namespace pine
     }
 
     /// @brief Sets the URI of the request.
-    /// @param value The new URI.
-    constexpr void set_uri(std::string_view value)
+    /// @param value The new URI, including the query string.
+    /// @return An error if the path cannot be normalized, in which case the
+    /// path is left as it is.
+    std::expected<void, pine::error> set_uri(std::string_view value)
     {
       this->uri = value;
+      return split_uri();
     }
 
     /// @brief Sets the HTTP version of the request.
@@ -172,11 +289,78 @@ namespace pine
     }
 
   private:
+    /// @brief A parameter of the query string, as offsets so that it
+    /// survives copies and moves of the request.
+    struct query_param
+    {
+      /// @brief Offsets in the URI, or in query_decoded if decoded is set.
+      size_t name_offset;
+      size_t name_size;
+      size_t value_offset;
+      size_t value_size;
+      bool decoded;
+    };
+
+    /// @brief Find where the path of the URI ends, normalize it and forget
+    /// the query parameters of the previous URI.
+    /// @return An error if the path cannot be normalized.
+    std::expected<void, pine::error> split_uri();
+
+    /// @brief Split the query string into parameters, decoding the ones
+    /// containing escapes.
+    void parse_query() const;
+
+    /// @brief Find the value of a query parameter, splitting the query
+    /// string on the first call.
+    /// @param name The decoded name of the parameter.
+    /// @return The decoded value, or nothing if the parameter is missing.
+    std::optional<std::string_view>
+      find_query_param(std::string_view name) const;
+
+    /// @brief Convert the value of a path or query parameter.
+    /// @tparam T The type of the parameter.
+    /// @param param The name and value of the parameter.
+    /// @return The converted value.
+    template <typename T>
+    static std::expected<T, error>
+      convert_param(const path_params::value_type& param)
+    {
+      const auto& [name, text] = param;
+
+      if constexpr (std::is_same_v<T, std::string>)
+        return std::string(text);
+      else if constexpr (std::is_same_v<T, std::string_view>)
+        return text;
+      else
+      {
+        T value;
+        if (std::from_chars(text.data(),
+                            text.data() + text.size(),
+                            value).ec != std::errc{})
+          return std::make_unexpected(
+            error(error_code::invalid_parameter,
+                  "Invalid parameter: " + std::string(name)));
+
+        return value;
+      }
+    }
+
     pine::http_method method = pine::http_method::get;
-    std::string uri;
+    std::pmr::string uri;
     pine::http_version version = pine::http_version::http_1_1;
-    std::unordered_map<std::string, std::string_view> headers;
-    std::string body;
-    std::unordered_map<std::string, std::string_view> path_params;
+    string_map<std::pmr::string> headers;
+    std::pmr::string body;
+    pine::path_params params;
+
+    /// @brief Size of the path, up to the '?' of the URI.
+    size_t path_size = 0;
+    /// @brief The normalized path, empty if the path of the URI is normal.
+    std::pmr::string normalized_path;
+    /// @brief Query parameters, split on first access.
+    mutable std::pmr::vector<query_param> query_params;
+    /// @brief Decoded names and values of the query parameters which needed
+    /// decoding. Allocated once, large enough for the whole query string.
+    mutable std::pmr::string query_decoded;
+    mutable bool query_parsed = false;
   };
 }
\ No newline at end of file
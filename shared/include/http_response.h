@@ -1,11 +1,15 @@
 #pragma once
 
+#include <array>
+#include <charconv>
 #include <map>
+#include <memory_resource>
 #include <string>
 #include <string_view>
 #include "error.h"
 #include "expected.h"
 #include "http.h"
+#include "request_arena.h"
 
 namespace pine
 {
@@ -16,6 +20,12 @@ namespace pine
     /// @brief Default constructor.
     explicit http_response() = default;
 
+    /// @brief Construct an empty response allocating from a memory resource.
+    /// @param resource The resource, usually the arena of a request_arena.
+    explicit http_response(std::pmr::memory_resource* resource)
+      : body(resource), headers(resource)
+    {}
+
     /// @brief Parses an HTTP response from a string.
     /// @param response The string representation of the HTTP response.
     /// @return An expected object containing the parsed HTTP response or an error code.
@@ -24,7 +34,7 @@ namespace pine
 
     /// @brief Gets the body of the HTTP response.
     /// @return A constant reference to the body string.
-    constexpr std::string_view get_body() const
+    std::string_view get_body() const
     {
       return this->body;
     }
@@ -32,11 +42,11 @@ namespace pine
     /// @brief Gets the value of a specific header in the HTTP response.
     /// @param name The name of the header.
     /// @return A constant reference to the header value.
-    std::string_view get_header(const std::string& name) const;
+    std::string_view get_header(std::string_view name) const;
 
     /// @brief Gets all the headers in the HTTP response.
     /// @return A constant reference to the headers map.
-    constexpr const std::unordered_map<std::string, std::string>& get_headers() const
+    const string_map<std::pmr::string>& get_headers() const
     {
       return this->headers;
     }
@@ -59,6 +69,12 @@ namespace pine
     /// @return The string representation of the HTTP response.
     std::string to_string() const;
 
+    /// @brief Converts the HTTP response to a string allocated from a memory
+    /// resource.
+    /// @param resource The resource to allocate the string from.
+    /// @return The string representation of the HTTP response.
+    std::pmr::string to_string(std::pmr::memory_resource* resource) const;
+
     /// @brief Sets the body of the HTTP response.
     /// @param value The new body value.
     void set_body(std::string_view value)
@@ -70,16 +86,22 @@ namespace pine
       }
       else
       {
-        this->headers.insert_or_assign("Content-Length", std::to_string(value.size()));
+        std::array<char, 20> length;
+        auto end = std::to_chars(length.data(),
+                                 length.data() + length.size(),
+                                 value.size()).ptr;
+        this->set_header("Content-Length",
+                         std::string_view(length.data(), end));
       }
     }
 
     /// @brief Sets a header in the HTTP response.
     /// @param name The name of the header.
     /// @param value The value of the header.
-    void set_header(const std::string& name, std::string_view value)
+    void set_header(std::string_view name, std::string_view value)
     {
-      this->headers.insert_or_assign(name, value);
+      this->headers.insert_or_assign(
+        std::pmr::string(name, this->headers.get_allocator()), value);
     }
 
     /// @brief Sets the status code of the HTTP response.
@@ -97,8 +119,12 @@ namespace pine
     }
 
   private:
-    std::string body;
-    std::unordered_map<std::string, std::string> headers;
+    /// @brief Append the string representation of the response to a string.
+    template <typename string_type>
+    void append_to(string_type& result) const;
+
+    std::pmr::string body;
+    string_map<std::pmr::string> headers;
     http_status status = http_status::ok;
     http_version version = http_version::http_1_1;
   };
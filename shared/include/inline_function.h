@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace pine
+{
+  template <typename signature_t, size_t capacity = 6 * sizeof(void*)>
+  class inline_function;
+
+  /// @brief A callable stored in place.
+  /// @details Unlike std::function, a callable fitting in the buffer is
+  /// stored inside the object, so calling it costs a single indirect call
+  /// and no pointer chase. Larger callables are allocated on the heap.
+  /// Functions and lambdas without captures are copied bytewise when the
+  /// inline_function is moved.
+  /// @tparam result_t The result of the callable.
+  /// @tparam args_t The arguments of the callable.
+  /// @tparam capacity The size of the buffer.
+  template <typename result_t, typename... args_t, size_t capacity>
+  class inline_function<result_t(args_t...), capacity>
+  {
+  public:
+    inline_function() noexcept = default;
+
+    /// @brief Store a callable. Where void is expected, callables returning
+    /// a value are rejected, so that overloads taking inline_functions of
+    /// different results are not ambiguous.
+    /// @param function The callable, copied or moved into the buffer.
+    template <typename function_t>
+      requires (!std::is_same_v<std::remove_cvref_t<function_t>, inline_function>)
+               && std::is_invocable_r_v<result_t, std::decay_t<function_t>&, args_t...>
+               && (!std::is_void_v<result_t>
+                   || std::is_void_v<std::invoke_result_t<std::decay_t<function_t>&, args_t...>>)
+    explicit(false) inline_function(function_t&& function)
+    {
+      using stored_t = std::decay_t<function_t>;
+
+      if constexpr (stored_inline<stored_t>)
+      {
+        ::new (static_cast<void*>(storage_)) stored_t(std::forward<function_t>(function));
+
+        invoke_ = [](void* storage, args_t... args) -> result_t
+          {
+            return std::invoke(*std::launder(static_cast<stored_t*>(storage)),
+                               std::forward<args_t>(args)...);
+          };
+
+        if constexpr (!std::is_trivially_copyable_v<stored_t>)
+          manage_ = &manage_inline<stored_t>;
+      }
+      else
+      {
+        auto pointer = new stored_t(std::forward<function_t>(function));
+        std::memcpy(storage_, &pointer, sizeof(pointer));
+
+        invoke_ = [](void* storage, args_t... args) -> result_t
+          {
+            return std::invoke(*heap_pointer<stored_t>(storage),
+                               std::forward<args_t>(args)...);
+          };
+        manage_ = &manage_heap<stored_t>;
+      }
+    }
+
+    inline_function(inline_function&& other) noexcept
+    {
+      move_from(other);
+    }
+
+    inline_function& operator=(inline_function&& other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        move_from(other);
+      }
+      return *this;
+    }
+
+    inline_function& operator=(std::nullptr_t) noexcept
+    {
+      reset();
+      return *this;
+    }
+
+    inline_function(const inline_function&) = delete;
+    inline_function& operator=(const inline_function&) = delete;
+
+    ~inline_function()
+    {
+      reset();
+    }
+
+    /// @brief Call the callable. There must be one.
+    result_t operator()(args_t... args) const
+    {
+      return invoke_(storage_, std::forward<args_t>(args)...);
+    }
+
+    /// @brief Check whether a callable is stored.
+    explicit operator bool() const noexcept
+    {
+      return invoke_ != nullptr;
+    }
+
+    /// @brief Check whether a callable of a given type is stored in the
+    /// buffer rather than on the heap.
+    template <typename function_t>
+    static constexpr bool stored_inline =
+      sizeof(function_t) <= capacity
+      && alignof(function_t) <= alignof(std::max_align_t)
+      && std::is_nothrow_move_constructible_v<function_t>;
+
+  private:
+    enum class operation
+    {
+      move,
+      destroy,
+    };
+
+    using invoke_type = result_t(*)(void*, args_t...);
+    using manage_type = void(*)(operation, void*, void*) noexcept;
+
+    template <typename stored_t>
+    static void manage_inline(operation op, void* from, void* to) noexcept
+    {
+      auto function = std::launder(static_cast<stored_t*>(from));
+      if (op == operation::move)
+        ::new (to) stored_t(std::move(*function));
+
+      function->~stored_t();
+    }
+
+    template <typename stored_t>
+    static stored_t* heap_pointer(void* storage) noexcept
+    {
+      stored_t* pointer;
+      std::memcpy(&pointer, storage, sizeof(pointer));
+      return pointer;
+    }
+
+    template <typename stored_t>
+    static void manage_heap(operation op, void* from, void* to) noexcept
+    {
+      if (op == operation::move)
+        std::memcpy(to, from, sizeof(stored_t*));
+      else
+        delete heap_pointer<stored_t>(from);
+    }
+
+    /// @brief Take the callable of another inline_function, leaving it
+    /// empty.
+    void move_from(inline_function& other) noexcept
+    {
+      if (other.manage_)
+        other.manage_(operation::move, other.storage_, storage_);
+      else
+        std::memcpy(storage_, other.storage_, capacity);
+
+      invoke_ = std::exchange(other.invoke_, nullptr);
+      manage_ = std::exchange(other.manage_, nullptr);
+    }
+
+    void reset() noexcept
+    {
+      if (manage_)
+        manage_(operation::destroy, storage_, nullptr);
+
+      invoke_ = nullptr;
+      manage_ = nullptr;
+    }
+
+    alignas(std::max_align_t) mutable std::byte storage_[capacity];
+    invoke_type invoke_ = nullptr;
+    manage_type manage_ = nullptr;
+  };
+}
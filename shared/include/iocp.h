@@ -13,8 +13,13 @@
 #include <functional>
 #include <iostream>
 #include <source_location>
+#include <span>
 #include <thread>
 #include <vector>
+#include "error.h"
+#include "expected.h"
+#include "timer_wheel.h"
+#include "topology.h"
 
 #pragma comment(lib, "Ws2_32.lib")
 #pragma comment(lib, "Mswsock.lib")
@@ -40,14 +45,139 @@ namespace pine
     SOCKET socket;
     /// @brief The WSABUF structure.
     WSABUF wsa_buffer;
-    /// @brief The buffer to store the data.
-    std::array<char, 1024> buffer;
     /// @brief The buffer to store the address.
     std::array<char, (sizeof(sockaddr_in) + 16) * 2> accept_buffer;
     /// @brief The number of bytes transferred.
     DWORD bytes_transferred;
     /// @brief The flags.
     DWORD flags;
+    /// @brief The error code of the operation, 0 if it succeeded.
+    DWORD error = 0;
+    /// @brief Value given when posting the operation, handed back with its
+    /// completion. Connections store their id there.
+    ULONG_PTR user_data = 0;
+    /// @brief The coroutine to resume when the operation completes. Only set
+    /// for operations posted by an awaitable, which own their data.
+    std::coroutine_handle<> continuation = nullptr;
+  };
+
+  /// @brief Get the address of the peer of a completed accept operation,
+  /// from the buffer filled by AcceptEx.
+  /// @param data The data of the accept operation.
+  /// @return The address of the peer.
+  sockaddr_in get_peer_address(const iocp_operation_data& data) noexcept;
+
+  class iocp_context;
+
+  /// @brief Base class of the awaitable socket operations.
+  /// @details The operation data lives in the awaiter, that is in the frame
+  /// of the awaiting coroutine, so posting an operation allocates nothing.
+  /// The worker thread that dequeues the completion resumes the coroutine
+  /// directly, without going through the callbacks of the iocp_context.
+  class iocp_awaitable
+  {
+  public:
+    iocp_awaitable(iocp_operation operation, SOCKET socket) noexcept
+    {
+      memset(&data_.overlapped, 0, sizeof(data_.overlapped));
+      data_.operation = operation;
+      data_.socket = socket;
+      data_.bytes_transferred = 0;
+      data_.flags = 0;
+    }
+
+    iocp_awaitable(const iocp_awaitable&) = delete;
+    iocp_awaitable& operator=(const iocp_awaitable&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+  protected:
+    /// @brief Get the error describing a failed operation.
+    pine::error get_error() const
+    {
+      return pine::error(error_code::winsock_error, std::to_string(data_.error));
+    }
+
+    iocp_operation_data data_;
+  };
+
+  /// @brief Awaitable receiving data from a socket. Resumes with the number of
+  /// bytes received, or an error if the operation failed or the peer closed
+  /// the connection.
+  class socket_read_awaitable : public iocp_awaitable
+  {
+  public:
+    socket_read_awaitable(SOCKET socket, std::span<char> buffer) noexcept
+      : iocp_awaitable(iocp_operation::read, socket)
+    {
+      data_.wsa_buffer.buf = buffer.data();
+      data_.wsa_buffer.len = static_cast<ULONG>(buffer.size());
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine) noexcept;
+
+    std::expected<size_t, pine::error> await_resume() const
+    {
+      if (data_.error != 0)
+        return std::make_unexpected(get_error());
+
+      if (data_.bytes_transferred == 0)
+        return std::make_unexpected(
+          pine::error(error_code::connection_closed,
+                      "The peer closed the connection."));
+
+      return data_.bytes_transferred;
+    }
+  };
+
+  /// @brief Awaitable sending a list of buffers on a socket with a single
+  /// WSASend. Resumes with the number of bytes sent.
+  class socket_write_awaitable : public iocp_awaitable
+  {
+  public:
+    socket_write_awaitable(SOCKET socket, std::span<WSABUF> buffers) noexcept
+      : iocp_awaitable(iocp_operation::write, socket),
+      buffers_(buffers)
+    {}
+
+    bool await_suspend(std::coroutine_handle<> coroutine) noexcept;
+
+    std::expected<size_t, pine::error> await_resume() const
+    {
+      if (data_.error != 0)
+        return std::make_unexpected(get_error());
+
+      return data_.bytes_transferred;
+    }
+
+  private:
+    std::span<WSABUF> buffers_;
+  };
+
+  /// @brief Awaitable accepting a connection on a listening socket. Resumes
+  /// with the accepted socket, already associated with the IOCP.
+  class socket_accept_awaitable : public iocp_awaitable
+  {
+  public:
+    socket_accept_awaitable(iocp_context& context, SOCKET listen_socket) noexcept
+      : iocp_awaitable(iocp_operation::accept, INVALID_SOCKET),
+      context_(context),
+      listen_socket_(listen_socket)
+    {}
+
+    bool await_suspend(std::coroutine_handle<> coroutine) noexcept;
+
+    std::expected<SOCKET, pine::error> await_resume();
+
+    /// @brief Get the address of the peer once the connection is accepted.
+    sockaddr_in peer_address() const noexcept
+    {
+      return get_peer_address(data_);
+    }
+
+  private:
+    iocp_context& context_;
+    SOCKET listen_socket_;
   };
 
   /// @brief This class represents an IOCP.
@@ -59,6 +189,9 @@ namespace pine
       HANDLE iocp;
       SOCKET socket;
       iocp_context* iocp_context;
+      /// @brief Whether the thread wakes up on every tick of the timer wheel,
+      /// so timers expire even when no I/O completes.
+      bool drives_timers;
     };
 
     /// @brief Default constructor.
@@ -73,13 +206,48 @@ namespace pine
     bool associate(SOCKET socket);
 
     /// @brief Posts an operation to the IOCP. The operation will be performed
-    /// asynchronously by Windows.
+    /// asynchronously by Windows. Accepted sockets are not associated with the
+    /// IOCP: the accept handler associates them with the IOCP that serves
+    /// them.
     /// @param operation The operation to post.
     /// @param socket The socket to post the operation to.
     /// @param wsa_buffer The WSABUF structure.
     /// @param flags The flags.
+    /// @param user_data Value handed back in the data of the completion.
     /// @return True if the operation was posted successfully, false otherwise.
-    bool post(iocp_operation operation, SOCKET socket, WSABUF wsa_buffer, DWORD flags = 0);
+    bool post(iocp_operation operation,
+              SOCKET socket,
+              WSABUF wsa_buffer,
+              DWORD flags = 0,
+              ULONG_PTR user_data = 0);
+
+    /// @brief Receive data from a socket associated with the IOCP.
+    /// @param socket The socket to read from.
+    /// @param buffer The buffer to fill.
+    /// @return An awaitable resuming with the number of bytes received.
+    socket_read_awaitable read(SOCKET socket, std::span<char> buffer) noexcept
+    {
+      return socket_read_awaitable(socket, buffer);
+    }
+
+    /// @brief Send buffers on a socket associated with the IOCP.
+    /// @param socket The socket to write to.
+    /// @param buffers The buffers to send. They must stay alive until the
+    /// operation completes.
+    /// @return An awaitable resuming with the number of bytes sent.
+    socket_write_awaitable write(SOCKET socket, std::span<WSABUF> buffers) noexcept
+    {
+      return socket_write_awaitable(socket, buffers);
+    }
+
+    /// @brief Accept a connection on a listening socket associated with the
+    /// IOCP. init() must have been called with that socket.
+    /// @param listen_socket The listening socket.
+    /// @return An awaitable resuming with the accepted socket.
+    socket_accept_awaitable accept(SOCKET listen_socket) noexcept
+    {
+      return socket_accept_awaitable(*this, listen_socket);
+    }
 
     /// @brief Closes the IOCP.
     /// @return True if the IOCP was closed successfully, false otherwise.
@@ -100,14 +268,34 @@ namespace pine
       on_write_ = on_write;
     }
 
-    inline void init(SOCKET socket)
+    /// @brief Get the timer wheel of the IOCP. Its timers are fired by the
+    /// worker threads.
+    inline timer_wheel& timers() noexcept
+    {
+      return timers_;
+    }
+
+    /// @brief Start the worker threads.
+    /// @param socket The listening socket. Accepts posted through post() are
+    /// made on it.
+    /// @param thread_count The number of worker threads, 0 for twice the
+    /// number of processors.
+    inline void init(SOCKET socket, size_t thread_count = 0)
     {
-      setup_thread_pool(socket);
+      setup_thread_pool(socket, thread_count);
       init_accept_ex(socket);
     }
 
+    /// @brief Pin the worker threads to processors. Thread i runs on
+    /// processors[i % processors.size()].
+    /// @param processors The processors, must not be empty.
+    /// @return True if every thread was pinned, false otherwise.
+    bool pin_threads(std::span<const processor> processors);
+
 
   private:
+    friend class socket_accept_awaitable;
+
     /// @brief The IOCP handle.
     HANDLE iocp_;
 
@@ -119,17 +307,19 @@ namespace pine
 
     std::vector<std::thread> threads_;
 
+    timer_wheel timers_;
+
     using LPFN_ACCEPTEX = BOOL(PASCAL*)(SOCKET, SOCKET, PVOID, DWORD, DWORD, DWORD, LPDWORD, LPOVERLAPPED);
     LPFN_ACCEPTEX accept_ex = nullptr;
 
     static DWORD WINAPI worker_thread(LPVOID lpParam);
 
-    void setup_thread_pool(SOCKET socket);
+    void setup_thread_pool(SOCKET socket, size_t thread_count);
     bool init_accept_ex(SOCKET socket);
 
     bool post_accept(SOCKET socket, WSABUF wsa_buffer, DWORD flags);
-    bool post_read(SOCKET socket, WSABUF wsa_buffer, DWORD flags);
-    bool post_write(SOCKET socket, WSABUF wsa_buffer, DWORD flags);
+    bool post_read(SOCKET socket, WSABUF wsa_buffer, DWORD flags, ULONG_PTR user_data);
+    bool post_write(SOCKET socket, WSABUF wsa_buffer, DWORD flags, ULONG_PTR user_data);
   };
 }
 
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+/// @brief The lowest level of the messages compiled in: 0 for debug, 1 for
+/// info, 2 for warning, 3 for error, 4 for none. Messages below it compile to
+/// nothing, arguments included.
+#ifndef PINE_LOG_LEVEL
+#define PINE_LOG_LEVEL 1
+#endif
+
+namespace pine
+{
+  /// @brief The level of a log message.
+  enum class log_level : uint8_t
+  {
+    debug,
+    info,
+    warning,
+    error,
+  };
+
+  /// @brief The lowest level compiled in, set by PINE_LOG_LEVEL.
+  inline constexpr int compiled_log_level = PINE_LOG_LEVEL;
+
+  /// @brief An argument of a log message, captured by value.
+  struct log_argument
+  {
+    enum class kind : uint8_t
+    {
+      signed_integer,
+      unsigned_integer,
+      floating,
+      string,
+      pointer,
+    };
+
+    kind type;
+    union
+    {
+      int64_t signed_integer;
+      uint64_t unsigned_integer;
+      double floating;
+      const void* pointer;
+
+      /// @brief Position of a string copied in the text of the record.
+      struct
+      {
+        uint16_t offset;
+        uint16_t size;
+      } string;
+    };
+  };
+
+  /// @brief A log message whose formatting is deferred: the format, which
+  /// must be a string literal, and the arguments, copied in binary form.
+  /// Strings are copied into the record, so they need not outlive the call.
+  struct log_record
+  {
+    /// @brief Number of arguments captured, the others are dropped.
+    static constexpr size_t max_arguments = 8;
+
+    /// @brief Room for the strings of the arguments, which are truncated
+    /// beyond it.
+    static constexpr size_t text_capacity = 320;
+
+    const char* format = "";
+    const char* file = "";
+    uint32_t line = 0;
+    log_level level = log_level::info;
+    uint8_t argument_count = 0;
+    uint16_t text_size = 0;
+    std::array<log_argument, max_arguments> arguments;
+    std::array<char, text_capacity> text;
+
+    /// @brief Capture an argument: integers, enumerations, floating point
+    /// numbers, strings and pointers.
+    template <typename value_t>
+    void capture(const value_t& value) noexcept
+    {
+      using type = std::remove_cvref_t<value_t>;
+
+      if (argument_count == max_arguments)
+        return;
+
+      if constexpr (std::is_enum_v<type>)
+        capture(static_cast<std::underlying_type_t<type>>(value));
+      else if constexpr (std::is_integral_v<type> && std::is_signed_v<type>)
+      {
+        auto& argument = arguments[argument_count++];
+        argument.type = log_argument::kind::signed_integer;
+        argument.signed_integer = value;
+      }
+      else if constexpr (std::is_integral_v<type>)
+      {
+        auto& argument = arguments[argument_count++];
+        argument.type = log_argument::kind::unsigned_integer;
+        argument.unsigned_integer = value;
+      }
+      else if constexpr (std::is_floating_point_v<type>)
+      {
+        auto& argument = arguments[argument_count++];
+        argument.type = log_argument::kind::floating;
+        argument.floating = value;
+      }
+      else if constexpr (std::is_convertible_v<const value_t&, std::string_view>)
+      {
+        if constexpr (std::is_pointer_v<type>)
+        {
+          if (value == nullptr)
+            return capture(std::string_view{ "(null)" });
+        }
+
+        std::string_view string = value;
+        size_t offset = text_size;
+
+        // Keep room for the terminating null character.
+        size_t size = offset < text_capacity
+          ? std::min(string.size(), text_capacity - offset - 1)
+          : 0;
+        std::memcpy(text.data() + offset, string.data(), size);
+        if (offset < text_capacity)
+          text[offset + size] = '\0';
+        text_size = static_cast<uint16_t>(
+          std::min(offset + size + 1, text_capacity));
+
+        auto& argument = arguments[argument_count++];
+        argument.type = log_argument::kind::string;
+        argument.string = { static_cast<uint16_t>(offset),
+                            static_cast<uint16_t>(size) };
+      }
+      else
+      {
+        static_assert(std::is_pointer_v<type>,
+                      "Log arguments are integers, floating point numbers, "
+                      "strings or pointers");
+
+        auto& argument = arguments[argument_count++];
+        argument.type = log_argument::kind::pointer;
+        argument.pointer = value;
+      }
+    }
+  };
+
+  /// @brief Format a log record the way printf would have formatted its
+  /// format and arguments.
+  /// @param record The record.
+  /// @return The message.
+  std::string format_log_record(const log_record& record);
+
+  /// @brief A log whose messages are formatted and written by a background
+  /// thread, so that the threads logging never format, wait on a lock or do
+  /// I/O.
+  /// @details Messages go through a bounded ring of records shared by every
+  /// thread. A thread claims a record by advancing the position of the ring,
+  /// fills it in place and publishes it; the background thread takes the
+  /// records in order. Claiming takes no lock. When the ring is full the
+  /// message is dropped and counted rather than waited for.
+  ///
+  /// The background thread polls the ring while messages come, and only
+  /// sleeps until woken once it stays idle, so that steady logging never
+  /// makes a system call on the threads logging.
+  class log_sink
+  {
+  public:
+    /// @brief Writes a formatted message, on the background thread.
+    using output_function = std::function<void(log_level level,
+                                               const char* file,
+                                               uint32_t line,
+                                               const std::string& message)>;
+
+    /// @brief Number of records of the log used by PINE_LOG.
+    static constexpr size_t default_capacity = 1024;
+
+    /// @brief Construct a log and start its background thread.
+    /// @param capacity The number of records of the ring, a power of two.
+    /// @param output Where the messages go, loguru by default.
+    explicit log_sink(size_t capacity = default_capacity,
+                      output_function output = {});
+
+    log_sink(const log_sink&) = delete;
+    log_sink& operator=(const log_sink&) = delete;
+
+    /// @brief Write the messages left and stop the background thread.
+    ~log_sink();
+
+    /// @brief Get the log used by PINE_LOG.
+    static log_sink& instance();
+
+    /// @brief Log a message.
+    /// @param level The level of the message.
+    /// @param file The file logging the message.
+    /// @param line The line logging the message.
+    /// @param format The printf format of the message. It must outlive the
+    /// log, as string literals do.
+    /// @param args The arguments of the format.
+    template <typename... args_t>
+    void write(log_level level,
+               const char* file,
+               uint32_t line,
+               const char* format,
+               const args_t&... args) noexcept
+    {
+      size_t position;
+      log_record* record = claim(position);
+      if (!record)
+      {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+
+      record->format = format;
+      record->file = file;
+      record->line = line;
+      record->level = level;
+      record->argument_count = 0;
+      record->text_size = 0;
+      (record->capture(args), ...);
+
+      publish(position);
+    }
+
+    /// @brief Wait until the messages logged so far have been written.
+    void flush();
+
+    /// @brief Replace where the messages go.
+    void set_output(output_function output);
+
+    /// @brief Get the number of messages dropped because the ring was full.
+    uint64_t dropped() const noexcept
+    {
+      return dropped_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct slot
+    {
+      /// @brief Equal to the position of the slot while it is free, to the
+      /// position plus one once its record is published.
+      std::atomic<size_t> sequence;
+      log_record record;
+    };
+
+    /// @brief Claim the next record of the ring.
+    /// @param position Set to the position of the record.
+    /// @return The record, or nullptr if the ring is full.
+    log_record* claim(size_t& position) noexcept;
+
+    /// @brief Hand a claimed record to the background thread.
+    void publish(size_t position) noexcept;
+
+    /// @brief Write the published records.
+    /// @return True if a record was written.
+    bool drain();
+
+    /// @brief Body of the background thread.
+    void run(std::stop_token stop);
+
+    size_t mask_;
+    std::unique_ptr<slot[]> slots_;
+
+    /// @brief Position of the next record to claim, shared by the threads
+    /// logging.
+    alignas(64) std::atomic<size_t> enqueue_position_ = 0;
+
+    /// @brief Position of the next record to write, advanced by the
+    /// background thread.
+    alignas(64) std::atomic<size_t> dequeue_position_ = 0;
+
+    std::atomic<uint64_t> dropped_ = 0;
+
+    /// @brief Messages dropped already reported, by the background thread.
+    uint64_t reported_dropped_ = 0;
+
+    /// @brief Set while the background thread waits for records.
+    std::atomic<bool> sleeping_ = false;
+
+    /// @brief Guards the output, which set_output may replace.
+    std::mutex output_mutex_;
+    output_function output_;
+
+    std::jthread thread_;
+  };
+}
+
+/// @brief Log a message with a printf format, without formatting it on the
+/// calling thread. Messages below PINE_LOG_LEVEL compile to nothing.
+/// @param level debug, info, warning or error.
+#define PINE_LOG(level, ...)                                                  \
+  do                                                                          \
+  {                                                                           \
+    if constexpr (static_cast<int>(::pine::log_level::level)                  \
+                  >= ::pine::compiled_log_level)                              \
+      ::pine::log_sink::instance().write(::pine::log_level::level,            \
+                                         __FILE__, __LINE__, __VA_ARGS__);    \
+  } while (false)
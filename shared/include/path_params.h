@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+namespace pine
+{
+  /// @brief The path parameters of a request, as pairs of name and value.
+  /// @details The parameters are stored inline, in the order they appear in
+  /// the route, so gathering them allocates nothing. The names refer to the
+  /// route nodes and the values to the URI of the request. Routes have few
+  /// parameters, so they are looked up by a linear scan.
+  class path_params
+  {
+  public:
+    using value_type = std::pair<std::string_view, std::string_view>;
+
+    /// @brief Maximum number of parameters of a route.
+    static constexpr size_t max_params = 8;
+
+    /// @brief Set a parameter, replacing the parameter of the same name.
+    /// @param name The name of the parameter.
+    /// @param value The value of the parameter.
+    /// @return False if there is no room left for the parameter.
+    constexpr bool set(std::string_view name, std::string_view value) noexcept
+    {
+      for (size_t i = 0; i < size_; i++)
+      {
+        if (params_[i].first == name)
+        {
+          params_[i].second = value;
+          return true;
+        }
+      }
+
+      if (size_ == max_params)
+        return false;
+
+      params_[size_++] = { name, value };
+      return true;
+    }
+
+    /// @brief Drop the parameters set after the first count ones.
+    /// @param count The number of parameters to keep.
+    constexpr void truncate(size_t count) noexcept
+    {
+      if (count < size_)
+        size_ = static_cast<uint8_t>(count);
+    }
+
+    /// @brief Find a parameter by name.
+    /// @param name The name of the parameter.
+    /// @return The parameter, or nullptr if there is none with this name.
+    constexpr const value_type* find(std::string_view name) const noexcept
+    {
+      for (size_t i = 0; i < size_; i++)
+      {
+        if (params_[i].first == name)
+          return &params_[i];
+      }
+
+      return nullptr;
+    }
+
+    /// @brief Get a parameter by its position in the route.
+    constexpr const value_type& operator[](size_t index) const noexcept
+    {
+      return params_[index];
+    }
+
+    constexpr size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+
+    constexpr const value_type* begin() const noexcept { return params_.data(); }
+    constexpr const value_type* end() const noexcept { return params_.data() + size_; }
+
+  private:
+    std::array<value_type, max_params> params_{};
+    uint8_t size_ = 0;
+  };
+}
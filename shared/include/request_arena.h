@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace pine
+{
+  /// @brief Hash of strings accepting any type convertible to a
+  /// std::string_view, so that maps keyed by strings can be searched without
+  /// building a key.
+  struct string_hash
+  {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view value) const noexcept
+    {
+      return std::hash<std::string_view>{}(value);
+    }
+  };
+
+  /// @brief Map keyed by strings allocated from a memory resource, searchable
+  /// with a std::string_view.
+  template <typename value_type>
+  using string_map = std::pmr::unordered_map<std::pmr::string,
+                                             value_type,
+                                             string_hash,
+                                             std::equal_to<>>;
+
+  /// @brief Memory of a request.
+  /// @details Everything allocated while a request is parsed, routed and
+  /// answered is bump allocated from a block owned by its connection: the
+  /// headers, the path parameters, the response and its rendering, and the
+  /// coroutine frames of asynchronous handlers. Nothing is
+  /// freed on its own; the whole block is reset once the response has been
+  /// sent. A request outgrowing the block continues on the upstream resource
+  /// until the reset.
+  class request_arena
+  {
+  public:
+    /// @brief Construct an arena.
+    /// @param block The memory to allocate from first. It must outlive the
+    /// arena.
+    /// @param upstream The resource used once the block is exhausted.
+    explicit request_arena(std::span<std::byte> block,
+                           std::pmr::memory_resource* upstream
+                           = std::pmr::get_default_resource()) noexcept
+      : resource_(block.data(), block.size(), upstream)
+    {}
+
+    request_arena(const request_arena&) = delete;
+    request_arena& operator=(const request_arena&) = delete;
+
+    /// @brief Get the resource to allocate from.
+    std::pmr::memory_resource* resource() noexcept
+    {
+      return &resource_;
+    }
+
+    /// @brief Free everything allocated since the last reset. The objects
+    /// allocated from the arena must be destroyed first.
+    void reset() noexcept
+    {
+      resource_.release();
+    }
+
+  private:
+    std::pmr::monotonic_buffer_resource resource_;
+  };
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// @brief Marks an empty member as taking no room, where MSVC needs its own
+/// attribute.
+#if defined(_MSC_VER)
+#define PINE_NO_UNIQUE_ADDRESS [[msvc::no_unique_address]]
+#else
+#define PINE_NO_UNIQUE_ADDRESS [[no_unique_address]]
+#endif
+
+namespace pine
+{
+  /// @brief Whether requests are traced, enabled by building with
+  /// PINE_TRACING defined (the ENABLE_TRACING CMake option).
+#ifdef PINE_TRACING
+  inline constexpr bool tracing_enabled = true;
+#else
+  inline constexpr bool tracing_enabled = false;
+#endif
+
+  /// @brief The phases of the life of a request, in order.
+  enum class trace_phase : uint8_t
+  {
+    /// @brief The connection was accepted.
+    accepted,
+    /// @brief The first bytes of the request were received.
+    first_byte,
+    /// @brief The request was received and parsed.
+    headers_parsed,
+    /// @brief The route of the request was found.
+    route_found,
+    /// @brief The handler was called.
+    handler_started,
+    /// @brief The handler returned, or its task completed.
+    handler_ended,
+    /// @brief The write of the response was posted.
+    write_posted,
+    /// @brief The write of the response completed.
+    write_completed,
+  };
+
+  constexpr size_t trace_phase_count = 8;
+
+  /// @brief Names of the phases, indexed by pine::trace_phase.
+  inline constexpr std::array<std::string_view, trace_phase_count>
+    trace_phase_names{
+    "accepted", "first_byte", "headers_parsed", "route_found",
+    "handler_started", "handler_ended", "write_posted", "write_completed",
+  };
+
+  /// @brief The times a request reached each phase of its life.
+  /// @tparam enabled Whether the times are taken. Disabled traces hold
+  /// nothing and marking them compiles to nothing; use pine::request_trace,
+  /// enabled by PINE_TRACING.
+  template <bool enabled>
+  class basic_request_trace
+  {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /// @brief Record that the request reached a phase now. A phase reached
+    /// again keeps its first time.
+    void mark(trace_phase phase) noexcept
+    {
+      auto& time = times_[static_cast<size_t>(phase)];
+      if (time == clock::time_point{})
+        time = clock::now();
+    }
+
+    /// @brief Check whether the request reached a phase.
+    bool reached(trace_phase phase) const noexcept
+    {
+      return times_[static_cast<size_t>(phase)] != clock::time_point{};
+    }
+
+    /// @brief Get the time the request reached a phase.
+    /// @return The time, the epoch of the clock if the phase was not reached.
+    clock::time_point at(trace_phase phase) const noexcept
+    {
+      return times_[static_cast<size_t>(phase)];
+    }
+
+    /// @brief Get the time spent reaching a phase since the previous phase
+    /// reached.
+    /// @return The time, zero if the phase or no phase before it was
+    /// reached.
+    std::chrono::nanoseconds phase_duration(trace_phase phase) const noexcept
+    {
+      auto index = static_cast<size_t>(phase);
+      if (!reached(phase))
+        return {};
+
+      while (index-- > 0)
+      {
+        if (times_[index] != clock::time_point{})
+          return times_[static_cast<size_t>(phase)] - times_[index];
+      }
+
+      return {};
+    }
+
+    /// @brief Get the time between the first and the last phase reached.
+    std::chrono::nanoseconds total() const noexcept
+    {
+      clock::time_point first{};
+      clock::time_point last{};
+      for (const auto& time : times_)
+      {
+        if (time == clock::time_point{})
+          continue;
+        if (first == clock::time_point{})
+          first = time;
+        last = time;
+      }
+
+      return last - first;
+    }
+
+    /// @brief Describe the phases reached, for the logs, for instance
+    /// "accepted +0us first_byte +12us headers_parsed +3us".
+    std::string to_string() const
+    {
+      std::string result;
+      for (size_t i = 0; i < trace_phase_count; ++i)
+      {
+        auto phase = static_cast<trace_phase>(i);
+        if (!reached(phase))
+          continue;
+
+        if (!result.empty())
+          result += ' ';
+        result += trace_phase_names[i];
+        result += " +";
+        result += std::to_string(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+            phase_duration(phase)).count());
+        result += "us";
+      }
+
+      return result;
+    }
+
+    /// @brief Forget the phases, before the next request.
+    void reset() noexcept
+    {
+      times_.fill({});
+    }
+
+  private:
+    std::array<clock::time_point, trace_phase_count> times_{};
+  };
+
+  /// @brief A disabled trace: empty, and its marks compile to nothing.
+  template <>
+  class basic_request_trace<false>
+  {
+  public:
+    void mark(trace_phase) noexcept {}
+    void reset() noexcept {}
+  };
+
+  /// @brief The trace of a request, enabled by PINE_TRACING.
+  using request_trace = basic_request_trace<tracing_enabled>;
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include "frame_allocator.h"
+
+namespace pine
+{
+  template <typename T = void>
+  class task;
+
+  namespace detail
+  {
+    /// @brief Part of the task promise shared by every result type.
+    /// @details The promise only stores the continuation to resume once the
+    /// coroutine completes. Completion hands control straight back to the
+    /// awaiting coroutine through symmetric transfer, so a chain of co_await
+    /// never grows the stack and never goes through a scheduler. Frames of
+    /// coroutines taking a request come from its arena, the others are
+    /// recycled by frame_allocator.
+    class task_promise_base : public resource_frame_allocated
+    {
+    public:
+      /// @brief Awaiter used at the final suspend point. Transfers execution
+      /// to the continuation of the task.
+      struct final_awaiter
+      {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename promise_t>
+        std::coroutine_handle<>
+          await_suspend(std::coroutine_handle<promise_t> coroutine) noexcept
+        {
+          return coroutine.promise().continuation_;
+        }
+
+        void await_resume() const noexcept {}
+      };
+
+      /// @brief Tasks are lazy: they only start when they are awaited.
+      std::suspend_always initial_suspend() const noexcept { return {}; }
+
+      /// @brief Resume the continuation when the task completes.
+      final_awaiter final_suspend() const noexcept { return {}; }
+
+      /// @brief Set the coroutine to resume when the task completes.
+      /// @param continuation The awaiting coroutine.
+      void set_continuation(std::coroutine_handle<> continuation) noexcept
+      {
+        continuation_ = continuation;
+      }
+
+    private:
+      std::coroutine_handle<> continuation_ = std::noop_coroutine();
+    };
+
+    /// @brief Promise of a task returning a value. The value is stored inline
+    /// in the promise, no shared state is allocated.
+    template <typename T>
+    class task_promise : public task_promise_base
+    {
+    public:
+      task<T> get_return_object() noexcept;
+
+      void unhandled_exception() noexcept
+      {
+        result_.template emplace<2>(std::current_exception());
+      }
+
+      template <typename value_t>
+        requires std::is_convertible_v<value_t&&, T>
+      void return_value(value_t&& value)
+        noexcept(std::is_nothrow_constructible_v<T, value_t&&>)
+      {
+        result_.template emplace<1>(std::forward<value_t>(value));
+      }
+
+      /// @brief Get the result of the coroutine. Rethrows the exception that
+      /// escaped the coroutine, if any.
+      T result()
+      {
+        if (result_.index() == 2)
+          std::rethrow_exception(std::get<2>(result_));
+
+        return std::move(std::get<1>(result_));
+      }
+
+    private:
+      std::variant<std::monostate, T, std::exception_ptr> result_;
+    };
+
+    /// @brief Promise of a task returning void.
+    template <>
+    class task_promise<void> : public task_promise_base
+    {
+    public:
+      task<void> get_return_object() noexcept;
+
+      void unhandled_exception() noexcept
+      {
+        exception_ = std::current_exception();
+      }
+
+      void return_void() const noexcept {}
+
+      /// @brief Rethrows the exception that escaped the coroutine, if any.
+      void result() const
+      {
+        if (exception_)
+          std::rethrow_exception(exception_);
+      }
+
+    private:
+      std::exception_ptr exception_;
+    };
+  }
+
+  /// @brief A lazily started coroutine returning a value of type T.
+  /// @details Unlike async_operation, a task only needs its coroutine frame:
+  /// the result lives in the promise, there is no future to poll and no
+  /// cancellation flag to share. Awaiting a task starts it and suspends the
+  /// caller; when the task completes it resumes the caller directly on the
+  /// same thread.
+  /// @tparam T The type of the value returned by the coroutine.
+  template <typename T>
+  class [[nodiscard]] task
+  {
+  public:
+    using promise_type = detail::task_promise<T>;
+
+    task() noexcept = default;
+
+    explicit task(std::coroutine_handle<promise_type> coroutine) noexcept
+      : coroutine_(coroutine)
+    {}
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    task(task&& other) noexcept
+      : coroutine_(std::exchange(other.coroutine_, nullptr))
+    {}
+
+    task& operator=(task&& other) noexcept
+    {
+      if (&other != this)
+      {
+        if (coroutine_)
+          coroutine_.destroy();
+        coroutine_ = std::exchange(other.coroutine_, nullptr);
+      }
+      return *this;
+    }
+
+    ~task()
+    {
+      if (coroutine_)
+        coroutine_.destroy();
+    }
+
+    /// @brief Check whether the task has run to completion.
+    bool is_ready() const noexcept
+    {
+      return !coroutine_ || coroutine_.done();
+    }
+
+    bool await_ready() const noexcept
+    {
+      return is_ready();
+    }
+
+    /// @brief Start the task and suspend the awaiting coroutine.
+    /// @param awaiting The coroutine awaiting the task.
+    /// @return The task coroutine, which is resumed in place of the caller.
+    std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+      coroutine_.promise().set_continuation(awaiting);
+      return coroutine_;
+    }
+
+    /// @brief Get the result of the task.
+    T await_resume()
+    {
+      return coroutine_.promise().result();
+    }
+
+  private:
+    std::coroutine_handle<promise_type> coroutine_ = nullptr;
+  };
+
+  namespace detail
+  {
+    template <typename T>
+    task<T> task_promise<T>::get_return_object() noexcept
+    {
+      return task<T>(
+        std::coroutine_handle<task_promise<T>>::from_promise(*this));
+    }
+
+    inline task<void> task_promise<void>::get_return_object() noexcept
+    {
+      return task<void>(
+        std::coroutine_handle<task_promise<void>>::from_promise(*this));
+    }
+
+    /// @brief Coroutine that owns its own frame: it starts eagerly and
+    /// destroys itself once it completes.
+    struct detached_task
+    {
+      struct promise_type : frame_allocated
+      {
+        detached_task get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+      };
+    };
+
+    /// @brief Coroutine used by sync_wait to drive a task from a thread that
+    /// is not a coroutine.
+    class sync_wait_task
+    {
+    public:
+      /// @brief Event signalled when the awaited task has completed.
+      struct event
+      {
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool is_set = false;
+
+        void set()
+        {
+          std::lock_guard lock{ mutex };
+          is_set = true;
+          condition.notify_one();
+        }
+
+        void wait()
+        {
+          std::unique_lock lock{ mutex };
+          condition.wait(lock, [this] { return is_set; });
+        }
+      };
+
+      struct promise_type
+      {
+        event* done = nullptr;
+
+        sync_wait_task get_return_object() noexcept
+        {
+          return sync_wait_task(
+            std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+
+        auto final_suspend() const noexcept
+        {
+          struct awaiter
+          {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(
+              std::coroutine_handle<promise_type> coroutine) const noexcept
+            {
+              coroutine.promise().done->set();
+            }
+
+            void await_resume() const noexcept {}
+          };
+          return awaiter{};
+        }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept { std::terminate(); }
+      };
+
+      explicit sync_wait_task(std::coroutine_handle<promise_type> coroutine)
+        : coroutine_(coroutine)
+      {}
+
+      sync_wait_task(const sync_wait_task&) = delete;
+
+      ~sync_wait_task()
+      {
+        if (coroutine_)
+          coroutine_.destroy();
+      }
+
+      /// @brief Start the coroutine and block until it completes.
+      void run()
+      {
+        event done;
+        coroutine_.promise().done = &done;
+        coroutine_.resume();
+        done.wait();
+      }
+
+    private:
+      std::coroutine_handle<promise_type> coroutine_;
+    };
+  }
+
+  /// @brief Start a task without waiting for its completion. The task runs on
+  /// the calling thread until its first suspension point, then wherever it is
+  /// resumed. The task must not let exceptions escape.
+  /// @param operation The task to start.
+  inline void start_detached(task<void> operation)
+  {
+    [](task<void> operation) -> detail::detached_task
+      {
+        co_await operation;
+      }(std::move(operation));
+  }
+
+  /// @brief Run a task to completion, blocking the calling thread.
+  /// @details Meant for code that is not a coroutine itself, such as main
+  /// functions and tests. Never call it from an I/O worker thread.
+  /// @param operation The task to run.
+  /// @return The result of the task.
+  template <typename T>
+  T sync_wait(task<T> operation)
+  {
+    std::exception_ptr exception;
+
+    if constexpr (std::is_void_v<T>)
+    {
+      auto runner = [](task<void>& operation,
+                       std::exception_ptr& exception)
+        -> detail::sync_wait_task
+        {
+          try { co_await operation; }
+          catch (...) { exception = std::current_exception(); }
+        };
+
+      runner(operation, exception).run();
+
+      if (exception)
+        std::rethrow_exception(exception);
+    }
+    else
+    {
+      std::optional<T> result;
+
+      auto runner = [](task<T>& operation,
+                       std::optional<T>& result,
+                       std::exception_ptr& exception)
+        -> detail::sync_wait_task
+        {
+          try { result.emplace(co_await operation); }
+          catch (...) { exception = std::current_exception(); }
+        };
+
+      runner(operation, result, exception).run();
+
+      if (exception)
+        std::rethrow_exception(exception);
+
+      return std::move(*result);
+    }
+  }
+}
@@ -1,23 +1,52 @@
 #pragma once
 
+#include <condition_variable>
+#include <coroutine>
 #include <functional>
 #include <mutex>
 #include <queue>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 
 namespace pine
 {
+  /// @brief Thrown when awaiting thread_pool::schedule while the queue of the
+  /// pool is full. The server answers the request with 503 Service
+  /// Unavailable.
+  class thread_pool_full : public std::runtime_error
+  {
+  public:
+    thread_pool_full()
+      : std::runtime_error("The queue of the thread pool is full")
+    {}
+  };
+
   /// @brief Thread pool for executing tasks.
   /// @details The thread pool is created with a fixed number of threads that
   /// are used to execute tasks asynchronously. The tasks are enqueued and
-  /// executed by the threads in the pool.
+  /// executed by the threads in the pool. New work is bounded by the size of
+  /// the queue, so a pool that cannot keep up rejects it instead of growing
+  /// until memory runs out. Producers are never blocked, since they are
+  /// usually I/O threads serving other connections.
   class thread_pool
   {
   public:
     static thread_pool& get_instance();
 
-    /// @brief Enqueue a task to be executed by the thread pool.
+    /// @brief Set the number of threads of the pool. Only effective when
+    /// called before the first call to get_instance.
+    /// @param thread_count The number of threads, 0 for one per processor.
+    static void set_thread_count(size_t thread_count);
+
+    /// @brief Set the maximum number of tasks waiting in the queue. Only
+    /// effective when called before the first call to get_instance.
+    /// @param max_queue_size The maximum number of tasks.
+    static void set_max_queue_size(size_t max_queue_size);
+
+    /// @brief Enqueue a task to be executed by the thread pool, even if the
+    /// queue is full. Meant for the continuations of work already accepted,
+    /// which must run; use try_enqueue or schedule for new work.
     /// @tparam task_type The type of the task to enqueue.
     /// @param task The task to enqueue.
     template <typename task_type>
@@ -28,6 +57,58 @@ namespace pine
       this->condition.notify_one();
     }
 
+    /// @brief Enqueue a task unless the queue is full.
+    /// @tparam task_type The type of the task to enqueue.
+    /// @param task The task to enqueue.
+    /// @return True if the task was enqueued, false if the queue is full.
+    template <typename task_type>
+    inline bool try_enqueue(task_type&& task)
+    {
+      std::unique_lock lock(this->queue_mutex);
+      if (this->tasks.size() >= this->max_queue_size)
+        return false;
+
+      this->tasks.emplace(std::forward<task_type>(task));
+      this->condition.notify_one();
+      return true;
+    }
+
+    /// @brief Get an awaitable that resumes the awaiting coroutine on one of
+    /// the threads of the pool. Use it to move blocking work off the I/O
+    /// threads. When the queue is full, the coroutine is resumed on the
+    /// calling thread and the await throws pine::thread_pool_full, rather
+    /// than running the blocking work on the calling thread.
+    /// @return The awaitable.
+    auto schedule()
+    {
+      struct awaiter
+      {
+        thread_pool& pool;
+        bool rejected = false;
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> coroutine)
+        {
+          // Once queued, the coroutine may already run on the pool and the
+          // awaiter must not be touched.
+          if (pool.try_enqueue([coroutine] { coroutine.resume(); }))
+            return true;
+
+          rejected = true;
+          return false;
+        }
+
+        void await_resume() const
+        {
+          if (rejected)
+            throw thread_pool_full();
+        }
+      };
+
+      return awaiter{ *this };
+    }
+
   private:
     /// @brief Construct a thread pool with a fixed number of threads.
     explicit thread_pool();
@@ -47,6 +128,7 @@ namespace pine
     std::queue<std::function<void()>> tasks;
     std::mutex queue_mutex;
     std::condition_variable condition;
+    size_t max_queue_size;
     bool stop = false;
   };
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace pine
+{
+  class timer_wheel;
+
+  /// @brief A timer that can be armed on a timer_wheel.
+  /// @details Timers are intrusive: the wheel links them into its slots, so
+  /// arming and cancelling never allocate. A timer cancels itself when it is
+  /// destroyed.
+  class timer
+  {
+  public:
+    /// @brief Construct a timer.
+    /// @param callback The function called when the timer expires. It is
+    /// called with the wheel locked, so it should be short. It may arm or
+    /// cancel timers, including the one that fired.
+    explicit timer(std::function<void()> callback = {})
+      : callback_(std::move(callback))
+    {}
+
+    timer(const timer&) = delete;
+    timer& operator=(const timer&) = delete;
+
+    ~timer();
+
+    /// @brief Replace the function called when the timer expires. Must not be
+    /// called while the timer is armed.
+    void set_callback(std::function<void()> callback)
+    {
+      callback_ = std::move(callback);
+    }
+
+    /// @brief Check whether the timer is armed.
+    bool is_armed() const noexcept
+    {
+      return next_ != nullptr;
+    }
+
+  private:
+    friend class timer_wheel;
+
+    timer* prev_ = nullptr;
+    timer* next_ = nullptr;
+    timer_wheel* wheel_ = nullptr;
+    uint64_t expiry_ = 0;
+    std::function<void()> callback_;
+  };
+
+  /// @brief A hierarchical timing wheel.
+  /// @details Time is divided in ticks of a fixed resolution. The wheel has
+  /// four levels of 256 slots: the first level holds the timers expiring in
+  /// the next 256 ticks, each following level covers 256 times the range of
+  /// the previous one. Timers of upper levels cascade down as time advances.
+  /// Arming and cancelling a timer are O(1) and the cost of advancing the
+  /// wheel does not depend on the number of armed timers, which keeps it cheap
+  /// with one timer per connection.
+  class timer_wheel
+  {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /// @brief Number of slots per level.
+    static constexpr size_t slot_count = 256;
+
+    /// @brief Number of levels.
+    static constexpr size_t level_count = 4;
+
+    /// @brief Construct a timer wheel.
+    /// @param resolution The duration of a tick. Timers expire at most one
+    /// tick late.
+    explicit timer_wheel(std::chrono::milliseconds resolution
+                         = std::chrono::milliseconds(10));
+
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    ~timer_wheel();
+
+    /// @brief Arm a timer. A timer that is already armed is re-armed.
+    /// @param timer The timer to arm.
+    /// @param delay The delay after which the timer expires.
+    void arm(timer& timer, std::chrono::milliseconds delay);
+
+    /// @brief Cancel a timer. Does nothing if the timer is not armed.
+    /// @param timer The timer to cancel.
+    void cancel(timer& timer);
+
+    /// @brief Advance the wheel to the given time and fire the expired
+    /// timers. Returns immediately if no tick has elapsed or if another
+    /// thread is already advancing the wheel, so it is cheap to call after
+    /// every completion.
+    /// @param now The current time.
+    /// @return The number of timers fired.
+    size_t poll(clock::time_point now = clock::now());
+
+    /// @brief Get the time until the next tick, to bound how long an event
+    /// loop may block.
+    /// @param now The current time.
+    std::chrono::milliseconds time_until_next_tick(clock::time_point now = clock::now()) const;
+
+    /// @brief Get the time the wheel started at.
+    clock::time_point start_time() const noexcept { return start_; }
+
+    /// @brief Get the duration of a tick.
+    std::chrono::milliseconds resolution() const noexcept { return resolution_; }
+
+    /// @brief Get the number of armed timers.
+    size_t size() const noexcept { return size_.load(std::memory_order_relaxed); }
+
+  private:
+    /// @brief Link a timer in the slot matching its expiry.
+    void insert(timer& timer);
+
+    /// @brief Unlink a timer from its slot.
+    void unlink(timer& timer);
+
+    /// @brief Move the timers of an upper level slot to the lower levels.
+    void cascade(size_t level, size_t index);
+
+    /// @brief Advance the wheel by one tick and fire the expired timers.
+    size_t tick();
+
+    /// @brief Sentinel of a slot: a circular list of timers.
+    struct slot
+    {
+      timer head;
+
+      slot()
+      {
+        head.prev_ = &head;
+        head.next_ = &head;
+      }
+    };
+
+    std::chrono::milliseconds resolution_;
+    clock::time_point start_;
+
+    std::recursive_mutex mutex_;
+    std::array<std::array<slot, slot_count>, level_count> levels_;
+    uint64_t current_tick_ = 0;
+    std::atomic<int64_t> next_tick_time_;
+    std::atomic<size_t> size_ = 0;
+  };
+}
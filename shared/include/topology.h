@@ -0,0 +1,185 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace pine
+{
+  /// @brief A logical processor.
+  struct processor
+  {
+    /// @brief The processor group. Windows splits machines with more than 64
+    /// logical processors in groups.
+    uint16_t group = 0;
+
+    /// @brief The index of the processor in its group.
+    uint8_t number = 0;
+
+    /// @brief The NUMA node of the processor.
+    uint32_t node = 0;
+  };
+
+  /// @brief Get the logical processors of the machine, sorted by NUMA node,
+  /// then group, then number. Consecutive processors thus share a node.
+  /// @return The processors. Never empty.
+  std::vector<processor> get_processors();
+
+  /// @brief Restrict a thread to a single logical processor.
+  /// @param thread The thread to pin.
+  /// @param target The processor.
+  /// @return True if the thread was pinned, false otherwise.
+  bool pin_thread(std::thread& thread, const processor& target);
+
+  /// @brief Pool of fixed size blocks allocated on a NUMA node.
+  /// @details Memory touched by a single thread should live on the node of the
+  /// processor running it, otherwise every access crosses the interconnect
+  /// between sockets. Blocks are carved out of chunks committed on the
+  /// requested node, one system call per chunk, and recycled instead of
+  /// being returned to the system. The chunks are released with the pool.
+  ///
+  /// Free blocks are kept in shards, each used by a few threads and locked
+  /// on its own, so threads rarely contend. A shard holding too many free
+  /// blocks gives half of them to the pool, and an empty shard takes a batch
+  /// from the pool, so blocks freed by one thread and allocated by another
+  /// only cross the lock of the pool once per batch.
+  class node_pool
+  {
+  public:
+    /// @brief Size of the chunks the blocks are carved out of, unless a
+    /// single block is bigger.
+    static constexpr size_t chunk_size = 1024 * 1024;
+
+    /// @brief Alignment of the blocks, a cache line so that blocks used by
+    /// different threads do not share one.
+    static constexpr size_t block_alignment = 64;
+
+    /// @brief Number of shards of free blocks, shared by the threads.
+    static constexpr size_t shard_count = 16;
+
+    /// @brief Maximum number of free blocks kept by a shard.
+    static constexpr size_t max_cached_blocks = 64;
+
+    /// @brief Number of blocks moved at once between a shard and the pool.
+    static constexpr size_t batch_size = max_cached_blocks / 2;
+
+    /// @brief Construct a pool.
+    /// @param block_size The size of the blocks.
+    /// @param node The NUMA node to allocate the blocks on.
+    node_pool(size_t block_size, uint32_t node);
+
+    node_pool(const node_pool&) = delete;
+    node_pool& operator=(const node_pool&) = delete;
+
+    ~node_pool();
+
+    /// @brief Allocate a block.
+    /// @return The block. Throws std::bad_alloc if no memory is available.
+    void* allocate();
+
+    /// @brief Give a block back to the pool.
+    /// @param block A block allocated by this pool.
+    void deallocate(void* block) noexcept;
+
+    /// @brief Deleter giving a block back to its pool, for std::unique_ptr.
+    struct deleter
+    {
+      node_pool* pool;
+
+      void operator()(void* block) const noexcept
+      {
+        pool->deallocate(block);
+      }
+    };
+
+    /// @brief Get the size of the blocks.
+    size_t block_size() const noexcept { return block_size_; }
+
+    /// @brief Get the NUMA node of the blocks.
+    uint32_t node() const noexcept { return node_; }
+
+  private:
+    /// @brief A free block. The link is stored in the block itself.
+    struct free_block
+    {
+      free_block* next;
+    };
+
+    /// @brief Free blocks of the threads using the shard.
+    struct alignas(64) shard
+    {
+      std::mutex mutex;
+      free_block* head = nullptr;
+      size_t size = 0;
+    };
+
+    /// @brief Take a batch of free blocks from the pool, carving them out of
+    /// a new chunk if it has none.
+    /// @param count Set to the number of blocks taken.
+    /// @return The blocks, linked.
+    free_block* take_batch(size_t& count);
+
+    /// @brief Allocate a chunk on the node of the pool. The pool must be
+    /// locked.
+    void allocate_chunk();
+
+    size_t block_size_;
+
+    /// @brief Distance between two blocks of a chunk.
+    size_t stride_;
+
+    size_t blocks_per_chunk_;
+    uint32_t node_;
+
+    std::array<shard, shard_count> shards_{};
+
+    /// @brief Guards the free blocks of the pool and the chunks.
+    std::mutex mutex_;
+    free_block* free_blocks_ = nullptr;
+
+    /// @brief The part of the last chunk not carved yet.
+    std::byte* next_block_ = nullptr;
+    std::byte* chunk_end_ = nullptr;
+
+    std::vector<std::byte*> chunks_;
+  };
+
+  /// @brief Base for classes whose instances should be allocated from a
+  /// node_pool, with new (pool) T(...). The pool is remembered in front of
+  /// the object, so a plain delete gives the memory back to it.
+  struct node_allocated
+  {
+    static void* operator new(size_t size, node_pool& pool)
+    {
+      if (size + header_size > pool.block_size())
+        throw std::bad_alloc();
+
+      auto block = static_cast<std::byte*>(pool.allocate());
+      *reinterpret_cast<node_pool**>(block) = &pool;
+      return block + header_size;
+    }
+
+    static void operator delete(void* object) noexcept
+    {
+      auto block = static_cast<std::byte*>(object) - header_size;
+      (*reinterpret_cast<node_pool**>(block))->deallocate(block);
+    }
+
+    /// @brief Called when a constructor throws.
+    static void operator delete(void* object, node_pool&) noexcept
+    {
+      operator delete(object);
+    }
+
+    /// @brief Space reserved in front of the object, keeping it aligned.
+    static constexpr size_t header_size = alignof(std::max_align_t);
+
+    /// @brief Size of the blocks of a pool holding objects of type T.
+    template <typename T>
+    static constexpr size_t block_size_for = sizeof(T) + header_size;
+  };
+}
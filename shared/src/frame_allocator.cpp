@@ -0,0 +1,93 @@
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "frame_allocator.h"
+
+namespace
+{
+  constexpr std::size_t size_class_count =
+    std::countr_zero(pine::frame_allocator::max_frame_size) -
+    std::countr_zero(pine::frame_allocator::min_frame_size) + 1;
+
+  /// @brief Get the size class of an allocation.
+  /// @param size The size of the allocation.
+  /// @return The index of the size class.
+  constexpr std::size_t size_class(std::size_t size) noexcept
+  {
+    if (size <= pine::frame_allocator::min_frame_size)
+      return 0;
+
+    return std::bit_width(size - 1) -
+      std::countr_zero(pine::frame_allocator::min_frame_size);
+  }
+
+  /// @brief A free frame. The link is stored in the frame itself.
+  struct free_frame
+  {
+    free_frame* next;
+  };
+
+  /// @brief Free lists of one thread, one per size class.
+  struct frame_pools
+  {
+    struct free_list
+    {
+      free_frame* head = nullptr;
+      std::size_t size = 0;
+    };
+
+    std::array<free_list, size_class_count> lists{};
+
+    ~frame_pools()
+    {
+      for (auto& list : lists)
+      {
+        while (list.head)
+          ::operator delete(std::exchange(list.head, list.head->next));
+        list.size = 0;
+      }
+    }
+  };
+
+  thread_local frame_pools pools;
+}
+
+namespace pine
+{
+  void* frame_allocator::allocate(std::size_t size)
+  {
+    if (size > max_frame_size)
+      return ::operator new(size);
+
+    std::size_t index = size_class(size);
+    auto& list = pools.lists[index];
+    if (list.head)
+    {
+      list.size--;
+      return std::exchange(list.head, list.head->next);
+    }
+
+    return ::operator new(min_frame_size << index);
+  }
+
+  void frame_allocator::deallocate(void* frame, std::size_t size) noexcept
+  {
+    if (size > max_frame_size)
+    {
+      ::operator delete(frame);
+      return;
+    }
+
+    auto& list = pools.lists[size_class(size)];
+    if (list.size >= max_cached_frames)
+    {
+      ::operator delete(frame);
+      return;
+    }
+
+    list.head = new (frame) free_frame{ list.head };
+    list.size++;
+  }
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
 #include <cstring>
 #include <format>
 #include <map>
@@ -9,6 +13,83 @@
 #include "expected.h"
 #include "http.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define PINE_SSE2
+#endif
+
+namespace
+{
+  /// @brief Get the value of a hexadecimal digit.
+  /// @param c The digit.
+  /// @return The value, -1 if c is not a hexadecimal digit.
+  int hex_value(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  /// @brief Check whether a path may need normalizing from a position: on
+  /// an escape, on a duplicate slash or on a segment starting with a dot.
+  bool needs_normalizing(std::string_view path, size_t i)
+  {
+    if (path[i] == '%')
+      return true;
+
+    return path[i] == '/'
+      && i + 1 < path.size()
+      && (path[i + 1] == '/' || path[i + 1] == '.');
+  }
+
+  /// @brief Find the first position of a path from which it may need
+  /// normalizing. Most paths are normal, and 16 bytes are checked at a time
+  /// where SSE2 is available.
+  /// @param path The path.
+  /// @return The position, or the size of the path if it is normal.
+  size_t find_unnormalized(std::string_view path)
+  {
+    size_t i = 0;
+
+  #ifdef PINE_SSE2
+    const __m128i percents = _mm_set1_epi8('%');
+    const __m128i slashes = _mm_set1_epi8('/');
+    const __m128i dots = _mm_set1_epi8('.');
+
+    // Each byte is compared with the next one through a second load one
+    // byte further, so the block must be followed by at least one byte.
+    for (; i + 17 <= path.size(); i += 16)
+    {
+      __m128i bytes = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(path.data() + i));
+      __m128i next = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(path.data() + i + 1));
+
+      __m128i slash = _mm_cmpeq_epi8(bytes, slashes);
+      __m128i next_special = _mm_or_si128(_mm_cmpeq_epi8(next, slashes),
+                                          _mm_cmpeq_epi8(next, dots));
+      __m128i special = _mm_or_si128(_mm_cmpeq_epi8(bytes, percents),
+                                     _mm_and_si128(slash, next_special));
+
+      if (auto mask = static_cast<unsigned>(_mm_movemask_epi8(special)))
+        return i + std::countr_zero(mask);
+    }
+  #endif // PINE_SSE2
+
+    for (; i < path.size(); ++i)
+    {
+      if (needs_normalizing(path, i))
+        return i;
+    }
+
+    return path.size();
+  }
+}
+
 namespace pine::http_utils
 {
   std::expected<std::string_view, pine::error>
@@ -27,7 +108,7 @@ namespace pine::http_utils
     return body;
   }
 
-  std::expected<std::pair<std::string, std::string_view>, pine::error>
+  std::expected<std::pair<std::string_view, std::string_view>, pine::error>
     try_get_header(std::string_view request, size_t& offset)
   {
     size_t start = offset;
@@ -48,12 +129,9 @@ namespace pine::http_utils
 
     offset = end + strlen(crlf);
 
-    const auto& name = std::string(
-      request.substr(name_start, name_end - name_start));
-    const auto& value = std::string(
+    return std::make_pair(
+      request.substr(name_start, name_end - name_start),
       request.substr(value_start, value_end - value_start));
-
-    return std::make_pair(name, value);
   }
 
   std::expected<std::unordered_map<std::string, std::string>, pine::error>
@@ -76,7 +154,7 @@ namespace pine::http_utils
         return std::make_unexpected(header_result.error());
       const auto& [name, value] = header_result.value();
 
-      result.insert_or_assign(name, value);
+      result.insert_or_assign(std::string(name), std::string(value));
     }
 
     return {};
@@ -139,7 +217,165 @@ namespace pine::http_utils
     }
 
     offset = end;
-    return std::string(request.substr(start, end - start));
+    return request.substr(start, end - start);
+  }
+
+  std::expected<size_t, pine::error>
+    get_content_length(std::string_view head)
+  {
+    constexpr std::string_view content_length = "content-length:";
+    constexpr std::string_view transfer_encoding = "transfer-encoding:";
+
+    auto has_name = [](std::string_view line, std::string_view name)
+      {
+        return line.size() >= name.size()
+          && std::equal(name.begin(), name.end(), line.begin(),
+                        [](char expected, char c)
+                        {
+                          return expected == std::tolower(static_cast<unsigned char>(c));
+                        });
+      };
+
+    auto invalid = [](const char* message)
+      {
+        return std::make_unexpected(
+          error(error_code::parse_error_headers, message));
+      };
+
+    bool found = false;
+    size_t length = 0;
+    for (size_t start = head.find(crlf);
+         start != std::string_view::npos;
+         start = head.find(crlf, start))
+    {
+      start += strlen(crlf);
+      std::string_view line = head.substr(start, head.find(crlf, start) - start);
+
+      if (has_name(line, transfer_encoding))
+        return invalid("Transfer-Encoding is not supported.");
+
+      if (!has_name(line, content_length))
+        continue;
+
+      std::string_view value = line.substr(content_length.size());
+      while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        value.remove_prefix(1);
+      while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+        value.remove_suffix(1);
+
+      // from_chars stops at the first byte that is not a digit, so the
+      // whole value must have been read: "5abc" is not 5.
+      size_t value_length = 0;
+      auto [end, ec] = std::from_chars(value.data(),
+                                       value.data() + value.size(),
+                                       value_length);
+      if (value.empty() || ec != std::errc{}
+          || end != value.data() + value.size())
+        return invalid("The Content-Length header is invalid.");
+
+      if (found && value_length != length)
+        return invalid("The Content-Length headers conflict.");
+
+      found = true;
+      length = value_length;
+    }
+
+    return length;
+  }
+
+  size_t percent_decode(std::string_view text, char* output)
+  {
+    size_t size = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+      if (text[i] == '+')
+      {
+        output[size++] = ' ';
+        continue;
+      }
+
+      if (text[i] == '%' && i + 2 < text.size())
+      {
+        int high = hex_value(text[i + 1]);
+        int low = hex_value(text[i + 2]);
+        if (high >= 0 && low >= 0)
+        {
+          output[size++] = static_cast<char>(high << 4 | low);
+          i += 2;
+          continue;
+        }
+      }
+
+      output[size++] = text[i];
+    }
+
+    return size;
+  }
+
+  std::expected<std::string_view, pine::error>
+    normalize_path(std::string_view path, char* output)
+  {
+    if (!path.starts_with('/'))
+      return std::make_unexpected(
+        error(error_code::parse_error_uri, "The path must start with '/'."));
+
+    size_t first = find_unnormalized(path);
+    if (first == path.size())
+      return path;
+
+    // Keep the normal segments before the first one needing work, then
+    // rebuild the rest segment by segment. The output always ends with a
+    // '/' where a segment starts.
+    size_t i = path.rfind('/', first) + 1;
+    std::memcpy(output, path.data(), i);
+    size_t size = i;
+
+    for (;;)
+    {
+      size_t segment = size;
+      for (; i < path.size() && path[i] != '/'; ++i)
+      {
+        char c = path[i];
+        if (c == '%')
+        {
+          int high = i + 2 < path.size() ? hex_value(path[i + 1]) : -1;
+          int low = i + 2 < path.size() ? hex_value(path[i + 2]) : -1;
+          if (high < 0 || low < 0)
+            return std::make_unexpected(
+              error(error_code::parse_error_uri,
+                    "The path has an invalid escape."));
+
+          c = static_cast<char>(high << 4 | low);
+          if (c == '/' || c == '\0')
+            return std::make_unexpected(
+              error(error_code::parse_error_uri,
+                    "The path has an escaped '/' or NUL."));
+
+          i += 2;
+        }
+
+        output[size++] = c;
+      }
+
+      std::string_view name{ output + segment, size - segment };
+      bool last = i == path.size();
+
+      if (name == "." || name == "..")
+      {
+        size = segment;
+
+        // Remove the previous segment, keeping its leading '/'.
+        if (name == ".." && segment > 1)
+          size = std::string_view{ output, segment - 1 }.rfind('/') + 1;
+      }
+      else if (!name.empty() && !last)
+        output[size++] = '/';
+
+      if (last)
+        return std::string_view{ output, size };
+
+      ++i;
+    }
   }
 
   std::expected<http_version, pine::error>
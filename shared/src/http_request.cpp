@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <cstring>
 #include <map>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include "error.h"
 #include "expected.h"
 #include "http.h"
@@ -12,14 +17,24 @@ namespace pine
                              std::string_view uri,
                              pine::http_version version,
                              const std::unordered_map<std::string, std::string_view>& headers,
-                             std::string_view body)
-    : method(method), uri(uri), version(version), headers(headers), body(body)
-  {}
+                             std::string_view body,
+                             std::pmr::memory_resource* resource)
+    : method(method), uri(uri, resource), version(version),
+    headers(resource), body(body, resource),
+    normalized_path(resource), query_params(resource),
+    query_decoded(resource)
+  {
+    // A path that cannot be normalized is kept as it is.
+    std::ignore = split_uri();
+    for (const auto& [name, value] : headers)
+      set_header(name, value);
+  }
 
   std::expected<http_request, pine::error>
-    http_request::parse(std::string_view request)
+    http_request::parse(std::string_view request,
+                        std::pmr::memory_resource* resource)
   {
-    http_request result;
+    http_request result(resource);
 
     size_t offset = 0;
     const auto& method_result = http_utils::try_get_method(request, offset);
@@ -32,6 +47,8 @@ namespace pine
     if (!uri_result)
       return std::make_unexpected(uri_result.error());
     result.uri = uri_result.value();
+    if (auto split_result = result.split_uri(); !split_result)
+      return std::make_unexpected(split_result.error());
     offset += strlen(" ");
 
     const auto& version_result = http_utils::try_get_version(request, offset);
@@ -40,11 +57,23 @@ namespace pine
     result.version = version_result.value();
     offset += strlen(crlf);
 
-    const auto& headers_result = http_utils::try_get_headers(request, offset);
-    if (!headers_result)
-      return std::make_unexpected(headers_result.error());
-    for (const auto& [name, value] : headers_result.value())
-      result.headers.insert_or_assign(name, value);
+    // Read the headers one by one rather than with try_get_headers, so they
+    // are copied straight into the resource of the request.
+    while (offset < request.size())
+    {
+      if (request.substr(offset).starts_with(crlf))
+      {
+        offset += strlen(crlf);
+        break;
+      }
+
+      const auto& header_result = http_utils::try_get_header(request, offset);
+      if (!header_result)
+        return std::make_unexpected(header_result.error());
+
+      const auto& [name, value] = header_result.value();
+      result.set_header(name, value);
+    }
 
     if (offset < request.size())
     {
@@ -57,32 +86,130 @@ namespace pine
     return result;
   }
 
-  std::string_view http_request::get_header(const std::string& name) const
+  std::expected<void, pine::error> http_request::split_uri()
   {
-    if (this->headers.contains(name))
+    this->path_size = std::min(this->uri.find('?'), this->uri.size());
+    this->normalized_path.clear();
+    this->query_params.clear();
+    this->query_decoded.clear();
+    this->query_parsed = false;
+
+    std::string_view path = std::string_view{ this->uri }.substr(0, this->path_size);
+    if (path.empty())
+      return {};
+
+    // Normalizing never makes the path longer. The buffer is only kept if
+    // the path was not normal.
+    this->normalized_path.resize(path.size());
+    auto normalized = http_utils::normalize_path(path,
+                                                 this->normalized_path.data());
+    if (!normalized)
     {
-      return this->headers.at(name);
+      this->normalized_path.clear();
+      return std::make_unexpected(normalized.error());
     }
+
+    if (normalized->data() == path.data())
+      this->normalized_path.clear();
     else
+      this->normalized_path.resize(normalized->size());
+
+    return {};
+  }
+
+  void http_request::parse_query() const
+  {
+    this->query_parsed = true;
+
+    std::string_view query = get_query();
+    size_t query_offset = this->uri.size() - query.size();
+
+    for (size_t start = 0; start < query.size();)
     {
-      static const std::string empty;
-      return empty;
+      size_t end = std::min(query.find('&', start), query.size());
+      std::string_view pair = query.substr(start, end - start);
+      size_t offset = query_offset + start;
+      start = end + 1;
+
+      if (pair.empty())
+        continue;
+
+      size_t equal = std::min(pair.find('='), pair.size());
+      std::string_view name = pair.substr(0, equal);
+      std::string_view value = pair.substr(std::min(equal + 1, pair.size()));
+
+      if (pair.find_first_of("%+") == std::string_view::npos)
+      {
+        this->query_params.push_back({ offset, name.size(),
+                                       offset + pair.size() - value.size(),
+                                       value.size(), false });
+        continue;
+      }
+
+      // Decoded text is never longer than the query string, so reserving
+      // it once keeps the buffer from moving.
+      if (this->query_decoded.capacity() < query.size())
+        this->query_decoded.reserve(query.size());
+
+      size_t name_offset = this->query_decoded.size();
+      this->query_decoded.resize(name_offset + pair.size());
+      char* output = this->query_decoded.data() + name_offset;
+
+      size_t name_size = http_utils::percent_decode(name, output);
+      size_t value_size = http_utils::percent_decode(value,
+                                                     output + name_size);
+      this->query_decoded.resize(name_offset + name_size + value_size);
+
+      this->query_params.push_back({ name_offset, name_size,
+                                     name_offset + name_size, value_size,
+                                     true });
     }
   }
 
+  std::optional<std::string_view>
+    http_request::find_query_param(std::string_view name) const
+  {
+    if (!this->query_parsed)
+      parse_query();
+
+    for (const auto& param : this->query_params)
+    {
+      std::string_view text = param.decoded
+        ? std::string_view{ this->query_decoded }
+        : std::string_view{ this->uri };
+
+      if (text.substr(param.name_offset, param.name_size) == name)
+        return text.substr(param.value_offset, param.value_size);
+    }
+
+    return std::nullopt;
+  }
+
+  std::string_view http_request::get_header(std::string_view name) const
+  {
+    if (auto it = this->headers.find(name); it != this->headers.end())
+      return it->second;
+
+    return {};
+  }
+
   std::string http_request::to_string() const
   {
     std::string result;
 
     result += pine::http_method_strings.at(this->method);
     result += " ";
-    result += this->uri + " ";
+    result += this->uri;
+    result += " ";
     result += pine::http_version_strings.at(this->version);
     result += crlf;
 
     for (const auto& [name, value] : this->headers)
     {
-      result += name + ": " + std::string(value) + crlf;
+      result += name;
+      result += ": ";
+      result += value;
+      result += crlf;
     }
 
     result += crlf;
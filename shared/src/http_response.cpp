@@ -1,6 +1,8 @@
+#include <array>
+#include <charconv>
 #include <cstring>
 #include <expected.h>
-#include <format>
+#include <memory_resource>
 #include <string>
 #include "error.h"
 #include "http.h"
@@ -30,7 +32,8 @@ namespace pine
     const auto& headers_result = http_utils::try_get_headers(response, offset);
     if (!headers_result)
       return std::make_unexpected(headers_result.error());
-    result.headers = headers_result.value();
+    for (const auto& [name, value] : headers_result.value())
+      result.set_header(name, value);
 
     if (offset < response.size())
     {
@@ -44,42 +47,64 @@ namespace pine
   }
 
   std::string_view
-    http_response::get_header(const std::string& name) const
+    http_response::get_header(std::string_view name) const
   {
-    if (this->headers.contains(name))
-    {
-      return this->headers.at(name);
-    }
-    else
-    {
-      static const std::string empty;
-      return empty;
-    }
+    if (auto it = this->headers.find(name); it != this->headers.end())
+      return it->second;
+
+    return {};
   }
 
-  std::string http_response::to_string() const
+  template <typename string_type>
+  void http_response::append_to(string_type& result) const
   {
     std::string_view version_string = http_version_strings.at(this->version);
-    const std::string& status_code_string = std::to_string(static_cast<int>(this->status));
     std::string_view status_message_string = http_status_strings.at(this->status);
 
-    std::string result = std::format("{} {} {}",
-                                     version_string,
-                                     status_code_string,
-                                     status_message_string);
+    std::array<char, 4> status_code;
+    auto status_code_end = std::to_chars(status_code.data(),
+                                         status_code.data() + status_code.size(),
+                                         static_cast<int>(this->status)).ptr;
+    std::string_view status_code_string(status_code.data(), status_code_end);
+
+    // Reserve the whole response up front so it is built with one allocation.
+    size_t size = version_string.size() + 1 + status_code_string.size() + 1
+      + status_message_string.size() + 2 + 2 + this->body.size();
+    for (const auto& [name, value] : this->headers)
+      size += name.size() + 2 + value.size() + 2;
+    result.reserve(result.size() + size);
 
+    result += version_string;
+    result += ' ';
+    result += status_code_string;
+    result += ' ';
+    result += status_message_string;
     result += crlf;
 
     for (const auto& [name, value] : this->headers)
     {
-      result += name + ": ";
+      result += name;
+      result += ": ";
       result += value;
       result += crlf;
     }
 
     result += crlf;
     result += this->body;
+  }
 
+  std::string http_response::to_string() const
+  {
+    std::string result;
+    append_to(result);
+    return result;
+  }
+
+  std::pmr::string
+    http_response::to_string(std::pmr::memory_resource* resource) const
+  {
+    std::pmr::string result(resource);
+    append_to(result);
     return result;
   }
-}
\ No newline at end of file
+}
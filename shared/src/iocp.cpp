@@ -6,17 +6,42 @@
 #include <bit>
 #include <cstring>
 #include <iocp.h>
-#include <loguru.hpp>
+#include <log_sink.h>
+#include <span>
 #include <thread>
+#include <topology.h>
 
 namespace pine
 {
+  sockaddr_in get_peer_address(const iocp_operation_data& data) noexcept
+  {
+    sockaddr* local_address = nullptr;
+    sockaddr* remote_address = nullptr;
+    int local_length = 0;
+    int remote_length = 0;
+
+    GetAcceptExSockaddrs(const_cast<char*>(data.accept_buffer.data()),
+                         0,
+                         sizeof(sockaddr_in) + 16,
+                         sizeof(sockaddr_in) + 16,
+                         &local_address,
+                         &local_length,
+                         &remote_address,
+                         &remote_length);
+
+    sockaddr_in peer{};
+    if (remote_address && remote_length >= static_cast<int>(sizeof(sockaddr_in)))
+      memcpy(&peer, remote_address, sizeof(sockaddr_in));
+    return peer;
+  }
+
   DWORD WINAPI iocp_context::worker_thread(LPVOID arg)
   {
     auto args = (thread_data*)arg;
     HANDLE iocp = args->iocp;
     SOCKET socket = args->socket;
     iocp_context* context = args->iocp_context;
+    bool drives_timers = args->drives_timers;
 
     while (true)
     {
@@ -24,49 +49,82 @@ namespace pine
       ULONG_PTR completion_key;
       LPOVERLAPPED overlapped;
 
-      LOG_F(1, "Worker thread waiting for notification");
+      PINE_LOG(debug, "Worker thread waiting for notification");
+
+      DWORD timeout = drives_timers
+        ? static_cast<DWORD>(context->timers_.time_until_next_tick().count())
+        : INFINITE;
 
       bool result = GetQueuedCompletionStatus(iocp,
                                               &bytes_transferred,
                                               &completion_key,
                                               &overlapped,
-                                              INFINITE);
+                                              timeout);
+      DWORD last_error = result ? 0 : GetLastError();
+
+      context->timers_.poll();
 
-      LOG_F(1, "Worker thread received a notification! Key: %d", completion_key);
+      PINE_LOG(debug, "Worker thread received a notification! Key: %d", completion_key);
 
-      if (!result || !overlapped)
+      if (!overlapped && last_error == WAIT_TIMEOUT)
+        continue;
+
+      if (!overlapped)
       {
-        LOG_F(ERROR, "Worker thread failed to get completion status:\n"
-              "\tiocp                             = %d\n"
-              "\tsocket                           = %d\n"
-              "\tWSAGetLastError                  = %d\n"
-              "\tGetLastError                     = %d\n"
-              "\tGetQueuedCompletionStatusresult  = %x\n"
-              "\toverlapped                       = %x\n"
-              "\tbytes_transferred                = %d\n"
-              "\tcompletion_key                   = %d\n",
-              iocp, socket, WSAGetLastError(), GetLastError(), result, overlapped, bytes_transferred, completion_key);
+        PINE_LOG(error, "Worker thread failed to get completion status:\n"
+                 "\tiocp                             = %d\n"
+                 "\tsocket                           = %d\n"
+                 "\tWSAGetLastError                  = %d\n"
+                 "\tGetLastError                     = %d\n"
+                 "\tGetQueuedCompletionStatusresult  = %x\n"
+                 "\toverlapped                       = %x\n"
+                 "\tbytes_transferred                = %d\n"
+                 "\tcompletion_key                   = %d\n",
+                 iocp, socket, WSAGetLastError(), GetLastError(), result, overlapped, bytes_transferred, completion_key);
         break;
       }
 
       auto data = CONTAINING_RECORD(overlapped, iocp_operation_data, overlapped);
       data->bytes_transferred = bytes_transferred;
-      data->overlapped = *overlapped;
+      data->error = last_error;
+
+      // Operations posted by an awaitable belong to the awaiting coroutine.
+      // Resume it on this thread; the data must not be touched afterwards.
+      if (data->continuation)
+      {
+        data->continuation.resume();
+        continue;
+      }
+
+      if (data->error != 0)
+      {
+        PINE_LOG(debug, "Operation failed on socket %d: %d", data->socket, data->error);
+
+        if (data->operation == iocp_operation::accept)
+        {
+          closesocket(data->socket);
+          delete data;
+          context->post_accept(socket, {}, 0);
+          continue;
+        }
+
+        // A failed read or write is reported as a closed connection.
+        data->bytes_transferred = 0;
+      }
 
       switch (data->operation)
       {
         using enum iocp_operation;
       case accept:
-        LOG_F(1, "Worker thread accepted a connection");
-        context->associate(data->socket);
+        PINE_LOG(debug, "Worker thread accepted a connection");
         context->on_accept_(data);
         break;
       case read:
-        LOG_F(1, "Worker thread read data");
+        PINE_LOG(debug, "Worker thread read data");
         context->on_read_(data);
         break;
       case write:
-        LOG_F(1, "Worker thread wrote data");
+        PINE_LOG(debug, "Worker thread wrote data");
         context->on_write_(data);
         break;
       }
@@ -81,14 +139,14 @@ namespace pine
   {
     iocp_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
 
-    LOG_F(1, "IOCP created: %d", iocp_);
+    PINE_LOG(debug, "IOCP created: %d", iocp_);
   }
 
   iocp_context::~iocp_context()
   {
     CloseHandle(iocp_);
 
-    LOG_F(1, "IOCP destroyed: %d", iocp_);
+    PINE_LOG(debug, "IOCP destroyed: %d", iocp_);
   }
 
   bool iocp_context::associate(SOCKET socket)
@@ -96,14 +154,18 @@ namespace pine
     if (HANDLE cp = CreateIoCompletionPort(std::bit_cast<HANDLE>(socket), iocp_, socket, 0);
         cp == nullptr)
     {
-      LOG_F(ERROR, "Failed to associate socket %d with IOCP", socket);
+      PINE_LOG(error, "Failed to associate socket %d with IOCP", socket);
       return false;
     }
 
     return true;
   }
 
-  bool iocp_context::post(iocp_operation operation, SOCKET socket, WSABUF wsa_buffer, DWORD flags)
+  bool iocp_context::post(iocp_operation operation,
+                          SOCKET socket,
+                          WSABUF wsa_buffer,
+                          DWORD flags,
+                          ULONG_PTR user_data)
   {
     switch (operation)
     {
@@ -111,18 +173,18 @@ namespace pine
     case accept:
       return post_accept(socket, wsa_buffer, flags);
     case read:
-      return post_read(socket, wsa_buffer, flags);
+      return post_read(socket, wsa_buffer, flags, user_data);
     case write:
-      return post_write(socket, wsa_buffer, flags);
+      return post_write(socket, wsa_buffer, flags, user_data);
     default:
-      LOG_F(WARNING, "Invalid IOCP operation");
+      PINE_LOG(warning, "Invalid IOCP operation");
       return false;
     }
   }
 
   bool iocp_context::close()
   {
-    LOG_F(1, "Closing IOCP");
+    PINE_LOG(debug, "Closing IOCP");
 
     return CloseHandle(iocp_);
   }
@@ -142,24 +204,28 @@ namespace pine
                               nullptr);
         result == 0)
     {
-      LOG_F(1, "AcceptEx initialized");
+      PINE_LOG(debug, "AcceptEx initialized");
       return true;
     }
     else
     {
-      LOG_F(WARNING, "Failed to initialize AcceptEx");
+      PINE_LOG(warning, "Failed to initialize AcceptEx");
       return false;
     }
   }
 
-  void iocp_context::setup_thread_pool(SOCKET socket)
+  void iocp_context::setup_thread_pool(SOCKET socket, size_t thread_count)
   {
-    SYSTEM_INFO system_info;
-    GetSystemInfo(&system_info);
+    if (thread_count == 0)
+    {
+      SYSTEM_INFO system_info;
+      GetSystemInfo(&system_info);
+      thread_count = system_info.dwNumberOfProcessors * 2;
+    }
 
-    for (DWORD i = 0; i < system_info.dwNumberOfProcessors * 2; i++)
+    for (size_t i = 0; i < thread_count; i++)
     {
-      auto thread_args = new thread_data{ iocp_, socket, this };
+      auto thread_args = new thread_data{ iocp_, socket, this, i == 0 };
       this->threads_.emplace_back(worker_thread, thread_args);
     }
 
@@ -168,7 +234,121 @@ namespace pine
       SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_HIGHEST);
     }
 
-    LOG_F(1, "Thread pool created with %d threads", system_info.dwNumberOfProcessors);
+    PINE_LOG(debug, "Thread pool created with %zu threads", thread_count);
+  }
+
+  bool iocp_context::pin_threads(std::span<const processor> processors)
+  {
+    bool pinned = true;
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+      const processor& target = processors[i % processors.size()];
+      if (!pin_thread(threads_[i], target))
+      {
+        PINE_LOG(warning, "Failed to pin thread to processor %u:%u: %d",
+                 target.group, target.number, GetLastError());
+        pinned = false;
+      }
+    }
+
+    return pinned;
+  }
+
+  bool socket_read_awaitable::await_suspend(std::coroutine_handle<> coroutine) noexcept
+  {
+    data_.continuation = coroutine;
+
+    DWORD flags = 0;
+    if (int result = WSARecv(data_.socket,
+                             &data_.wsa_buffer,
+                             1,
+                             nullptr,
+                             &flags,
+                             &data_.overlapped,
+                             nullptr);
+        result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
+    {
+      data_.error = WSAGetLastError();
+      return false;
+    }
+
+    // The completion may already be resuming the coroutine on another thread,
+    // the awaiter must not be touched from here.
+    return true;
+  }
+
+  bool socket_write_awaitable::await_suspend(std::coroutine_handle<> coroutine) noexcept
+  {
+    data_.continuation = coroutine;
+
+    if (int result = WSASend(data_.socket,
+                             buffers_.data(),
+                             static_cast<DWORD>(buffers_.size()),
+                             nullptr,
+                             0,
+                             &data_.overlapped,
+                             nullptr);
+        result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
+    {
+      data_.error = WSAGetLastError();
+      return false;
+    }
+
+    return true;
+  }
+
+  bool socket_accept_awaitable::await_suspend(std::coroutine_handle<> coroutine) noexcept
+  {
+    data_.continuation = coroutine;
+    data_.socket = WSASocket(AF_INET,
+                             SOCK_STREAM,
+                             IPPROTO_TCP,
+                             nullptr,
+                             0,
+                             WSA_FLAG_OVERLAPPED);
+    if (data_.socket == INVALID_SOCKET)
+    {
+      data_.error = WSAGetLastError();
+      return false;
+    }
+
+    DWORD bytes_received;
+    if (int result = context_.accept_ex(listen_socket_,
+                                        data_.socket,
+                                        data_.accept_buffer.data(),
+                                        0,
+                                        sizeof(sockaddr_in) + 16,
+                                        sizeof(sockaddr_in) + 16,
+                                        &bytes_received,
+                                        &data_.overlapped);
+        result == FALSE && WSAGetLastError() != ERROR_IO_PENDING)
+    {
+      data_.error = WSAGetLastError();
+      return false;
+    }
+
+    return true;
+  }
+
+  std::expected<SOCKET, pine::error> socket_accept_awaitable::await_resume()
+  {
+    if (data_.error == 0)
+    {
+      // Let getpeername and shutdown work on the accepted socket.
+      setsockopt(data_.socket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+                 reinterpret_cast<char*>(&listen_socket_),
+                 sizeof(listen_socket_));
+
+      if (context_.associate(data_.socket))
+        return data_.socket;
+
+      data_.error = GetLastError();
+    }
+
+    if (data_.socket != INVALID_SOCKET)
+      closesocket(data_.socket);
+
+    return std::make_unexpected(get_error());
   }
 
   bool iocp_context::post_accept(SOCKET socket, WSABUF wsa_buffer, DWORD flags)
@@ -181,11 +361,11 @@ namespace pine
                                      WSA_FLAG_OVERLAPPED);
     if (accept_socket == INVALID_SOCKET)
     {
-      LOG_F(WARNING, "Failed to create accept socket");
+      PINE_LOG(warning, "Failed to create accept socket");
       return false;
     }
 
-    LOG_F(1, "Accept socket created: %d", accept_socket);
+    PINE_LOG(debug, "Accept socket created: %d", accept_socket);
 
     auto data = new iocp_operation_data;
     memset(&data->overlapped, 0, sizeof(data->overlapped));
@@ -203,22 +383,23 @@ namespace pine
                                &data->overlapped);
         result == FALSE && WSAGetLastError() != ERROR_IO_PENDING)
     {
-      LOG_F(WARNING, "Failed to post AcceptEx");
+      PINE_LOG(warning, "Failed to post AcceptEx");
       delete data;
       return false;
     }
 
-    LOG_F(1, "Accept posted");
+    PINE_LOG(debug, "Accept posted");
     return true;
   }
 
-  bool iocp_context::post_read(SOCKET socket, WSABUF wsa_buffer, DWORD flags)
+  bool iocp_context::post_read(SOCKET socket, WSABUF wsa_buffer, DWORD flags, ULONG_PTR user_data)
   {
     auto data = new iocp_operation_data;
     data->socket = socket;
     data->operation = iocp_operation::read;
     data->wsa_buffer = wsa_buffer;
     data->flags = flags;
+    data->user_data = user_data;
     memset(&data->overlapped, 0, sizeof(data->overlapped));
     DWORD bytes_received;
     if (int result = WSARecv(socket,
@@ -230,22 +411,23 @@ namespace pine
                              nullptr);
         result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
     {
-      LOG_F(ERROR, "Failed to post WSARecv: %d", WSAGetLastError());
+      PINE_LOG(error, "Failed to post WSARecv: %d", WSAGetLastError());
       delete data;
       return false;
     }
 
-    LOG_F(1, "Read posted");
+    PINE_LOG(debug, "Read posted");
     return true;
   }
 
-  bool iocp_context::post_write(SOCKET socket, WSABUF wsa_buffer, DWORD flags)
+  bool iocp_context::post_write(SOCKET socket, WSABUF wsa_buffer, DWORD flags, ULONG_PTR user_data)
   {
     auto data = new iocp_operation_data;
     data->socket = socket;
     data->operation = iocp_operation::write;
     data->wsa_buffer = wsa_buffer;
     data->flags = flags;
+    data->user_data = user_data;
     memset(&data->overlapped, 0, sizeof(data->overlapped));
     DWORD bytes_sent;
     if (int result = WSASend(socket,
@@ -257,12 +439,12 @@ namespace pine
                              nullptr);
         result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING)
     {
-      LOG_F(WARNING, "Failed to post WSASend: %d", WSAGetLastError());
+      PINE_LOG(warning, "Failed to post WSASend: %d", WSAGetLastError());
       delete data;
       return false;
     }
 
-    LOG_F(1, "Write posted");
+    PINE_LOG(debug, "Write posted");
     return true;
   }
 }
\ No newline at end of file
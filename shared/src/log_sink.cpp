@@ -0,0 +1,404 @@
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <log_sink.h>
+#include <loguru.hpp>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace
+{
+  /// @brief Time the background thread waits between polls of the ring.
+  constexpr std::chrono::milliseconds idle_interval{ 1 };
+
+  /// @brief Number of polls finding no record before the background thread
+  /// sleeps until woken.
+  constexpr size_t max_idle_rounds = 100;
+
+  /// @brief Append a conversion formatted by snprintf.
+  /// @param spec The conversion, null terminated.
+  template <typename value_t>
+  void append_formatted(std::string& output, const char* spec, value_t value)
+  {
+    int size = std::snprintf(nullptr, 0, spec, value);
+    if (size <= 0)
+      return;
+
+    size_t offset = output.size();
+    output.resize(offset + size + 1);
+    std::snprintf(output.data() + offset, size + 1, spec, value);
+    output.resize(offset + size);
+  }
+
+  /// @brief Get an argument as a signed integer, whatever it was captured as.
+  long long as_signed(const pine::log_argument& argument)
+  {
+    using kind = pine::log_argument::kind;
+    switch (argument.type)
+    {
+    case kind::signed_integer:
+      return argument.signed_integer;
+    case kind::floating:
+      return static_cast<long long>(argument.floating);
+    case kind::pointer:
+      return static_cast<long long>(
+        reinterpret_cast<uintptr_t>(argument.pointer));
+    case kind::string:
+      return 0;
+    default:
+      return static_cast<long long>(argument.unsigned_integer);
+    }
+  }
+
+  /// @brief Get an argument as a floating point number.
+  double as_floating(const pine::log_argument& argument)
+  {
+    using kind = pine::log_argument::kind;
+    switch (argument.type)
+    {
+    case kind::floating:
+      return argument.floating;
+    case kind::signed_integer:
+      return static_cast<double>(argument.signed_integer);
+    case kind::unsigned_integer:
+      return static_cast<double>(argument.unsigned_integer);
+    default:
+      return 0;
+    }
+  }
+
+  /// @brief Get an argument as a string.
+  const char* as_string(const pine::log_record& record,
+                        const pine::log_argument& argument)
+  {
+    if (argument.type != pine::log_argument::kind::string
+        || argument.string.offset >= pine::log_record::text_capacity)
+      return "";
+
+    return record.text.data() + argument.string.offset;
+  }
+
+  /// @brief Map a level to a loguru verbosity, debug messages being logged
+  /// at verbosity 1 as they were with LOG_F(1, ...).
+  loguru::Verbosity to_verbosity(pine::log_level level)
+  {
+    switch (level)
+    {
+    case pine::log_level::debug:
+      return 1;
+    case pine::log_level::warning:
+      return loguru::Verbosity_WARNING;
+    case pine::log_level::error:
+      return loguru::Verbosity_ERROR;
+    default:
+      return loguru::Verbosity_INFO;
+    }
+  }
+
+  void write_to_loguru(pine::log_level level,
+                       const char* file,
+                       uint32_t line,
+                       const std::string& message)
+  {
+    auto verbosity = to_verbosity(level);
+    if (verbosity > loguru::current_verbosity_cutoff())
+      return;
+
+    loguru::log(verbosity, file, line, "%s", message.c_str());
+  }
+}
+
+namespace pine
+{
+  std::string format_log_record(const log_record& record)
+  {
+    std::string output;
+    size_t next_argument = 0;
+
+    auto next = [&]() -> const log_argument*
+      {
+        if (next_argument == record.argument_count)
+          return nullptr;
+        return &record.arguments[next_argument++];
+      };
+
+    const char* format = record.format;
+    while (*format)
+    {
+      if (*format != '%')
+      {
+        const char* end = std::strchr(format, '%');
+        if (!end)
+          end = format + std::strlen(format);
+        output.append(format, end);
+        format = end;
+        continue;
+      }
+
+      if (format[1] == '%')
+      {
+        output += '%';
+        format += 2;
+        continue;
+      }
+
+      // Rebuild the conversion with the widths given by arguments written
+      // out and without its length modifier, which is set from the type the
+      // argument was captured as.
+      const char* start = format++;
+      std::string spec = "%";
+      bool missing = false;
+
+      auto copy_digits_or_star = [&]()
+        {
+          if (*format == '*')
+          {
+            ++format;
+            if (auto argument = next())
+              spec += std::to_string(as_signed(*argument));
+            else
+              missing = true;
+            return;
+          }
+
+          while (*format >= '0' && *format <= '9')
+            spec += *format++;
+        };
+
+      while (*format && std::strchr("-+ #0", *format))
+        spec += *format++;
+      copy_digits_or_star();
+      if (*format == '.')
+      {
+        spec += *format++;
+        copy_digits_or_star();
+      }
+      while (*format && std::strchr("hljztL", *format))
+        ++format;
+
+      char conversion = *format;
+      if (!conversion)
+      {
+        output.append(start, format);
+        break;
+      }
+      ++format;
+
+      const log_argument* argument = missing ? nullptr : next();
+      if (!argument)
+      {
+        output.append(start, format);
+        continue;
+      }
+
+      switch (conversion)
+      {
+      case 'd':
+      case 'i':
+        append_formatted(output, (spec + "lld").c_str(), as_signed(*argument));
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        append_formatted(output, (spec + "ll" + conversion).c_str(),
+                         static_cast<unsigned long long>(as_signed(*argument)));
+        break;
+      case 'c':
+        append_formatted(output, (spec + 'c').c_str(),
+                         static_cast<int>(as_signed(*argument)));
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        append_formatted(output, (spec + conversion).c_str(),
+                         as_floating(*argument));
+        break;
+      case 's':
+        append_formatted(output, (spec + 's').c_str(),
+                         as_string(record, *argument));
+        break;
+      case 'p':
+        append_formatted(output, (spec + 'p').c_str(),
+                         argument->type == log_argument::kind::pointer
+                           ? argument->pointer
+                           : nullptr);
+        break;
+      default:
+        output.append(start, format);
+        break;
+      }
+    }
+
+    return output;
+  }
+
+  log_sink::log_sink(size_t capacity, output_function output)
+    : mask_(capacity - 1),
+    slots_(std::make_unique<slot[]>(capacity)),
+    output_(output ? std::move(output) : output_function{ write_to_loguru })
+  {
+    // Positions are mapped to slots with mask_.
+    assert(std::has_single_bit(capacity));
+
+    for (size_t i = 0; i < capacity; ++i)
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+    thread_ = std::jthread([this](std::stop_token stop) { run(stop); });
+  }
+
+  log_sink::~log_sink()
+  {
+    thread_.request_stop();
+    sleeping_.exchange(false);
+    sleeping_.notify_one();
+    thread_.join();
+  }
+
+  log_sink& log_sink::instance()
+  {
+    static log_sink sink;
+    return sink;
+  }
+
+  log_record* log_sink::claim(size_t& position) noexcept
+  {
+    position = enqueue_position_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      auto& slot = slots_[position & mask_];
+      size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+
+      if (difference == 0)
+      {
+        if (enqueue_position_.compare_exchange_weak(
+          position, position + 1, std::memory_order_relaxed))
+          return &slot.record;
+      }
+      else if (difference < 0)
+        // The background thread has not written the record yet: the ring
+        // is full.
+        return nullptr;
+      else
+        position = enqueue_position_.load(std::memory_order_relaxed);
+    }
+  }
+
+  void log_sink::publish(size_t position) noexcept
+  {
+    // Sequentially consistent, like the store of sleeping_ by the
+    // background thread, so that either it sees the record before sleeping
+    // or this thread sees it sleeping and wakes it.
+    slots_[position & mask_].sequence.store(position + 1);
+
+    if (sleeping_.load() && sleeping_.exchange(false))
+      sleeping_.notify_one();
+  }
+
+  bool log_sink::drain()
+  {
+    bool drained = false;
+    size_t position = dequeue_position_.load(std::memory_order_relaxed);
+
+    for (;; ++position)
+    {
+      auto& slot = slots_[position & mask_];
+      if (slot.sequence.load() != position + 1)
+        break;
+
+      std::string message = format_log_record(slot.record);
+      const char* file = slot.record.file;
+      uint32_t line = slot.record.line;
+      log_level level = slot.record.level;
+
+      // The record is copied out, hand the slot back to the threads logging
+      // before the slow part.
+      slot.sequence.store(position + mask_ + 1, std::memory_order_release);
+
+      {
+        std::scoped_lock lock{ output_mutex_ };
+        output_(level, file, line, message);
+      }
+
+      dequeue_position_.store(position + 1, std::memory_order_release);
+      drained = true;
+    }
+
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped_)
+    {
+      std::scoped_lock lock{ output_mutex_ };
+      output_(log_level::warning, __FILE__, __LINE__,
+              std::to_string(dropped - reported_dropped_)
+              + " log messages dropped: the log ring was full.");
+      reported_dropped_ = dropped;
+    }
+
+    return drained;
+  }
+
+  void log_sink::run(std::stop_token stop)
+  {
+    size_t idle_rounds = 0;
+    while (!stop.stop_requested())
+    {
+      if (drain())
+      {
+        idle_rounds = 0;
+        continue;
+      }
+
+      // Poll for a while before sleeping until woken, so that the threads
+      // logging steadily never have to wake this one, which takes a system
+      // call.
+      if (idle_rounds++ < max_idle_rounds)
+      {
+        std::this_thread::sleep_for(idle_interval);
+        continue;
+      }
+
+      // An exchange rather than a store, so that if the destructor cleared
+      // the flag first, its stop request is seen below.
+      sleeping_.exchange(true);
+
+      // A record published before sleeping_ was set would not wake us.
+      if (drain() || stop.stop_requested())
+      {
+        sleeping_.store(false);
+        continue;
+      }
+
+      sleeping_.wait(true);
+    }
+
+    drain();
+  }
+
+  void log_sink::flush()
+  {
+    size_t position = enqueue_position_.load();
+    while (dequeue_position_.load(std::memory_order_acquire) < position)
+      std::this_thread::yield();
+  }
+
+  void log_sink::set_output(output_function output)
+  {
+    std::scoped_lock lock{ output_mutex_ };
+    output_ = output ? std::move(output) : output_function{ write_to_loguru };
+  }
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <mutex>
 #include <thread>
@@ -5,8 +7,24 @@
 #include <vector>
 #include "thread_pool.h"
 
+namespace
+{
+  std::atomic<size_t> configured_thread_count = 0;
+  std::atomic<size_t> configured_max_queue_size = 64 * 1024;
+}
+
 namespace pine
 {
+  void thread_pool::set_thread_count(size_t thread_count)
+  {
+    configured_thread_count = thread_count;
+  }
+
+  void thread_pool::set_max_queue_size(size_t max_queue_size)
+  {
+    configured_max_queue_size = std::max<size_t>(max_queue_size, 1);
+  }
+
   thread_pool& thread_pool::get_instance()
   {
     static thread_pool instance;
@@ -14,8 +32,13 @@ namespace pine
   }
 
   thread_pool::thread_pool()
+    : max_queue_size(configured_max_queue_size)
   {
-    this->start_pool(std::jthread::hardware_concurrency());
+    size_t thread_count = configured_thread_count;
+    if (thread_count == 0)
+      thread_count = std::max<size_t>(std::jthread::hardware_concurrency(), 1);
+
+    this->start_pool(thread_count);
   }
 
   thread_pool::~thread_pool()
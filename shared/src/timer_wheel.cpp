@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include "timer_wheel.h"
+
+namespace
+{
+  constexpr uint64_t slot_bits = 8;
+  constexpr uint64_t slot_mask = pine::timer_wheel::slot_count - 1;
+
+  /// @brief Longest delay a timer can be armed with, in ticks.
+  constexpr uint64_t max_ticks =
+    (uint64_t{ 1 } << (slot_bits * pine::timer_wheel::level_count)) - 1;
+}
+
+namespace pine
+{
+  timer::~timer()
+  {
+    if (wheel_)
+      wheel_->cancel(*this);
+  }
+
+  timer_wheel::timer_wheel(std::chrono::milliseconds resolution)
+    : resolution_(std::max(resolution, std::chrono::milliseconds(1))),
+    start_(clock::now()),
+    next_tick_time_((start_ + resolution_).time_since_epoch().count())
+  {}
+
+  timer_wheel::~timer_wheel()
+  {
+    std::lock_guard lock{ mutex_ };
+
+    // Leave the remaining timers unarmed so they do not try to cancel
+    // themselves on a destroyed wheel.
+    for (auto& level : levels_)
+    {
+      for (auto& slot : level)
+      {
+        while (slot.head.next_ != &slot.head)
+        {
+          timer& armed = *slot.head.next_;
+          unlink(armed);
+          armed.wheel_ = nullptr;
+        }
+      }
+    }
+  }
+
+  void timer_wheel::arm(timer& timer, std::chrono::milliseconds delay)
+  {
+    std::lock_guard lock{ mutex_ };
+
+    if (timer.is_armed())
+      unlink(timer);
+
+    uint64_t ticks = (std::max<int64_t>(delay.count(), 0) + resolution_.count() - 1)
+      / resolution_.count();
+    ticks = std::clamp<uint64_t>(ticks, 1, max_ticks);
+
+    timer.wheel_ = this;
+    timer.expiry_ = current_tick_ + ticks;
+    insert(timer);
+  }
+
+  void timer_wheel::cancel(timer& timer)
+  {
+    std::lock_guard lock{ mutex_ };
+
+    if (timer.is_armed())
+      unlink(timer);
+  }
+
+  size_t timer_wheel::poll(clock::time_point now)
+  {
+    if (now.time_since_epoch().count() <
+        next_tick_time_.load(std::memory_order_relaxed))
+      return 0;
+
+    std::unique_lock lock{ mutex_, std::try_to_lock };
+    if (!lock.owns_lock())
+      return 0;
+
+    uint64_t target = static_cast<uint64_t>((now - start_) / resolution_);
+
+    size_t fired = 0;
+    while (current_tick_ < target)
+      fired += tick();
+
+    next_tick_time_.store((start_ + resolution_ * (current_tick_ + 1))
+                          .time_since_epoch().count(),
+                          std::memory_order_relaxed);
+
+    return fired;
+  }
+
+  std::chrono::milliseconds
+    timer_wheel::time_until_next_tick(clock::time_point now) const
+  {
+    auto next = clock::time_point(
+      clock::duration(next_tick_time_.load(std::memory_order_relaxed)));
+    if (next <= now)
+      return std::chrono::milliseconds(0);
+
+    return std::chrono::ceil<std::chrono::milliseconds>(next - now);
+  }
+
+  void timer_wheel::insert(timer& timer)
+  {
+    uint64_t expiry = timer.expiry_;
+    uint64_t delta = expiry > current_tick_ ? expiry - current_tick_ : 0;
+
+    size_t level = 0;
+    while (level + 1 < level_count &&
+           delta >= (uint64_t{ 1 } << (slot_bits * (level + 1))))
+      level++;
+
+    // A timer already due goes in the slot of the current tick, which is
+    // fired right after cascading.
+    if (delta == 0)
+      expiry = current_tick_;
+
+    slot& target = levels_[level][(expiry >> (slot_bits * level)) & slot_mask];
+
+    timer.prev_ = target.head.prev_;
+    timer.next_ = &target.head;
+    target.head.prev_->next_ = &timer;
+    target.head.prev_ = &timer;
+
+    size_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void timer_wheel::unlink(timer& timer)
+  {
+    timer.prev_->next_ = timer.next_;
+    timer.next_->prev_ = timer.prev_;
+    timer.prev_ = nullptr;
+    timer.next_ = nullptr;
+
+    size_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void timer_wheel::cascade(size_t level, size_t index)
+  {
+    slot& source = levels_[level][index];
+
+    while (source.head.next_ != &source.head)
+    {
+      timer& moved = *source.head.next_;
+      unlink(moved);
+      insert(moved);
+    }
+  }
+
+  size_t timer_wheel::tick()
+  {
+    current_tick_++;
+
+    if ((current_tick_ & slot_mask) == 0)
+    {
+      for (size_t level = 1; level < level_count; level++)
+      {
+        size_t index = (current_tick_ >> (slot_bits * level)) & slot_mask;
+        cascade(level, index);
+        if (index != 0)
+          break;
+      }
+    }
+
+    slot& expired = levels_[0][current_tick_ & slot_mask];
+
+    size_t fired = 0;
+    while (expired.head.next_ != &expired.head)
+    {
+      timer& due = *expired.head.next_;
+      unlink(due);
+      fired++;
+
+      if (due.callback_)
+        due.callback_();
+    }
+
+    return fired;
+  }
+}
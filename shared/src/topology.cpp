@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "topology.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+  /// @brief Get the shard of free blocks the thread uses.
+  size_t shard_index() noexcept
+  {
+    static std::atomic<size_t> next_index = 0;
+    thread_local size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed)
+      % pine::node_pool::shard_count;
+    return index;
+  }
+}
+
+namespace pine
+{
+  std::vector<processor> get_processors()
+  {
+    std::vector<processor> processors;
+
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &length);
+    std::vector<std::byte> buffer(length);
+    auto information =
+      reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data());
+
+    if (length > 0 &&
+        GetLogicalProcessorInformationEx(RelationNumaNode, information, &length))
+    {
+      for (DWORD offset = 0; offset < length;)
+      {
+        auto node = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(
+          buffer.data() + offset);
+        const GROUP_AFFINITY& mask = node->NumaNode.GroupMask;
+
+        for (uint8_t number = 0; number < sizeof(KAFFINITY) * 8; number++)
+        {
+          if (mask.Mask & (KAFFINITY{ 1 } << number))
+            processors.push_back({ mask.Group, number, node->NumaNode.NodeNumber });
+        }
+
+        offset += node->Size;
+      }
+    }
+#endif // _WIN32
+
+    if (processors.empty())
+    {
+      // Without topology information, assume a single group and node.
+      size_t count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+      for (size_t i = 0; i < count; i++)
+        processors.push_back({ static_cast<uint16_t>(i / 64),
+                               static_cast<uint8_t>(i % 64),
+                               0 });
+    }
+
+    std::ranges::sort(processors, [](const processor& a, const processor& b)
+                      {
+                        if (a.node != b.node)
+                          return a.node < b.node;
+                        if (a.group != b.group)
+                          return a.group < b.group;
+                        return a.number < b.number;
+                      });
+
+    return processors;
+  }
+
+  bool pin_thread(std::thread& thread, const processor& target)
+  {
+#ifdef _WIN32
+    GROUP_AFFINITY affinity{};
+    affinity.Group = target.group;
+    affinity.Mask = KAFFINITY{ 1 } << target.number;
+
+    return SetThreadGroupAffinity(thread.native_handle(), &affinity, nullptr);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(size_t{ target.group } * 64 + target.number, &set);
+
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  node_pool::node_pool(size_t block_size, uint32_t node)
+    : block_size_(block_size),
+    stride_((std::max(block_size, sizeof(free_block)) + block_alignment - 1)
+            / block_alignment * block_alignment),
+    blocks_per_chunk_(std::max<size_t>(chunk_size / stride_, 1)),
+    node_(node)
+  {}
+
+  node_pool::~node_pool()
+  {
+    for (std::byte* chunk : chunks_)
+    {
+#ifdef _WIN32
+      VirtualFree(chunk, 0, MEM_RELEASE);
+#else
+      ::operator delete(chunk, std::align_val_t{ block_alignment });
+#endif
+    }
+  }
+
+  void* node_pool::allocate()
+  {
+    shard& shard = shards_[shard_index()];
+    {
+      std::lock_guard lock{ shard.mutex };
+      if (shard.head)
+      {
+        shard.size--;
+        return std::exchange(shard.head, shard.head->next);
+      }
+    }
+
+    size_t count = 0;
+    free_block* batch = take_batch(count);
+    free_block* block = batch;
+    batch = batch->next;
+
+    // The rest of the batch serves the next allocations of the shard.
+    if (batch)
+    {
+      free_block* last = batch;
+      while (last->next)
+        last = last->next;
+
+      std::lock_guard lock{ shard.mutex };
+      last->next = shard.head;
+      shard.head = batch;
+      shard.size += count - 1;
+    }
+
+    return block;
+  }
+
+  void node_pool::deallocate(void* block) noexcept
+  {
+    shard& shard = shards_[shard_index()];
+    free_block* overflow = nullptr;
+    free_block* last = nullptr;
+    {
+      std::lock_guard lock{ shard.mutex };
+      shard.head = new (block) free_block{ shard.head };
+      if (++shard.size <= max_cached_blocks)
+        return;
+
+      // Give a batch to the pool, for the threads that allocate more than
+      // they free.
+      overflow = shard.head;
+      last = overflow;
+      for (size_t i = 1; i < batch_size; i++)
+        last = last->next;
+      shard.head = std::exchange(last->next, nullptr);
+      shard.size -= batch_size;
+    }
+
+    std::lock_guard lock{ mutex_ };
+    last->next = free_blocks_;
+    free_blocks_ = overflow;
+  }
+
+  node_pool::free_block* node_pool::take_batch(size_t& count)
+  {
+    std::lock_guard lock{ mutex_ };
+
+    free_block* batch = nullptr;
+    count = 0;
+    while (free_blocks_ && count < batch_size)
+    {
+      free_block* block = free_blocks_;
+      free_blocks_ = block->next;
+      block->next = batch;
+      batch = block;
+      count++;
+    }
+
+    if (count > 0)
+      return batch;
+
+    if (next_block_ == chunk_end_)
+      allocate_chunk();
+
+    while (next_block_ != chunk_end_ && count < batch_size)
+    {
+      batch = new (next_block_) free_block{ batch };
+      next_block_ += stride_;
+      count++;
+    }
+
+    return batch;
+  }
+
+  void node_pool::allocate_chunk()
+  {
+    // Pushing the chunk must not throw once it is allocated.
+    chunks_.reserve(chunks_.size() + 1);
+
+    size_t size = blocks_per_chunk_ * stride_;
+#ifdef _WIN32
+    void* chunk = VirtualAllocExNuma(GetCurrentProcess(),
+                                     nullptr,
+                                     size,
+                                     MEM_RESERVE | MEM_COMMIT,
+                                     PAGE_READWRITE,
+                                     node_);
+    // The node may have no memory left, fall back to any node.
+    if (!chunk)
+      chunk = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT,
+                           PAGE_READWRITE);
+    if (!chunk)
+      throw std::bad_alloc();
+#else
+    void* chunk = ::operator new(size, std::align_val_t{ block_alignment });
+#endif
+
+    chunks_.push_back(static_cast<std::byte*>(chunk));
+    next_block_ = chunks_.back();
+    chunk_end_ = next_block_ + size;
+  }
+}
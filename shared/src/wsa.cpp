@@ -8,7 +8,7 @@
 #include <ws2def.h>
 #include <error.h>
 #include <wsa.h>
-#include <loguru.hpp>
+#include <log_sink.h>
 
 namespace pine
 {
@@ -18,12 +18,12 @@ namespace pine
     if (int result = WSAStartup(MAKEWORD(2, 2), &wsa_data);
         result != 0)
     {
-      LOG_F(ERROR, "Failed to init WSA: %d", result);
+      PINE_LOG(error, "Failed to init WSA: %d", result);
       return std::make_unexpected(error(error_code::winsock_error,
                                         std::to_string(result)));
     }
 
-    LOG_F(1, "WSA initialized: %s", wsa_data.szDescription);
+    PINE_LOG(debug, "WSA initialized: %s", wsa_data.szDescription);
 
     return {};
   }
@@ -45,12 +45,12 @@ namespace pine
     if (int error = getaddrinfo(node, service, &hints, &result);
         error != 0)
     {
-      LOG_F(ERROR, "Failed to get address info: %d", error);
+      PINE_LOG(error, "Failed to get address info: %d", error);
       return std::make_unexpected(pine::error(error_code::getaddrinfo_error,
                                               std::to_string(error)));
     }
 
-    LOG_F(1, "Address info obtained");
+    PINE_LOG(debug, "Address info obtained");
 
     return result;
   }
@@ -67,13 +67,13 @@ namespace pine
 
     if (socket == INVALID_SOCKET)
     {
-      LOG_F(ERROR, "Failed to open socket: %d", WSAGetLastError());
+      PINE_LOG(error, "Failed to open socket: %d", WSAGetLastError());
       return std::make_unexpected(error(error_code::winsock_error,
                                         std::to_string(WSAGetLastError())));
 
     }
     
-    LOG_F(INFO, "Listen socket created: %d", socket);
+    PINE_LOG(info, "Listen socket created: %d", socket);
 
     return socket;
   }
@@ -86,12 +86,12 @@ namespace pine
              static_cast<int>(address_info->ai_addrlen))
         == SOCKET_ERROR)
     {
-      LOG_F(ERROR, "Failed to bind socket: %d", WSAGetLastError());
+      PINE_LOG(error, "Failed to bind socket: %d", WSAGetLastError());
       return std::make_unexpected(error(error_code::winsock_error,
                                         std::to_string(WSAGetLastError())));
     }
 
-    LOG_F(1, "Lisent socket bound");
+    PINE_LOG(debug, "Lisent socket bound");
 
     return {};
   }
@@ -101,12 +101,12 @@ namespace pine
   {
     if (listen(socket, backlog) == SOCKET_ERROR)
     {
-      LOG_F(ERROR, "Failed to listen on socket: %d", WSAGetLastError());
+      PINE_LOG(error, "Failed to listen on socket: %d", WSAGetLastError());
       return std::make_unexpected(error(error_code::winsock_error,
                                         std::to_string(WSAGetLastError())));
     }
 
-    LOG_F(1, "Listen socket listening");
+    PINE_LOG(debug, "Listen socket listening");
 
     return {};
   }
@@ -118,12 +118,12 @@ namespace pine
 
     if (accepted_socket == INVALID_SOCKET)
     {
-      LOG_F(ERROR, "Failed to accept socket: %d", WSAGetLastError());
+      PINE_LOG(error, "Failed to accept socket: %d", WSAGetLastError());
       return std::make_unexpected(error(error_code::winsock_error,
                                         std::to_string(WSAGetLastError())));
     }
 
-    LOG_F(1, "Socket accepted: %d", accepted_socket);
+    PINE_LOG(debug, "Socket accepted: %d", accepted_socket);
 
     return accepted_socket;
   }
@@ -136,12 +136,12 @@ namespace pine
                 static_cast<int>(address_info->ai_addrlen))
         == SOCKET_ERROR)
     {
-      LOG_F(ERROR, "Failed to connect socket: %d", WSAGetLastError());
+      PINE_LOG(error, "Failed to connect socket: %d", WSAGetLastError());
       return std::make_unexpected(error(error_code::winsock_error,
                                         std::to_string(WSAGetLastError())));
     }
 
-    LOG_F(1, "Socket connected: %d", socket);
+    PINE_LOG(debug, "Socket connected: %d", socket);
 
     return {};
   }
@@ -150,6 +150,6 @@ namespace pine
   {
     closesocket(socket);
 
-    LOG_F(1, "Socket closed: %d", socket);
+    PINE_LOG(debug, "Socket closed: %d", socket);
   }
 }
\ No newline at end of file
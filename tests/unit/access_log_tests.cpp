@@ -0,0 +1,227 @@
+#include <doctest/doctest.h>
+
+#include <access_log.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <http.h>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using namespace pine;
+
+namespace
+{
+  /// @brief A directory removed with its content at the end of a test.
+  struct temporary_directory
+  {
+    std::filesystem::path path;
+
+    explicit temporary_directory(std::string_view name)
+      : path(std::filesystem::temp_directory_path() / name)
+    {
+      std::filesystem::remove_all(path);
+    }
+
+    ~temporary_directory()
+    {
+      std::error_code error;
+      std::filesystem::remove_all(path, error);
+    }
+
+    /// @brief Get the segments in the directory, in the order of their
+    /// names.
+    std::vector<std::filesystem::path> segments() const
+    {
+      std::vector<std::filesystem::path> result;
+      for (const auto& entry : std::filesystem::directory_iterator(path))
+        result.push_back(entry.path());
+      std::ranges::sort(result);
+      return result;
+    }
+  };
+
+  access_record make_record(uint64_t index)
+  {
+    access_record record;
+    record.time = 1'700'000'000'000'000'000 + index;
+    record.latency = 1'500 + index;
+    record.bytes_received = 100 + index;
+    record.bytes_sent = 200 + index;
+    record.peer_address = { 192, 168, 0, 1 };
+    record.peer_port = 5000;
+    record.status = 200;
+    record.method = static_cast<uint8_t>(http_method::get);
+    record.set_path("/items/" + std::to_string(index));
+    return record;
+  }
+
+  /// @brief Read the records of every segment of a directory.
+  std::vector<access_record> read_all(const temporary_directory& directory)
+  {
+    std::vector<access_record> records;
+    for (const auto& segment : directory.segments())
+    {
+      auto result = read_access_log(segment);
+      REQUIRE(result.has_value());
+      records.insert(records.end(), result->begin(), result->end());
+    }
+    return records;
+  }
+}
+
+TEST_SUITE("Access Log Tests")
+{
+  TEST_CASE("access_record")
+  {
+    access_record record;
+    record.set_path("/short");
+    CHECK(record.get_path() == "/short");
+    CHECK(!record.path_truncated);
+
+    std::string long_path(200, 'a');
+    record.set_path(long_path);
+    CHECK(record.get_path() == long_path.substr(0, access_record::path_capacity));
+    CHECK(record.path_truncated);
+  }
+
+  TEST_CASE("Records are read back")
+  {
+    temporary_directory directory{ "pine_access_log_read" };
+    {
+      access_log log{ { directory.path } };
+      for (uint64_t i = 0; i < 10; ++i)
+        log.write(make_record(i));
+      CHECK(0 == log.dropped());
+    }
+
+    auto segments = directory.segments();
+    REQUIRE(segments.size() == 1);
+
+    // The segment is cut to the records written.
+    CHECK(std::filesystem::file_size(segments[0])
+          == sizeof(access_log_header) + 10 * sizeof(access_record));
+
+    auto records = read_all(directory);
+    REQUIRE(records.size() == 10);
+    for (uint64_t i = 0; i < 10; ++i)
+    {
+      auto expected = make_record(i);
+      CHECK(records[i].time == expected.time);
+      CHECK(records[i].latency == expected.latency);
+      CHECK(records[i].bytes_sent == expected.bytes_sent);
+      CHECK(records[i].get_path() == expected.get_path());
+    }
+  }
+
+  TEST_CASE("Segments rotate")
+  {
+    constexpr size_t segment_size =
+      sizeof(access_log_header) + 4 * sizeof(access_record);
+
+    SUBCASE("All segments kept")
+    {
+      temporary_directory directory{ "pine_access_log_rotate_all" };
+      access_log_options options{ directory.path, segment_size };
+      {
+        access_log log{ options };
+        for (uint64_t i = 0; i < 10; ++i)
+          log.write(make_record(i));
+      }
+
+      CHECK(3 == directory.segments().size());
+      auto records = read_all(directory);
+      REQUIRE(records.size() == 10);
+      CHECK(records.back().get_path() == "/items/9");
+    }
+
+    SUBCASE("Oldest segments deleted")
+    {
+      temporary_directory directory{ "pine_access_log_rotate_oldest" };
+      access_log_options options{ directory.path, segment_size, 1 };
+      {
+        access_log log{ options };
+        for (uint64_t i = 0; i < 10; ++i)
+          log.write(make_record(i));
+      }
+
+      CHECK(2 == directory.segments().size());
+      auto records = read_all(directory);
+      REQUIRE(records.size() == 6);
+      CHECK(records.front().get_path() == "/items/4");
+    }
+  }
+
+  TEST_CASE("Each thread writes its own segments")
+  {
+    temporary_directory directory{ "pine_access_log_threads" };
+    constexpr uint64_t thread_count = 4;
+    constexpr uint64_t record_count = 100;
+    {
+      access_log log{ { directory.path } };
+      std::vector<std::jthread> threads;
+      for (uint64_t t = 0; t < thread_count; ++t)
+      {
+        threads.emplace_back([&log, t]
+                             {
+                               for (uint64_t i = 0; i < record_count; ++i)
+                                 log.write(make_record(t * record_count + i));
+                             });
+      }
+    }
+
+    CHECK(thread_count == directory.segments().size());
+    CHECK(thread_count * record_count == read_all(directory).size());
+  }
+
+  TEST_CASE("read_access_log rejects other files")
+  {
+    temporary_directory directory{ "pine_access_log_invalid" };
+    std::filesystem::create_directories(directory.path);
+    auto path = directory.path / "not_a_segment";
+    std::ofstream{ path } << "GET / HTTP/1.1\r\n\r\n and more text to fill a header";
+
+    auto result = read_access_log(path);
+    REQUIRE(!result.has_value());
+    CHECK(error_code::file_error == result.error().code());
+    CHECK(!read_access_log(directory.path / "missing").has_value());
+  }
+
+  TEST_CASE("format_access_record")
+  {
+    auto record = make_record(0);
+    record.time = 1'700'000'000'123'456'789;
+    record.latency = 1'500'000;
+
+    CHECK(format_access_record(record, access_log_format::text)
+          == "2023-11-14T22:13:20.123456789Z 192.168.0.1:5000 GET /items/0 "
+             "200 100 200 1500us");
+
+    record.set_path("/say \"hi\"");
+    CHECK(format_access_record(record, access_log_format::csv)
+          == "2023-11-14T22:13:20.123456789Z,192.168.0.1:5000,GET,"
+             "\"/say \"\"hi\"\"\",0,200,100,200,1500000");
+
+    // Decoded paths may hold any byte: none may forge a line or a field.
+    record.set_path("/a b\r\n2023-11-14 forged\\\x1b");
+    CHECK(format_access_record(record, access_log_format::text)
+          == "2023-11-14T22:13:20.123456789Z 192.168.0.1:5000 GET "
+             "/a\\x20b\\x0d\\x0a2023-11-14\\x20forged\\\\\\x1b "
+             "200 100 200 1500us");
+    CHECK(format_access_record(record, access_log_format::csv)
+          == "2023-11-14T22:13:20.123456789Z,192.168.0.1:5000,GET,"
+             "\"/a b\\x0d\\x0a2023-11-14 forged\\\\\\x1b\",0,200,100,200,1500000");
+
+    access_record unparsed = record;
+    unparsed.method = 0;
+    unparsed.set_path("");
+    CHECK(format_access_record(unparsed, access_log_format::text)
+          == "2023-11-14T22:13:20.123456789Z 192.168.0.1:5000 - - "
+             "200 100 200 1500us");
+  }
+}
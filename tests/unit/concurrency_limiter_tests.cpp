@@ -0,0 +1,93 @@
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <concurrency_limiter.h>
+
+using namespace pine;
+using namespace std::chrono_literals;
+
+TEST_SUITE("Concurrency Limiter")
+{
+  TEST_CASE("concurrency_limiter::try_acquire")
+  {
+    concurrency_limiter limiter({ .initial_limit = 4, .min_limit = 1 });
+
+    SUBCASE("Requests over the limit are refused")
+    {
+      for (int i = 0; i < 4; i++)
+        CHECK(limiter.try_acquire());
+      CHECK(!limiter.try_acquire());
+      CHECK(4 == limiter.in_flight());
+    }
+
+    SUBCASE("Releasing a request frees its slot")
+    {
+      for (int i = 0; i < 4; i++)
+        CHECK(limiter.try_acquire());
+      limiter.release(1ms);
+      CHECK(3 == limiter.in_flight());
+      CHECK(limiter.try_acquire());
+    }
+  }
+
+  TEST_CASE("concurrency_limiter::release")
+  {
+    concurrency_limiter_options options{
+      .initial_limit = 10,
+      .min_limit = 2,
+      .max_limit = 11,
+      .latency_target = 100ms,
+      .backoff_ratio = 0.5,
+    };
+    concurrency_limiter limiter(options);
+    auto now = concurrency_limiter::clock::now();
+
+    SUBCASE("Fast requests raise the limit while busy")
+    {
+      for (int round = 0; round < 3; round++)
+      {
+        for (int i = 0; i < 10; i++)
+          limiter.try_acquire();
+        for (int i = 0; i < 10; i++)
+          limiter.release(1ms, now);
+      }
+      CHECK(11 == limiter.limit());
+    }
+
+    SUBCASE("Fast requests do not raise the limit while idle")
+    {
+      for (int i = 0; i < 100; i++)
+      {
+        limiter.try_acquire();
+        limiter.release(1ms, now);
+      }
+      CHECK(10 == limiter.limit());
+    }
+
+    SUBCASE("A slow request cuts the limit")
+    {
+      limiter.try_acquire();
+      limiter.release(200ms, now);
+      CHECK(5 == limiter.limit());
+    }
+
+    SUBCASE("Slow requests cut the limit once per latency target")
+    {
+      for (int i = 0; i < 3; i++)
+      {
+        limiter.try_acquire();
+        limiter.release(200ms, now + 10ms * i);
+      }
+      CHECK(5 == limiter.limit());
+
+      limiter.try_acquire();
+      limiter.release(200ms, now + 150ms);
+      CHECK(2 == limiter.limit());
+
+      limiter.try_acquire();
+      limiter.release_dropped(now + 300ms);
+      CHECK(2 == limiter.limit());
+      CHECK(0 == limiter.in_flight());
+    }
+  }
+}
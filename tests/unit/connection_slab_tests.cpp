@@ -0,0 +1,234 @@
+#include <doctest/doctest.h>
+
+#include <connection_slab.h>
+#include <cstdint>
+#include <memory>
+#include <set>
+
+using namespace pine;
+
+namespace
+{
+  struct tracked
+  {
+    explicit tracked(int value, int& destroyed)
+      : value(value),
+      destroyed(destroyed)
+    {}
+
+    ~tracked()
+    {
+      destroyed++;
+    }
+
+    int value;
+    int& destroyed;
+  };
+
+  /// @brief Object counting its references like a connection. Releasing the
+  /// last one removes it from its slab.
+  struct counted
+  {
+    bool try_retain() noexcept
+    {
+      if (references == 0)
+        return false;
+      references++;
+      return true;
+    }
+
+    void release()
+    {
+      if (--references == 0)
+        slab->remove(id);
+    }
+
+    int references = 1;
+    connection_slab<counted>* slab = nullptr;
+    uint64_t id = 0;
+  };
+}
+
+TEST_SUITE("Connection Slab")
+{
+  TEST_CASE("connection_slab::insert")
+  {
+    int destroyed = 0;
+    connection_slab<tracked> slab(2);
+
+    SUBCASE("Inserted objects can be found by id")
+    {
+      uint64_t first = slab.insert(std::make_unique<tracked>(1, destroyed));
+      uint64_t second = slab.insert(std::make_unique<tracked>(2, destroyed));
+
+      CHECK(first != second);
+      CHECK(2 == slab.size());
+      REQUIRE(slab.get(first) != nullptr);
+      REQUIRE(slab.get(second) != nullptr);
+      CHECK(1 == slab.get(first)->value);
+      CHECK(2 == slab.get(second)->value);
+    }
+
+    SUBCASE("Inserting in a full slab fails and destroys the object")
+    {
+      slab.insert(std::make_unique<tracked>(1, destroyed));
+      slab.insert(std::make_unique<tracked>(2, destroyed));
+
+      uint64_t id = slab.insert(std::make_unique<tracked>(3, destroyed));
+      CHECK(connection_slab<tracked>::invalid_id == id);
+      CHECK(1 == destroyed);
+      CHECK(2 == slab.size());
+    }
+  }
+
+  TEST_CASE("connection_slab::remove")
+  {
+    int destroyed = 0;
+    connection_slab<tracked> slab(1);
+
+    uint64_t id = slab.insert(std::make_unique<tracked>(1, destroyed));
+
+    SUBCASE("Removing gives back ownership")
+    {
+      auto removed = slab.remove(id);
+      REQUIRE(removed != nullptr);
+      CHECK(1 == removed->value);
+      CHECK(0 == destroyed);
+      CHECK(0 == slab.size());
+      CHECK(nullptr == slab.get(id));
+
+      removed.reset();
+      CHECK(1 == destroyed);
+    }
+
+    SUBCASE("Stale ids do not reach the next object of the slot")
+    {
+      slab.remove(id);
+      uint64_t reused = slab.insert(std::make_unique<tracked>(2, destroyed));
+
+      CHECK(reused != id);
+      CHECK(nullptr == slab.get(id));
+      CHECK(nullptr == slab.remove(id));
+      REQUIRE(slab.get(reused) != nullptr);
+      CHECK(2 == slab.get(reused)->value);
+    }
+
+    SUBCASE("Removing twice fails")
+    {
+      CHECK(slab.remove(id) != nullptr);
+      CHECK(nullptr == slab.remove(id));
+    }
+
+    SUBCASE("Invalid ids are rejected")
+    {
+      CHECK(nullptr == slab.get(connection_slab<tracked>::invalid_id));
+      CHECK(nullptr == slab.remove(connection_slab<tracked>::invalid_id));
+    }
+  }
+
+  TEST_CASE("connection_slab::owns")
+  {
+    int destroyed = 0;
+    connection_slab<tracked> first(4);
+    connection_slab<tracked> second(4, 4);
+
+    uint64_t first_id = first.insert(std::make_unique<tracked>(1, destroyed));
+    uint64_t second_id = second.insert(std::make_unique<tracked>(2, destroyed));
+
+    CHECK(first_id != second_id);
+    CHECK(first.owns(first_id));
+    CHECK(!first.owns(second_id));
+    CHECK(second.owns(second_id));
+    CHECK(!second.owns(first_id));
+    CHECK(nullptr == first.get(second_id));
+    CHECK(nullptr == second.get(first_id));
+    REQUIRE(second.get(second_id) != nullptr);
+    CHECK(2 == second.get(second_id)->value);
+  }
+
+  TEST_CASE("connection_slab::for_each")
+  {
+    int destroyed = 0;
+
+    {
+      connection_slab<tracked> slab(4);
+      slab.insert(std::make_unique<tracked>(1, destroyed));
+      uint64_t removed = slab.insert(std::make_unique<tracked>(2, destroyed));
+      slab.insert(std::make_unique<tracked>(3, destroyed));
+      slab.remove(removed);
+
+      std::set<int> values;
+      slab.for_each([&values](tracked& object) { values.insert(object.value); });
+      CHECK(std::set<int>{ 1, 3 } == values);
+    }
+
+    // The slab destroys the objects it still owns.
+    CHECK(3 == destroyed);
+  }
+
+  TEST_CASE("connection_slab::acquire")
+  {
+    connection_slab<counted> slab(1);
+    uint64_t id = slab.insert(std::make_unique<counted>());
+    counted* object = slab.get(id);
+    REQUIRE(object != nullptr);
+    object->slab = &slab;
+    object->id = id;
+
+    SUBCASE("Acquiring takes a reference")
+    {
+      CHECK(object == slab.acquire(id));
+      CHECK(2 == object->references);
+
+      object->release();
+      CHECK(1 == object->references);
+      CHECK(1 == slab.size());
+    }
+
+    SUBCASE("Connections being released are not acquired")
+    {
+      object->references = 0;
+      CHECK(nullptr == slab.acquire(id));
+      object->references = 1;
+    }
+
+    SUBCASE("Stale ids do not reach the next object of the slot")
+    {
+      object->release();
+      CHECK(0 == slab.size());
+
+      uint64_t reused = slab.insert(std::make_unique<counted>());
+      CHECK(nullptr == slab.acquire(id));
+      CHECK(slab.get(reused) == slab.acquire(reused));
+    }
+
+    SUBCASE("Invalid ids are rejected")
+    {
+      CHECK(nullptr == slab.acquire(connection_slab<counted>::invalid_id));
+    }
+  }
+
+  TEST_CASE("connection_slab::for_each_acquired")
+  {
+    connection_slab<counted> slab(4);
+    for (int i = 0; i < 3; ++i)
+    {
+      uint64_t id = slab.insert(std::make_unique<counted>());
+      slab.get(id)->slab = &slab;
+      slab.get(id)->id = id;
+    }
+
+    // Releasing the last reference inside the function removes the object
+    // once the function returns, without deadlocking on the slab.
+    int visited = 0;
+    slab.for_each_acquired([&visited](counted& object)
+                           {
+                             CHECK(2 == object.references);
+                             visited++;
+                             object.release();
+                           });
+
+    CHECK(3 == visited);
+    CHECK(0 == slab.size());
+  }
+}
@@ -0,0 +1,38 @@
+#include <doctest/doctest.h>
+
+#include <frame_allocator.h>
+
+using namespace pine;
+
+TEST_SUITE("Frame Allocator")
+{
+  TEST_CASE("frame_allocator::allocate")
+  {
+    SUBCASE("Frames are recycled within a size class")
+    {
+      void* first = frame_allocator::allocate(100);
+      frame_allocator::deallocate(first, 100);
+
+      void* second = frame_allocator::allocate(120);
+      CHECK(first == second);
+      frame_allocator::deallocate(second, 120);
+    }
+
+    SUBCASE("Different size classes do not share frames")
+    {
+      void* small = frame_allocator::allocate(64);
+      frame_allocator::deallocate(small, 64);
+
+      void* big = frame_allocator::allocate(1000);
+      CHECK(small != big);
+      frame_allocator::deallocate(big, 1000);
+    }
+
+    SUBCASE("Oversized frames bypass the pools")
+    {
+      void* frame = frame_allocator::allocate(frame_allocator::max_frame_size + 1);
+      CHECK(frame != nullptr);
+      frame_allocator::deallocate(frame, frame_allocator::max_frame_size + 1);
+    }
+  }
+}
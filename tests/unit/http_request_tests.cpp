@@ -2,6 +2,9 @@
 
 #include "error.h"
 #include "http_request.h"
+#include <string>
+#include <string_view>
+#include <utility>
 
 TEST_SUITE("HTTP Request")
 {
@@ -52,6 +55,56 @@ TEST_SUITE("HTTP Request")
     CHECK(request.get_body().compare("<product><name>Widget</name><price>9.99</price></product>") == 0);
   }
 
+  TEST_CASE("http_request::get_query_param")
+  {
+    pine::http_request request;
+
+    SUBCASE("No query string")
+    {
+      request.set_uri("/search");
+      CHECK(request.get_path() == "/search");
+      CHECK(request.get_query().empty());
+      CHECK(pine::error_code::parameter_not_found == request.get_query_param<int>("q").error().code());
+    }
+
+    SUBCASE("Values")
+    {
+      request.set_uri("/search?q=pine&page=2&price=9.5&q=other&flag&empty=&&a%2Bb=c%26d");
+      CHECK(request.get_path() == "/search");
+      CHECK(request.get_query_param<std::string>("q").value() == "pine");
+      CHECK(2 == request.get_query_param<int>("page").value());
+      CHECK(9.5 == request.get_query_param<double>("price").value());
+      CHECK(request.get_query_param<std::string_view>("a+b").value() == "c&d");
+      CHECK(request.has_query_param("flag"));
+      CHECK(request.get_query_param<std::string_view>("flag").value().empty());
+      CHECK(request.get_query_param<std::string_view>("empty").value().empty());
+      CHECK(!request.has_query_param("missing"));
+    }
+
+    SUBCASE("Invalid value")
+    {
+      request.set_uri("/search?page=two");
+      CHECK(pine::error_code::invalid_parameter == request.get_query_param<int>("page").error().code());
+    }
+
+    SUBCASE("A new URI replaces the parameters")
+    {
+      request.set_uri("/search?q=one");
+      CHECK(request.get_query_param<std::string>("q").value() == "one");
+      request.set_uri("/search?q=t%77o");
+      CHECK(request.get_query_param<std::string>("q").value() == "two");
+    }
+
+    SUBCASE("Parameters survive moves")
+    {
+      request.set_uri("/s?q=%61&p=b");
+      CHECK(request.has_query_param("q"));
+      pine::http_request moved = std::move(request);
+      CHECK(moved.get_query_param<std::string_view>("q").value() == "a");
+      CHECK(moved.get_query_param<std::string_view>("p").value() == "b");
+    }
+  }
+
   TEST_CASE("http_request::parse")
   {
     SUBCASE("Valid request")
@@ -77,6 +130,42 @@ TEST_SUITE("HTTP Request")
       CHECK(request.get_body().compare("") == 0);
     }
 
+    SUBCASE("Query string")
+    {
+      std::string requestStr = "GET /api/users?id=42&name=J%C3%B6rg+D HTTP/1.1\r\n"
+        "Host: example.com\r\n"
+        "\r\n";
+
+      auto result = pine::http_request::parse(requestStr);
+      REQUIRE(result.has_value());
+
+      CHECK(result->get_uri() == "/api/users?id=42&name=J%C3%B6rg+D");
+      CHECK(result->get_path() == "/api/users");
+      CHECK(result->get_query() == "id=42&name=J%C3%B6rg+D");
+      CHECK(42 == result->get_query_param<int>("id").value());
+      CHECK(result->get_query_param<std::string_view>("name").value() == "J\xC3\xB6rg D");
+    }
+
+    SUBCASE("Path is normalized")
+    {
+      std::string requestStr = "GET /static/./css/%2e%2e//app%2Ejs?v=1 HTTP/1.1\r\n\r\n";
+
+      auto result = pine::http_request::parse(requestStr);
+      REQUIRE(result.has_value());
+      CHECK(result->get_uri() == "/static/./css/%2e%2e//app%2Ejs?v=1");
+      CHECK(result->get_path() == "/static/app.js");
+      CHECK(result->get_query() == "v=1");
+    }
+
+    SUBCASE("Invalid escape in the path")
+    {
+      std::string requestStr = "GET /users/%zz HTTP/1.1\r\n\r\n";
+
+      auto result = pine::http_request::parse(requestStr);
+      REQUIRE(!result.has_value());
+      CHECK(pine::error_code::parse_error_uri == result.error().code());
+    }
+
     SUBCASE("Invalid request")
     {
       std::string requestStr = "INVALID REQUEST";
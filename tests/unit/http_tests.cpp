@@ -2,6 +2,8 @@
 
 #include "error.h"
 #include "http.h"
+#include <string>
+#include <string_view>
 
 using namespace pine;
 
@@ -27,6 +29,10 @@ TEST_SUITE("HTTP Tests")
     CHECK(http_status_strings.at(http_status::not_found).compare("Not Found") == 0);
     CHECK(http_status_strings.at(http_status::internal_server_error).compare("Internal Server Error") == 0);
     CHECK(http_status_strings.at(http_status::method_not_allowed).compare("Method Not Allowed") == 0);
+    CHECK(http_status_strings.at(http_status::payload_too_large).compare("Payload Too Large") == 0);
+    CHECK(http_status_strings.at(http_status::too_many_requests).compare("Too Many Requests") == 0);
+    CHECK(http_status_strings.at(http_status::request_header_fields_too_large).compare("Request Header Fields Too Large") == 0);
+    CHECK(http_status_strings.at(http_status::service_unavailable).compare("Service Unavailable") == 0);
   }
 
   TEST_CASE("http::http_version_strings")
@@ -54,6 +60,50 @@ TEST_SUITE("HTTP Tests")
     CHECK(result.value().at("Content-Type").compare("text/html") == 0);
   }
 
+  TEST_CASE("http_utils::get_content_length")
+  {
+    SUBCASE("Header present")
+    {
+      std::string_view head = "POST / HTTP/1.1\r\nHost: example.com\r\ncontent-Length: 42\r\n";
+      CHECK(42 == http_utils::get_content_length(head).value());
+    }
+
+    SUBCASE("Header missing")
+    {
+      std::string_view head = "GET / HTTP/1.1\r\nHost: example.com\r\n";
+      CHECK(0 == http_utils::get_content_length(head).value());
+    }
+
+    SUBCASE("Header invalid")
+    {
+      for (std::string_view head : {
+        "POST / HTTP/1.1\r\nContent-Length: abc\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 5abc\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: -5\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: \r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n" })
+        CHECK(!http_utils::get_content_length(head));
+    }
+
+    SUBCASE("Repeated headers must agree")
+    {
+      std::string_view same =
+        "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5 \r\n";
+      CHECK(5 == http_utils::get_content_length(same).value());
+
+      std::string_view conflicting =
+        "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n";
+      CHECK(!http_utils::get_content_length(conflicting));
+    }
+
+    SUBCASE("Transfer-Encoding is refused")
+    {
+      std::string_view head =
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n";
+      CHECK(!http_utils::get_content_length(head));
+    }
+  }
+
   TEST_CASE("http_utils::try_get_header")
   {
     std::string_view request = "GET /index.html HTTP/1.1\r\nHost: example.com\r\n\r\n";
@@ -73,6 +123,76 @@ TEST_SUITE("HTTP Tests")
     CHECK(http_method::get == result.value());
   }
 
+  TEST_CASE("http_utils::percent_decode")
+  {
+    SUBCASE("Escapes and spaces are decoded")
+    {
+      std::string output(32, '\0');
+      std::string_view text = "a%20b+c%2Fd%3d";
+      output.resize(http_utils::percent_decode(text, output.data()));
+      CHECK(output == "a b c/d=");
+    }
+
+    SUBCASE("Invalid escapes are kept")
+    {
+      std::string output(32, '\0');
+      std::string_view text = "100%+%zz%4";
+      output.resize(http_utils::percent_decode(text, output.data()));
+      CHECK(output == "100% %zz%4");
+    }
+  }
+
+  TEST_CASE("http_utils::normalize_path")
+  {
+    auto normalize = [](std::string_view path) -> std::string
+      {
+        std::string output(path.size(), '\0');
+        auto result = http_utils::normalize_path(path, output.data());
+        return result ? std::string(result.value()) : "error";
+      };
+
+    SUBCASE("Normal paths are not copied")
+    {
+      std::string_view path = "/api/v1/users/42/messages/files/logo.png";
+      std::string output(path.size(), '\0');
+      auto result = http_utils::normalize_path(path, output.data());
+      REQUIRE(result.has_value());
+      CHECK(result->data() == path.data());
+      CHECK(normalize("/") == "/");
+      CHECK(normalize("/users/") == "/users/");
+    }
+
+    SUBCASE("Escapes are decoded")
+    {
+      CHECK(normalize("/caf%C3%A9") == "/caf\xC3\xA9");
+      CHECK(normalize("/a%20b/c+d") == "/a b/c+d");
+      CHECK(normalize("/a/very/long/path/before/the/escape%41") == "/a/very/long/path/before/the/escapeA");
+    }
+
+    SUBCASE("Dot segments and duplicate slashes are removed")
+    {
+      CHECK(normalize("//a///b//") == "/a/b/");
+      CHECK(normalize("/a/./b/.") == "/a/b/");
+      CHECK(normalize("/a/b/../c") == "/a/c");
+      CHECK(normalize("/a/b/..") == "/a/");
+      CHECK(normalize("/../../etc/passwd") == "/etc/passwd");
+      CHECK(normalize("/public/%2e%2e/%2E%2e/secret") == "/secret");
+      CHECK(normalize("/static/files/images/thumbnails/../../styles/app.css") == "/static/files/styles/app.css");
+      CHECK(normalize("/a/.hidden/..file") == "/a/.hidden/..file");
+    }
+
+    SUBCASE("Invalid paths are rejected")
+    {
+      CHECK(normalize("") == "error");
+      CHECK(normalize("users") == "error");
+      CHECK(normalize("/a%zz") == "error");
+      CHECK(normalize("/a%4") == "error");
+      CHECK(normalize("/a%") == "error");
+      CHECK(normalize("/a%2Fb") == "error");
+      CHECK(normalize("/a%00b") == "error");
+    }
+  }
+
   TEST_CASE("http_utils::try_get_status")
   {
     std::string_view response = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\n";
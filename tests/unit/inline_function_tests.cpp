@@ -0,0 +1,115 @@
+#include <doctest/doctest.h>
+
+#include <array>
+#include <inline_function.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+using namespace pine;
+
+namespace
+{
+  int twice(int value)
+  {
+    return value * 2;
+  }
+
+  /// @brief Callable counting the live copies of itself.
+  struct counted
+  {
+    explicit counted(int& live) : live(&live) { ++*this->live; }
+    counted(const counted& other) : live(other.live) { ++*live; }
+    counted(counted&& other) noexcept : live(other.live) { ++*live; }
+    ~counted() { --*live; }
+
+    int operator()(int value) const { return value + 1; }
+
+    int* live;
+  };
+}
+
+TEST_SUITE("Inline Function Tests")
+{
+  TEST_CASE("inline_function::inline_function")
+  {
+    SUBCASE("Empty")
+    {
+      inline_function<int(int)> function;
+      CHECK(!function);
+    }
+
+    SUBCASE("Function pointer")
+    {
+      inline_function<int(int)> function = &twice;
+      CHECK(function);
+      CHECK(4 == function(2));
+    }
+
+    SUBCASE("Lambda with captures is stored inline")
+    {
+      std::string suffix = "!";
+      auto lambda = [suffix](int value) { return static_cast<int>(suffix.size()) + value; };
+      static_assert(inline_function<int(int)>::stored_inline<decltype(lambda)>);
+
+      inline_function<int(int)> function = lambda;
+      CHECK(2 == function(1));
+    }
+
+    SUBCASE("Large callable is stored on the heap")
+    {
+      std::array<int, 64> values{};
+      values[63] = 5;
+      auto lambda = [values](int index) { return values[index]; };
+      static_assert(!inline_function<int(int)>::stored_inline<decltype(lambda)>);
+
+      inline_function<int(int)> function = lambda;
+      CHECK(5 == function(63));
+
+      inline_function<int(int)> moved = std::move(function);
+      CHECK(!function);
+      CHECK(5 == moved(63));
+    }
+
+    SUBCASE("Move only callable")
+    {
+      auto value = std::make_unique<int>(3);
+      inline_function<int()> function = [value = std::move(value)] { return *value; };
+      CHECK(3 == function());
+    }
+  }
+
+  TEST_CASE("inline_function lifetime")
+  {
+    int live = 0;
+
+    SUBCASE("Destroyed with the function")
+    {
+      {
+        inline_function<int(int)> function = counted{ live };
+        CHECK(1 == live);
+        CHECK(2 == function(1));
+      }
+      CHECK(0 == live);
+    }
+
+    SUBCASE("Moved between functions")
+    {
+      inline_function<int(int)> function = counted{ live };
+      inline_function<int(int)> other = std::move(function);
+      CHECK(1 == live);
+      CHECK(2 == other(1));
+
+      other = nullptr;
+      CHECK(0 == live);
+    }
+
+    SUBCASE("Replaced by assignment")
+    {
+      inline_function<int(int)> function = counted{ live };
+      function = inline_function<int(int)>{ &twice };
+      CHECK(0 == live);
+      CHECK(4 == function(2));
+    }
+  }
+}
@@ -0,0 +1,196 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <log_sink.h>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace pine;
+
+namespace
+{
+  enum class color : uint8_t
+  {
+    red = 3,
+  };
+
+  template <typename... args_t>
+  std::string format(const char* format, const args_t&... args)
+  {
+    log_record record;
+    record.format = format;
+    (record.capture(args), ...);
+    return format_log_record(record);
+  }
+
+  /// @brief Collects the messages written by a log.
+  struct collector
+  {
+    std::mutex mutex;
+    std::vector<std::string> messages;
+
+    log_sink::output_function output()
+    {
+      return [this](log_level, const char*, uint32_t, const std::string& message)
+        {
+          std::scoped_lock lock{ mutex };
+          messages.push_back(message);
+        };
+    }
+  };
+}
+
+TEST_SUITE("Log Sink Tests")
+{
+  TEST_CASE("format_log_record")
+  {
+    CHECK(format("no arguments") == "no arguments");
+    CHECK(format("%d %i %u", -1, 2, 3u) == "-1 2 3");
+    CHECK(format("%zu %llu %hd", size_t{ 42 }, uint64_t{ 7 }, short{ 5 }) == "42 7 5");
+    CHECK(format("%x %X %o", 255, 255, 8) == "ff FF 10");
+    CHECK(format("%05d|%-4d|%+d", 42, 7, 3) == "00042|7   |+3");
+    CHECK(format("%.2f %g", 3.14159, 0.5) == "3.14 0.5");
+    CHECK(format("%c%c", 'o', 'k') == "ok");
+    CHECK(format("100%%") == "100%");
+    CHECK(format("%d", color::red) == "3");
+    CHECK(format("%d", true) == "1");
+  }
+
+  TEST_CASE("Strings are copied")
+  {
+    std::string text = "copied";
+    log_record record;
+    record.format = "%s and %s";
+    record.capture(text);
+    record.capture(std::string_view{ "a view" });
+    text = "changed";
+
+    CHECK(format_log_record(record) == "copied and a view");
+    CHECK(format("%.*s", 3, "abcdef") == "abc");
+    CHECK(format("%s", static_cast<const char*>(nullptr)) == "(null)");
+
+    // Views need not be null terminated.
+    std::string_view prefix = std::string_view{ "prefix" }.substr(0, 3);
+    CHECK(format("[%s]", prefix) == "[pre]");
+  }
+
+  TEST_CASE("Long strings are truncated")
+  {
+    std::string text(log_record::text_capacity * 2, 'a');
+    std::string message = format("%s|%s", text, "b");
+    CHECK(message == std::string(log_record::text_capacity - 1, 'a') + "|");
+  }
+
+  TEST_CASE("Missing arguments are written as is")
+  {
+    CHECK(format("%d and %s", 1) == "1 and %s");
+    CHECK(format("trailing %") == "trailing %");
+  }
+
+  TEST_CASE("Extra arguments are dropped")
+  {
+    CHECK(format("%d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9)
+          == "1 2 3 4 5 6 7 8 %d");
+  }
+
+  TEST_CASE("log_sink")
+  {
+    SUBCASE("Messages are written in order")
+    {
+      collector messages;
+      log_sink sink{ 8, messages.output() };
+
+      // Flushing before the ring fills, so that nothing is dropped.
+      for (int i = 0; i < 100; ++i)
+      {
+        sink.write(log_level::info, __FILE__, __LINE__, "message %d", i);
+        if (i % 4 == 3)
+          sink.flush();
+      }
+      sink.flush();
+
+      CHECK(0 == sink.dropped());
+      std::scoped_lock lock{ messages.mutex };
+      REQUIRE(messages.messages.size() == 100);
+      for (int i = 0; i < 100; ++i)
+        CHECK(messages.messages[i] == "message " + std::to_string(i));
+    }
+
+    SUBCASE("Messages of many threads")
+    {
+      collector messages;
+      constexpr int thread_count = 4;
+      constexpr int message_count = 200;
+      {
+        log_sink sink{ 1024, messages.output() };
+
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < thread_count; ++t)
+        {
+          threads.emplace_back([&sink, t]
+                               {
+                                 for (int i = 0; i < message_count; ++i)
+                                   sink.write(log_level::debug, __FILE__, __LINE__,
+                                              "thread %d message %d", t, i);
+                               });
+        }
+        threads.clear();
+        sink.flush();
+
+        std::scoped_lock lock{ messages.mutex };
+        size_t written = std::ranges::count_if(
+          messages.messages,
+          [](const std::string& message) { return message.starts_with("thread"); });
+        CHECK(written + sink.dropped() == thread_count * message_count);
+      }
+    }
+
+    SUBCASE("Messages are dropped when the ring is full")
+    {
+      collector messages;
+      {
+        // Hold the output so that the ring fills.
+        std::unique_lock lock{ messages.mutex };
+        log_sink sink{ 4, messages.output() };
+        for (int i = 0; i < 16; ++i)
+          sink.write(log_level::info, __FILE__, __LINE__, "message %d", i);
+        CHECK(sink.dropped() > 0);
+        lock.unlock();
+      }
+
+      CHECK(messages.messages.back().ends_with("log ring was full."));
+    }
+
+    SUBCASE("An idle log is woken by a message")
+    {
+      collector messages;
+      log_sink sink{ 64, messages.output() };
+
+      // Long enough for the background thread to stop polling.
+      std::this_thread::sleep_for(std::chrono::milliseconds{ 200 });
+      sink.write(log_level::info, __FILE__, __LINE__, "wake up");
+      sink.flush();
+
+      std::scoped_lock lock{ messages.mutex };
+      REQUIRE(messages.messages.size() == 1);
+      CHECK(messages.messages[0] == "wake up");
+    }
+
+    SUBCASE("The destructor writes the messages left")
+    {
+      collector messages;
+      {
+        log_sink sink{ 64, messages.output() };
+        sink.write(log_level::error, __FILE__, __LINE__, "last words: %s", "bye");
+      }
+
+      REQUIRE(messages.messages.size() == 1);
+      CHECK(messages.messages[0] == "last words: bye");
+    }
+  }
+}
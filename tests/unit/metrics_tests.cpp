@@ -0,0 +1,208 @@
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <http.h>
+#include <metrics.h>
+#include <request_trace.h>
+#include <route_path.h>
+#include <route_tree.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pine;
+using namespace std::chrono_literals;
+
+namespace
+{
+  void no_op(const http_request&, http_response&) {}
+}
+
+TEST_SUITE("Metrics Tests")
+{
+  TEST_CASE("latency_histogram::bucket_index")
+  {
+    using histogram = latency_histogram;
+
+    SUBCASE("Small values have their own bucket")
+    {
+      for (uint64_t value = 0; value < histogram::sub_bucket_count; ++value)
+      {
+        CHECK(value == histogram::bucket_index(value));
+        CHECK(value == histogram::bucket_upper_bound(histogram::bucket_index(value)));
+      }
+    }
+
+    SUBCASE("Buckets hold the values up to their upper bound")
+    {
+      for (uint64_t value : { 16ull, 17ull, 31ull, 32ull, 33ull, 1000ull, 123'456ull, 1'000'000'000ull })
+      {
+        size_t index = histogram::bucket_index(value);
+        CHECK(value <= histogram::bucket_upper_bound(index));
+        CHECK(value > histogram::bucket_upper_bound(index - 1));
+
+        // The relative error is bounded by the number of sub-buckets.
+        CHECK(histogram::bucket_upper_bound(index) - value
+              <= value / histogram::sub_bucket_count);
+      }
+    }
+
+    SUBCASE("Large values go to the last bucket")
+    {
+      auto max = static_cast<uint64_t>(histogram::max_latency.count());
+      CHECK(histogram::bucket_count - 1 == histogram::bucket_index(max));
+      CHECK(max == histogram::bucket_upper_bound(histogram::bucket_count - 1));
+      CHECK(histogram::bucket_count - 1 == histogram::bucket_index(max * 4));
+    }
+  }
+
+  TEST_CASE("latency_histogram::percentile")
+  {
+    latency_histogram histogram;
+    CHECK(0ns == histogram.percentile(50));
+
+    for (int i = 1; i <= 100; ++i)
+      histogram.record(std::chrono::microseconds{ i });
+
+    CHECK(100 == histogram.count());
+    CHECK(5050us == histogram.sum());
+
+    auto median = histogram.percentile(50);
+    CHECK(median >= 50us);
+    CHECK(median <= 50us + 50us / latency_histogram::sub_bucket_count);
+
+    auto p99 = histogram.percentile(99);
+    CHECK(p99 >= 99us);
+    CHECK(p99 <= 99us + 99us / latency_histogram::sub_bucket_count);
+  }
+
+  TEST_CASE("latency_histogram::record")
+  {
+    latency_histogram histogram;
+
+    // More threads than shards, so that shards are shared and allocated
+    // concurrently.
+    constexpr int thread_count = 2 * latency_histogram::shard_count;
+    {
+      std::vector<std::jthread> threads;
+      for (int i = 0; i < thread_count; ++i)
+        threads.emplace_back([&histogram]
+                             {
+                               for (int j = 0; j < 1000; ++j)
+                                 histogram.record(std::chrono::microseconds{ 1 });
+                             });
+    }
+
+    CHECK(thread_count * 1000 == histogram.count());
+    CHECK(thread_count * 1000us == histogram.sum());
+
+    auto index = latency_histogram::bucket_index(1000);
+    CHECK(thread_count * 1000 == histogram.bucket(index));
+  }
+
+  TEST_CASE("server_metrics")
+  {
+    server_metrics metrics;
+
+    SUBCASE("Counters of every thread are summed")
+    {
+      std::vector<std::jthread> threads;
+      for (int i = 0; i < 8; ++i)
+        threads.emplace_back([&metrics]
+                             {
+                               for (int j = 0; j < 1000; ++j)
+                               {
+                                 metrics.add(server_counter::requests);
+                                 metrics.add(server_counter::bytes_sent, 10);
+                                 metrics.count_response(http_status::ok);
+                               }
+                             });
+      threads.clear();
+
+      auto snapshot = metrics.snapshot();
+      CHECK(8000 == snapshot.get(server_counter::requests));
+      CHECK(80000 == snapshot.get(server_counter::bytes_sent));
+      CHECK(8000 == snapshot.get(http_status::ok));
+      CHECK(0 == snapshot.get(http_status::not_found));
+    }
+
+    SUBCASE("Active connections")
+    {
+      metrics.add(server_counter::accepts, 3);
+      metrics.add(server_counter::disconnects);
+      CHECK(2 == metrics.snapshot().active_connections());
+    }
+  }
+
+  TEST_CASE("prometheus::write")
+  {
+    SUBCASE("Counters")
+    {
+      server_metrics metrics;
+      metrics.add(server_counter::requests, 3);
+      metrics.add(server_counter::parse_errors);
+      metrics.count_response(http_status::ok);
+      metrics.count_response(http_status::ok);
+      metrics.count_response(http_status::not_found);
+
+      std::string output;
+      prometheus::write(output, metrics.snapshot());
+
+      CHECK(output.find("# TYPE pine_requests_total counter\npine_requests_total 3\n") != std::string::npos);
+      CHECK(output.find("pine_parse_errors_total 1\n") != std::string::npos);
+      CHECK(output.find("pine_responses_total{status=\"200\"} 2\n") != std::string::npos);
+      CHECK(output.find("pine_responses_total{status=\"404\"} 1\n") != std::string::npos);
+      CHECK(output.find("status=\"500\"") == std::string::npos);
+    }
+
+    SUBCASE("Times of the phases")
+    {
+      basic_request_trace<true> trace;
+      trace.mark(trace_phase::accepted);
+      trace.mark(trace_phase::headers_parsed);
+      trace.mark(trace_phase::write_completed);
+
+      phase_histograms phases;
+      phases.record(trace);
+      CHECK(0 == phases[trace_phase::accepted].count());
+      CHECK(1 == phases[trace_phase::headers_parsed].count());
+      CHECK(0 == phases[trace_phase::first_byte].count());
+
+      std::string output;
+      prometheus::write(output, phases);
+      CHECK(output.find("pine_request_phase_seconds_count{phase=\"headers_parsed\"} 1\n") != std::string::npos);
+      CHECK(output.find("pine_request_phase_seconds_count{phase=\"write_completed\"} 1\n") != std::string::npos);
+      CHECK(output.find("phase=\"first_byte\"") == std::string::npos);
+    }
+
+    SUBCASE("Latencies of the routes")
+    {
+      route_tree tree;
+      tree.add_route(route_path("/")).add_handler(http_method::get, &no_op);
+      auto& user = tree.add_route(route_path("/users/:id"));
+      user.add_handler(http_method::get, &no_op);
+      tree.add_route(route_path("/idle")).add_handler(http_method::get, &no_op);
+
+      REQUIRE(tree.add_route(route_path("/users")).latency() == nullptr);
+      REQUIRE(user.latency() != nullptr);
+
+      user.latency()->record(200us);
+      user.latency()->record(3ms);
+      tree.root().latency()->record(20ms);
+
+      std::string output;
+      prometheus::write(output, tree);
+
+      CHECK(output.find("# TYPE pine_request_duration_seconds histogram\n") != std::string::npos);
+      CHECK(output.find("pine_request_duration_seconds_bucket{route=\"/users/:id\",le=\"0.0001\"} 0\n") != std::string::npos);
+      CHECK(output.find("pine_request_duration_seconds_bucket{route=\"/users/:id\",le=\"0.00025\"} 1\n") != std::string::npos);
+      CHECK(output.find("pine_request_duration_seconds_bucket{route=\"/users/:id\",le=\"0.005\"} 2\n") != std::string::npos);
+      CHECK(output.find("pine_request_duration_seconds_bucket{route=\"/users/:id\",le=\"+Inf\"} 2\n") != std::string::npos);
+      CHECK(output.find("pine_request_duration_seconds_count{route=\"/users/:id\"} 2\n") != std::string::npos);
+      CHECK(output.find("pine_request_duration_seconds_count{route=\"/\"} 1\n") != std::string::npos);
+      CHECK(output.find("route=\"/idle\"") == std::string::npos);
+    }
+  }
+}
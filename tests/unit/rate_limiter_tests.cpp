@@ -0,0 +1,97 @@
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <error.h>
+#include <limits>
+#include <rate_limiter.h>
+#include <string_view>
+
+using namespace pine;
+using namespace std::chrono_literals;
+
+TEST_SUITE("Rate Limiter")
+{
+  TEST_CASE("rate_limiter::try_acquire")
+  {
+    rate_limiter limiter({ .requests_per_second = 10,
+                           .burst = 5,
+                           .idle_expiry = 60s });
+    auto now = rate_limiter::clock::now();
+
+    SUBCASE("A burst is allowed, then requests are rejected")
+    {
+      for (int i = 0; i < 5; i++)
+        CHECK(limiter.try_acquire(1, now));
+      CHECK(!limiter.try_acquire(1, now));
+    }
+
+    SUBCASE("Tokens are refilled over time")
+    {
+      for (int i = 0; i < 5; i++)
+        limiter.try_acquire(1, now);
+      CHECK(!limiter.try_acquire(1, now + 50ms));
+      CHECK(limiter.try_acquire(1, now + 150ms));
+      CHECK(!limiter.try_acquire(1, now + 150ms));
+    }
+
+    SUBCASE("Keys have their own bucket")
+    {
+      for (int i = 0; i < 5; i++)
+        limiter.try_acquire(rate_limiter::key_of(std::string_view{ "a" }), now);
+      CHECK(!limiter.try_acquire(rate_limiter::key_of(std::string_view{ "a" }), now));
+      CHECK(limiter.try_acquire(rate_limiter::key_of(std::string_view{ "b" }), now));
+    }
+
+    SUBCASE("Idle keys expire")
+    {
+      for (uint32_t address = 0; address < 100; address++)
+        limiter.try_acquire(rate_limiter::key_of(address), now);
+      CHECK(100 == limiter.size());
+
+      for (uint32_t address = 0; address < 100; address++)
+        limiter.try_acquire(rate_limiter::key_of(address + 100), now + 61s);
+      CHECK(100 == limiter.size());
+    }
+  }
+
+  TEST_CASE("rate_limiter::max_keys")
+  {
+    // Two buckets per shard.
+    rate_limiter limiter({ .requests_per_second = 10,
+                           .burst = 5,
+                           .max_keys = 128 });
+    auto now = rate_limiter::clock::now();
+
+    // A key in use keeps its bucket while new keys evict each other.
+    for (int i = 0; i < 5; i++)
+      limiter.try_acquire(1, now);
+    for (uint64_t key = 2; key < 10'000; key++)
+    {
+      limiter.try_acquire(key, now);
+      CHECK(!limiter.try_acquire(1, now));
+    }
+
+    CHECK(limiter.size() <= 128);
+  }
+
+  TEST_CASE("rate_limiter::rejection")
+  {
+    rate_limiter limiter({ .requests_per_second = 0.5 });
+
+    std::string_view rejection = limiter.rejection();
+    CHECK(rejection.starts_with("HTTP/1.1 429 Too Many Requests\r\n"));
+    CHECK(rejection.find("Retry-After: 2\r\n") != std::string_view::npos);
+  }
+
+  TEST_CASE("rate_limiter::rate_limiter")
+  {
+    CHECK_THROWS_AS(rate_limiter({ .requests_per_second = 0 }), error);
+    CHECK_THROWS_AS(rate_limiter({ .requests_per_second = -1 }), error);
+    CHECK_THROWS_AS(rate_limiter(
+      { .requests_per_second = std::numeric_limits<double>::quiet_NaN() }),
+      error);
+    CHECK_THROWS_AS(rate_limiter(
+      { .requests_per_second = std::numeric_limits<double>::infinity() }),
+      error);
+  }
+}
@@ -0,0 +1,109 @@
+#include <doctest/doctest.h>
+
+#include <array>
+#include <cstddef>
+#include <http_request.h>
+#include <http_response.h>
+#include <memory_resource>
+#include <request_arena.h>
+#include <route_tree.h>
+#include <string>
+#include <string_view>
+
+using namespace pine;
+
+namespace
+{
+  /// @brief Resource counting the allocations that reach it.
+  class counting_resource : public std::pmr::memory_resource
+  {
+  public:
+    size_t allocations = 0;
+
+  private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+      allocations++;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+      return this == &other;
+    }
+  };
+}
+
+TEST_SUITE("Request Arena")
+{
+  TEST_CASE("request_arena")
+  {
+    alignas(std::max_align_t) std::array<std::byte, 8 * 1024> block;
+    counting_resource upstream;
+    request_arena arena(block, &upstream);
+
+    SUBCASE("A typical request stays in the block")
+    {
+      route_tree routes;
+      routes.add_route("/users/:id");
+
+      {
+        auto request = http_request::parse(
+          "GET /users/42 HTTP/1.1\r\n"
+          "Host: example.com\r\n"
+          "User-Agent: a user agent long enough to allocate\r\n"
+          "Accept: application/json\r\n"
+          "\r\n",
+          arena.resource());
+        REQUIRE(request.has_value());
+
+        const auto& [route, found, params] =
+          routes.find_route_with_params(request->get_uri());
+        CHECK(found);
+        request->set_path_params(params);
+        CHECK(42 == request->get_path_param<int>("id").value());
+
+        http_response response(arena.resource());
+        response.set_header("Content-Type", "application/json");
+        response.set_header("Connection", "close");
+        response.set_body(R"({"id": 42, "name": "a name long enough to allocate"})");
+        auto raw = response.to_string(arena.resource());
+        CHECK(std::string_view(raw).starts_with("HTTP/1.1 200 OK\r\n"));
+      }
+
+      CHECK(0 == upstream.allocations);
+    }
+
+    SUBCASE("Resetting reuses the block")
+    {
+      std::string body(block.size() / 4, 'a');
+
+      for (int i = 0; i < 100; i++)
+      {
+        {
+          http_response response(arena.resource());
+          response.set_body(body);
+          auto raw = response.to_string(arena.resource());
+        }
+        arena.reset();
+      }
+
+      CHECK(0 == upstream.allocations);
+    }
+
+    SUBCASE("Large requests fall back to the upstream resource")
+    {
+      {
+        http_response response(arena.resource());
+        response.set_body(std::string(2 * block.size(), 'a'));
+      }
+
+      CHECK(0 < upstream.allocations);
+    }
+  }
+}
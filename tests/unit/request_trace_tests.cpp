@@ -0,0 +1,82 @@
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <request_trace.h>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+using namespace pine;
+using namespace std::chrono_literals;
+
+namespace
+{
+  struct traced
+  {
+    int value;
+    PINE_NO_UNIQUE_ADDRESS basic_request_trace<false> trace;
+  };
+}
+
+TEST_SUITE("Request Trace Tests")
+{
+  TEST_CASE("basic_request_trace<false>")
+  {
+    static_assert(std::is_empty_v<basic_request_trace<false>>);
+    static_assert(sizeof(traced) == sizeof(int));
+  }
+
+  TEST_CASE("basic_request_trace<true>")
+  {
+    SUBCASE("Phases reached")
+    {
+      basic_request_trace<true> trace;
+      CHECK(!trace.reached(trace_phase::accepted));
+      CHECK(0ns == trace.total());
+
+      trace.mark(trace_phase::accepted);
+      std::this_thread::sleep_for(2ms);
+      trace.mark(trace_phase::headers_parsed);
+      trace.mark(trace_phase::write_completed);
+
+      CHECK(trace.reached(trace_phase::accepted));
+      CHECK(!trace.reached(trace_phase::first_byte));
+
+      // Phases are timed from the previous phase reached.
+      CHECK(trace.phase_duration(trace_phase::headers_parsed) >= 2ms);
+      CHECK(0ns == trace.phase_duration(trace_phase::accepted));
+      CHECK(0ns == trace.phase_duration(trace_phase::first_byte));
+      CHECK(trace.total() == trace.at(trace_phase::write_completed) - trace.at(trace_phase::accepted));
+    }
+
+    SUBCASE("A phase keeps its first time")
+    {
+      basic_request_trace<true> trace;
+      trace.mark(trace_phase::write_posted);
+      auto first = trace.at(trace_phase::write_posted);
+      std::this_thread::sleep_for(1ms);
+      trace.mark(trace_phase::write_posted);
+      CHECK(first == trace.at(trace_phase::write_posted));
+    }
+
+    SUBCASE("Description")
+    {
+      basic_request_trace<true> trace;
+      trace.mark(trace_phase::accepted);
+      trace.mark(trace_phase::route_found);
+
+      std::string description = trace.to_string();
+      CHECK(description.starts_with("accepted +0us route_found +"));
+      CHECK(description.ends_with("us"));
+    }
+
+    SUBCASE("Reset")
+    {
+      basic_request_trace<true> trace;
+      trace.mark(trace_phase::accepted);
+      trace.reset();
+      CHECK(!trace.reached(trace_phase::accepted));
+      CHECK(trace.to_string().empty());
+    }
+  }
+}
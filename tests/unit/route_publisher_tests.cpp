@@ -0,0 +1,122 @@
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <latch>
+#include <memory>
+#include <route_node.h>
+#include <route_path.h>
+#include <route_publisher.h>
+#include <route_tree.h>
+#include <thread>
+#include <vector>
+
+using namespace pine;
+
+namespace
+{
+  /// @brief Build routes with a single route.
+  std::unique_ptr<route_tree> make_routes(route_path path)
+  {
+    auto routes = std::make_unique<route_tree>();
+    routes->add_route(path);
+    return routes;
+  }
+}
+
+TEST_SUITE("Route Publisher Tests")
+{
+  TEST_CASE("route_publisher::publish")
+  {
+    SUBCASE("New pins see the new routes")
+    {
+      route_publisher publisher{ make_routes("/v1") };
+      CHECK(std::get<1>(publisher.pin()->find_route_with_params("/v1")));
+
+      publisher.publish(make_routes("/v2"));
+      auto routes = publisher.pin();
+      CHECK(!std::get<1>(routes->find_route_with_params("/v1")));
+      CHECK(std::get<1>(routes->find_route_with_params("/v2")));
+    }
+
+    SUBCASE("Pinned routes outlive their replacement")
+    {
+      route_publisher publisher{ make_routes("/v1") };
+      auto old_routes = publisher.pin();
+      const auto& route = std::get<0>(old_routes->find_route_with_params("/v1"));
+
+      publisher.publish(make_routes("/v2"));
+      publisher.publish(make_routes("/v3"));
+      publisher.reclaim();
+      CHECK(2 == publisher.retired_count());
+      CHECK(route.path().compare("v1") == 0);
+
+      {
+        auto moved = std::move(old_routes);
+      }
+
+      publisher.reclaim();
+      CHECK(0 == publisher.retired_count());
+    }
+
+    SUBCASE("Replaced routes without readers are destroyed")
+    {
+      route_publisher publisher{ make_routes("/v1") };
+      publisher.publish(make_routes("/v2"));
+      CHECK(0 == publisher.retired_count());
+    }
+  }
+
+  TEST_CASE("route_publisher concurrent readers")
+  {
+    constexpr int reader_count = 4;
+    route_publisher publisher{ make_routes("/0") };
+    std::atomic_bool stop = false;
+    std::atomic<size_t> lookups = 0;
+    std::latch started{ reader_count };
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < reader_count; i++)
+    {
+      readers.emplace_back(
+        [&]
+        {
+          bool first = true;
+          while (!stop)
+          {
+            auto routes = publisher.pin();
+            const auto& root = routes->root();
+            CHECK(1 == root.children().size());
+            lookups++;
+
+            if (first)
+            {
+              started.count_down();
+              first = false;
+            }
+          }
+        });
+    }
+
+    // Every reader holds pins before the first publish, and each publish
+    // waits for a new lookup, so routes are replaced while being read.
+    started.wait();
+    for (int i = 1; i < 200; i++)
+    {
+      size_t seen = lookups;
+      while (lookups == seen)
+        std::this_thread::yield();
+
+      auto routes = std::make_unique<route_tree>();
+      routes->root().add_child(std::to_string(i));
+      publisher.publish(std::move(routes));
+    }
+
+    stop = true;
+    for (auto& reader : readers)
+      reader.join();
+
+    publisher.reclaim();
+    CHECK(0 == publisher.retired_count());
+    CHECK(reader_count + 199 <= lookups);
+  }
+}
@@ -0,0 +1,182 @@
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <http.h>
+#include <http_request.h>
+#include <http_response.h>
+#include <path_params.h>
+#include <route_table.h>
+#include <string>
+
+using namespace pine;
+
+namespace
+{
+  void get_index(const http_request&, http_response& response)
+  {
+    response.set_body("index");
+  }
+
+  void get_user(const http_request& request, http_response& response)
+  {
+    response.set_body(request.get_path_params()[0].second);
+  }
+
+  void post_user(const http_request&, http_response& response)
+  {
+    response.set_body("created");
+  }
+
+  using routes = route_table<
+    table_route<"/", http_method::get, &get_index>,
+    table_route<"/users", http_method::get, &get_index>,
+    table_route<"/users", http_method::post, &post_user>,
+    table_route<"/users/:id", http_method::get, &get_user>,
+    table_route<"/users/:id/messages/:message", http_method::get, &get_user>,
+    table_route<"/files/*path", http_method::get, &get_user>,
+    table_route<"/api/v1/status", http_method::patch,
+                [](const http_request&, http_response& response)
+                {
+                  response.set_body("patched");
+                }>>;
+}
+
+TEST_SUITE("Route Table Tests")
+{
+  TEST_CASE("route_table::find")
+  {
+    SUBCASE("Static routes are found at compile time")
+    {
+      static_assert(routes::find("/", http_method::get) == &table_route<"/", http_method::get, &get_index>::handle);
+      static_assert(routes::find("/users", http_method::post) != nullptr);
+      static_assert(routes::find("/users", http_method::put) == nullptr);
+      static_assert(routes::find("/api/v1/status", http_method::patch) != nullptr);
+      static_assert(routes::find("/unknown", http_method::get) == nullptr);
+      static_assert(routes::find("/user", http_method::get) == nullptr);
+    }
+
+    SUBCASE("Routes with path parameters")
+    {
+      path_params params;
+      auto entry = routes::find("/users/42/messages/7", params);
+      REQUIRE(entry != nullptr);
+      CHECK(entry->path == "/users/:id/messages/:message");
+      REQUIRE(2 == params.size());
+      CHECK(params[0].second == "42");
+      CHECK(params[1].first == "message");
+      CHECK(params[1].second == "7");
+
+      CHECK(routes::find("/users/42/messages", params) == nullptr);
+      CHECK(routes::find("/users/42/messages/7/8", params) == nullptr);
+    }
+
+    SUBCASE("Wildcard matches the rest of the path")
+    {
+      path_params params;
+      auto entry = routes::find("/files/images/logo.png", params);
+      REQUIRE(entry != nullptr);
+      REQUIRE(1 == params.size());
+      CHECK(params[0].first == "path");
+      CHECK(params[0].second == "images/logo.png");
+    }
+
+    SUBCASE("Many static routes")
+    {
+      using many = route_table<
+        table_route<"/a", http_method::get, &get_index>,
+        table_route<"/b", http_method::get, &get_index>,
+        table_route<"/c", http_method::get, &get_index>,
+        table_route<"/d", http_method::get, &get_index>,
+        table_route<"/e", http_method::get, &get_index>,
+        table_route<"/f", http_method::get, &get_index>,
+        table_route<"/g", http_method::get, &get_index>,
+        table_route<"/h", http_method::get, &get_index>,
+        table_route<"/aa", http_method::get, &get_index>,
+        table_route<"/ab", http_method::get, &get_index>,
+        table_route<"/abc", http_method::get, &get_index>,
+        table_route<"/abcd", http_method::get, &get_index>>;
+
+      static_assert(many::find("/a", http_method::get) != nullptr);
+      static_assert(many::find("/h", http_method::get) != nullptr);
+      static_assert(many::find("/ab", http_method::get) != nullptr);
+      static_assert(many::find("/abcd", http_method::get) != nullptr);
+      static_assert(many::find("/i", http_method::get) == nullptr);
+      static_assert(many::find("/abcde", http_method::get) == nullptr);
+    }
+  }
+
+  TEST_CASE("route_table::dispatch")
+  {
+    http_request request;
+    http_response response;
+
+    SUBCASE("Call the handler of the route")
+    {
+      request.set_method(http_method::get);
+      request.set_uri("/users/42");
+      CHECK(http_status::ok == routes::dispatch(request, response));
+      CHECK(response.get_body() == "42");
+    }
+
+    SUBCASE("Query string is not part of the path")
+    {
+      request.set_method(http_method::get);
+      request.set_uri("/users/42?fields=name");
+      CHECK(http_status::ok == routes::dispatch(request, response));
+      CHECK(response.get_body() == "42");
+    }
+
+    SUBCASE("Last method")
+    {
+      request.set_method(http_method::patch);
+      request.set_uri("/api/v1/status");
+      CHECK(http_status::ok == routes::dispatch(request, response));
+      CHECK(response.get_body() == "patched");
+    }
+
+    SUBCASE("Unknown path")
+    {
+      request.set_method(http_method::get);
+      request.set_uri("/unknown");
+      CHECK(http_status::not_found == routes::dispatch(request, response));
+    }
+
+    SUBCASE("Unknown method")
+    {
+      request.set_method(http_method::delete_);
+      request.set_uri("/users");
+      CHECK(http_status::method_not_allowed == routes::dispatch(request, response));
+    }
+  }
+
+  TEST_CASE("route_table::route")
+  {
+    http_request request;
+
+    request.set_method(http_method::get);
+    request.set_uri("/users/42");
+    auto found = routes::route(request);
+    CHECK(http_status::ok == found.status);
+    CHECK(found.handler != nullptr);
+    REQUIRE(found.latency != nullptr);
+
+    // The tree may handle the other methods of the path, counted by the
+    // same histogram.
+    request.set_method(http_method::delete_);
+    auto other_method = routes::route(request);
+    CHECK(http_status::method_not_allowed == other_method.status);
+    CHECK(other_method.handler == nullptr);
+    CHECK(other_method.latency == found.latency);
+
+    request.set_uri("/unknown");
+    auto unknown = routes::route(request);
+    CHECK(http_status::not_found == unknown.status);
+    CHECK(unknown.latency == nullptr);
+
+    found.latency->record(std::chrono::microseconds{ 50 });
+    std::string output;
+    routes::write_metrics(output);
+    CHECK(output.find("pine_request_duration_seconds_count{route=\"/users/:id\"} 1")
+          != std::string::npos);
+  }
+}
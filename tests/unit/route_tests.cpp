@@ -1,10 +1,17 @@
 #include <doctest/doctest.h>
 
+#include <filesystem>
+#include <fstream>
 #include <route_node.h>
 #include <route_tree.h>
 
 using namespace pine;
 
+namespace
+{
+  void no_op(const http_request&, http_response&) {}
+}
+
 TEST_SUITE("Route Tests")
 {
   TEST_CASE("route_node::route_node")
@@ -78,6 +85,72 @@ TEST_SUITE("Route Tests")
     }
   }
 
+  TEST_CASE("route_node::add_handler")
+  {
+    SUBCASE("Asynchronous handler")
+    {
+      route_node node("/");
+      node.add_handler(http_method::get,
+                       [](const http_request&, http_response& response) -> task<void>
+                       {
+                         response.set_body("async");
+                         co_return;
+                       });
+
+      CHECK(node.has_handler(http_method::get));
+      CHECK(node.is_async(http_method::get));
+      CHECK(!node.has_handler(http_method::post));
+
+      http_request request;
+      http_response response;
+      sync_wait(node.handle_async(request, response));
+      CHECK(response.get_body().compare("async") == 0);
+    }
+
+    SUBCASE("Synchronous handler replaces asynchronous handler")
+    {
+      route_node node("/");
+      node.add_handler(http_method::get,
+                       [](const http_request&, http_response&) -> task<void>
+                       {
+                         co_return;
+                       });
+      node.add_handler(http_method::get,
+                       [](const http_request&, http_response&) {});
+
+      CHECK(node.has_handler(http_method::get));
+      CHECK(!node.is_async(http_method::get));
+    }
+
+    SUBCASE("Every method has its own handler")
+    {
+      route_node node("/");
+      node.add_handler(http_method::get,
+                       [](const http_request&, http_response& response)
+                       {
+                         response.set_body("get");
+                       });
+      node.add_handler(http_method::patch,
+                       [](const http_request&, http_response& response)
+                       {
+                         response.set_body("patch");
+                       });
+
+      CHECK(node.has_handler(http_method::patch));
+      CHECK(!node.has_handler(http_method::trace));
+
+      http_request request;
+      http_response response;
+      request.set_method(http_method::patch);
+      node.handle(request, response);
+      CHECK(response.get_body().compare("patch") == 0);
+
+      request.set_method(http_method::get);
+      node.handle(request, response);
+      CHECK(response.get_body().compare("get") == 0);
+    }
+  }
+
   TEST_CASE("route_node::find_child")
   {
     SUBCASE("Find child")
@@ -197,4 +270,261 @@ TEST_SUITE("Route Tests")
       CHECK(id_node.path().compare(":id") == 0);
     }
   }
+
+  TEST_CASE("route_tree::find_route_with_params")
+  {
+    route_tree tree;
+    tree.add_route(route_path("/api/users/:id/messages/:message"));
+
+    const auto& [node, found, params] =
+      tree.find_route_with_params("/api/users/123/messages/456");
+    CHECK(found);
+    CHECK(node.path().compare(":message") == 0);
+    REQUIRE(2 == params.size());
+    CHECK(params[0].first.compare("id") == 0);
+    CHECK(params[0].second.compare("123") == 0);
+    CHECK(params[1].first.compare("message") == 0);
+    CHECK(params[1].second.compare("456") == 0);
+  }
+
+  TEST_CASE("route_tree::find_route with many children")
+  {
+    route_tree tree;
+    tree.add_route(route_path("/api/users"));
+    tree.add_route(route_path("/api/users2"));
+    tree.add_route(route_path("/api/accounts"));
+    tree.add_route(route_path("/api/a"));
+    tree.add_route(route_path("/api/orders"));
+    tree.add_route(route_path("/api/orders/:id"));
+    tree.add_route(route_path("/api/items"));
+    tree.add_route(route_path("/api/zones"));
+    tree.add_route(route_path("/api/~home"));
+    tree.add_route(route_path("/api/:resource"));
+
+    CHECK(tree.find_route("/api/users").path().compare("users") == 0);
+    CHECK(tree.find_route("/api/users2").path().compare("users2") == 0);
+    CHECK(tree.find_route("/api/a").path().compare("a") == 0);
+    CHECK(tree.find_route("/api/accounts").path().compare("accounts") == 0);
+    CHECK(tree.find_route("/api/zones").path().compare("zones") == 0);
+    CHECK(tree.find_route("/api/~home").path().compare("~home") == 0);
+    CHECK(tree.find_route("/api/orders/1").path().compare(":id") == 0);
+    CHECK(tree.find_route("/api/user").path().compare(":resource") == 0);
+    CHECK(tree.find_route("/api/b").path().compare(":resource") == 0);
+    CHECK(&tree.find_route("/api/b/c") == &route_tree::unknown_route);
+  }
+
+  TEST_CASE("route_tree::find_route_with_params with wildcard")
+  {
+    route_tree tree;
+    tree.add_route(route_path("/files/*path")).add_handler(http_method::get, &no_op);
+    tree.add_route(route_path("/files/public")).add_handler(http_method::get, &no_op);
+    tree.add_route(route_path("/files/:name/meta")).add_handler(http_method::get, &no_op);
+
+    SUBCASE("Wildcard matches the rest of the path")
+    {
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/files/images/logo.png");
+      CHECK(found);
+      CHECK(node.is_wildcard());
+      REQUIRE(1 == params.size());
+      CHECK(params[0].first.compare("path") == 0);
+      CHECK(params[0].second.compare("images/logo.png") == 0);
+    }
+
+    SUBCASE("Static and path parameter children take precedence")
+    {
+      CHECK(tree.find_route("/files/public").path().compare("public") == 0);
+
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/files/report/meta");
+      CHECK(found);
+      CHECK(node.path().compare("meta") == 0);
+      REQUIRE(1 == params.size());
+      CHECK(params[0].first.compare("name") == 0);
+      CHECK(params[0].second.compare("report") == 0);
+    }
+
+    SUBCASE("Failed path parameter branch falls back on the wildcard")
+    {
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/files/report/data");
+      CHECK(found);
+      CHECK(node.is_wildcard());
+      REQUIRE(1 == params.size());
+      CHECK(params[0].first.compare("path") == 0);
+      CHECK(params[0].second.compare("report/data") == 0);
+    }
+  }
+
+  TEST_CASE("route_tree::find_route_with_params longest prefix")
+  {
+    route_tree tree;
+    tree.add_route(route_path("/*page")).add_handler(http_method::get, &no_op);
+    tree.add_route(route_path("/docs/*page")).add_handler(http_method::get, &no_op);
+    tree.add_route(route_path("/docs/api/:version/index")).add_handler(http_method::get, &no_op);
+    tree.add_route(route_path("/users/:id")).add_handler(http_method::get, &no_op);
+
+    SUBCASE("Deepest wildcard wins")
+    {
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/docs/guide/install");
+      CHECK(found);
+      CHECK(node.path().compare("*page") == 0);
+      REQUIRE(1 == params.size());
+      CHECK(params[0].second.compare("guide/install") == 0);
+    }
+
+    SUBCASE("Node without handlers falls back on the wildcard")
+    {
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/docs/api/v2");
+      CHECK(found);
+      REQUIRE(1 == params.size());
+      CHECK(params[0].first.compare("page") == 0);
+      CHECK(params[0].second.compare("api/v2") == 0);
+    }
+
+    SUBCASE("Parameters of the abandoned branch are dropped")
+    {
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/docs/api/v2/index/more");
+      CHECK(found);
+      REQUIRE(1 == params.size());
+      CHECK(params[0].first.compare("page") == 0);
+      CHECK(params[0].second.compare("api/v2/index/more") == 0);
+    }
+
+    SUBCASE("Exact route")
+    {
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/docs/api/v2/index");
+      CHECK(found);
+      CHECK(node.path().compare("index") == 0);
+      REQUIRE(1 == params.size());
+      CHECK(params[0].second.compare("v2") == 0);
+    }
+
+    SUBCASE("Root wildcard")
+    {
+      const auto& [node, found, params] =
+        tree.find_route_with_params("/users/1/avatar");
+      CHECK(found);
+      REQUIRE(1 == params.size());
+      CHECK(params[0].second.compare("users/1/avatar") == 0);
+    }
+  }
+
+  TEST_CASE("route_tree cache")
+  {
+    route_tree tree;
+    tree.add_route(route_path("/health")).add_handler(http_method::get, &no_op);
+    tree.add_route(route_path("/users/:id/messages/:message")).add_handler(http_method::get, &no_op);
+    tree.enable_cache(true);
+
+    SUBCASE("Cached routes give the parameters of the path")
+    {
+      auto before = tree.cache_stats();
+      for (std::string_view path : { "/users/1/messages/22", "/users/1/messages/22" })
+      {
+        const auto& [node, found, params] = tree.find_route_with_params(path);
+        CHECK(found);
+        CHECK(node.path().compare(":message") == 0);
+        REQUIRE(2 == params.size());
+        CHECK(params[0].first.compare("id") == 0);
+        CHECK(params[0].second.compare("1") == 0);
+        CHECK(params[0].second.data() == path.data() + 7);
+        CHECK(params[1].second.compare("22") == 0);
+      }
+
+      auto after = tree.cache_stats();
+      CHECK(1 == after.hits - before.hits);
+      CHECK(1 == after.misses - before.misses);
+      CHECK(0.0 < after.hit_rate());
+    }
+
+    SUBCASE("Unknown paths are not cached")
+    {
+      auto hits = tree.cache_stats().hits;
+      CHECK(!std::get<1>(tree.find_route_with_params("/unknown")));
+      CHECK(!std::get<1>(tree.find_route_with_params("/unknown")));
+      CHECK(hits == tree.cache_stats().hits);
+    }
+
+    SUBCASE("Adding a route invalidates the cache")
+    {
+      CHECK(!std::get<1>(tree.find_route_with_params("/health/live")));
+      tree.find_route_with_params("/health");
+      tree.find_route_with_params("/health");
+      auto hits = tree.cache_stats().hits;
+
+      tree.add_route(route_path("/*page")).add_handler(http_method::get, &no_op);
+      tree.find_route_with_params("/health");
+      CHECK(hits == tree.cache_stats().hits);
+      CHECK(std::get<0>(tree.find_route_with_params("/health/live")).is_wildcard());
+    }
+  }
+
+  TEST_CASE("route_node::serve_files")
+  {
+    auto directory = std::filesystem::temp_directory_path() / "pine_serve_files";
+    std::filesystem::create_directories(directory / "css");
+    std::ofstream(directory / "index.html") << "index";
+    std::ofstream(directory / "css" / "app.css") << "body {}";
+
+    route_tree tree;
+    tree.add_route(route_path("/public")).serve_files(std::filesystem::path{ directory });
+
+    auto get = [&](std::string_view uri)
+      {
+        const auto& [node, found, params] = tree.find_route_with_params(uri);
+        http_request request;
+        http_response response;
+        request.set_method(http_method::get);
+        request.set_path_params(params);
+        if (found)
+          node.handle(request, response);
+        else
+          response.set_status(http_status::not_found);
+        return response;
+      };
+
+    CHECK(get("/public").get_body().compare("index") == 0);
+    CHECK(get("/public/css/app.css").get_body().compare("body {}") == 0);
+    CHECK(http_status::not_found == get("/public/css/missing.css").get_status());
+    CHECK(http_status::not_found == get("/public/../pine_serve_files/index.html").get_status());
+    CHECK(http_status::not_found == get("/public//etc/hosts").get_status());
+
+    // Requests are routed on their normalized path, so escaped dot segments
+    // cannot leave the directory either.
+    http_request request;
+    REQUIRE(request.set_uri("/public/css/%2e%2e/index.html"));
+    CHECK(get(request.get_path()).get_body().compare("index") == 0);
+    REQUIRE(request.set_uri("/public/%2e%2e/pine_serve_files/index.html"));
+    CHECK(http_status::not_found == get(request.get_path()).get_status());
+
+    std::filesystem::remove_all(directory);
+  }
+
+  TEST_CASE("route_path::param_index")
+  {
+    constexpr route_path path = "/api/users/:id/messages/:message";
+    static_assert(2 == path.param_count());
+    static_assert(0 == path.param_index("id"));
+    static_assert(1 == path.param_index("message"));
+    static_assert(path_params::max_params == path.param_index("unknown"));
+
+    constexpr route_path wildcard = "/files/:owner/*path";
+    static_assert(2 == wildcard.param_count());
+    static_assert(1 == wildcard.param_index("path"));
+    static_assert(!route_path::validate_wildcard("/files/*path/meta"));
+    static_assert(!route_path::validate_path("/a//b"));
+    static_assert(!route_path::validate_path("//"));
+    static_assert(route_path::validate_path("/"));
+
+    http_request request;
+    request.add_path_param("id", "123");
+    request.add_path_param("message", "456");
+    CHECK(456 == request.get_path_param<int, path.param_index("message")>().value());
+    CHECK(!request.get_path_param<int, 2>().has_value());
+  }
 }
@@ -0,0 +1,173 @@
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <http_request.h>
+#include <latch>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <task.h>
+#include <thread>
+#include <thread_pool.h>
+
+using namespace pine;
+
+static task<int> answer()
+{
+  co_return 42;
+}
+
+static task<int> chain(int depth)
+{
+  if (depth == 0)
+    co_return co_await answer();
+
+  co_return co_await chain(depth - 1) + 1;
+}
+
+static task<void> set_flag(bool& flag)
+{
+  flag = true;
+  co_return;
+}
+
+static task<std::thread::id> scheduled()
+{
+  co_await thread_pool::get_instance().schedule();
+  co_return std::this_thread::get_id();
+}
+
+static task<std::size_t> body_size(const http_request& request)
+{
+  co_return request.get_body().size();
+}
+
+static task<std::size_t> nested_body_size(const http_request& request)
+{
+  co_return co_await body_size(request);
+}
+
+static task<std::string> throwing()
+{
+  throw std::runtime_error("failure");
+  co_return "unreachable";
+}
+
+TEST_SUITE("Task")
+{
+  TEST_CASE("task::await")
+  {
+    SUBCASE("Value")
+    {
+      CHECK(42 == sync_wait(answer()));
+    }
+
+    SUBCASE("Void")
+    {
+      bool flag = false;
+      sync_wait(set_flag(flag));
+      CHECK(flag);
+    }
+
+    SUBCASE("Deep chain does not overflow the stack")
+    {
+      CHECK(42 + 1000 == sync_wait(chain(1000)));
+    }
+
+    SUBCASE("Exception")
+    {
+      CHECK_THROWS(sync_wait(throwing()));
+    }
+  }
+
+  TEST_CASE("task frames of request handlers")
+  {
+    // Counts the frames allocated from the arena of the request.
+    struct counting_resource : std::pmr::memory_resource
+    {
+      std::size_t allocations = 0;
+      std::size_t live = 0;
+
+      void* do_allocate(std::size_t bytes, std::size_t alignment) override
+      {
+        allocations++;
+        live++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+      }
+
+      void do_deallocate(void* p, std::size_t bytes,
+                         std::size_t alignment) override
+      {
+        live--;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+      }
+
+      bool do_is_equal(const memory_resource& other) const noexcept override
+      {
+        return this == &other;
+      }
+    };
+
+    counting_resource arena;
+    http_request request{ &arena };
+    std::size_t before = arena.allocations;
+
+    CHECK(0 == sync_wait(nested_body_size(request)));
+    CHECK(before + 2 == arena.allocations);
+    CHECK(0 == arena.live);
+
+    // Coroutines without a request keep using frame_allocator.
+    sync_wait(answer());
+    CHECK(before + 2 == arena.allocations);
+  }
+
+  TEST_CASE("start_detached")
+  {
+    bool flag = false;
+    start_detached(set_flag(flag));
+    CHECK(flag);
+  }
+
+  TEST_CASE("task::is_ready")
+  {
+    bool flag = false;
+    auto operation = set_flag(flag);
+
+    // Tasks are lazy, nothing runs before the task is awaited.
+    CHECK(!operation.is_ready());
+    CHECK(!flag);
+
+    sync_wait(std::move(operation));
+    CHECK(flag);
+  }
+
+  TEST_CASE("thread_pool::schedule")
+  {
+    // The pool is created by the first call to get_instance, no other test
+    // uses it.
+    thread_pool::set_thread_count(1);
+    thread_pool::set_max_queue_size(1);
+    auto& pool = thread_pool::get_instance();
+
+    CHECK(std::this_thread::get_id() != sync_wait(scheduled()));
+
+    // Keep the only thread busy and fill the queue. The latches are shared
+    // with the tasks, which may outlive the test.
+    auto busy = std::make_shared<std::latch>(1);
+    auto release = std::make_shared<std::latch>(1);
+    pool.enqueue([=] { busy->count_down(); release->wait(); });
+    busy->wait();
+    CHECK(pool.try_enqueue([] {}));
+
+    // New work is rejected while the queue is full.
+    CHECK(!pool.try_enqueue([] {}));
+    CHECK_THROWS_AS(sync_wait(scheduled()), thread_pool_full);
+
+    // Continuations are queued past the bound, without blocking.
+    auto done = std::make_shared<std::latch>(1);
+    pool.enqueue([=] { done->count_down(); });
+    release->count_down();
+    done->wait();
+  }
+}
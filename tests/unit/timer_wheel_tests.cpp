@@ -0,0 +1,139 @@
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <memory>
+#include <timer_wheel.h>
+#include <vector>
+
+using namespace pine;
+using namespace std::chrono_literals;
+
+TEST_SUITE("Timer Wheel")
+{
+  TEST_CASE("timer_wheel::arm")
+  {
+    timer_wheel wheel(10ms);
+    auto start = wheel.start_time();
+
+    SUBCASE("Timer fires after its delay")
+    {
+      int fired = 0;
+      timer t([&fired] { fired++; });
+      wheel.arm(t, 50ms);
+      CHECK(t.is_armed());
+      CHECK(1 == wheel.size());
+
+      wheel.poll(start + 40ms);
+      CHECK(0 == fired);
+
+      wheel.poll(start + 60ms);
+      CHECK(1 == fired);
+      CHECK(!t.is_armed());
+      CHECK(0 == wheel.size());
+    }
+
+    SUBCASE("Timers cascade from upper levels")
+    {
+      std::vector<int> order;
+      timer near([&order] { order.push_back(1); });
+      timer far([&order] { order.push_back(2); });
+      timer very_far([&order] { order.push_back(3); });
+      wheel.arm(very_far, 700s);
+      wheel.arm(far, 5s);
+      wheel.arm(near, 1s);
+
+      wheel.poll(start + 4s);
+      CHECK(order == std::vector<int>{ 1 });
+
+      wheel.poll(start + 6s);
+      CHECK(order == std::vector<int>{ 1, 2 });
+
+      wheel.poll(start + 699s);
+      CHECK(order.size() == 2);
+
+      wheel.poll(start + 701s);
+      CHECK(order == std::vector<int>{ 1, 2, 3 });
+    }
+
+    SUBCASE("Re-arming moves the expiry")
+    {
+      int fired = 0;
+      timer t([&fired] { fired++; });
+      wheel.arm(t, 20ms);
+      wheel.arm(t, 100ms);
+      CHECK(1 == wheel.size());
+
+      wheel.poll(start + 50ms);
+      CHECK(0 == fired);
+
+      wheel.poll(start + 110ms);
+      CHECK(1 == fired);
+    }
+
+    SUBCASE("Callback may re-arm its timer")
+    {
+      int fired = 0;
+      timer t;
+      t.set_callback([&]
+                     {
+                       if (++fired < 3)
+                         wheel.arm(t, 10ms);
+                     });
+      wheel.arm(t, 10ms);
+
+      wheel.poll(start + 100ms);
+      CHECK(3 == fired);
+    }
+  }
+
+  TEST_CASE("timer_wheel::cancel")
+  {
+    timer_wheel wheel(10ms);
+    auto start = wheel.start_time();
+
+    SUBCASE("Cancelled timer does not fire")
+    {
+      int fired = 0;
+      timer t([&fired] { fired++; });
+      wheel.arm(t, 10ms);
+      wheel.cancel(t);
+      CHECK(!t.is_armed());
+
+      wheel.poll(start + 1s);
+      CHECK(0 == fired);
+    }
+
+    SUBCASE("Destroyed timer does not fire")
+    {
+      int fired = 0;
+      {
+        timer t([&fired] { fired++; });
+        wheel.arm(t, 10ms);
+      }
+      CHECK(0 == wheel.size());
+
+      wheel.poll(start + 1s);
+      CHECK(0 == fired);
+    }
+
+    SUBCASE("Many timers")
+    {
+      constexpr size_t count = 100000;
+      size_t fired = 0;
+      std::vector<std::unique_ptr<timer>> timers;
+      for (size_t i = 0; i < count; i++)
+      {
+        timers.push_back(std::make_unique<timer>([&fired] { fired++; }));
+        wheel.arm(*timers.back(), std::chrono::milliseconds(10 + i % 5000));
+      }
+
+      for (size_t i = 0; i < count; i += 2)
+        wheel.cancel(*timers[i]);
+      CHECK(count / 2 == wheel.size());
+
+      wheel.poll(start + 6s);
+      CHECK(count / 2 == fired);
+      CHECK(0 == wheel.size());
+    }
+  }
+}
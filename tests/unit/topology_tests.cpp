@@ -0,0 +1,136 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <topology.h>
+#include <vector>
+
+using namespace pine;
+
+namespace
+{
+  struct pooled : node_allocated
+  {
+    explicit pooled(int value)
+      : value(value)
+    {}
+
+    virtual ~pooled() = default;
+
+    int value;
+  };
+
+  struct throwing : node_allocated
+  {
+    throwing()
+    {
+      throw 1;
+    }
+  };
+}
+
+TEST_SUITE("Topology")
+{
+  TEST_CASE("get_processors")
+  {
+    auto processors = get_processors();
+
+    REQUIRE(!processors.empty());
+    for (size_t i = 1; i < processors.size(); i++)
+      CHECK(processors[i - 1].node <= processors[i].node);
+  }
+
+  TEST_CASE("node_pool")
+  {
+    node_pool pool(node_allocated::block_size_for<pooled>, 0);
+
+    SUBCASE("Blocks are recycled")
+    {
+      void* first = pool.allocate();
+      pool.deallocate(first);
+      CHECK(first == pool.allocate());
+      pool.deallocate(first);
+    }
+
+    SUBCASE("Objects are given back to their pool when deleted")
+    {
+      std::unique_ptr<pooled> object{ new (pool) pooled(42) };
+      CHECK(42 == object->value);
+
+      void* address = object.get();
+      object.reset();
+
+      std::unique_ptr<pooled> reused{ new (pool) pooled(7) };
+      CHECK(address == reused.get());
+      CHECK(7 == reused->value);
+    }
+
+    SUBCASE("Blocks are carved out of chunks")
+    {
+      std::vector<void*> blocks;
+      for (size_t i = 0; i < 3 * node_pool::chunk_size / pool.block_size(); i++)
+      {
+        void* block = pool.allocate();
+        CHECK(0 == reinterpret_cast<uintptr_t>(block) % node_pool::block_alignment);
+        std::memset(block, 0xab, pool.block_size());
+        blocks.push_back(block);
+      }
+
+      std::ranges::sort(blocks);
+      CHECK(std::ranges::adjacent_find(blocks) == blocks.end());
+
+      for (void* block : blocks)
+        pool.deallocate(block);
+    }
+
+    SUBCASE("Blocks freed by another thread are reused")
+    {
+      // More than a shard keeps, so that batches go through the pool.
+      constexpr size_t count = 4 * node_pool::max_cached_blocks;
+      std::vector<void*> blocks;
+      for (size_t i = 0; i < count; i++)
+        blocks.push_back(pool.allocate());
+
+      std::thread{ [&]
+                   {
+                     for (void* block : blocks)
+                       pool.deallocate(block);
+                   } }.join();
+
+      std::vector<void*> reused;
+      for (size_t i = 0; i < count; i++)
+        reused.push_back(pool.allocate());
+
+      std::ranges::sort(blocks);
+      std::ranges::sort(reused);
+      size_t common = 0;
+      for (void* block : reused)
+        common += std::ranges::binary_search(blocks, block);
+      CHECK(common > 0);
+
+      for (void* block : reused)
+        pool.deallocate(block);
+    }
+
+    SUBCASE("Objects must fit in the blocks")
+    {
+      node_pool small(sizeof(pooled), 0);
+      CHECK_THROWS_AS(new (small) pooled(1), std::bad_alloc);
+    }
+
+    SUBCASE("Memory is given back when the constructor throws")
+    {
+      node_pool throwing_pool(node_allocated::block_size_for<throwing>, 0);
+      void* block = throwing_pool.allocate();
+      throwing_pool.deallocate(block);
+
+      CHECK_THROWS(new (throwing_pool) throwing());
+      CHECK(block == throwing_pool.allocate());
+      throwing_pool.deallocate(block);
+    }
+  }
+}
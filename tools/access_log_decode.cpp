@@ -0,0 +1,104 @@
+// Purpose: Convert the segments of the binary access log to text or CSV.
+// Usage: access_log_decode [--csv] <segment or directory>...
+// The records of every segment given, and of every segment of the
+// directories given, are merged in the order of their time.
+
+#include <access_log.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+  void print_usage()
+  {
+    std::fprintf(stderr,
+                 "Usage: access_log_decode [--csv] <segment or directory>...\n");
+  }
+
+  /// @brief Add the segments of a path: the file itself, or the .plog files
+  /// of a directory.
+  /// @return False if the path does not exist.
+  bool add_segments(const std::filesystem::path& path,
+                    std::vector<std::filesystem::path>& segments)
+  {
+    std::error_code error;
+    if (std::filesystem::is_directory(path, error))
+    {
+      for (const auto& entry : std::filesystem::directory_iterator(path, error))
+      {
+        if (entry.is_regular_file() && entry.path().extension() == ".plog")
+          segments.push_back(entry.path());
+      }
+      return true;
+    }
+
+    if (!std::filesystem::exists(path, error))
+      return false;
+
+    segments.push_back(path);
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  auto format = pine::access_log_format::text;
+  std::vector<std::filesystem::path> segments;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string_view argument = argv[i];
+    if (argument == "--csv")
+      format = pine::access_log_format::csv;
+    else if (argument == "--help" || argument == "-h")
+    {
+      print_usage();
+      return 0;
+    }
+    else if (!add_segments(argument, segments))
+    {
+      std::fprintf(stderr, "%s: no such file or directory\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (segments.empty())
+  {
+    print_usage();
+    return 1;
+  }
+
+  int result = 0;
+  std::vector<pine::access_record> records;
+  for (const auto& segment : segments)
+  {
+    auto segment_records = pine::read_access_log(segment);
+    if (!segment_records)
+    {
+      std::fprintf(stderr, "%s\n", segment_records.error().message().c_str());
+      result = 1;
+      continue;
+    }
+    records.insert(records.end(),
+                   segment_records->begin(),
+                   segment_records->end());
+  }
+
+  // Each segment is in order, the threads writing them are not.
+  std::ranges::stable_sort(records, {}, &pine::access_record::time);
+
+  if (format == pine::access_log_format::csv)
+    std::printf("%.*s\n",
+                static_cast<int>(pine::access_log_csv_header.size()),
+                pine::access_log_csv_header.data());
+
+  for (const auto& record : records)
+    std::printf("%s\n", pine::format_access_record(record, format).c_str());
+
+  return result;
+}